@@ -0,0 +1,1182 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3bench
+ *
+ * Application to benchmark the EMIO bus interface. For each selected backend
+ * (mmap, gpiod, gpiov2, simulated) and wait mode (polling, events), it measures the latency
+ * of ReadQuadlet and ReadBlock for block sizes from 1 to 512 quadlets (powers of 2),
+ * and compares a sequence of individual quadlet reads with the same sequence in a bus
+ * session and submitted via ExecuteBatch. The batch with EMIO_BATCH_HOLD_BUS, which reads
+ * the quadlets as one block transfer, is only run if an address is specified (-H) where
+ * this is equivalent (e.g., the PROM data buffer), since the firmware may treat a block
+ * transfer differently (e.g., a block read from address 0 is the real-time read). Write
+ * tests are only performed if a scratch address is specified (-w); they include a sequence
+ * of quadlet writes to consecutive addresses, with and without the write-combining layer
+ * (EMIO_Interface_WriteCombined), which flushes them as one block write.
+ *
+ * Optionally (-x), it measures the cost of the register accessors used by the mmap
+ * interface (fpgav3_mmio.h): plain pointer, volatile, and volatile with memory barrier
+ * (dmb), on the GPIO registers (if /dev/mem is accessible) and on normal memory.
+ *
+ * Optionally (-a), it also measures the round-trip latency (submit and wait) of quadlet
+ * reads and batches executed by an EMIO_AsyncWorker thread pinned to the specified CPU.
+ *
+ * Optionally (-C), it runs an EMIO_CyclicScheduler at the specified rate, reading a block
+ * of quadlets each cycle, and measures the wake-up latency (jitter) and execution time of
+ * each cycle; overruns are reported as errors.
+ *
+ * Optionally (-c), it measures ReadQuadlet of the hardware version via EMIO_Interface_Cached,
+ * which is served from the shadow-register cache after the first read.
+ *
+ * Optionally (-P), it enables the timing statistics with hardware performance counters
+ * (fpgav3_perf.h) and prints, for each backend and wait mode, the mean and maximum cycles,
+ * instructions, cache misses and context switches per operation (this adds the cost of
+ * reading the counters to the measured latency).
+ *
+ * For the gpiod backend, it also prints the number of output line writes (ioctls) that
+ * were issued and that were skipped because the line values did not change.
+ *
+ * Optionally (-E), it enables edge timing (see EMIO_EdgeStats) and prints, for the gpiod
+ * and gpiov2 backends in event mode, the firmware response time (from the request to the
+ * kernel timestamp of the op_done edge), separately from the system call and wakeup times.
+ *
+ * The -L option runs a stress test of the cross-process bus lock instead of the benchmark.
+ * After the concurrent phase, it checks that a lock held by a live process times out and
+ * that a lock held by a terminated process is recovered. It does not require the FPGA if
+ * used with the simulated interface (e.g., fpgav3bench -s -L4).
+ *
+ * The -V option checks the GPIO v2 uAPI interface without the FPGA instead of the benchmark:
+ * it creates a gpio-sim chip, sets the version and op_done lines via the gpio-sim pulls,
+ * and checks the version read and a read handshake (see RunGpioSimCheck).
+ *
+ * The results (p50/p99/p99.9/max latency and throughput) are written in JSON format,
+ * together with the library and firmware versions, so that results can be compared
+ * across releases. Progress messages are written to stderr.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fpgav3_emio_gpiod.h>
+#include <fpgav3_emio_gpiov2.h>
+#include <fpgav3_emio_mmap.h>
+#include <fpgav3_emio_sim.h>
+#include <fpgav3_emio_remote.h>
+#include <fpgav3_emio_async.h>
+#include <fpgav3_emio_cyclic.h>
+#include <fpgav3_emio_cache.h>
+#include <fpgav3_emio_wcombine.h>
+#include <fpgav3_emio_regs.h>
+#include <fpgav3_mmio.h>
+#include <fpgav3_lib.h>
+
+// FPGA registers used to identify the firmware
+const uint16_t ADDR_HW_VERSION = 4;
+const uint16_t ADDR_FW_VERSION = 7;
+
+enum BenchBackend { BACKEND_MMAP, BACKEND_GPIOD, BACKEND_GPIOV2, BACKEND_SIM, BACKEND_REMOTE, NUM_BACKENDS };
+const char *BackendName[NUM_BACKENDS] = { "mmap", "gpiod", "gpiov2", "sim", "remote" };
+
+const char *WaitPolicyName[4] = { "spin", "spin_yield", "spin_sleep", "adaptive" };
+
+// Benchmark configuration
+struct BenchConfig {
+    unsigned int numIter;       // number of measured iterations per test
+    unsigned int numWarmup;     // number of iterations before measuring
+    uint16_t readAddr;          // base address for read tests
+    bool doHold;                // true if the held-bus batch should be tested
+    uint16_t holdAddr;          // base address for held-bus batch (a block range)
+    bool doWrite;               // true if write tests should be performed
+    uint16_t writeAddr;         // base address for write tests (scratch registers)
+    unsigned int maxQuads;      // maximum block size (quadlets)
+    unsigned int batchSize;     // number of quadlets for per-call vs batch comparison
+    uint32_t simLatency_ns;     // op_done latency for simulated interface
+    EMIO_WaitPolicy waitPolicy; // strategy for polling op_done
+    bool useBusLock;            // true to enable the cross-process bus lock
+    bool useAsync;              // true to test the asynchronous worker
+    bool useCache;              // true to test the shadow-register cache
+    int asyncCpu;               // CPU core for the asynchronous worker (-1 for any)
+    double cyclicRate_hz;       // rate for cyclic scheduler test (0 to disable)
+    const char *gpioChip;       // GPIO chip for gpiov2 interface
+    bool usePerf;               // true to collect performance counters per operation
+    bool useEdge;               // true to collect edge timing (event mode)
+};
+
+// Results of one test
+struct BenchResult {
+    std::string backend;
+    std::string wait;
+    std::string op;
+    unsigned int nQuads;
+    unsigned int numErrors;
+    std::vector<double> samples;    // latency in microseconds
+};
+
+static double GetTime_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1.0e6 + ts.tv_nsec*1.0e-3;
+}
+
+// Returns the specified percentile (0-100) of sorted samples
+static double Percentile(const std::vector<double> &sorted, double pct)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t idx = static_cast<size_t>(pct/100.0*(sorted.size()-1) + 0.5);
+    if (idx >= sorted.size())
+        idx = sorted.size()-1;
+    return sorted[idx];
+}
+
+enum BenchOp { OP_READ_QUAD, OP_WRITE_QUAD, OP_READ_BLOCK, OP_WRITE_BLOCK, OP_QUAD_SEQUENCE, OP_BATCH,
+               OP_SESSION_SEQUENCE, OP_BATCH_HOLD, OP_WRITE_SEQUENCE, OP_WRITE_COMBINED };
+const char *BenchOpName[10] = { "ReadQuadlet", "WriteQuadlet", "ReadBlock", "WriteBlock",
+                                "ReadQuadletSequence", "ExecuteBatch", "ReadQuadletSession",
+                                "ExecuteBatchHold", "WriteQuadletSequence", "WriteQuadletCombined" };
+
+// Runs one test: numWarmup+numIter iterations of the specified operation, with nQuads quadlets
+static void RunTest(EMIO_Interface *emio, const BenchConfig &config, BenchBackend backend,
+                    BenchOp op, unsigned int nQuads, std::vector<BenchResult> &results)
+{
+    BenchResult res;
+    res.backend = BackendName[backend];
+    res.wait = emio->GetEventMode() ? "events" : "polling";
+    res.op = BenchOpName[op];
+    res.nQuads = nQuads;
+    res.numErrors = 0;
+    res.samples.reserve(config.numIter);
+
+    std::vector<uint32_t> data(nQuads, 0);
+    std::vector<EMIO_Request> reqs;
+    if (op == OP_BATCH) {
+        for (unsigned int q = 0; q < nQuads; q++)
+            reqs.push_back(EMIO_Request::ReadQuadlet(config.readAddr+q, &data[q]));
+    }
+    else if (op == OP_BATCH_HOLD) {
+        for (unsigned int q = 0; q < nQuads; q++)
+            reqs.push_back(EMIO_Request::ReadQuadlet(config.holdAddr+q, &data[q]));
+    }
+    else if ((op == OP_WRITE_QUAD) || (op == OP_WRITE_BLOCK) || (op == OP_WRITE_SEQUENCE) ||
+             (op == OP_WRITE_COMBINED)) {
+        for (unsigned int q = 0; q < nQuads; q++)
+            data[q] = q;
+    }
+
+    // The held-bus batch combines the quadlets into a block transfer, so they are declared
+    // as a block range (the user specified the address as one where this is equivalent)
+    if (op == OP_BATCH_HOLD)
+        emio->AddBlockRange(config.holdAddr, nQuads);
+
+    // Write-combining layer (flushed after each sequence); the scratch registers at the
+    // write address are declared as a block range, so that the writes are combined
+    EMIO_Interface_WriteCombined *wcomb = 0;
+    if (op == OP_WRITE_COMBINED) {
+        wcomb = new EMIO_Interface_WriteCombined(emio);
+        wcomb->AddBlockRange(config.writeAddr, nQuads);
+    }
+
+    for (unsigned int n = 0; n < config.numWarmup+config.numIter; n++) {
+        bool ok = true;
+        double t0 = GetTime_us();
+        switch (op) {
+            case OP_READ_QUAD:
+                ok = emio->ReadQuadlet(config.readAddr, data[0]);
+                break;
+            case OP_WRITE_QUAD:
+                ok = emio->WriteQuadlet(config.writeAddr, data[0]);
+                break;
+            case OP_READ_BLOCK:
+                ok = emio->ReadBlock(config.readAddr, &data[0], 4*nQuads);
+                break;
+            case OP_WRITE_BLOCK:
+                ok = emio->WriteBlock(config.writeAddr, &data[0], 4*nQuads);
+                break;
+            case OP_QUAD_SEQUENCE:
+                for (unsigned int q = 0; q < nQuads; q++) {
+                    if (!emio->ReadQuadlet(config.readAddr+q, data[q]))
+                        ok = false;
+                }
+                break;
+            case OP_BATCH:
+                ok = emio->ExecuteBatch(&reqs[0], nQuads);
+                break;
+            case OP_SESSION_SEQUENCE:
+                if (!emio->BeginBusSession()) {
+                    ok = false;
+                    break;
+                }
+                for (unsigned int q = 0; q < nQuads; q++) {
+                    if (!emio->ReadQuadlet(config.readAddr+q, data[q]))
+                        ok = false;
+                }
+                emio->EndBusSession();
+                break;
+            case OP_BATCH_HOLD:
+                ok = emio->ExecuteBatch(&reqs[0], nQuads, EMIO_BATCH_HOLD_BUS);
+                break;
+            case OP_WRITE_SEQUENCE:
+                for (unsigned int q = 0; q < nQuads; q++) {
+                    if (!emio->WriteQuadlet(config.writeAddr+q, data[q]))
+                        ok = false;
+                }
+                break;
+            case OP_WRITE_COMBINED:
+                for (unsigned int q = 0; q < nQuads; q++) {
+                    if (!wcomb->WriteQuadlet(config.writeAddr+q, data[q]))
+                        ok = false;
+                }
+                if (!wcomb->Flush())
+                    ok = false;
+                break;
+        }
+        double dt = GetTime_us()-t0;
+        if (n >= config.numWarmup) {
+            res.samples.push_back(dt);
+            if (!ok)
+                res.numErrors++;
+        }
+    }
+    delete wcomb;
+    if (op == OP_BATCH_HOLD)
+        emio->ClearBlockRanges();
+    results.push_back(res);
+}
+
+// Runs one asynchronous test: each sample is the time from submitting nQuads quadlet
+// reads (as one operation) to the worker until the operation is done
+static void RunAsyncTest(EMIO_AsyncWorker &worker, const BenchConfig &config, const char *backendName,
+                         const char *waitName, unsigned int nQuads, std::vector<BenchResult> &results)
+{
+    BenchResult res;
+    res.backend = backendName;
+    res.wait = waitName;
+    res.op = (nQuads == 1) ? "AsyncReadQuadlet" : "AsyncBatch";
+    res.nQuads = nQuads;
+    res.numErrors = 0;
+    res.samples.reserve(config.numIter);
+
+    std::vector<uint32_t> data(nQuads, 0);
+    std::vector<EMIO_Request> reqs;
+    for (unsigned int q = 0; q < nQuads; q++)
+        reqs.push_back(EMIO_Request::ReadQuadlet(config.readAddr+q, &data[q]));
+
+    EMIO_AsyncOp op;
+    for (unsigned int n = 0; n < config.numWarmup+config.numIter; n++) {
+        double t0 = GetTime_us();
+        bool ok = worker.Submit(op, &reqs[0], nQuads) && op.Wait(1.0e6) && op.GetResult();
+        double dt = GetTime_us()-t0;
+        if (n >= config.numWarmup) {
+            res.samples.push_back(dt);
+            if (!ok)
+                res.numErrors++;
+        }
+    }
+    results.push_back(res);
+}
+
+// Samples recorded by the cycle callback of the cyclic scheduler test
+struct CyclicSamples {
+    BenchResult *wake;
+    BenchResult *exec;
+    unsigned int numCycles;
+};
+
+static void CyclicCallback(const EMIO_CyclicCycleInfo &info, void *arg)
+{
+    CyclicSamples *cs = static_cast<CyclicSamples *>(arg);
+    if (cs->wake->samples.size() < cs->wake->samples.capacity()) {
+        cs->wake->samples.push_back(info.wakeLatency_us);
+        cs->exec->samples.push_back(info.exec_us);
+        if (!info.ok)
+            cs->exec->numErrors++;
+    }
+    __atomic_add_fetch(&cs->numCycles, 1, __ATOMIC_RELEASE);
+}
+
+// Runs the cyclic scheduler test: numIter cycles at config.cyclicRate_hz, each reading
+// batchSize quadlets from readAddr. The consumer (this thread) polls the snapshot.
+static void RunCyclicTest(EMIO_Interface *emio, const BenchConfig &config, BenchBackend backend,
+                          std::vector<BenchResult> &results)
+{
+    unsigned int nQuads = (config.batchSize > 0) ? config.batchSize : 1;
+    std::cerr << "Testing " << BackendName[backend] << " cyclic scheduler at "
+              << config.cyclicRate_hz << " Hz" << std::endl;
+
+    BenchResult wake, exec;
+    wake.backend = exec.backend = BackendName[backend];
+    wake.wait = exec.wait = emio->GetEventMode() ? "events" : "polling";
+    wake.op = "CyclicWakeLatency";
+    exec.op = "CyclicExecute";
+    wake.nQuads = exec.nQuads = nQuads;
+    wake.numErrors = exec.numErrors = 0;
+    wake.samples.reserve(config.numIter);
+    exec.samples.reserve(config.numIter);
+    CyclicSamples cs = { &wake, &exec, 0 };
+
+    EMIO_CyclicScheduler sched(emio, config.cyclicRate_hz, config.asyncCpu);
+    int id = sched.AddTransfer(EMIO_READ_BLOCK, config.readAddr, nQuads);
+    sched.SetCycleCallback(CyclicCallback, &cs);
+    if ((id < 0) || !sched.Start())
+        return;
+    std::vector<uint32_t> data(nQuads);
+    while (__atomic_load_n(&cs.numCycles, __ATOMIC_ACQUIRE) < config.numIter) {
+        sched.GetReadData(id, &data[0]);
+        usleep(1000);
+    }
+    sched.Stop();
+
+    EMIO_CyclicStats stats;
+    sched.GetStats(stats);
+    stats.Print(std::cerr);
+    wake.numErrors = stats.numOverruns;
+    results.push_back(wake);
+    results.push_back(exec);
+}
+
+// Number of register accesses per sample in the MMIO access tests
+const unsigned int MMIO_ACCESS_LOOP = 100;
+
+enum MmioOp { MMIO_READ_PLAIN, MMIO_READ_VOLATILE, MMIO_READ_BARRIER,
+              MMIO_WRITE_PLAIN, MMIO_WRITE_VOLATILE, MMIO_WRITE_BARRIER };
+const char *MmioOpName[6] = { "RegRead_plain", "RegRead_volatile", "RegRead_dmb",
+                              "RegWrite_plain", "RegWrite_volatile", "RegWrite_dmb" };
+
+// Prevents the compiler from discarding the values read in the MMIO access tests
+static volatile uint32_t mmioSink;
+
+// Runs one MMIO access test: each sample is the time for MMIO_ACCESS_LOOP reads of
+// Reg_InputUpper or writes of 0 (idle) to Reg_OutputUpper. Note that the compiler
+// may merge or hoist the plain pointer accesses, which is why they are not used.
+static void RunMmioTest(void *region, const char *target, const BenchConfig &config,
+                        MmioOp op, std::vector<BenchResult> &results)
+{
+    BenchResult res;
+    res.backend = target;
+    res.wait = "none";
+    res.op = MmioOpName[op];
+    res.nQuads = MMIO_ACCESS_LOOP;
+    res.numErrors = 0;
+    res.samples.reserve(config.numIter);
+
+    uint32_t *plainIn = reinterpret_cast<uint32_t *>(region)+(Reg_InputUpper/sizeof(uint32_t));
+    uint32_t *plainOut = reinterpret_cast<uint32_t *>(region)+(Reg_OutputUpper/sizeof(uint32_t));
+    uint32_t sum = 0;
+    unsigned int k;
+
+    for (unsigned int n = 0; n < config.numWarmup+config.numIter; n++) {
+        double t0 = GetTime_us();
+        switch (op) {
+            case MMIO_READ_PLAIN:
+                for (k = 0; k < MMIO_ACCESS_LOOP; k++)
+                    sum += *plainIn;
+                break;
+            case MMIO_READ_VOLATILE:
+                for (k = 0; k < MMIO_ACCESS_LOOP; k++)
+                    sum += MMIO_Read32(region, Reg_InputUpper);
+                break;
+            case MMIO_READ_BARRIER:
+                for (k = 0; k < MMIO_ACCESS_LOOP; k++) {
+                    sum += MMIO_Read32(region, Reg_InputUpper);
+                    MMIO_Barrier();
+                }
+                break;
+            case MMIO_WRITE_PLAIN:
+                for (k = 0; k < MMIO_ACCESS_LOOP; k++)
+                    *plainOut = 0;
+                break;
+            case MMIO_WRITE_VOLATILE:
+                for (k = 0; k < MMIO_ACCESS_LOOP; k++)
+                    MMIO_Write32(region, Reg_OutputUpper, 0);
+                break;
+            case MMIO_WRITE_BARRIER:
+                for (k = 0; k < MMIO_ACCESS_LOOP; k++) {
+                    MMIO_Write32(region, Reg_OutputUpper, 0);
+                    MMIO_Barrier();
+                }
+                break;
+        }
+        double dt = GetTime_us()-t0;
+        if (n >= config.numWarmup)
+            res.samples.push_back(dt);
+    }
+    mmioSink = sum;
+    results.push_back(res);
+}
+
+// Runs the MMIO access tests on the GPIO registers (if tryDevice is true and /dev/mem
+// can be mapped) and on normal memory
+static void RunMmioTests(const BenchConfig &config, bool tryDevice, std::vector<BenchResult> &results)
+{
+    unsigned int op;
+
+    if (tryDevice) {
+        int fd = open("/dev/mem", O_RDWR | O_SYNC);
+        void *region = MAP_FAILED;
+        if (fd >= 0) {
+            region = mmap(NULL, GPIO_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, GPIO_BASE_ADDR);
+            close(fd);
+        }
+        if (region != MAP_FAILED) {
+            std::cerr << "Testing MMIO register access (GPIO)" << std::endl;
+            for (op = MMIO_READ_PLAIN; op <= MMIO_WRITE_BARRIER; op++)
+                RunMmioTest(region, "mmio", config, static_cast<MmioOp>(op), results);
+            munmap(region, GPIO_SIZE);
+        }
+        else {
+            std::cerr << "Could not map GPIO registers, skipping MMIO register access test" << std::endl;
+        }
+    }
+
+    std::cerr << "Testing MMIO register access (normal memory)" << std::endl;
+    std::vector<uint32_t> buffer(GPIO_SIZE/sizeof(uint32_t), 0);
+    for (op = MMIO_READ_PLAIN; op <= MMIO_WRITE_BARRIER; op++)
+        RunMmioTest(&buffer[0], "memory", config, static_cast<MmioOp>(op), results);
+}
+
+// Runs all tests for the specified backend and current wait mode
+static void RunTests(EMIO_Interface *emio, const BenchConfig &config, BenchBackend backend,
+                     std::vector<BenchResult> &results)
+{
+    unsigned int nQuads;
+
+    std::cerr << "Testing " << BackendName[backend] << " ("
+              << (emio->GetEventMode() ? "events" : "polling") << ")" << std::endl;
+
+    emio->ResetEdgeTimingStats();
+
+    RunTest(emio, config, backend, OP_READ_QUAD, 1, results);
+    if (config.doWrite)
+        RunTest(emio, config, backend, OP_WRITE_QUAD, 1, results);
+
+    if (emio->GetVersion() >= 1) {
+        for (nQuads = 1; nQuads <= config.maxQuads; nQuads *= 2) {
+            RunTest(emio, config, backend, OP_READ_BLOCK, nQuads, results);
+            if (config.doWrite)
+                RunTest(emio, config, backend, OP_WRITE_BLOCK, nQuads, results);
+        }
+    }
+
+    if (config.batchSize > 0) {
+        RunTest(emio, config, backend, OP_QUAD_SEQUENCE, config.batchSize, results);
+        RunTest(emio, config, backend, OP_BATCH, config.batchSize, results);
+        RunTest(emio, config, backend, OP_SESSION_SEQUENCE, config.batchSize, results);
+        if (emio->GetVersion() >= 1) {
+            if (config.doHold)
+                RunTest(emio, config, backend, OP_BATCH_HOLD, config.batchSize, results);
+            else
+                std::cerr << "Held-bus batch skipped (specify a block range address with -H)" << std::endl;
+        }
+        if (config.doWrite) {
+            RunTest(emio, config, backend, OP_WRITE_SEQUENCE, config.batchSize, results);
+            RunTest(emio, config, backend, OP_WRITE_COMBINED, config.batchSize, results);
+        }
+    }
+
+    if (backend == BACKEND_GPIOD) {
+        // Output line writes (one ioctl each) issued and skipped via the shadows
+        EMIO_Interface_Gpiod *gpiod = static_cast<EMIO_Interface_Gpiod *>(emio);
+        unsigned long numWrites, numSkipped;
+        gpiod->GetLineWriteStats(numWrites, numSkipped);
+        std::cerr << "Line writes: " << numWrites << " issued, " << numSkipped << " skipped" << std::endl;
+        gpiod->ResetLineWriteStats();
+    }
+
+    if (emio->GetEventMode() && emio->GetEdgeTiming()) {
+        EMIO_EdgeStats edgeStats;
+        emio->GetEdgeTimingStats(edgeStats);
+        edgeStats.Print(std::cerr);
+    }
+
+    if (config.usePerf) {
+        // Print before the asynchronous test, since the counters only count this thread
+        EMIO_TimingStats stats;
+        emio->GetTimingStats(stats);
+        stats.Print(std::cerr);
+        emio->ResetTimingStats();
+    }
+
+    if (config.useAsync) {
+        // The worker is the only thread that uses emio until it is stopped
+        EMIO_AsyncWorker worker(emio, config.asyncCpu);
+        if (worker.Start()) {
+            const char *waitName = emio->GetEventMode() ? "events" : "polling";
+            RunAsyncTest(worker, config, BackendName[backend], waitName, 1, results);
+            if (config.batchSize > 0)
+                RunAsyncTest(worker, config, BackendName[backend], waitName, config.batchSize, results);
+            worker.Stop();
+        }
+    }
+
+    if (config.cyclicRate_hz > 0.0)
+        RunCyclicTest(emio, config, backend, results);
+
+    if (config.useCache) {
+        EMIO_Interface_Cached cached(emio);
+        BenchConfig cacheConfig = config;
+        cacheConfig.readAddr = EMIO_CACHE_ADDR_HW_VERSION;
+        RunTest(&cached, cacheConfig, backend, OP_READ_QUAD, 1, results);
+        results.back().op = "CachedReadQuadlet";
+        const EMIO_CacheStats &stats = cached.GetStats();
+        std::cerr << "Cache: " << stats.numHits << " hits, " << stats.numMisses << " misses" << std::endl;
+    }
+}
+
+static EMIO_Interface *CreateInterface(BenchBackend backend, const BenchConfig &config)
+{
+    EMIO_Interface *emio = 0;
+    if (backend == BACKEND_MMAP) {
+        emio = new EMIO_Interface_Mmap;
+    }
+    else if (backend == BACKEND_GPIOD) {
+        emio = new EMIO_Interface_Gpiod;
+    }
+    else if (backend == BACKEND_GPIOV2) {
+        emio = new EMIO_Interface_GpioV2(config.gpioChip);
+    }
+    else if (backend == BACKEND_SIM) {
+        EMIO_Interface_Sim *sim = new EMIO_Interface_Sim;
+        sim->SetOpDoneLatency_ns(config.simLatency_ns);
+        emio = sim;
+    }
+    else if (backend == BACKEND_REMOTE) {
+        emio = new EMIO_Interface_Remote;
+    }
+    if (emio && !emio->IsOK()) {
+        std::cerr << "Error initializing EMIO " << BackendName[backend] << " interface" << std::endl;
+        delete emio;
+        emio = 0;
+    }
+    if (emio) {
+        emio->SetWaitPolicy(config.waitPolicy);
+        if (config.useBusLock && !emio->SetBusLock(true)) {
+            std::cerr << "Error enabling bus lock" << std::endl;
+            delete emio;
+            emio = 0;
+        }
+    }
+    if (emio && config.usePerf) {
+        emio->SetTimingMode(1);
+        if (!emio->SetPerfCounters(true))
+            std::cerr << "Performance counters not available, printing timing statistics only" << std::endl;
+    }
+    if (emio && config.useEdge && !emio->SetEdgeTiming(true))
+        std::cerr << "Edge timing not available for " << BackendName[backend] << " interface" << std::endl;
+    return emio;
+}
+
+// Maximum number of processes for the bus lock stress test
+const unsigned int STRESS_MAX_PROCS = 64;
+
+// Results of the bus lock stress test (in memory shared with the child processes)
+struct StressShared {
+    volatile uint64_t counter;              // incremented (non-atomically) while holding the lock
+    struct {
+        unsigned int numErrors;             // failed or inconsistent transactions
+        EMIO_BusLockStats lockStats;        // bus lock statistics of the interface
+    } child[STRESS_MAX_PROCS];
+};
+
+// Stress test child process: each iteration performs a read (ReadQuadlet or ReadBlock),
+// a write and read-back of the scratch register in one batch (if -w specified), and a
+// non-atomic increment of the shared counter while holding a separate lock object
+static void RunStressChild(BenchBackend backend, const BenchConfig &config, unsigned int id,
+                           StressShared *stress)
+{
+    unsigned int &numErrors = stress->child[id].numErrors;
+    EMIO_Interface *emio = CreateInterface(backend, config);
+    EMIO_BusLock lock;
+    if (!emio || !lock.IsOK()) {
+        numErrors = config.numIter;
+        delete emio;
+        return;
+    }
+    uint32_t data[4];
+    for (unsigned int n = 0; n < config.numIter; n++) {
+        bool ok;
+        if ((n%2) && (emio->GetVersion() >= 1))
+            ok = emio->ReadBlock(config.readAddr, data, sizeof(data));
+        else
+            ok = emio->ReadQuadlet(config.readAddr, data[0]);
+        if (!ok)
+            numErrors++;
+        if (config.doWrite) {
+            uint32_t wdata = (id << 24) | n;
+            uint32_t rdata = 0;
+            EMIO_Request reqs[2] = { EMIO_Request::WriteQuadlet(config.writeAddr, &wdata),
+                                     EMIO_Request::ReadQuadlet(config.writeAddr, &rdata) };
+            if (!emio->ExecuteBatch(reqs, 2, EMIO_BATCH_STOP_ON_ERR) || (rdata != wdata))
+                numErrors++;
+        }
+        bool otherOwner;
+        if (lock.Lock(1.0e6, otherOwner)) {
+            uint64_t val = stress->counter;
+            sched_yield();
+            stress->counter = val+1;
+            lock.Unlock();
+        }
+        else {
+            numErrors++;
+        }
+    }
+    emio->GetBusLockStats(stress->child[id].lockStats);
+    delete emio;
+}
+
+// Name of the lock used by the recovery check (not the bus lock, so the bus is not blocked)
+#define STRESS_RECOVERY_LOCK_NAME "fpgav3bench_lock_check"
+
+// Bus lock recovery check: a child process acquires the lock and keeps it while the parent
+// tries to acquire it (which must time out), then terminates without releasing it, after
+// which the parent must recover it. Returns true if successful.
+static bool RunLockRecoveryCheck()
+{
+    int toParent[2], toChild[2];
+    if ((pipe(toParent) != 0) || (pipe(toChild) != 0)) {
+        std::cerr << "Could not create pipes for recovery check" << std::endl;
+        return false;
+    }
+    char c = 0;
+    pid_t pid = fork();
+    if (pid == 0) {
+        EMIO_BusLock lock(STRESS_RECOVERY_LOCK_NAME);
+        bool otherOwner;
+        c = lock.Lock(1.0e6, otherOwner) ? 1 : 0;
+        // Wait for the parent, then terminate while holding the lock
+        if ((write(toParent[1], &c, 1) == 1) && c && (read(toChild[0], &c, 1) != 1))
+            c = 0;
+        _exit(0);
+    }
+    if (pid < 0) {
+        std::cerr << "Could not create process for recovery check" << std::endl;
+        return false;
+    }
+    bool childLocked = (read(toParent[0], &c, 1) == 1) && c;
+
+    EMIO_BusLock lock(STRESS_RECOVERY_LOCK_NAME);
+    bool otherOwner;
+    bool timedOut = false;
+    pid_t heldBy = lock.GetOwnerPid();
+    if (childLocked) {
+        timedOut = !lock.Lock(1.0e4, otherOwner);
+        if (!timedOut)
+            lock.Unlock();
+    }
+    if (write(toChild[1], &c, 1) != 1)
+        kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    bool tookOver = false;
+    bool recovered = lock.Lock(1.0e4, otherOwner, tookOver);
+    if (recovered)
+        lock.Unlock();
+    recovered = recovered && tookOver;
+    bool ok = childLocked && (heldBy == pid) && timedOut && recovered &&
+              (lock.GetStats().numRecovered == 1) && (lock.GetOwnerPid() == 0);
+    std::cout << "  lock owner published: " << ((heldBy == pid) ? "yes" : "no") << std::endl
+              << "  timeout (live owner): " << (timedOut ? "yes" : "no") << std::endl
+              << "  recovered (terminated owner): " << (recovered ? "yes" : "no") << std::endl;
+
+    close(toParent[0]); close(toParent[1]);
+    close(toChild[0]); close(toChild[1]);
+    unlink("/dev/shm/" STRESS_RECOVERY_LOCK_NAME);
+    return ok;
+}
+
+// Bus lock stress test: runs numProcs child processes concurrently (see RunStressChild)
+// and checks the shared counter and number of errors, followed by the recovery check.
+// Returns true if successful.
+static bool RunLockStress(BenchBackend backend, BenchConfig config, unsigned int numProcs)
+{
+    unsigned int i;
+    config.useBusLock = true;
+    if (numProcs > STRESS_MAX_PROCS)
+        numProcs = STRESS_MAX_PROCS;
+
+    void *region = mmap(NULL, sizeof(StressShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        std::cerr << "Could not allocate shared memory for stress test" << std::endl;
+        return false;
+    }
+    StressShared *stress = new (region) StressShared;
+    stress->counter = 0;
+
+    std::cout << "Bus lock stress test: " << numProcs << " processes, " << config.numIter
+              << " iterations, " << BackendName[backend] << " interface" << std::endl;
+    double t0 = GetTime_us();
+    unsigned int numStarted = 0;
+    for (i = 0; i < numProcs; i++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            RunStressChild(backend, config, i, stress);
+            _exit(0);
+        }
+        if (pid < 0) {
+            std::cerr << "Could not create process " << i << std::endl;
+            break;
+        }
+        numStarted++;
+    }
+    while (wait(NULL) > 0);
+    double dt = GetTime_us()-t0;
+
+    unsigned int numErrors = 0;
+    EMIO_BusLockStats total;
+    for (i = 0; i < numStarted; i++) {
+        const EMIO_BusLockStats &st = stress->child[i].lockStats;
+        numErrors += stress->child[i].numErrors;
+        total.numAcquired += st.numAcquired;
+        total.numContended += st.numContended;
+        total.numTimeouts += st.numTimeouts;
+        total.numRecovered += st.numRecovered;
+        total.numOwnerChanges += st.numOwnerChanges;
+        total.wait_us += st.wait_us;
+    }
+    uint64_t expected = static_cast<uint64_t>(numStarted)*config.numIter;
+    bool ok = (numStarted == numProcs) && (numErrors == 0) && (stress->counter == expected);
+
+    std::cout << "  elapsed time:         " << dt*1.0e-6 << " s" << std::endl
+              << "  counter:              " << stress->counter << " (expected " << expected << ")" << std::endl
+              << "  transaction errors:   " << numErrors << std::endl
+              << "  lock acquired:        " << total.numAcquired << std::endl
+              << "  lock contended:       " << total.numContended << std::endl
+              << "  owner changes:        " << total.numOwnerChanges << std::endl
+              << "  lock timeouts:        " << total.numTimeouts << std::endl
+              << "  mean contended wait:  "
+              << ((total.numContended > 0) ? total.wait_us/total.numContended : 0.0) << " us" << std::endl;
+    if (!RunLockRecoveryCheck())
+        ok = false;
+    std::cout << "Stress test " << (ok ? "PASSED" : "FAILED") << std::endl;
+
+    munmap(region, sizeof(StressShared));
+    return ok;
+}
+
+// gpio-sim chip created by the GPIO v2 uAPI check (configfs directory)
+#define GPIOSIM_CONFIG_DIR "/sys/kernel/config/gpio-sim/fpgav3bench"
+
+// Line offsets of the gpio-sim chip used by the check (EMIO line n is offset 54+n)
+const unsigned int GPIOSIM_NUM_LINES     = 118;
+const unsigned int GPIOSIM_LINE_DATA0    = 54;    // emio[0], data bit 0
+const unsigned int GPIOSIM_LINE_DATA2    = 56;    // emio[2], data bit 2
+const unsigned int GPIOSIM_LINE_ADDR2    = 88;    // emio[34], address bit 2
+const unsigned int GPIOSIM_LINE_REQ_BUS  = 102;   // emio[48], req_bus
+const unsigned int GPIOSIM_LINE_OP_DONE  = 103;   // emio[49], op_done
+const unsigned int GPIOSIM_LINE_VERSION0 = 114;   // emio[60], version bit 0
+
+static bool WriteSysFile(const std::string &path, const std::string &value)
+{
+    std::ofstream file(path.c_str());
+    file << value << std::flush;
+    return file.good();
+}
+
+static std::string ReadSysFile(const std::string &path)
+{
+    std::ifstream file(path.c_str());
+    std::string value;
+    file >> value;
+    return value;
+}
+
+// GPIO v2 uAPI check: creates a gpio-sim chip (the gpio-sim module must be loaded), pulls
+// up the version line (version 1) and two data lines, and checks that EMIO_Interface_GpioV2
+// reads the version and performs a read handshake, with polling and events. For each
+// handshake, a child process checks that the address and req_bus lines are driven while
+// op_done is low, then pulls op_done up; the read must not complete before then, must
+// return the data lines and must clear req_bus. Returns true if successful.
+static bool RunGpioSimCheck()
+{
+    const std::string cfg(GPIOSIM_CONFIG_DIR);
+    std::cout << "GPIO v2 uAPI check with gpio-sim" << std::endl;
+    if ((mkdir(cfg.c_str(), 0755) != 0) && (errno != EEXIST)) {
+        std::cerr << "Could not create " << cfg << " (gpio-sim module loaded?)" << std::endl;
+        return false;
+    }
+    mkdir((cfg+"/bank0").c_str(), 0755);
+    std::ostringstream numLines;
+    numLines << GPIOSIM_NUM_LINES;
+    bool ok = WriteSysFile(cfg+"/bank0/num_lines", numLines.str()) && WriteSysFile(cfg+"/live", "1");
+    std::string chipName = ReadSysFile(cfg+"/bank0/chip_name");
+    std::string lineDir = "/sys/devices/platform/" + ReadSysFile(cfg+"/dev_name") + "/" + chipName + "/sim_gpio";
+    if (!ok || chipName.empty()) {
+        std::cerr << "Could not create gpio-sim chip" << std::endl;
+        ok = false;
+    }
+
+    EMIO_Interface_GpioV2 *emio = 0;
+    if (ok) {
+        std::ostringstream line;
+        line << lineDir << GPIOSIM_LINE_VERSION0 << "/pull";
+        ok = WriteSysFile(line.str(), "pull-up");
+        line.str("");
+        line << lineDir << GPIOSIM_LINE_DATA0 << "/pull";
+        ok = ok && WriteSysFile(line.str(), "pull-up");
+        line.str("");
+        line << lineDir << GPIOSIM_LINE_DATA2 << "/pull";
+        ok = ok && WriteSysFile(line.str(), "pull-up");
+        emio = new EMIO_Interface_GpioV2(("/dev/"+chipName).c_str());
+        ok = ok && emio->IsOK();
+        std::cout << "  chip:                 /dev/" << chipName << std::endl
+                  << "  version:              " << emio->GetVersion() << " (expected 1)" << std::endl;
+        ok = ok && (emio->GetVersion() == 1);
+    }
+
+    std::ostringstream opDone, reqBus, addr2;
+    opDone << lineDir << GPIOSIM_LINE_OP_DONE << "/pull";
+    reqBus << lineDir << GPIOSIM_LINE_REQ_BUS << "/value";
+    addr2 << lineDir << GPIOSIM_LINE_ADDR2 << "/value";
+    const double delay_us = 1.0e5;
+    for (unsigned int mode = 0; ok && (mode < 2); mode++) {
+        emio->SetEventMode(mode == 1);
+        emio->SetTimeout_us(10*delay_us);
+        if (!WriteSysFile(opDone.str(), "pull-down")) {
+            ok = false;
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            usleep(static_cast<useconds_t>(delay_us));
+            bool driven = (ReadSysFile(reqBus.str()) == "1") && (ReadSysFile(addr2.str()) == "1");
+            _exit((WriteSysFile(opDone.str(), "pull-up") && driven) ? 0 : 1);
+        }
+        if (pid < 0) {
+            std::cerr << "Could not create process for handshake" << std::endl;
+            ok = false;
+            break;
+        }
+        uint32_t data = 0;
+        double t0 = GetTime_us();
+        bool readOk = emio->ReadQuadlet(0x0004, data);
+        double dt = GetTime_us()-t0;
+        int status = -1;
+        waitpid(pid, &status, 0);
+        bool driven = WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+        bool released = (ReadSysFile(reqBus.str()) == "0");
+        bool handshake = readOk && driven && released && (dt >= 0.5*delay_us) && (data == 0x5);
+        std::cout << "  handshake (" << ((mode == 1) ? "events" : "polling") << "): "
+                  << (handshake ? "OK" : "FAILED") << " (data 0x" << std::hex << data << std::dec
+                  << ", waited " << dt << " us, req_bus " << (driven ? "set" : "not set")
+                  << (released ? " and cleared" : ", not cleared") << ")" << std::endl;
+        ok = handshake;
+    }
+
+    delete emio;
+    WriteSysFile(cfg+"/live", "0");
+    rmdir((cfg+"/bank0").c_str());
+    rmdir(cfg.c_str());
+    std::cout << "GPIO v2 uAPI check " << (ok ? "PASSED" : "FAILED") << std::endl;
+    return ok;
+}
+
+static void WriteJSON(std::ostream &out, const BenchConfig &config, std::vector<BenchResult> &results,
+                      uint32_t hwVersion, uint32_t fwVersion, unsigned int emioVersion)
+{
+    char hwStr[5];
+    hwStr[0] = (hwVersion & 0xff000000) >> 24;
+    hwStr[1] = (hwVersion & 0x00ff0000) >> 16;
+    hwStr[2] = (hwVersion & 0x0000ff00) >> 8;
+    hwStr[3] = (hwVersion & 0x000000ff);
+    hwStr[4] = 0;
+    for (size_t i = 0; i < 4; i++) {
+        if ((hwStr[i] < ' ') || (hwStr[i] > '~') || (hwStr[i] == '"') || (hwStr[i] == '\\'))
+            hwStr[i] = '?';
+    }
+
+    out << std::fixed;
+    out << "{" << std::endl;
+    out << "  \"tool\": \"fpgav3bench\"," << std::endl;
+    out << "  \"libfpgav3_version\": \"" << libfpgav3_version() << "\"," << std::endl;
+    out << "  \"libfpgav3_git_version\": \"" << libfpgav3_git_version() << "\"," << std::endl;
+    out << "  \"libfpgav3_git_sha\": \"" << std::hex << std::setw(8) << std::setfill('0')
+        << libfpgav3_git_sha() << std::dec << std::setfill(' ') << "\"," << std::endl;
+    out << "  \"hw_version\": \"" << hwStr << "\"," << std::endl;
+    out << "  \"fw_version\": " << fwVersion << "," << std::endl;
+    out << "  \"emio_version\": " << emioVersion << "," << std::endl;
+    out << "  \"iterations\": " << config.numIter << "," << std::endl;
+    out << "  \"wait_policy\": \"" << WaitPolicyName[config.waitPolicy] << "\"," << std::endl;
+    out << "  \"bus_lock\": " << (config.useBusLock ? "true" : "false") << "," << std::endl;
+    if (config.useAsync)
+        out << "  \"async_cpu\": " << config.asyncCpu << "," << std::endl;
+    if (config.cyclicRate_hz > 0.0)
+        out << "  \"cyclic_rate_hz\": " << config.cyclicRate_hz << "," << std::endl;
+    out << "  \"results\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        BenchResult &res = results[i];
+        std::sort(res.samples.begin(), res.samples.end());
+        double sum = 0.0;
+        for (size_t j = 0; j < res.samples.size(); j++)
+            sum += res.samples[j];
+        double mean = res.samples.empty() ? 0.0 : sum/res.samples.size();
+        // Bytes per microsecond is the same as MB/s
+        double mbps = (sum > 0.0) ? (4.0*res.nQuads*res.samples.size())/sum : 0.0;
+        out << std::setprecision(3)
+            << "    { \"backend\": \"" << res.backend << "\", \"wait\": \"" << res.wait
+            << "\", \"op\": \"" << res.op << "\", \"quadlets\": " << res.nQuads
+            << ", \"bytes\": " << 4*res.nQuads << ", \"samples\": " << res.samples.size()
+            << ", \"errors\": " << res.numErrors
+            << ", \"mean_us\": " << mean
+            << ", \"p50_us\": " << Percentile(res.samples, 50.0)
+            << ", \"p99_us\": " << Percentile(res.samples, 99.0)
+            << ", \"p999_us\": " << Percentile(res.samples, 99.9)
+            << ", \"max_us\": " << (res.samples.empty() ? 0.0 : res.samples.back())
+            << ", \"MBps\": " << mbps << " }"
+            << ((i+1 < results.size()) ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int args_found;
+    BenchConfig config;
+    config.numIter = 1000;
+    config.numWarmup = 10;
+    config.readAddr = 0;
+    config.doHold = false;
+    config.holdAddr = 0;
+    config.doWrite = false;
+    config.writeAddr = 0;
+    config.maxQuads = 512;
+    config.batchSize = 16;
+    config.simLatency_ns = 0;
+    config.waitPolicy = EMIO_WAIT_SPIN;
+    config.useBusLock = false;
+    config.useAsync = false;
+    config.useCache = false;
+    config.asyncCpu = 1;
+    config.cyclicRate_hz = 0.0;
+    config.gpioChip = EMIO_GPIOV2_DEFAULT_CHIP;
+    config.usePerf = false;
+    config.useEdge = false;
+
+    bool useMmap = false;
+    bool useGpiod = false;
+    bool useGpioV2 = false;
+    bool useSim = false;
+    bool useRemote = false;
+    unsigned int eventMode = 2;
+    const char *outFile = 0;
+    bool doMmio = false;
+    unsigned int stressProcs = 0;
+    bool doGpioSimCheck = false;
+
+    args_found = 0;
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            if (argv[i][1] == 'm') {
+                useMmap = true;
+            }
+            else if (argv[i][1] == 'g') {
+                useGpiod = true;
+            }
+            else if (argv[i][1] == 'G') {
+                useGpioV2 = true;
+                if (argv[i][2]) config.gpioChip = argv[i]+2;
+            }
+            else if (argv[i][1] == 's') {
+                useSim = true;
+                if (argv[i][2]) config.simLatency_ns = strtoul(argv[i]+2, 0, 10);
+            }
+            else if (argv[i][1] == 'r') {
+                useRemote = true;
+            }
+            else if (argv[i][1] == 'e') {
+                if (argv[i][2]) eventMode = argv[i][2]-'0';
+            }
+            else if (argv[i][1] == 'p') {
+                if ((argv[i][2] >= '0') && (argv[i][2] <= '3'))
+                    config.waitPolicy = static_cast<EMIO_WaitPolicy>(argv[i][2]-'0');
+            }
+            else if (argv[i][1] == 'n') {
+                if (argv[i][2]) config.numIter = strtoul(argv[i]+2, 0, 10);
+            }
+            else if (argv[i][1] == 'b') {
+                if (argv[i][2]) config.maxQuads = strtoul(argv[i]+2, 0, 10);
+            }
+            else if (argv[i][1] == 'q') {
+                if (argv[i][2]) config.batchSize = strtoul(argv[i]+2, 0, 10);
+            }
+            else if (argv[i][1] == 'w') {
+                if (argv[i][2]) {
+                    config.doWrite = true;
+                    config.writeAddr = strtoul(argv[i]+2, 0, 16);
+                }
+            }
+            else if (argv[i][1] == 'H') {
+                if (argv[i][2]) {
+                    config.doHold = true;
+                    config.holdAddr = strtoul(argv[i]+2, 0, 16);
+                }
+            }
+            else if (argv[i][1] == 'l') {
+                config.useBusLock = true;
+            }
+            else if (argv[i][1] == 'a') {
+                config.useAsync = true;
+                if (argv[i][2]) config.asyncCpu = strtol(argv[i]+2, 0, 10);
+            }
+            else if (argv[i][1] == 'c') {
+                config.useCache = true;
+            }
+            else if (argv[i][1] == 'C') {
+                config.cyclicRate_hz = argv[i][2] ? strtod(argv[i]+2, 0) : 1000.0;
+            }
+            else if (argv[i][1] == 'L') {
+                stressProcs = argv[i][2] ? strtoul(argv[i]+2, 0, 10) : 4;
+            }
+            else if (argv[i][1] == 'V') {
+                doGpioSimCheck = true;
+            }
+            else if (argv[i][1] == 'x') {
+                doMmio = true;
+            }
+            else if (argv[i][1] == 'P') {
+                config.usePerf = true;
+            }
+            else if (argv[i][1] == 'E') {
+                config.useEdge = true;
+            }
+            else if (argv[i][1] == 'o') {
+                if (argv[i][2]) outFile = argv[i]+2;
+            }
+            else if (argv[i][1] == 'h') {
+                args_found = -1;
+                break;
+            }
+        }
+        else {
+            if (args_found == 0)
+                config.readAddr = strtoul(argv[i], 0, 16);
+            else
+                std::cerr << "Warning: extra parameter: " << argv[i] << std::endl;
+            args_found++;
+        }
+    }
+
+    if ((args_found < 0) || (config.numIter == 0) || (config.maxQuads > 512)) {
+        std::cout << "Usage: " << argv[0] << " [-m] [-g] [-G<chip>] [-s<ns>] [-r] [-e<n>] [-p<n>] [-n<iter>] [-b<quads>] [-q<quads>]"
+                  << " [-w<addr>] [-H<addr>] [-x] [-a<cpu>] [-C<hz>] [-c] [-P] [-E] [-l] [-L<procs>] [-V] [-o<file>]"
+                  << " [read address in hex]" << std::endl
+                  << "       where -m specifies to test the mmap interface" << std::endl
+                  << "             -g specifies to test the gpiod interface" << std::endl
+                  << "             -G<chip> specifies to test the GPIO v2 uAPI interface, with optional GPIO chip" << std::endl
+                  << "                (default " EMIO_GPIOV2_DEFAULT_CHIP ", e.g., a gpio-sim chip for testing without the FPGA)" << std::endl
+                  << "             -s<ns> specifies to test the simulated interface, with optional op_done latency in ns" << std::endl
+                  << "             -r specifies to test the EMIO request server (fpgav3emiod must be running)" << std::endl
+                  << "             -e<n> is to test polling (0), events (1) or both (2, default)" << std::endl
+                  << "             -p<n> is the polling wait policy: spin (0, default), spin+yield (1), spin+sleep (2), adaptive (3)" << std::endl
+                  << "             -n<iter> is the number of iterations per test (default 1000)" << std::endl
+                  << "             -b<quads> is the maximum block size in quadlets (default 512)" << std::endl
+                  << "             -q<quads> is the number of quadlets for per-call vs batch comparison (default 16, 0 to disable)" << std::endl
+                  << "             -w<addr> enables write tests, using the specified (scratch) address in hex" << std::endl
+                  << "             -H<addr> also tests the batch that holds the bus (one block read of the -q quadlets)," << std::endl
+                  << "                at the specified address in hex, where a block read must be equivalent to quadlet" << std::endl
+                  << "                reads (e.g., " << std::hex << EMIO_ADDR_PROM_DATA << std::dec << " for the PROM data buffer)" << std::endl
+                  << "             -x measures the cost of MMIO register access (plain, volatile, volatile+dmb)" << std::endl
+                  << "             -a<cpu> also tests the asynchronous worker, pinned to the specified CPU (default 1, -1 for any)" << std::endl
+                  << "             -C<hz> also runs the cyclic scheduler at the specified rate (default 1000 Hz), reading" << std::endl
+                  << "                the -q quadlets each cycle for -n cycles; uses the -a CPU" << std::endl
+                  << "             -c also tests ReadQuadlet of the hardware version via the shadow-register cache" << std::endl
+                  << "             -P prints timing statistics with performance counters (cycles, instructions, cache" << std::endl
+                  << "                misses, context switches) per operation" << std::endl
+                  << "             -E prints edge timing (firmware response vs. system call and wakeup time) in event" << std::endl
+                  << "                mode, for the gpiod and GPIO v2 uAPI interfaces" << std::endl
+                  << "             -l enables the cross-process bus lock" << std::endl
+                  << "             -L<procs> runs the bus lock stress test with the specified number of processes (default 4)," << std::endl
+                  << "                using the first selected interface (also tests write/read-back if -w specified)," << std::endl
+                  << "                followed by a check of lock recovery from a terminated process" << std::endl
+                  << "             -V checks the GPIO v2 uAPI interface (version read and handshake) with a gpio-sim" << std::endl
+                  << "                chip, without the FPGA (requires root and the gpio-sim module)" << std::endl
+                  << "             -o<file> writes the JSON results to the specified file (default is stdout)" << std::endl
+                  << "       If no interface is specified, mmap and gpiod are tested" << std::endl;
+        return 0;
+    }
+
+    if (!useMmap && !useGpiod && !useGpioV2 && !useSim && !useRemote) {
+        useMmap = true;
+        useGpiod = true;
+    }
+
+    bool useBackend[NUM_BACKENDS] = { useMmap, useGpiod, useGpioV2, useSim, useRemote };
+
+    if (doGpioSimCheck)
+        return RunGpioSimCheck() ? 0 : -1;
+
+    if (stressProcs > 0) {
+        unsigned int b;
+        for (b = 0; (b < NUM_BACKENDS-1) && !useBackend[b]; b++);
+        return RunLockStress(static_cast<BenchBackend>(b), config, stressProcs) ? 0 : -1;
+    }
+    std::vector<BenchResult> results;
+    uint32_t hwVersion = 0;
+    uint32_t fwVersion = 0;
+    unsigned int emioVersion = 0;
+
+    for (unsigned int b = 0; b < NUM_BACKENDS; b++) {
+        if (!useBackend[b])
+            continue;
+        BenchBackend backend = static_cast<BenchBackend>(b);
+        EMIO_Interface *emio = CreateInterface(backend, config);
+        if (!emio)
+            continue;
+        emio->ReadQuadlet(ADDR_HW_VERSION, hwVersion);
+        emio->ReadQuadlet(ADDR_FW_VERSION, fwVersion);
+        emioVersion = emio->GetVersion();
+
+        if (eventMode != 1) {
+            emio->SetEventMode(false);
+            RunTests(emio, config, backend, results);
+        }
+        if (eventMode != 0) {
+            emio->SetEventMode(true);
+            // Skip if events are not supported by this interface
+            if (emio->GetEventMode())
+                RunTests(emio, config, backend, results);
+        }
+        delete emio;
+    }
+
+    if (doMmio)
+        RunMmioTests(config, useMmap, results);
+
+    if (results.empty()) {
+        std::cerr << "No tests were run" << std::endl;
+        return -1;
+    }
+
+    if (outFile) {
+        std::ofstream out(outFile);
+        if (!out) {
+            std::cerr << "Could not open output file " << outFile << std::endl;
+            return -1;
+        }
+        WriteJSON(out, config, results, hwVersion, fwVersion, emioVersion);
+    }
+    else {
+        WriteJSON(std::cout, config, results, hwVersion, fwVersion, emioVersion);
+    }
+
+    return 0;
+}
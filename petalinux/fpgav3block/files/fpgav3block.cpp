@@ -17,13 +17,14 @@
 #include <byteswap.h>
 #include <fpgav3_emio_gpiod.h>
 #include <fpgav3_emio_mmap.h>
+#include <fpgav3_emio_remote.h>
 #include <fpgav3_lib.h>
 
 int main(int argc, char **argv)
 {
     int i, j;
     int args_found;
-    uint16_t addr;
+    uint16_t addr = 0;
     int num;
     uint32_t data1;
     uint32_t *data = 0;
@@ -31,8 +32,12 @@ int main(int argc, char **argv)
     bool isQuad = (strstr(argv[0], "fpgav3quad") != 0);
     bool isVerbose = false;
     bool useGpiod = false;
+    bool useRemote = false;
     unsigned int eventMode = 2;
     unsigned int timingMode = 0;
+    bool useGlobalTimer = false;
+    bool useBusLock = false;
+    const char *traceFile = 0;
 
     j = 0;
     num = 1;
@@ -45,12 +50,24 @@ int main(int argc, char **argv)
             else if (argv[i][1] == 'g') {
                 useGpiod = true;
             }
+            else if (argv[i][1] == 'r') {
+                useRemote = true;
+            }
             else if (argv[i][1] == 't') {
                 if (argv[i][2]) timingMode = argv[i][2]-'0';
             }
+            else if (argv[i][1] == 'c') {
+                useGlobalTimer = true;
+            }
+            else if (argv[i][1] == 'l') {
+                useBusLock = true;
+            }
             else if (argv[i][1] == 'e') {
                 if (argv[i][2]) eventMode = argv[i][2]-'0';
             }
+            else if (argv[i][1] == 'T') {
+                if (argv[i][2]) traceFile = argv[i]+2;
+            }
         }
         else {
             if (args_found == 0)
@@ -73,21 +90,33 @@ int main(int argc, char **argv)
     }
 
     if (args_found < 1) {
-        std::cout << "Usage: " << argv[0] << " [-v] [-g] [-e<n>] [-t<n>] <address in hex> ";
+        std::cout << "Usage: " << argv[0] << " [-v] [-g] [-r] [-e<n>] [-t<n>] [-c] [-l] [-T<file>] <address in hex> ";
         if (isQuad)
             std::cout << "[value to write in hex]" << std::endl;
         else
             std::cout << "<address in hex> <number of quadlets> [write data quadlets in hex]" << std::endl;
         std::cout << "       where -v is for verbose output" << std::endl
                   << "             -g specifies to use gpiod interface" << std::endl
+                  << "             -r specifies to use the EMIO request server (fpgav3emiod)" << std::endl
                   << "             -e<n> is to use polling (0) or events (1)" << std::endl
                   << "             -t<n> is for timing measurement: 0 (no timing), 1 (total time only), 2+ (all timing)"
+                  << std::endl
+                  << "             -c specifies to use the global timer (cycle counter) for timing measurement"
+                  << std::endl
+                  << "             -l specifies to use the cross-process bus lock (wait for other processes using the lock)"
+                  << std::endl
+                  << "             -T<file> records a binary trace of the transactions in the specified file (see fpgav3trace)"
                   << std::endl;
         return 0;
     }
 
     EMIO_Interface *emio;
-    if (useGpiod) {
+    if (useRemote) {
+        if (isVerbose)
+            std::cout << "Using EMIO request server" << std::endl;
+        emio = new EMIO_Interface_Remote;
+    }
+    else if (useGpiod) {
         if (isVerbose)
             std::cout << "Using EMIO gpiod interface" << std::endl;
         emio = new EMIO_Interface_Gpiod;
@@ -99,11 +128,15 @@ int main(int argc, char **argv)
     }
     if (!emio->IsOK()) {
         std::cout << "Error initializing EMIO bus interface" << std::endl;
+        delete emio;
         return -1;
     }
 
     emio->SetVerbose(isVerbose);
 
+    if (useBusLock && !emio->SetBusLock(true))
+        std::cout << "Bus lock not available, continuing without lock" << std::endl;
+
     bool defaultEventMode = true;
     if (eventMode == 0) {
         emio->SetEventMode(false);
@@ -114,6 +147,18 @@ int main(int argc, char **argv)
         defaultEventMode = false;
     }
 
+    if (useGlobalTimer) {
+        if (!EMIO_Interface::SetTimeSource(EMIO_TIME_GLOBAL_TIMER))
+            std::cout << "Global timer not available, using clock_gettime for timing" << std::endl;
+        else if (isVerbose)
+            std::cout << "Using global timer for timing, tick period "
+                      << EMIO_Interface::GetTickPeriod_us()*1000.0 << " ns" << std::endl;
+    }
+
+    // Start trace after setting the time source, which is recorded in the trace
+    if (traceFile && !emio->StartTrace(traceFile))
+        std::cout << "Failed to start trace, continuing without trace" << std::endl;
+
     emio->SetTimingMode(timingMode);
 
     if (isVerbose) {
@@ -159,6 +204,27 @@ int main(int argc, char **argv)
             std::cout << "Write failed" << std::endl;
     }
 
+    if (timingMode > 0) {
+        // Print the timing results of the (single) operation
+        EMIO_TimingStats stats;
+        emio->GetTimingStats(stats);
+        std::cout << std::dec << std::setfill(' ');
+        for (j = 0; j < EMIO_TIMING_NUM_OPS; j++) {
+            const EMIO_OpTimingStats &opStats = stats.op[j];
+            if (opStats.total.GetCount() == 0)
+                continue;
+            std::cout << EMIO_TimingOpName(static_cast<EMIO_TimingOp>(j)) << " total time = "
+                      << opStats.total.GetMean_us() << " us" << std::endl;
+            if (opStats.phase[EMIO_PHASE_WAIT].GetCount() > 0) {
+                std::cout << ((j == EMIO_TIMING_READ_BLOCK) || (j == EMIO_TIMING_WRITE_BLOCK) ?
+                              "Start-loop-end" : "Start-wait-end") << " times = "
+                          << opStats.phase[EMIO_PHASE_START].GetMean_us() << ", "
+                          << opStats.phase[EMIO_PHASE_WAIT].GetMean_us() << ", "
+                          << opStats.phase[EMIO_PHASE_END].GetMean_us() << " us" << std::endl;
+            }
+        }
+    }
+
     delete [] data;
     delete emio;
     return 0;
@@ -0,0 +1,197 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3emiod
+ *
+ * EMIO request server (daemon). It owns the EMIO bus interface and executes the
+ * transactions submitted by clients (EMIO_Interface_Remote, e.g., fpgav3block -r) via
+ * shared memory, combining the pending requests of all clients into a single batch.
+ * See fpgav3_emio_remote.h.
+ *
+ * The server runs until it receives SIGTERM or SIGINT, then prints its statistics.
+ */
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <grp.h>
+#include <fpgav3_emio_gpiod.h>
+#include <fpgav3_emio_gpiov2.h>
+#include <fpgav3_emio_mmap.h>
+#include <fpgav3_emio_sim.h>
+#include <fpgav3_emio_remote.h>
+#include <fpgav3_lib.h>
+
+static EMIO_RemoteServer *server = 0;
+
+static void StopHandler(int)
+{
+    if (server)
+        server->Stop();
+}
+
+int main(int argc, char **argv)
+{
+    bool isVerbose = false;
+    bool useGpiod = false;
+    const char *gpioChip = 0;
+    bool useSim = false;
+    uint32_t simLatency_ns = 0;
+    unsigned int eventMode = 2;
+    EMIO_WaitPolicy waitPolicy = EMIO_WAIT_SPIN;
+    bool useBusLock = false;
+    const char *name = EMIO_REMOTE_DEFAULT_NAME;
+    const char *groupName = 0;
+    const char *traceFile = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            std::cout << "Warning: extra parameter: " << argv[i] << std::endl;
+            continue;
+        }
+        if (argv[i][1] == 'v') {
+            isVerbose = true;
+        }
+        else if (argv[i][1] == 'm') {
+            useGpiod = false;
+            useSim = false;
+            gpioChip = 0;
+        }
+        else if (argv[i][1] == 'g') {
+            useGpiod = true;
+        }
+        else if (argv[i][1] == 'G') {
+            gpioChip = argv[i][2] ? argv[i]+2 : EMIO_GPIOV2_DEFAULT_CHIP;
+        }
+        else if (argv[i][1] == 's') {
+            useSim = true;
+            if (argv[i][2]) simLatency_ns = strtoul(argv[i]+2, 0, 10);
+        }
+        else if (argv[i][1] == 'e') {
+            if (argv[i][2]) eventMode = argv[i][2]-'0';
+        }
+        else if (argv[i][1] == 'p') {
+            if ((argv[i][2] >= '0') && (argv[i][2] <= '3'))
+                waitPolicy = static_cast<EMIO_WaitPolicy>(argv[i][2]-'0');
+        }
+        else if (argv[i][1] == 'l') {
+            useBusLock = true;
+        }
+        else if (argv[i][1] == 'n') {
+            if (argv[i][2]) name = argv[i]+2;
+        }
+        else if (argv[i][1] == 'a') {
+            if (argv[i][2]) groupName = argv[i]+2;
+        }
+        else if (argv[i][1] == 'T') {
+            if (argv[i][2]) traceFile = argv[i]+2;
+        }
+        else {
+            std::cout << "Usage: " << argv[0] << " [-v] [-m | -g | -G<chip> | -s<ns>] [-e<n>] [-p<n>] [-l] [-n<name>]"
+                      << " [-a<group>] [-T<file>]" << std::endl
+                      << "       where -v is for verbose output" << std::endl
+                      << "             -m specifies to use mmap interface (default)" << std::endl
+                      << "             -g specifies to use gpiod interface" << std::endl
+                      << "             -G<chip> specifies to use GPIO v2 uAPI interface, with optional GPIO chip (default "
+                      << EMIO_GPIOV2_DEFAULT_CHIP << ")" << std::endl
+                      << "             -s<ns> specifies to use simulated interface, with op_done latency in ns" << std::endl
+                      << "             -e<n> is to use polling (0) or events (1)" << std::endl
+                      << "             -p<n> is the wait policy: 0 (spin), 1 (spin-yield), 2 (spin-sleep), 3 (adaptive)"
+                      << std::endl
+                      << "             -l specifies to use the cross-process bus lock (for other processes that do not use this server)"
+                      << std::endl
+                      << "             -n<name> is the name of the shared-memory segment (default " << EMIO_REMOTE_DEFAULT_NAME
+                      << ")" << std::endl
+                      << "             -a<group> allows members of the specified group to connect (default: only the user"
+                      << std::endl
+                      << "                and group of the server)" << std::endl
+                      << "             -T<file> records a binary trace of the transactions in the specified file (see fpgav3trace)"
+                      << std::endl;
+            return 0;
+        }
+    }
+
+    EMIO_Interface *emio;
+    if (useSim) {
+        EMIO_Interface_Sim *sim = new EMIO_Interface_Sim;
+        sim->SetOpDoneLatency_ns(simLatency_ns);
+        emio = sim;
+    }
+    else if (gpioChip)
+        emio = new EMIO_Interface_GpioV2(gpioChip);
+    else if (useGpiod)
+        emio = new EMIO_Interface_Gpiod;
+    else
+        emio = new EMIO_Interface_Mmap;
+    if (!emio->IsOK()) {
+        std::cout << "Error initializing EMIO bus interface" << std::endl;
+        return -1;
+    }
+
+    emio->SetVerbose(isVerbose);
+    emio->SetWaitPolicy(waitPolicy);
+    if (eventMode == 0)
+        emio->SetEventMode(false);
+    else if (eventMode == 1)
+        emio->SetEventMode(true);
+    if (useBusLock && !emio->SetBusLock(true))
+        std::cout << "Bus lock not available, continuing without lock" << std::endl;
+    if (traceFile && !emio->StartTrace(traceFile))
+        std::cout << "Failed to start trace, continuing without trace" << std::endl;
+
+    // Group of the shared-memory segment (name or number)
+    gid_t group = static_cast<gid_t>(-1);
+    if (groupName) {
+        struct group *gr = getgrnam(groupName);
+        char *end;
+        unsigned long gid = strtoul(groupName, &end, 10);
+        if (gr)
+            group = gr->gr_gid;
+        else if ((end != groupName) && (*end == 0))
+            group = static_cast<gid_t>(gid);
+        else {
+            std::cout << "Unknown group: " << groupName << std::endl;
+            delete emio;
+            return -1;
+        }
+    }
+
+    server = new EMIO_RemoteServer(emio, name, group);
+    if (!server->IsOK()) {
+        std::cout << "Error initializing EMIO request server" << std::endl;
+        delete server;
+        delete emio;
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = StopHandler;
+    sigaction(SIGTERM, &sa, 0);
+    sigaction(SIGINT, &sa, 0);
+
+    if (isVerbose) {
+        print_fpgav3_versions(std::cout);
+        std::cout << "EMIO bus interface version " << emio->GetVersion() << std::endl;
+        std::cout << "Configured to use " << (emio->GetEventMode() ? "events" : "polling") << std::endl;
+    }
+    std::cout << "fpgav3emiod: serving requests on /dev/shm/" << name << std::endl;
+
+    server->Run();
+
+    const EMIO_RemoteServerStats &stats = server->GetStats();
+    std::cout << "fpgav3emiod: " << stats.numClients << " clients, " << stats.numSubmissions
+              << " submissions, " << stats.numRequests << " requests, " << stats.numBatches << " batches";
+    if (stats.numBatches > 0)
+        std::cout << " (" << static_cast<double>(stats.numRequests)/stats.numBatches << " requests/batch)";
+    std::cout << ", " << stats.numDeadClients << " terminated clients" << std::endl;
+    if (emio->IsTracing())
+        std::cout << "fpgav3emiod: " << emio->GetNumTraced() << " transactions traced in " << traceFile << std::endl;
+
+    delete server;
+    server = 0;
+    delete emio;
+    return 0;
+}
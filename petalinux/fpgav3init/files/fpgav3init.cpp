@@ -12,6 +12,9 @@
  *   5) Copies qspi-boot.bin to flash if different
  *   6) Sets the Ethernet MAC and IP addresses
  *   7) Copies FPGA serial number from QSPI to FPGA (via EMIO)
+ *
+ * The start and end of each step are marked by the init_step_start and init_step_end
+ * USDT probes (see fpgav3_probes.h), so that the boot sequence can be profiled.
  */
 
 #include <stdio.h>
@@ -29,6 +32,7 @@
 #include <fpgav3_emio_gpiod.h>
 #include <fpgav3_qspi.h>
 #include <fpgav3_lib.h>
+#include <fpgav3_probes.h>
 
 // Detected board type
 enum BoardType { BOARD_UNKNOWN, BOARD_NONE, BOARD_QLA, BOARD_DQLA, BOARD_DRAC };
@@ -265,15 +269,20 @@ int main(int argc, char **argv)
     std::cout << std::endl;
 
     // Get FPGA Serial Number
+    FPGAV3_PROBE2(init_step_start, 1, "serial number");
     char fpga_sn[FPGA_SN_SIZE];
     GetFpgaSerialNumber(fpga_sn);
     if (fpga_sn[0])
         std::cout << "FPGA S/N: " << fpga_sn << std::endl;
+    FPGAV3_PROBE2(init_step_end, 1, (fpga_sn[0] != 0));
 
+    FPGAV3_PROBE2(init_step_start, 2, "board information");
     uint32_t reg_hw, reg_status, reg_ethctrl;
     EMIO_Interface_Gpiod emio;
-    if (!emio.IsOK())
+    if (!emio.IsOK()) {
+        FPGAV3_PROBE2(init_step_end, 2, 0);
         return -1;
+    }
 
     emio.ReadQuadlet(4, reg_hw);
     emio.ReadQuadlet(0, reg_status);
@@ -286,6 +295,7 @@ int main(int argc, char **argv)
     hwStr[4] = 0;
     if (strcmp(hwStr, "BCFG") != 0) {
         std::cout << "fpgav3init: did not detect BCFG firmware, exiting" << std::endl;
+        FPGAV3_PROBE2(init_step_end, 2, 0);
         return -1;
     }
     std::cout << "Hardware version: " << hwStr << std::endl;
@@ -315,22 +325,31 @@ int main(int argc, char **argv)
     std::cout << "Board type: " << BoardName[board_type] << std::endl;
 
     std::cout << "Board ID: " << board_id << std::endl << std::endl;
+    FPGAV3_PROBE2(init_step_end, 2, 1);
 
+    FPGAV3_PROBE2(init_step_start, 3, "export variables");
     std::cout << "Exporting FPGAV3 environment variables" << std::endl;
     char fpga_ver[4];
     fpga_ver[0] = '3';
     fpga_ver[1] = '.';
     fpga_ver[2] = isV30 ? '0' : '1';
     fpga_ver[3] = '\0';
-    ExportFpgaInfo(fpga_ver, fpga_sn, BoardName[board_type].c_str(), board_id);
+    bool ok = ExportFpgaInfo(fpga_ver, fpga_sn, BoardName[board_type].c_str(), board_id);
+    FPGAV3_PROBE2(init_step_end, 3, ok);
 
     // MicroSD card should be auto-mounted
 
+    FPGAV3_PROBE2(init_step_start, 4, "program FPGA");
+    ok = false;
     if (!FirmwareName[board_type].empty())
-        ProgramFpga(FirmwareName[board_type]);
+        ok = ProgramFpga(FirmwareName[board_type]);
+    FPGAV3_PROBE2(init_step_end, 4, ok);
 
-    ProgramFlash("/media/qspi-boot.bin", "/dev/mtd0");
+    FPGAV3_PROBE2(init_step_start, 5, "program flash");
+    ok = ProgramFlash("/media/qspi-boot.bin", "/dev/mtd0");
+    FPGAV3_PROBE2(init_step_end, 5, ok);
 
+    FPGAV3_PROBE2(init_step_start, 6, "Ethernet");
     std::cout << std::endl << "Enabling PS Ethernet" << std::endl;
     // Bit 25: mask for PS Ethernet enable
     // Bit 16: enable PS eth (Rev 9)
@@ -339,13 +358,17 @@ int main(int argc, char **argv)
     emio.WriteQuadlet(12, reg_ethctrl);
 
     std::cout << "Setting Ethernet MAC and IP addresses" << std::endl;
-    if (!SetMACandIP("eth0", board_id))
+    ok = SetMACandIP("eth0", board_id);
+    if (!ok)
         std::cout << "Failed to set MAC or IP address for eth0" << std::endl;
+    FPGAV3_PROBE2(init_step_end, 6, ok);
 
     // Copy first 16 bytes (i.e., FPGA S/N)
     // from QSPI flash to FPGA registers
+    FPGAV3_PROBE2(init_step_start, 7, "copy S/N to FPGA");
     std::cout << "Writing FPGA S/N to FPGA" << std::endl << std::endl;
-    CopyQspiToFpga("/dev/mtd4ro", &emio, 16);
+    ok = CopyQspiToFpga("/dev/mtd4ro", &emio, 16);
+    FPGAV3_PROBE2(init_step_end, 7, ok);
 
     std::cout << "*** FPGAV3 Initialization Complete ***" << std::endl << std::endl;
     return 0;
@@ -0,0 +1,209 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3mirror
+ *
+ * Application to mirror FPGA registers in shared memory (see fpgav3_emio_mirror.h).
+ * By default, it runs as the publisher: it reads the specified address ranges at the
+ * specified rate and publishes them until it receives SIGTERM or SIGINT. With -d, it
+ * instead prints the current snapshot from a running publisher, without accessing the
+ * EMIO bus.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <fpgav3_emio_gpiod.h>
+#include <fpgav3_emio_mmap.h>
+#include <fpgav3_emio_sim.h>
+#include <fpgav3_emio_remote.h>
+#include <fpgav3_emio_mirror.h>
+#include <fpgav3_lib.h>
+
+static EMIO_MirrorPublisher *publisher = 0;
+
+static void StopHandler(int)
+{
+    if (publisher)
+        publisher->Stop();
+}
+
+// Print the current snapshot of all ranges
+static int PrintSnapshot(const char *name)
+{
+    EMIO_MirrorReader reader(name);
+    if (!reader.IsOK())
+        return -1;
+    if (!reader.IsPublisherRunning())
+        std::cout << "Warning: publisher is not running, data may be stale" << std::endl;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (unsigned int i = 0; i < reader.GetNumRanges(); i++) {
+        uint16_t addr;
+        unsigned int nQuads;
+        reader.GetRange(i, addr, nQuads);
+        uint32_t *data = new uint32_t[nQuads];
+        EMIO_MirrorSnapshot info;
+        if (reader.Read(addr, data, nQuads, &info)) {
+            double age_ms = (now.tv_sec-info.time.tv_sec)*1.0e3 + (now.tv_nsec-info.time.tv_nsec)*1.0e-6;
+            std::cout << "Range " << std::hex << addr << std::dec << " (" << nQuads << " quadlets), update "
+                      << info.seq << ", " << age_ms << " ms ago" << (info.ok ? "" : " (read failed)")
+                      << std::endl;
+            for (unsigned int q = 0; q < nQuads; q++)
+                std::cout << "  " << std::hex << std::setw(4) << std::setfill('0') << (addr+q) << ": 0x"
+                          << std::setw(8) << data[q] << std::dec << std::setfill(' ') << std::endl;
+        }
+        else {
+            std::cout << "Range " << std::hex << addr << std::dec << ": no data" << std::endl;
+        }
+        delete [] data;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool isVerbose = false;
+    bool useGpiod = false;
+    bool useSim = false;
+    bool useRemote = false;
+    bool doPrint = false;
+    uint32_t simLatency_ns = 0;
+    unsigned int eventMode = 2;
+    bool useBusLock = false;
+    double rate_hz = 100.0;
+    const char *name = EMIO_MIRROR_DEFAULT_NAME;
+    std::vector<uint16_t> rangeAddr;
+    std::vector<unsigned int> rangeQuads;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            // Range: address in hex, optionally followed by :number of quadlets
+            char *end;
+            rangeAddr.push_back(strtoul(argv[i], &end, 16));
+            rangeQuads.push_back((*end == ':') ? strtoul(end+1, 0, 10) : 1);
+            continue;
+        }
+        if (argv[i][1] == 'v') {
+            isVerbose = true;
+        }
+        else if (argv[i][1] == 'm') {
+            useGpiod = false;
+            useSim = false;
+            useRemote = false;
+        }
+        else if (argv[i][1] == 'g') {
+            useGpiod = true;
+        }
+        else if (argv[i][1] == 's') {
+            useSim = true;
+            if (argv[i][2]) simLatency_ns = strtoul(argv[i]+2, 0, 10);
+        }
+        else if (argv[i][1] == 'r') {
+            useRemote = true;
+        }
+        else if (argv[i][1] == 'e') {
+            if (argv[i][2]) eventMode = argv[i][2]-'0';
+        }
+        else if (argv[i][1] == 'l') {
+            useBusLock = true;
+        }
+        else if (argv[i][1] == 'f') {
+            if (argv[i][2]) rate_hz = strtod(argv[i]+2, 0);
+        }
+        else if (argv[i][1] == 'n') {
+            if (argv[i][2]) name = argv[i]+2;
+        }
+        else if (argv[i][1] == 'd') {
+            doPrint = true;
+        }
+        else {
+            rangeAddr.clear();
+            break;
+        }
+    }
+
+    if (doPrint)
+        return PrintSnapshot(name);
+
+    if (rangeAddr.empty()) {
+        std::cout << "Usage: " << argv[0] << " [-v] [-m | -g | -s<ns> | -r] [-e<n>] [-l] [-f<hz>] [-n<name>] "
+                  << "<address in hex>[:<number of quadlets>] ..." << std::endl
+                  << "       " << argv[0] << " -d [-n<name>]" << std::endl
+                  << "       where -v is for verbose output" << std::endl
+                  << "             -m specifies to use mmap interface (default)" << std::endl
+                  << "             -g specifies to use gpiod interface" << std::endl
+                  << "             -s<ns> specifies to use simulated interface, with op_done latency in ns" << std::endl
+                  << "             -r specifies to use the EMIO request server (fpgav3emiod)" << std::endl
+                  << "             -e<n> is to use polling (0) or events (1)" << std::endl
+                  << "             -l specifies to use the cross-process bus lock" << std::endl
+                  << "             -f<hz> is the update rate (default 100 Hz)" << std::endl
+                  << "             -n<name> is the name of the shared-memory segment (default " << EMIO_MIRROR_DEFAULT_NAME
+                  << ")" << std::endl
+                  << "             -d prints the current snapshot from a running publisher" << std::endl;
+        return 0;
+    }
+
+    EMIO_Interface *emio;
+    if (useSim) {
+        EMIO_Interface_Sim *sim = new EMIO_Interface_Sim;
+        sim->SetOpDoneLatency_ns(simLatency_ns);
+        emio = sim;
+    }
+    else if (useRemote)
+        emio = new EMIO_Interface_Remote;
+    else if (useGpiod)
+        emio = new EMIO_Interface_Gpiod;
+    else
+        emio = new EMIO_Interface_Mmap;
+    if (!emio->IsOK()) {
+        std::cout << "Error initializing EMIO bus interface" << std::endl;
+        return -1;
+    }
+
+    emio->SetVerbose(isVerbose);
+    if (eventMode == 0)
+        emio->SetEventMode(false);
+    else if (eventMode == 1)
+        emio->SetEventMode(true);
+    if (useBusLock && !emio->SetBusLock(true))
+        std::cout << "Bus lock not available, continuing without lock" << std::endl;
+
+    publisher = new EMIO_MirrorPublisher(emio, name);
+    bool ok = true;
+    for (size_t i = 0; ok && (i < rangeAddr.size()); i++)
+        ok = publisher->AddRange(rangeAddr[i], rangeQuads[i]);
+    if (!ok || !publisher->Open()) {
+        std::cout << "Error initializing register mirror" << std::endl;
+        delete publisher;
+        delete emio;
+        return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = StopHandler;
+    sigaction(SIGTERM, &sa, 0);
+    sigaction(SIGINT, &sa, 0);
+
+    if (isVerbose) {
+        print_fpgav3_versions(std::cout);
+        std::cout << "EMIO bus interface version " << emio->GetVersion() << std::endl;
+    }
+    std::cout << "fpgav3mirror: publishing " << rangeAddr.size() << " ranges at " << rate_hz
+              << " Hz on /dev/shm/" << name << std::endl;
+
+    publisher->Run(rate_hz);
+
+    std::cout << "fpgav3mirror: " << publisher->GetNumUpdates() << " updates, "
+              << publisher->GetNumErrors() << " errors" << std::endl;
+
+    delete publisher;
+    publisher = 0;
+    delete emio;
+    return 0;
+}
@@ -0,0 +1,277 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3stat
+ *
+ * Application to monitor the EMIO counters of all processes that use libfpgav3 (see
+ * fpgav3_procstats.h). Like vmstat, it prints the rates (per second) of transactions,
+ * bytes, polls, timeouts, aborts, retries, direction switches and errors every interval, summed over all
+ * processes (or, with -a, for each process), and the mean bus arbitration and access times
+ * of the transactions that sampled grant_bus (timing mode 2). With -P, it instead prints the current
+ * counters of all processes in the Prometheus text exposition format and exits, e.g.,
+ * for the node_exporter textfile collector.
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fpgav3_procstats.h>
+
+static double GetTime_s()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1.0e-9;
+}
+
+// Read counters of all running processes (and remove segments of terminated processes,
+// if removeStale is true)
+static void ReadAll(std::map<pid_t, EMIO_ProcessCounters> &counters, std::map<pid_t, std::string> &names,
+                    bool removeStale)
+{
+    std::vector<pid_t> pids;
+    EMIO_ProcessStatsReader::ListProcesses(pids);
+    counters.clear();
+    for (size_t i = 0; i < pids.size(); i++) {
+        EMIO_ProcessStatsReader reader(pids[i]);
+        if (!reader.IsAlive()) {
+            if (removeStale && EMIO_ProcessStatsReader::RemoveStale(pids[i]))
+                std::cerr << "Removed counters of terminated process " << pids[i] << std::endl;
+            continue;
+        }
+        EMIO_ProcessCounters c;
+        if (reader.Read(c)) {
+            counters[pids[i]] = c;
+            names[pids[i]] = reader.GetName();
+        }
+    }
+}
+
+// Adds the differences (cur-prev) to sum; maxima are not differences
+static void AddDelta(EMIO_ProcessCounters &sum, const EMIO_ProcessCounters &cur, const EMIO_ProcessCounters &prev)
+{
+    for (unsigned int i = 0; i < EMIO_TIMING_NUM_OPS; i++)
+        sum.numOps[i] += cur.numOps[i]-prev.numOps[i];
+    sum.numErrors += cur.numErrors-prev.numErrors;
+    sum.bytesRead += cur.bytesRead-prev.bytesRead;
+    sum.bytesWritten += cur.bytesWritten-prev.bytesWritten;
+    sum.numWaits += cur.numWaits-prev.numWaits;
+    sum.waitPolls += cur.waitPolls-prev.waitPolls;
+    sum.numTimeouts += cur.numTimeouts-prev.numTimeouts;
+    sum.numDirSwitches += cur.numDirSwitches-prev.numDirSwitches;
+    sum.numAborts += cur.numAborts-prev.numAborts;
+    sum.numRetries += cur.numRetries-prev.numRetries;
+    sum.numGrants += cur.numGrants-prev.numGrants;
+    sum.arbitration_ns += cur.arbitration_ns-prev.arbitration_ns;
+    sum.access_ns += cur.access_ns-prev.access_ns;
+    if (cur.maxArbitration_ns > sum.maxArbitration_ns)
+        sum.maxArbitration_ns = cur.maxArbitration_ns;
+    if (cur.maxWait_ns > sum.maxWait_ns)
+        sum.maxWait_ns = cur.maxWait_ns;
+    if (cur.maxLatency_ns > sum.maxLatency_ns)
+        sum.maxLatency_ns = cur.maxLatency_ns;
+}
+
+static void PrintHeader(bool perProcess)
+{
+    if (perProcess)
+        std::cout << std::setw(7) << "pid" << " " << std::left << std::setw(15) << "name" << std::right;
+    std::cout << std::setw(9) << "rquad/s" << std::setw(9) << "wquad/s" << std::setw(9) << "rblk/s"
+              << std::setw(9) << "wblk/s" << std::setw(9) << "batch/s" << std::setw(9) << "rkB/s"
+              << std::setw(9) << "wkB/s" << std::setw(10) << "polls/s" << std::setw(7) << "tmo/s"
+              << std::setw(7) << "abt/s" << std::setw(7) << "rty/s" << std::setw(7) << "dir/s" << std::setw(7) << "err/s"
+              << std::setw(8) << "arb" << std::setw(8) << "acc" << std::setw(10) << "maxwait"
+              << std::setw(10) << "maxlat";
+    if (!perProcess)
+        std::cout << std::setw(6) << "procs";
+    std::cout << std::endl;
+}
+
+static void PrintRates(const EMIO_ProcessCounters &d, double dt)
+{
+    std::cout << std::fixed << std::setprecision(0);
+    for (unsigned int i = 0; i < EMIO_TIMING_NUM_OPS; i++)
+        std::cout << std::setw(9) << d.numOps[i]/dt;
+    std::cout << std::setprecision(1)
+              << std::setw(9) << d.bytesRead/(1024.0*dt) << std::setw(9) << d.bytesWritten/(1024.0*dt)
+              << std::setprecision(0)
+              << std::setw(10) << d.waitPolls/dt << std::setw(7) << d.numTimeouts/dt
+              << std::setw(7) << d.numAborts/dt << std::setw(7) << d.numRetries/dt
+              << std::setw(7) << d.numDirSwitches/dt << std::setw(7) << d.numErrors/dt
+              << std::setprecision(1);
+    if (d.numGrants > 0)
+        std::cout << std::setw(8) << d.arbitration_ns*1.0e-3/d.numGrants
+                  << std::setw(8) << d.access_ns*1.0e-3/d.numGrants;
+    else
+        std::cout << std::setw(8) << "-" << std::setw(8) << "-";
+    std::cout << std::setw(10) << d.maxWait_ns*1.0e-3 << std::setw(10) << d.maxLatency_ns*1.0e-3;
+}
+
+// Prints counters of all processes in Prometheus text format
+static void PrintPrometheus(const std::map<pid_t, EMIO_ProcessCounters> &counters,
+                            const std::map<pid_t, std::string> &names)
+{
+    struct Metric {
+        const char *name;
+        const char *type;
+        const char *help;
+    };
+    const Metric metrics[] = {
+        { "fpgav3_emio_ops_total", "counter", "EMIO operations by type" },
+        { "fpgav3_emio_errors_total", "counter", "Failed EMIO operations" },
+        { "fpgav3_emio_bytes_read_total", "counter", "Bytes read from the FPGA" },
+        { "fpgav3_emio_bytes_written_total", "counter", "Bytes written to the FPGA" },
+        { "fpgav3_emio_waits_total", "counter", "Waits for op_done that required polling" },
+        { "fpgav3_emio_wait_polls_total", "counter", "Polls of op_done" },
+        { "fpgav3_emio_timeouts_total", "counter", "Waits for op_done that timed out" },
+        { "fpgav3_emio_direction_switches_total", "counter", "Data line direction changes" },
+        { "fpgav3_emio_aborts_total", "counter", "Transactions aborted after a timeout or deadline miss" },
+        { "fpgav3_emio_retries_total", "counter", "Transaction retries after a timeout" },
+        { "fpgav3_emio_grants_total", "counter", "Transactions with a sampled bus grant (timing mode 2)" },
+        { "fpgav3_emio_arbitration_seconds_total", "counter", "Time from bus request to grant" },
+        { "fpgav3_emio_access_seconds_total", "counter", "Time from bus grant to op_done" },
+        { "fpgav3_emio_max_arbitration_seconds", "gauge", "Maximum time from bus request to grant" },
+        { "fpgav3_emio_max_wait_seconds", "gauge", "Maximum polling wait for op_done" },
+        { "fpgav3_emio_max_latency_seconds", "gauge", "Maximum operation time (if timing enabled)" }
+    };
+    const unsigned int numMetrics = sizeof(metrics)/sizeof(metrics[0]);
+    std::map<pid_t, EMIO_ProcessCounters>::const_iterator it;
+    for (unsigned int m = 0; m < numMetrics; m++) {
+        std::cout << "# HELP " << metrics[m].name << " " << metrics[m].help << std::endl
+                  << "# TYPE " << metrics[m].name << " " << metrics[m].type << std::endl;
+        for (it = counters.begin(); it != counters.end(); it++) {
+            const EMIO_ProcessCounters &c = it->second;
+            std::string labels = "pid=\"" + std::to_string(it->first) + "\",name=\"" + names.at(it->first) + "\"";
+            if (m == 0) {
+                for (unsigned int i = 0; i < EMIO_TIMING_NUM_OPS; i++)
+                    std::cout << metrics[m].name << "{" << labels << ",op=\""
+                              << EMIO_TimingOpName(static_cast<EMIO_TimingOp>(i)) << "\"} " << c.numOps[i] << std::endl;
+                continue;
+            }
+            std::cout << metrics[m].name << "{" << labels << "} ";
+            switch (m) {
+                case 1: std::cout << c.numErrors; break;
+                case 2: std::cout << c.bytesRead; break;
+                case 3: std::cout << c.bytesWritten; break;
+                case 4: std::cout << c.numWaits; break;
+                case 5: std::cout << c.waitPolls; break;
+                case 6: std::cout << c.numTimeouts; break;
+                case 7: std::cout << c.numDirSwitches; break;
+                case 8: std::cout << c.numAborts; break;
+                case 9: std::cout << c.numRetries; break;
+                case 10: std::cout << c.numGrants; break;
+                case 11: std::cout << c.arbitration_ns*1.0e-9; break;
+                case 12: std::cout << c.access_ns*1.0e-9; break;
+                case 13: std::cout << c.maxArbitration_ns*1.0e-9; break;
+                case 14: std::cout << c.maxWait_ns*1.0e-9; break;
+                case 15: std::cout << c.maxLatency_ns*1.0e-9; break;
+            }
+            std::cout << std::endl;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    bool perProcess = false;
+    bool doPrometheus = false;
+    bool removeStale = false;
+    double interval_s = 1.0;
+    unsigned int count = 0;        // 0 means forever
+    int args_found = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            if (argv[i][1] == 'a') {
+                perProcess = true;
+            }
+            else if (argv[i][1] == 'P') {
+                doPrometheus = true;
+            }
+            else if (argv[i][1] == 'c') {
+                removeStale = true;
+            }
+            else {
+                args_found = -1;
+                break;
+            }
+        }
+        else {
+            if (args_found == 0)
+                interval_s = strtod(argv[i], 0);
+            else if (args_found == 1)
+                count = strtoul(argv[i], 0, 10);
+            args_found++;
+        }
+    }
+
+    if ((args_found < 0) || (interval_s <= 0.0)) {
+        std::cout << "Usage: " << argv[0] << " [-a] [-P] [-c] [<interval in s> [<count>]]" << std::endl
+                  << "       where -a prints the rates of each process (default is the sum of all processes)" << std::endl
+                  << "             -P prints the counters of all processes in Prometheus text format and exits" << std::endl
+                  << "             -c removes the counters of terminated processes" << std::endl
+                  << "       The maxwait and maxlat columns are the maximum wait for op_done and operation" << std::endl
+                  << "       time (if timing is enabled) in microseconds, since the start of each process." << std::endl
+                  << "       The arb and acc columns are the mean bus arbitration (request to grant_bus) and" << std::endl
+                  << "       access (grant_bus to op_done) times in microseconds, if sampled (timing mode 2)." << std::endl
+                  << "       Set FPGAV3_STATS=0 in the environment of a process to disable its counters." << std::endl;
+        return 0;
+    }
+
+    std::map<pid_t, EMIO_ProcessCounters> prev, cur;
+    std::map<pid_t, std::string> names;
+    ReadAll(cur, names, removeStale);
+
+    if (doPrometheus) {
+        PrintPrometheus(cur, names);
+        return 0;
+    }
+
+    double prevTime = GetTime_s();
+    for (unsigned int n = 0; (count == 0) || (n < count); n++) {
+        if ((n%20) == 0)
+            PrintHeader(perProcess);
+        prev.swap(cur);
+        usleep(static_cast<useconds_t>(interval_s*1.0e6));
+        ReadAll(cur, names, false);
+        double curTime = GetTime_s();
+        double dt = curTime-prevTime;
+        prevTime = curTime;
+
+        // Rates of processes that were running at both samples (new processes are
+        // included from the next interval)
+        EMIO_ProcessCounters sum;
+        memset(&sum, 0, sizeof(sum));
+        unsigned int numProcs = 0;
+        std::map<pid_t, EMIO_ProcessCounters>::const_iterator it;
+        for (it = cur.begin(); it != cur.end(); it++) {
+            std::map<pid_t, EMIO_ProcessCounters>::const_iterator p = prev.find(it->first);
+            if (p == prev.end())
+                continue;
+            if (perProcess) {
+                EMIO_ProcessCounters d;
+                memset(&d, 0, sizeof(d));
+                AddDelta(d, it->second, p->second);
+                std::cout << std::setw(7) << it->first << " " << std::left << std::setw(15)
+                          << names[it->first] << std::right;
+                PrintRates(d, dt);
+                std::cout << std::endl;
+            }
+            else {
+                AddDelta(sum, it->second, p->second);
+            }
+            numProcs++;
+        }
+        if (!perProcess) {
+            PrintRates(sum, dt);
+            std::cout << std::setw(6) << numProcs << std::endl;
+        }
+    }
+    return 0;
+}
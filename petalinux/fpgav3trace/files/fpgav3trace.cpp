@@ -0,0 +1,400 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3trace
+ *
+ * Application to analyze a binary trace of EMIO transactions (see fpgav3_emio_trace.h),
+ * e.g., as recorded by fpgav3emiod -T or fpgav3block -T. By default, it prints a summary
+ * (number of transactions, errors, duration and wait time percentiles per operation,
+ * and the addresses with the largest total time). It can also convert the trace to
+ * Chrome trace (Perfetto) JSON format (-j), and replay it against any backend (-p),
+ * which issues the transactions at the recorded times (or back-to-back, with -f) and
+ * compares the replayed durations with the recorded durations.
+ *
+ * Writes are only replayed if -w is specified, since they change the state of the FPGA.
+ * Quadlet writes use the recorded data; block writes use zero data, since the trace only
+ * contains a hash of the block data.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <vector>
+#include <map>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fpgav3_emio_gpiod.h>
+#include <fpgav3_emio_gpiov2.h>
+#include <fpgav3_emio_mmap.h>
+#include <fpgav3_emio_sim.h>
+#include <fpgav3_emio_remote.h>
+#include <fpgav3_emio_trace.h>
+#include <fpgav3_lib.h>
+
+const unsigned int NUM_OP_TYPES = 4;
+const char *OpName[NUM_OP_TYPES] = { "ReadQuadlet", "WriteQuadlet", "ReadBlock", "WriteBlock" };
+
+// Durations (in microseconds) of one operation type
+struct OpSamples {
+    unsigned long numErrors;
+    std::vector<double> duration;
+    std::vector<double> wait;
+
+    OpSamples() : numErrors(0) {}
+};
+
+static double GetTime_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1.0e6 + ts.tv_nsec*1.0e-3;
+}
+
+// Returns the specified percentile (0-100) of sorted samples
+static double Percentile(const std::vector<double> &sorted, double pct)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t idx = static_cast<size_t>(pct/100.0*(sorted.size()-1) + 0.5);
+    if (idx >= sorted.size())
+        idx = sorted.size()-1;
+    return sorted[idx];
+}
+
+static void PrintSamples(const char *label, std::vector<double> &samples)
+{
+    if (samples.empty())
+        return;
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (size_t i = 0; i < samples.size(); i++)
+        sum += samples[i];
+    std::cout << "    " << std::left << std::setw(9) << label << std::right << std::fixed << std::setprecision(2)
+              << " mean " << std::setw(9) << sum/samples.size()
+              << "  p50 " << std::setw(9) << Percentile(samples, 50.0)
+              << "  p99 " << std::setw(9) << Percentile(samples, 99.0)
+              << "  max " << std::setw(9) << samples.back() << " us" << std::endl;
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+static void PrintOpSamples(OpSamples *ops)
+{
+    for (unsigned int op = 0; op < NUM_OP_TYPES; op++) {
+        if (ops[op].duration.empty())
+            continue;
+        std::cout << "  " << OpName[op] << ": " << ops[op].duration.size() << " transactions, "
+                  << ops[op].numErrors << " errors" << std::endl;
+        PrintSamples("duration", ops[op].duration);
+        PrintSamples("wait", ops[op].wait);
+    }
+}
+
+static void PrintSummary(const EMIO_TraceReader &trace, unsigned int numTop)
+{
+    const EMIO_TraceHeader *hdr = trace.GetHeader();
+    unsigned int num = trace.GetNumEntries();
+    std::cout << "Trace: " << num << " transactions (" << hdr->numRecorded << " recorded, "
+              << hdr->maxEntries << " maximum), EMIO bus interface version " << hdr->emioVersion
+              << ", time source " << ((hdr->timeSource == EMIO_TIME_GLOBAL_TIMER) ? "global timer" : "clock")
+              << std::endl;
+    if (num == 0)
+        return;
+    const EMIO_TraceEntry &firstEntry = trace.GetEntry(0);
+    const EMIO_TraceEntry &lastEntry = trace.GetEntry(num-1);
+    double span_us = trace.Ticks_us(lastEntry.start+lastEntry.duration-firstEntry.start);
+    std::cout << "Time span: " << span_us*1.0e-3 << " ms" << std::endl;
+
+    OpSamples ops[NUM_OP_TYPES];
+    std::map<uint16_t, double> addrTime;
+    double busy_us = 0.0;
+    for (unsigned int i = 0; i < num; i++) {
+        const EMIO_TraceEntry &entry = trace.GetEntry(i);
+        if (entry.opType >= NUM_OP_TYPES)
+            continue;
+        double dur_us = trace.Ticks_us(entry.duration);
+        ops[entry.opType].duration.push_back(dur_us);
+        ops[entry.opType].wait.push_back(trace.Ticks_us(entry.wait));
+        if (!entry.ok)
+            ops[entry.opType].numErrors++;
+        addrTime[entry.addr] += dur_us;
+        busy_us += dur_us;
+    }
+    if (span_us > 0.0)
+        std::cout << "Bus utilization: " << 100.0*busy_us/span_us << "%" << std::endl;
+    PrintOpSamples(ops);
+
+    // Addresses with the largest total time
+    std::vector<std::pair<double, uint16_t> > top;
+    for (std::map<uint16_t, double>::const_iterator it = addrTime.begin(); it != addrTime.end(); it++)
+        top.push_back(std::make_pair(it->second, it->first));
+    std::sort(top.rbegin(), top.rend());
+    if (top.size() > numTop)
+        top.resize(numTop);
+    std::cout << "Addresses with largest total time:" << std::endl;
+    for (size_t i = 0; i < top.size(); i++)
+        std::cout << "  " << std::hex << std::setw(4) << std::setfill('0') << top[i].second << std::dec
+                  << std::setfill(' ') << ": " << top[i].first << " us" << std::endl;
+}
+
+// Write trace in Chrome trace event format (complete events, timestamps in microseconds
+// from the first transaction), which can be loaded in Perfetto or chrome://tracing
+static bool WriteJson(const EMIO_TraceReader &trace, std::ostream &out)
+{
+    unsigned int num = trace.GetNumEntries();
+    uint64_t t0 = (num > 0) ? trace.GetEntry(0).start : 0;
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    for (unsigned int i = 0; i < num; i++) {
+        const EMIO_TraceEntry &entry = trace.GetEntry(i);
+        const char *name = (entry.opType < NUM_OP_TYPES) ? OpName[entry.opType] : "Unknown";
+        out << "  {\"name\": \"" << name << "\", \"cat\": \"emio\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1"
+            << ", \"ts\": " << trace.Ticks_us(entry.start-t0)
+            << ", \"dur\": " << trace.Ticks_us(entry.duration)
+            << ", \"args\": {\"addr\": \"0x" << std::hex << entry.addr << std::dec << "\""
+            << ", \"nquads\": " << entry.nQuads
+            << ", \"data\": \"0x" << std::hex << entry.data << std::dec << "\""
+            << ", \"wait_us\": " << trace.Ticks_us(entry.wait)
+            << ", \"ok\": " << (entry.ok ? "true" : "false") << "}}"
+            << ((i+1 < num) ? "," : "") << std::endl;
+    }
+    out << "]}" << std::endl;
+    return out.good();
+}
+
+// Replay the trace; returns false if any transaction failed
+static bool Replay(const EMIO_TraceReader &trace, EMIO_Interface *emio, bool doWrites, bool fast)
+{
+    unsigned int num = trace.GetNumEntries();
+    if (num == 0)
+        return true;
+    OpSamples recorded[NUM_OP_TYPES];
+    OpSamples replayed[NUM_OP_TYPES];
+    std::vector<uint32_t> buffer;
+    unsigned long numSkipped = 0;
+    unsigned long numLate = 0;
+    uint64_t t0 = trace.GetEntry(0).start;
+    double start_us = GetTime_us();
+
+    for (unsigned int i = 0; i < num; i++) {
+        const EMIO_TraceEntry &entry = trace.GetEntry(i);
+        EMIO_OpType opType = static_cast<EMIO_OpType>(entry.opType);
+        if ((entry.opType >= NUM_OP_TYPES) ||
+            (!doWrites && ((opType == EMIO_WRITE_QUAD) || (opType == EMIO_WRITE_BLOCK)))) {
+            numSkipped++;
+            continue;
+        }
+        if (!fast) {
+            // Wait until the recorded start time (relative to the first transaction)
+            double target_us = start_us + trace.Ticks_us(entry.start-t0);
+            double now_us = GetTime_us();
+            if (now_us < target_us) {
+                struct timespec ts;
+                double target_s = target_us*1.0e-6;
+                ts.tv_sec = static_cast<time_t>(target_s);
+                ts.tv_nsec = static_cast<long>((target_s-ts.tv_sec)*1.0e9);
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            }
+            else if (now_us > target_us+1.0) {
+                numLate++;
+            }
+        }
+        buffer.assign(entry.nQuads ? entry.nQuads : 1, 0);
+        if (opType == EMIO_WRITE_QUAD)
+            buffer[0] = entry.data;
+        double t1 = GetTime_us();
+        bool ok = false;
+        switch (opType) {
+            case EMIO_READ_QUAD:   ok = emio->ReadQuadlet(entry.addr, buffer[0]);
+                                   break;
+            case EMIO_WRITE_QUAD:  ok = emio->WriteQuadlet(entry.addr, buffer[0]);
+                                   break;
+            case EMIO_READ_BLOCK:  ok = emio->ReadBlock(entry.addr, &buffer[0], 4*entry.nQuads);
+                                   break;
+            case EMIO_WRITE_BLOCK: ok = emio->WriteBlock(entry.addr, &buffer[0], 4*entry.nQuads);
+                                   break;
+        }
+        double t2 = GetTime_us();
+        recorded[opType].duration.push_back(trace.Ticks_us(entry.duration));
+        if (!entry.ok)
+            recorded[opType].numErrors++;
+        replayed[opType].duration.push_back(t2-t1);
+        if (!ok)
+            replayed[opType].numErrors++;
+    }
+
+    std::cout << "Replayed " << (num-numSkipped) << " transactions in " << (GetTime_us()-start_us)*1.0e-3
+              << " ms (" << numSkipped << " skipped";
+    if (!fast)
+        std::cout << ", " << numLate << " started late";
+    std::cout << ")" << std::endl;
+    std::cout << "Recorded:" << std::endl;
+    PrintOpSamples(recorded);
+    std::cout << "Replayed:" << std::endl;
+    PrintOpSamples(replayed);
+    bool ret = true;
+    for (unsigned int op = 0; op < NUM_OP_TYPES; op++) {
+        if (replayed[op].numErrors > 0)
+            ret = false;
+    }
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    bool isVerbose = false;
+    bool doJson = false;
+    const char *jsonFile = 0;
+    bool doReplay = false;
+    bool doWrites = false;
+    bool fast = false;
+    bool useGpiod = false;
+    const char *gpioChip = 0;
+    bool useSim = false;
+    bool useRemote = false;
+    uint32_t simLatency_ns = 0;
+    unsigned int eventMode = 2;
+    const char *replayTrace = 0;
+    unsigned int numTop = 10;
+    const char *fileName = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            if (!fileName)
+                fileName = argv[i];
+            else
+                std::cout << "Warning: extra parameter: " << argv[i] << std::endl;
+            continue;
+        }
+        if (argv[i][1] == 'v') {
+            isVerbose = true;
+        }
+        else if (argv[i][1] == 'j') {
+            doJson = true;
+            if (argv[i][2]) jsonFile = argv[i]+2;
+        }
+        else if (argv[i][1] == 't') {
+            if (argv[i][2]) numTop = strtoul(argv[i]+2, 0, 10);
+        }
+        else if (argv[i][1] == 'p') {
+            doReplay = true;
+        }
+        else if (argv[i][1] == 'w') {
+            doWrites = true;
+        }
+        else if (argv[i][1] == 'f') {
+            fast = true;
+        }
+        else if (argv[i][1] == 'm') {
+            useGpiod = false;
+            gpioChip = 0;
+            useSim = false;
+            useRemote = false;
+        }
+        else if (argv[i][1] == 'g') {
+            useGpiod = true;
+        }
+        else if (argv[i][1] == 'G') {
+            gpioChip = argv[i][2] ? argv[i]+2 : EMIO_GPIOV2_DEFAULT_CHIP;
+        }
+        else if (argv[i][1] == 's') {
+            useSim = true;
+            if (argv[i][2]) simLatency_ns = strtoul(argv[i]+2, 0, 10);
+        }
+        else if (argv[i][1] == 'r') {
+            useRemote = true;
+        }
+        else if (argv[i][1] == 'e') {
+            if (argv[i][2]) eventMode = argv[i][2]-'0';
+        }
+        else if (argv[i][1] == 'T') {
+            if (argv[i][2]) replayTrace = argv[i]+2;
+        }
+        else {
+            fileName = 0;
+            break;
+        }
+    }
+
+    if (!fileName) {
+        std::cout << "Usage: " << argv[0] << " [-v] [-t<n>] [-j[<file>]] [-p [-m | -g | -G<chip> | -s<ns> | -r] [-e<n>] [-w] [-f]"
+                  << " [-T<file>]] <trace file>" << std::endl
+                  << "       where -v is for verbose output" << std::endl
+                  << "             -t<n> is the number of addresses listed in the summary (default 10)" << std::endl
+                  << "             -j<file> writes the trace in Chrome trace (Perfetto) JSON format to the file" << std::endl
+                  << "                (default is stdout) instead of printing the summary" << std::endl
+                  << "             -p replays the trace and compares the durations with the recorded durations" << std::endl
+                  << "             -m specifies to replay using mmap interface (default)" << std::endl
+                  << "             -g specifies to replay using gpiod interface" << std::endl
+                  << "             -G<chip> specifies to replay using GPIO v2 uAPI interface, with optional GPIO chip" << std::endl
+                  << "             -s<ns> specifies to replay using simulated interface, with op_done latency in ns" << std::endl
+                  << "             -r specifies to replay using EMIO request server (fpgav3emiod must be running)" << std::endl
+                  << "             -e<n> is to use polling (0) or events (1)" << std::endl
+                  << "             -w also replays the writes (block writes use zero data)" << std::endl
+                  << "             -f replays the transactions back-to-back, instead of at the recorded times" << std::endl
+                  << "             -T<file> records a trace of the replay in the specified file" << std::endl;
+        return 0;
+    }
+
+    EMIO_TraceReader trace(fileName);
+    if (!trace.IsOK())
+        return -1;
+
+    if (doJson) {
+        if (jsonFile) {
+            std::ofstream out(jsonFile);
+            if (!out || !WriteJson(trace, out)) {
+                std::cout << "Error writing " << jsonFile << std::endl;
+                return -1;
+            }
+        }
+        else if (!WriteJson(trace, std::cout)) {
+            return -1;
+        }
+    }
+    else {
+        PrintSummary(trace, numTop);
+    }
+
+    if (!doReplay)
+        return 0;
+
+    EMIO_Interface *emio;
+    if (useSim) {
+        EMIO_Interface_Sim *sim = new EMIO_Interface_Sim;
+        sim->SetOpDoneLatency_ns(simLatency_ns);
+        emio = sim;
+    }
+    else if (useRemote)
+        emio = new EMIO_Interface_Remote;
+    else if (gpioChip)
+        emio = new EMIO_Interface_GpioV2(gpioChip);
+    else if (useGpiod)
+        emio = new EMIO_Interface_Gpiod;
+    else
+        emio = new EMIO_Interface_Mmap;
+    if (!emio->IsOK()) {
+        std::cout << "Error initializing EMIO bus interface" << std::endl;
+        delete emio;
+        return -1;
+    }
+
+    emio->SetVerbose(isVerbose);
+    if (eventMode == 0)
+        emio->SetEventMode(false);
+    else if (eventMode == 1)
+        emio->SetEventMode(true);
+    if (replayTrace && !emio->StartTrace(replayTrace, trace.GetNumEntries()))
+        std::cout << "Failed to start trace of replay, continuing without trace" << std::endl;
+
+    if (isVerbose) {
+        print_fpgav3_versions(std::cout);
+        std::cout << "EMIO bus interface version " << emio->GetVersion() << std::endl;
+    }
+
+    bool ok = Replay(trace, emio, doWrites, fast);
+    delete emio;
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,204 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fpgav3_buslock.h"
+#include "fpgav3_futex.h"
+
+// Identifies (and versions) the layout of the shared-memory segment
+const uint32_t BUSLOCK_MAGIC = 0x424c4b32;    // 'BLK2'
+
+// The lock word contains the process id of the owner (0 if unlocked), so that the owner
+// is published by the same atomic operation that acquires the lock, and the waiters flag
+const uint32_t BUSLOCK_PID_MASK = 0x3fffffff;
+const uint32_t BUSLOCK_WAITERS  = 0x80000000;
+
+// Shared-memory segment. A newly created segment is all zero, which is a valid
+// (unlocked) state, so no initialization is needed.
+struct EMIO_BusLock::Shared {
+    uint32_t magic;
+    uint32_t lockWord;         // owner pid (0: unlocked), or'ed with BUSLOCK_WAITERS
+    uint32_t seq;              // incremented each time lock is acquired
+    uint32_t reserved;
+    // Statistics (updated while holding the lock, except numTimeouts)
+    uint64_t numAcquired;
+    uint64_t numContended;
+    uint64_t numTimeouts;
+    uint64_t numRecovered;
+    uint64_t numOwnerChanges;
+    uint64_t wait_ns;
+};
+
+static double ElapsedSince_us(const struct timespec &start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start.tv_sec)*1.0e6 + (now.tv_nsec-start.tv_nsec)*1.0e-3;
+}
+
+EMIO_BusLock::EMIO_BusLock(const char *name) : shared(0), lastSeq(0)
+{
+    std::string path = std::string("/dev/shm/") + name;
+    // Create the segment exclusively, so that only a segment created here is made accessible
+    // to other users, or else open the existing one. O_NOFOLLOW prevents following a symbolic
+    // link placed at the path by another user.
+    bool created = true;
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0666);
+    if ((fd < 0) && (errno == EEXIST)) {
+        created = false;
+        fd = open(path.c_str(), O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (fd < 0) {
+        std::cout << "EMIO_BusLock: failed to open " << path << std::endl;
+        return;
+    }
+    // An existing segment must be a regular file owned by this user or root
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) ||
+        (!created && (st.st_uid != geteuid()) && (st.st_uid != 0))) {
+        std::cout << "EMIO_BusLock: " << path << " is not a valid lock segment" << std::endl;
+        close(fd);
+        return;
+    }
+    // Allow other users to open the segment (the mode of open is masked by umask)
+    if (created)
+        fchmod(fd, 0666);
+    if ((st.st_size < static_cast<off_t>(sizeof(Shared))) && (ftruncate(fd, sizeof(Shared)) != 0)) {
+        std::cout << "EMIO_BusLock: failed to set size of " << path << std::endl;
+        close(fd);
+        return;
+    }
+    void *region = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        std::cout << "EMIO_BusLock: failed to mmap " << path << std::endl;
+        return;
+    }
+    Shared *seg = reinterpret_cast<Shared *>(region);
+    uint32_t magic = 0;
+    if (!__atomic_compare_exchange_n(&seg->magic, &magic, BUSLOCK_MAGIC, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) &&
+        (magic != BUSLOCK_MAGIC)) {
+        std::cout << "EMIO_BusLock: " << path << " has unexpected format" << std::endl;
+        munmap(region, sizeof(Shared));
+        return;
+    }
+    shared = seg;
+    // Ensure that first Lock reports another owner, since the state is unknown
+    lastSeq = shared->seq-1;
+}
+
+EMIO_BusLock::~EMIO_BusLock()
+{
+    if (shared)
+        munmap(shared, sizeof(Shared));
+}
+
+bool EMIO_BusLock::Lock(double timeout_us, bool &otherOwner, bool &recovered)
+{
+    otherOwner = false;
+    recovered = false;
+    if (!shared)
+        return false;
+
+    // Uncontended case: single compare-and-swap
+    uint32_t self = static_cast<uint32_t>(getpid()) & BUSLOCK_PID_MASK;
+    uint32_t c = 0;
+    if (!__atomic_compare_exchange_n(&shared->lockWord, &c, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        // Contended case: set the waiters flag and sleep until the lock is released. When
+        // acquired after waiting, the flag is set, since there may be other waiters.
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (;;) {
+            if (c == 0) {
+                if (__atomic_compare_exchange_n(&shared->lockWord, &c, self|BUSLOCK_WAITERS, false,
+                                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                    break;
+                continue;
+            }
+            if (!(c & BUSLOCK_WAITERS)) {
+                if (!__atomic_compare_exchange_n(&shared->lockWord, &c, c|BUSLOCK_WAITERS, false,
+                                                 __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                    continue;
+                c |= BUSLOCK_WAITERS;
+            }
+            double remaining_us = timeout_us-ElapsedSince_us(start);
+            if (remaining_us <= 0.0) {
+                // Timeout: if the owner has terminated, take over the lock (only one waiter
+                // can succeed in replacing the lock word)
+                pid_t pid = static_cast<pid_t>(c & BUSLOCK_PID_MASK);
+                if ((kill(pid, 0) != 0) && (errno == ESRCH) &&
+                    __atomic_compare_exchange_n(&shared->lockWord, &c, self|BUSLOCK_WAITERS, false,
+                                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                    recovered = true;
+                    break;
+                }
+                __atomic_fetch_add(&shared->numTimeouts, 1, __ATOMIC_RELAXED);
+                stats.numTimeouts++;
+                stats.wait_us += ElapsedSince_us(start);
+                return false;
+            }
+            struct timespec timeout;
+            timeout.tv_sec = static_cast<time_t>(remaining_us*1.0e-6);
+            timeout.tv_nsec = static_cast<long>((remaining_us-timeout.tv_sec*1.0e6)*1.0e3);
+            FutexWait(&shared->lockWord, c, &timeout);
+            c = __atomic_load_n(&shared->lockWord, __ATOMIC_RELAXED);
+        }
+        double wait_us = ElapsedSince_us(start);
+        stats.numContended++;
+        stats.wait_us += wait_us;
+        shared->numContended++;
+        shared->wait_ns += static_cast<uint64_t>(wait_us*1.0e3);
+        if (recovered) {
+            std::cout << "EMIO_BusLock: recovered lock from terminated process" << std::endl;
+            stats.numRecovered++;
+            shared->numRecovered++;
+        }
+    }
+
+    // Check whether lock was acquired by another owner since our last Lock
+    if (shared->seq != lastSeq) {
+        otherOwner = true;
+        stats.numOwnerChanges++;
+        shared->numOwnerChanges++;
+    }
+    lastSeq = ++shared->seq;
+    stats.numAcquired++;
+    shared->numAcquired++;
+    return true;
+}
+
+void EMIO_BusLock::Unlock()
+{
+    if (!shared)
+        return;
+    // Release the lock (and clear the owner) and, if there may be waiters, wake one of them
+    if (__atomic_exchange_n(&shared->lockWord, 0, __ATOMIC_RELEASE) & BUSLOCK_WAITERS)
+        FutexWake(&shared->lockWord, 1);
+}
+
+pid_t EMIO_BusLock::GetOwnerPid() const
+{
+    return shared ? static_cast<pid_t>(__atomic_load_n(&shared->lockWord, __ATOMIC_RELAXED) & BUSLOCK_PID_MASK) : 0;
+}
+
+void EMIO_BusLock::GetSharedStats(EMIO_BusLockStats &sharedStats) const
+{
+    sharedStats = EMIO_BusLockStats();
+    if (!shared)
+        return;
+    sharedStats.numAcquired = shared->numAcquired;
+    sharedStats.numContended = shared->numContended;
+    sharedStats.numTimeouts = __atomic_load_n(&shared->numTimeouts, __ATOMIC_RELAXED);
+    sharedStats.numRecovered = shared->numRecovered;
+    sharedStats.numOwnerChanges = shared->numOwnerChanges;
+    sharedStats.wait_us = shared->wait_ns*1.0e-3;
+}
@@ -0,0 +1,89 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_buslock (Linux library)
+ *
+ * Cross-process lock for the EMIO bus. Without it, nothing prevents two processes
+ * (e.g., a controller and fpgav3block) from driving the EMIO lines at the same time.
+ *
+ * The lock is a futex in a shared-memory segment (a file in /dev/shm), so that the
+ * uncontended case only requires a single atomic operation and the contended case
+ * sleeps in the kernel. The segment also contains statistics that are shared by all
+ * processes; these are only updated while holding the lock. The lock word contains the
+ * process id of the owner, so there is no time at which the lock is held without a known
+ * owner. If the process holding the lock terminates, another process can recover the lock
+ * after its timeout expires. The stress test of fpgav3bench (-L) checks the lock with
+ * multiple processes, including recovery from a terminated owner.
+ *
+ * See EMIO_Interface::SetBusLock.
+ */
+
+#ifndef FPGAV3_BUSLOCK_H
+#define FPGAV3_BUSLOCK_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Default name of shared-memory segment (/dev/shm/fpgav3_emio_lock)
+#define EMIO_BUSLOCK_DEFAULT_NAME "fpgav3_emio_lock"
+
+// Lock statistics
+struct EMIO_BusLockStats {
+    unsigned long numAcquired;      // number of times lock was acquired
+    unsigned long numContended;     // number of times lock was held by another owner (had to wait)
+    unsigned long numTimeouts;      // number of times lock could not be acquired within timeout
+    unsigned long numRecovered;     // number of times lock was recovered from a terminated process
+    unsigned long numOwnerChanges;  // number of times lock was previously acquired by another owner
+    double wait_us;                 // total time waiting for lock, in microseconds
+
+    EMIO_BusLockStats() : numAcquired(0), numContended(0), numTimeouts(0), numRecovered(0),
+                          numOwnerChanges(0), wait_us(0.0) {}
+};
+
+class EMIO_BusLock
+{
+    struct Shared;
+    Shared *shared;            // shared-memory segment
+    uint32_t lastSeq;          // value of shared sequence number after last Lock
+    EMIO_BusLockStats stats;   // statistics for this object
+
+public:
+
+    EMIO_BusLock(const char *name = EMIO_BUSLOCK_DEFAULT_NAME);
+
+    ~EMIO_BusLock();
+
+    // Returns true if shared-memory segment was successfully opened
+    bool IsOK() const
+    { return (shared != 0); }
+
+    // Lock
+    //   Acquires the lock, waiting up to timeout_us microseconds.
+    // Parameters:
+    //     timeout_us   maximum time to wait
+    //     otherOwner   set to true if the lock was acquired by another owner (e.g., another
+    //                  process) since this object last acquired it; in this case, any state
+    //                  cached by the caller (e.g., data line direction) should be re-validated
+    //     recovered    set to true if the lock was taken over from a terminated process,
+    //                  which may have left a transaction in progress (e.g., req_bus set)
+    // Returns:  true if lock acquired
+    bool Lock(double timeout_us, bool &otherOwner, bool &recovered);
+
+    bool Lock(double timeout_us, bool &otherOwner)
+    { bool recovered; return Lock(timeout_us, otherOwner, recovered); }
+
+    void Unlock();
+
+    // Returns process id of current lock owner (0 if not locked)
+    pid_t GetOwnerPid() const;
+
+    // Get statistics for this object
+    const EMIO_BusLockStats &GetStats() const
+    { return stats; }
+
+    // Get statistics for all processes (since the shared-memory segment was created)
+    void GetSharedStats(EMIO_BusLockStats &sharedStats) const;
+};
+
+#endif // FPGAV3_BUSLOCK_H
@@ -2,8 +2,59 @@
 /* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
 
 #include <iostream>
+#include <algorithm>
 #include <byteswap.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#ifdef USE_TIMEOFDAY
+#include <sys/time.h>
+#endif
 #include "fpgav3_emio.h"
+#include "fpgav3_emio_trace.h"
+#include "fpgav3_emio_regs.h"
+#include "fpgav3_mmio.h"
+
+// Number of samples used to calibrate the timing overhead
+const unsigned int TIMING_CALIBRATION_SAMPLES = 1000;
+
+// Number of polls between checks of the elapsed time when waiting for op_done
+const unsigned int WAIT_TIME_CHECK_POLLS = 8;
+
+// Limits on the spin budget for EMIO_WAIT_ADAPTIVE
+const unsigned int WAIT_ADAPT_MIN_SPIN = 16;
+const unsigned int WAIT_ADAPT_MAX_SPIN = 4096;
+
+// Time source state (shared by all EMIO_Interface objects)
+static EMIO_TimeSource timeSource = EMIO_TIME_CLOCK;
+static double tickPeriod_us = 1.0e-3;                  // clock_gettime ticks are ns
+static void *globalTimer = 0;                          // mapped Cortex-A9 global timer
+
+const char *EMIO_ErrorString(EMIO_Error err)
+{
+    switch (err) {
+        case EMIO_OK:              return "ok";
+        case EMIO_ERR_TIMEOUT:     return "timeout";
+        case EMIO_ERR_DEADLINE:    return "deadline expired";
+        case EMIO_ERR_BUS_LOCK:    return "bus lock timeout";
+        case EMIO_ERR_BUS_STUCK:   return "bus stuck (op_done not cleared)";
+        case EMIO_ERR_UNSUPPORTED: return "not supported";
+        case EMIO_ERR_IO:          return "I/O error";
+    }
+    return "unknown";
+}
+
+EMIO_Interface::~EMIO_Interface()
+{
+    delete timingRec;
+    delete perfCounters;
+    delete edgeRec;
+    delete busLock;
+    delete traceRec;
+    EMIO_ProcessStats::Release(procStats);
+}
 
 void EMIO_Interface::SetTimingMode( unsigned int newMode)
 {
@@ -11,15 +62,511 @@ void EMIO_Interface::SetTimingMode( unsigned int newMode)
     doTiming = newMode;
 
     if (doTiming > 0) {
-        // Timing calibration
-        for (unsigned int i = 0; i < 10; i++) {
+        // Timing calibration (in ticks, converted to us at the end)
+        uint64_t sum = 0;
+        for (unsigned int i = 0; i < TIMING_CALIBRATION_SAMPLES; i++) {
             GetCurTime(&startTime);
             GetCurTime(&endTime);
-            timingOverhead += TimeDiff_us(&startTime, &endTime);
+            sum += endTime-startTime;
         }
-        timingOverhead /= 10.0;
+        timingOverhead = (sum*tickPeriod_us)/TIMING_CALIBRATION_SAMPLES;
         if (isVerbose)
             std::cout << "Calibrated timing overhead of " << timingOverhead << " us" << std::endl;
+        // Allocate recorder when first needed (statistics are kept if timing mode is changed)
+        if (!timingRec)
+            timingRec = new EMIO_TimingRecorder;
+        timingRec->SetConversion(tickPeriod_us, timingOverhead);
+    }
+}
+
+bool EMIO_Interface::GetTimingStats(EMIO_TimingStats &stats)
+{
+    if (!timingRec) {
+        stats.Clear();
+        return false;
+    }
+    timingRec->GetStats(stats);
+    stats.perfMask = perfCounters ? perfCounters->GetAvailableMask() : 0;
+    return true;
+}
+
+void EMIO_Interface::ResetTimingStats()
+{
+    if (timingRec)
+        timingRec->Reset();
+}
+
+bool EMIO_Interface::SetPerfCounters(bool enable)
+{
+    delete perfCounters;
+    perfCounters = 0;
+    if (enable) {
+        perfCounters = new EMIO_PerfCounters;
+        if (!perfCounters->IsOK()) {
+            delete perfCounters;
+            perfCounters = 0;
+            return false;
+        }
+        if (isVerbose)
+            std::cout << "Performance counters enabled (mask " << std::hex << perfCounters->GetAvailableMask()
+                      << std::dec << ")" << std::endl;
+    }
+    return true;
+}
+
+bool EMIO_Interface::SetEdgeTiming(bool enable)
+{
+    delete edgeRec;
+    edgeRec = 0;
+    if (enable) {
+        if (!HasEdgeTimestamps())
+            return false;
+        edgeRec = new EMIO_EdgeRecorder;
+        if (!useEvents && isVerbose)
+            std::cout << "Edge timing is only recorded in event mode" << std::endl;
+    }
+    return true;
+}
+
+bool EMIO_Interface::GetEdgeTimingStats(EMIO_EdgeStats &stats) const
+{
+    if (!edgeRec)
+        return false;
+    edgeRec->GetStats(stats);
+    return true;
+}
+
+void EMIO_Interface::ResetEdgeTimingStats()
+{
+    if (edgeRec)
+        edgeRec->Reset();
+}
+
+EMIO_TimeSource EMIO_Interface::GetTimeSource()
+{
+    return timeSource;
+}
+
+// Local method to read 64-bit global timer; the upper 32 bits are read twice in case
+// the lower 32 bits rolled over.
+static inline uint64_t ReadGlobalTimer()
+{
+    uint32_t upper, lower;
+    do {
+        upper = MMIO_Read32(globalTimer, GLOBAL_TIMER_COUNT_U32);
+        lower = MMIO_Read32(globalTimer, GLOBAL_TIMER_COUNT_L32);
+    } while (upper != MMIO_Read32(globalTimer, GLOBAL_TIMER_COUNT_U32));
+    return (static_cast<uint64_t>(upper) << 32) | lower;
+}
+
+bool EMIO_Interface::SetTimeSource(EMIO_TimeSource newSource)
+{
+    if (newSource == EMIO_TIME_GLOBAL_TIMER) {
+        if (!globalTimer) {
+            int fd = open("/dev/mem", O_RDONLY | O_SYNC);
+            if (fd < 0) {
+                std::cout << "SetTimeSource: failed to open /dev/mem" << std::endl;
+                return false;
+            }
+            void *region = mmap(NULL, SCU_SIZE, PROT_READ, MAP_SHARED, fd, SCU_BASE_ADDR);
+            close(fd);
+            if (region == MAP_FAILED) {
+                std::cout << "SetTimeSource: failed to mmap global timer" << std::endl;
+                return false;
+            }
+            globalTimer = region;
+        }
+        // The global timer is normally enabled by Linux (clocksource)
+        if (!(MMIO_Read32(globalTimer, GLOBAL_TIMER_CONTROL) & GLOBAL_TIMER_ENABLE)) {
+            std::cout << "SetTimeSource: global timer not enabled" << std::endl;
+            return false;
+        }
+        // Calibrate the timer period against clock_gettime
+        struct timespec ts0, ts1;
+        struct timespec sleepTime = { 0, 10000000 };   // 10 ms
+        clock_gettime(CLOCK_MONOTONIC, &ts0);
+        uint64_t t0 = ReadGlobalTimer();
+        nanosleep(&sleepTime, NULL);
+        clock_gettime(CLOCK_MONOTONIC, &ts1);
+        uint64_t t1 = ReadGlobalTimer();
+        double dt_us = (ts1.tv_sec-ts0.tv_sec)*1.0e6 + (ts1.tv_nsec-ts0.tv_nsec)*1.0e-3;
+        if (t1 <= t0) {
+            std::cout << "SetTimeSource: global timer not running" << std::endl;
+            return false;
+        }
+        tickPeriod_us = dt_us/(t1-t0);
+        timeSource = EMIO_TIME_GLOBAL_TIMER;
+    }
+    else {
+        tickPeriod_us = 1.0e-3;
+        timeSource = EMIO_TIME_CLOCK;
+    }
+    return true;
+}
+
+double EMIO_Interface::GetTickPeriod_us()
+{
+    return tickPeriod_us;
+}
+
+void EMIO_Interface::SetWaitPolicy(EMIO_WaitPolicy newPolicy, unsigned int newSpinCount,
+                                   unsigned int newSleep_ns)
+{
+    waitPolicy = newPolicy;
+    spinCount = newSpinCount;
+    sleep_ns = newSleep_ns;
+    adaptPolls16 = 0;
+}
+
+unsigned int EMIO_Interface::GetSpinCount() const
+{
+    if (waitPolicy != EMIO_WAIT_ADAPTIVE)
+        return spinCount;
+    // Spin for 4 times the average number of polls
+    unsigned int budget = adaptPolls16/4;
+    if (budget < WAIT_ADAPT_MIN_SPIN) budget = WAIT_ADAPT_MIN_SPIN;
+    if (budget > WAIT_ADAPT_MAX_SPIN) budget = WAIT_ADAPT_MAX_SPIN;
+    return budget;
+}
+
+void EMIO_Interface::WaitBegin(WaitState &ws) const
+{
+    ws.polls = 0;
+    GetCurTime(&ws.start);
+    // Deadline in ticks, so that WaitContinue only needs an integer comparison
+    ws.deadline = ws.start + static_cast<fpgav3_time_t>(timeout_us/tickPeriod_us);
+    ws.byDeadline = hasDeadline && (static_cast<int64_t>(deadlineTicks-ws.deadline) < 0);
+    if (ws.byDeadline)
+        ws.deadline = deadlineTicks;
+}
+
+bool EMIO_Interface::WaitContinue(WaitState &ws) const
+{
+    ws.polls++;
+    if ((waitPolicy != EMIO_WAIT_SPIN) && (ws.polls > GetSpinCount())) {
+        if (waitPolicy == EMIO_WAIT_SPIN_SLEEP) {
+            struct timespec sleepTime = { 0, static_cast<long>(sleep_ns) };
+            nanosleep(&sleepTime, NULL);
+        }
+        else {
+            sched_yield();
+        }
+    }
+    else if ((ws.polls%WAIT_TIME_CHECK_POLLS) != 0) {
+        return true;
+    }
+    fpgav3_time_t curTime;
+    GetCurTime(&curTime);
+    return static_cast<int64_t>(curTime-ws.deadline) < 0;
+}
+
+void EMIO_Interface::WaitEnd(const WaitState &ws, bool done)
+{
+    if (traceRec)
+        TraceWait(ws.start);
+    if (procStats) {
+        fpgav3_time_t curTime;
+        GetCurTime(&curTime);
+        procStats->CountWait(ws.polls, done, static_cast<uint64_t>((curTime-ws.start)*tickPeriod_us*1000.0));
+    }
+    if (!done)
+        lastError = ws.byDeadline ? EMIO_ERR_DEADLINE : EMIO_ERR_TIMEOUT;
+
+    // Learn the typical number of polls (moving average, weight 1/8); timeouts are not
+    // included, so that a stuck bus does not inflate the spin budget
+    if (done && (waitPolicy == EMIO_WAIT_ADAPTIVE)) {
+        unsigned int polls16 = ((ws.polls+1) < WAIT_ADAPT_MAX_SPIN) ? (ws.polls+1)*16 : WAIT_ADAPT_MAX_SPIN*16;
+        adaptPolls16 = adaptPolls16 - adaptPolls16/8 + polls16/8;
+    }
+}
+
+void EMIO_Interface::WaitTimeout()
+{
+    lastError = DeadlineExpired() ? EMIO_ERR_DEADLINE : EMIO_ERR_TIMEOUT;
+    if (procStats)
+        procStats->CountTimeout();
+}
+
+void EMIO_Interface::SetDeadline(const struct timespec &deadline)
+{
+    // Convert to ticks of the time source (which may not be CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fpgav3_time_t curTime;
+    GetCurTime(&curTime);
+    double remaining_us = (deadline.tv_sec-now.tv_sec)*1.0e6 + (deadline.tv_nsec-now.tv_nsec)*1.0e-3;
+    deadlineTicks = curTime + static_cast<int64_t>(remaining_us/tickPeriod_us);
+    hasDeadline = true;
+}
+
+bool EMIO_Interface::DeadlineExpired() const
+{
+    if (!hasDeadline)
+        return false;
+    fpgav3_time_t curTime;
+    GetCurTime(&curTime);
+    return static_cast<int64_t>(curTime-deadlineTicks) >= 0;
+}
+
+double EMIO_Interface::DeadlineLimit_us(double limit_us) const
+{
+    if (!hasDeadline)
+        return limit_us;
+    fpgav3_time_t curTime;
+    GetCurTime(&curTime);
+    double remaining_us = TimeDiff_us(&curTime, &deadlineTicks);
+    if (remaining_us < 0.0)
+        remaining_us = 0.0;
+    return (remaining_us < limit_us) ? remaining_us : limit_us;
+}
+
+bool EMIO_Interface::BeginTransaction()
+{
+    if (DeadlineExpired()) {
+        lastError = EMIO_ERR_DEADLINE;
+        recoveryStats.numDeadlineMisses++;
+        return false;
+    }
+    if (busLock && !AcquireBusLock())
+        return false;
+    if (abortPending && !RecoverBus()) {
+        UnlockBus();
+        return false;
+    }
+    return true;
+}
+
+void EMIO_Interface::TransactionFailed()
+{
+    if (lastError == EMIO_OK)
+        lastError = EMIO_ERR_IO;
+    if (lastError == EMIO_ERR_TIMEOUT)
+        recoveryStats.numTimeouts++;
+    else if (lastError == EMIO_ERR_DEADLINE)
+        recoveryStats.numDeadlineMisses++;
+    else
+        return;
+    // The firmware may still be waiting for the FPGA bus, with req_bus (and possibly
+    // blk_start or blk_end) set; release the bus so that the firmware can complete
+    if (AbortTransaction()) {
+        abortPending = true;
+        recoveryStats.numAborts++;
+        if (procStats)
+            procStats->CountAbort();
+        if (isVerbose)
+            std::cout << "EMIO transaction aborted (" << EMIO_ErrorString(lastError) << ")" << std::endl;
+    }
+}
+
+bool EMIO_Interface::RecoverBus()
+{
+    if (WaitBusIdle()) {
+        abortPending = false;
+        recoveryStats.numRecoveries++;
+        return true;
+    }
+    // A deadline miss is not a recovery failure (recovery is attempted again next time)
+    if (lastError != EMIO_ERR_DEADLINE) {
+        lastError = EMIO_ERR_BUS_STUCK;
+        recoveryStats.numRecoveryFailures++;
+        // Reported via GetLastError and GetRecoveryStats, since this is repeated by each
+        // transaction while the bus is stuck
+        if (isVerbose)
+            std::cout << "EMIO bus recovery failed: op_done not cleared" << std::endl;
+    }
+    return false;
+}
+
+bool EMIO_Interface::PrepareRetry()
+{
+    // Only timeouts are retried; other errors would fail again
+    if ((lastError != EMIO_ERR_TIMEOUT) || DeadlineExpired())
+        return false;
+    if (abortPending && !RecoverBus())
+        return false;
+    retryCount++;
+    recoveryStats.numRetries++;
+    if (procStats)
+        procStats->CountRetry();
+    if (isVerbose)
+        std::cout << "EMIO transaction retry " << retryCount << std::endl;
+    lastError = EMIO_OK;
+    return true;
+}
+
+void EMIO_Interface::RetrySucceeded()
+{
+    recoveryStats.numRetrySuccess++;
+    retryCount = 0;
+}
+
+bool EMIO_Interface::StartTrace(const char *fileName, unsigned int maxEntries)
+{
+    StopTrace();
+    traceRec = new EMIO_TraceRecorder(fileName, maxEntries, version);
+    if (!traceRec->IsOK()) {
+        delete traceRec;
+        traceRec = 0;
+        return false;
+    }
+    return true;
+}
+
+void EMIO_Interface::StopTrace()
+{
+    delete traceRec;
+    traceRec = 0;
+}
+
+unsigned long EMIO_Interface::GetNumTraced() const
+{
+    return traceRec ? traceRec->GetNumRecorded() : 0;
+}
+
+void EMIO_Interface::RecordTrace(EMIO_OpType opType, uint16_t addr, const uint32_t *data, unsigned int nBytes, bool ok)
+{
+    fpgav3_time_t curTime;
+    GetCurTime(&curTime);
+    traceRec->Record(opType, addr, data, nBytes, ok, traceStart, curTime, traceWait);
+}
+
+void EMIO_Interface::TraceWait(fpgav3_time_t waitStart)
+{
+    fpgav3_time_t curTime;
+    GetCurTime(&curTime);
+    traceWait += curTime-waitStart;
+}
+
+double EMIO_Interface::WaitElapsed_us(const WaitState &ws) const
+{
+    fpgav3_time_t curTime;
+    GetCurTime(&curTime);
+    return TimeDiff_us(&ws.start, &curTime);
+}
+
+bool EMIO_Interface::SetBusLock(bool enable, const char *name)
+{
+    if (busLockDepth > 0) {
+        std::cout << "SetBusLock: cannot be changed while bus is locked" << std::endl;
+        return false;
+    }
+    delete busLock;
+    busLock = 0;
+    if (enable) {
+        busLock = new EMIO_BusLock(name);
+        if (!busLock->IsOK()) {
+            delete busLock;
+            busLock = 0;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool EMIO_Interface::GetBusLockStats(EMIO_BusLockStats &stats, EMIO_BusLockStats *sharedStats) const
+{
+    if (!busLock)
+        return false;
+    stats = busLock->GetStats();
+    if (sharedStats)
+        busLock->GetSharedStats(*sharedStats);
+    return true;
+}
+
+bool EMIO_Interface::AcquireBusLock()
+{
+    if (busLockDepth > 0) {
+        if (!SessionMustYield()) {
+            busLockDepth++;
+            return true;
+        }
+        // Release the lock held by the session, so that another process can acquire it,
+        // and then acquire it again for the session and this transaction
+        SessionHoldEnd();
+        sessionStats.numYields++;
+        sessionHoldsLock = false;
+        busLockDepth = 0;
+        busLock->Unlock();
+        sched_yield();
+    }
+    bool otherOwner, recovered;
+    if (!busLock->Lock(DeadlineLimit_us(busLockTimeout_us), otherOwner, recovered)) {
+        if (DeadlineExpired()) {
+            lastError = EMIO_ERR_DEADLINE;
+            recoveryStats.numDeadlineMisses++;
+            return false;
+        }
+        std::cout << "EMIO bus lock timeout (held by process " << busLock->GetOwnerPid() << ")" << std::endl;
+        lastError = EMIO_ERR_BUS_LOCK;
+        return false;
+    }
+    busLockDepth = 1;
+    if (otherOwner)
+        RevalidateDirection();
+    // A terminated owner may have left req_bus (and blk_start or blk_end) set, so release
+    // the bus as after an aborted transaction; BeginTransaction then waits for it to be idle
+    if (recovered && AbortTransaction()) {
+        abortPending = true;
+        recoveryStats.numAborts++;
+    }
+    if ((sessionDepth > 0) && !sessionHoldsLock) {
+        // Session lost the lock (see above), so also hold it for the session
+        busLockDepth++;
+        sessionHoldsLock = true;
+        GetCurTime(&sessionStart);
+    }
+    return true;
+}
+
+void EMIO_Interface::ReleaseBusLock()
+{
+    if ((busLockDepth > 0) && (--busLockDepth == 0))
+        busLock->Unlock();
+}
+
+bool EMIO_Interface::SessionMustYield()
+{
+    if (!sessionHoldsLock || (busLockDepth != 1) || (sessionMaxHold_us <= 0.0))
+        return false;
+    fpgav3_time_t now;
+    GetCurTime(&now);
+    return (TimeDiff_us(&sessionStart, &now) > sessionMaxHold_us);
+}
+
+void EMIO_Interface::SessionHoldEnd()
+{
+    fpgav3_time_t now;
+    GetCurTime(&now);
+    double hold_us = TimeDiff_us(&sessionStart, &now);
+    if (hold_us > sessionStats.maxHold_us)
+        sessionStats.maxHold_us = hold_us;
+}
+
+bool EMIO_Interface::BeginBusSession()
+{
+    if (sessionDepth > 0) {
+        sessionDepth++;
+        return true;
+    }
+    // Acquire the bus lock (if enabled) for the session; this also checks the deadline
+    // and recovers the bus after an aborted transaction
+    if (!LockBus())
+        return false;
+    sessionDepth = 1;
+    sessionHoldsLock = (busLockDepth > 0);
+    GetCurTime(&sessionStart);
+    sessionStats.numSessions++;
+    return true;
+}
+
+void EMIO_Interface::EndBusSession()
+{
+    if ((sessionDepth == 0) || (--sessionDepth > 0))
+        return;
+    if (sessionHoldsLock) {
+        SessionHoldEnd();
+        sessionHoldsLock = false;
+        ReleaseBusLock();
     }
 }
 
@@ -27,30 +574,267 @@ bool EMIO_Interface::WritePromData(char *data, unsigned int nBytes)
 {
     // Round up to nearest multiple of 4
     uint16_t nQuads = (nBytes+3)/4;
-    for (uint16_t i = 0; i < nQuads; i++) {
-        uint32_t qdata = bswap_32(*(uint32_t *)(data+i*4));
-        if (!WriteQuadlet(0x2000+i, qdata))
+    if (nQuads == 0)
+        return true;
+    if (GetVersion() < 1) {
+        for (uint16_t i = 0; i < nQuads; i++) {
+            uint32_t qdata = bswap_32(*(uint32_t *)(data+i*4));
+            if (!WriteQuadlet(EMIO_ADDR_PROM_DATA+i, qdata))
+                return false;
+        }
+        return true;
+    }
+    // Write the data as block writes of up to EMIO_HOLD_MAX_QUADS quadlets, which byte-swap
+    // the data in the same way as above. The last quadlet is padded with zeros.
+    std::vector<uint32_t> buf(nQuads, 0);
+    memcpy(&buf[0], data, nBytes);
+    for (uint16_t i = 0; i < nQuads; i += EMIO_HOLD_MAX_QUADS) {
+        unsigned int n = std::min(nQuads-i, static_cast<int>(EMIO_HOLD_MAX_QUADS));
+        if (!WriteBlock(EMIO_ADDR_PROM_DATA+i, &buf[i], 4*n))
             return false;
     }
     return true;
 }
 
-// Local method to get current time
+bool EMIO_Interface::ExecuteBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags)
+{
+    unsigned int i;
+    bool ret;
+
+    // Acquire cross-process bus lock (if enabled) for the whole batch
+    if (!LockBus()) {
+        for (i = 0; i < num; i++)
+            reqs[i].status = EMIO_REQ_FAILED;
+        return false;
+    }
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    for (i = 0; i < num; i++)
+        reqs[i].status = EMIO_REQ_PENDING;
+
+    // Execute runs of quadlets as block transfers, which hold req_bus
+    EMIO_Request *runReqs = reqs;
+    unsigned int runNum = num;
+    if ((flags & EMIO_BATCH_HOLD_BUS) && (GetVersion() >= 1) && MergeHoldRuns(reqs, num)) {
+        runReqs = &holdReqs[0];
+        runNum = holdReqs.size();
+    }
+
+    if (flags & EMIO_BATCH_READS_FIRST) {
+        ret = RunBatch(runReqs, runNum, flags, BATCH_READS);
+        if (ret || !(flags & EMIO_BATCH_STOP_ON_ERR)) {
+            EMIO_Error readError = lastError;
+            if (!RunBatch(runReqs, runNum, flags, BATCH_WRITES))
+                ret = false;
+            else if (!ret)
+                lastError = readError;
+        }
+    }
+    else {
+        ret = RunBatch(runReqs, runNum, flags, BATCH_ALL);
+    }
+
+    if (runReqs != reqs)
+        SplitHoldRuns(reqs);
+
+    UnlockBus();
+
+    if (procStats)
+        procStats->CountOp(EMIO_TIMING_BATCH, 0, false, ret);
+
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_BATCH);
+
+    return ret;
+}
+
+bool EMIO_Interface::AddBlockRange(uint16_t addr, unsigned int nQuads)
+{
+    if ((nQuads == 0) || (addr+nQuads > 0x10000)) {
+        std::cout << "EMIO_Interface: invalid block range " << std::hex << addr << std::dec
+                  << ", " << nQuads << " quadlets" << std::endl;
+        return false;
+    }
+    BlockRange r = { addr, nQuads };
+    blockRanges.push_back(r);
+    return true;
+}
+
+unsigned int EMIO_Interface::BlockRangeQuads(uint16_t addr) const
+{
+    unsigned int nQuads = 0;
+    for (size_t i = 0; i < blockRanges.size(); i++) {
+        const BlockRange &r = blockRanges[i];
+        if ((addr >= r.addr) && (addr < r.addr+r.nQuads))
+            nQuads = std::max(nQuads, r.addr+r.nQuads-addr);
+    }
+    return nQuads;
+}
+
+unsigned int EMIO_Interface::HoldRunLength(const EMIO_Request *reqs, unsigned int num, unsigned int i) const
+{
+    unsigned int n = 1;
+    if ((reqs[i].opType == EMIO_READ_QUAD) || (reqs[i].opType == EMIO_WRITE_QUAD)) {
+        unsigned int maxQuads = std::min(BlockRangeQuads(reqs[i].addr), static_cast<unsigned int>(EMIO_HOLD_MAX_QUADS));
+        while ((i+n < num) && (n < maxQuads) && (reqs[i+n].opType == reqs[i].opType) &&
+               (reqs[i+n].addr == reqs[i].addr+n))
+            n++;
+    }
+    return n;
+}
+
+bool EMIO_Interface::MergeHoldRuns(const EMIO_Request *reqs, unsigned int num)
+{
+    unsigned int i, n;
+
+    // Count the quadlets in runs, to allocate the block data before taking pointers to it
+    unsigned int nQuads = 0;
+    for (i = 0; i < num; i += n) {
+        n = HoldRunLength(reqs, num, i);
+        if (n > 1)
+            nQuads += n;
+    }
+    if (nQuads == 0)
+        return false;
+    holdData.resize(nQuads);
+    holdReqs.clear();
+    holdFirst.clear();
+
+    uint32_t *blockData = &holdData[0];
+    for (i = 0; i < num; i += n) {
+        n = HoldRunLength(reqs, num, i);
+        holdFirst.push_back(i);
+        if (n == 1) {
+            holdReqs.push_back(reqs[i]);
+        }
+        else if (reqs[i].IsWrite()) {
+            // Block data is byte-swapped, but quadlet data is not
+            for (unsigned int q = 0; q < n; q++)
+                blockData[q] = bswap_32(*reqs[i+q].data);
+            holdReqs.push_back(EMIO_Request::WriteBlock(reqs[i].addr, blockData, 4*n));
+            blockData += n;
+        }
+        else {
+            holdReqs.push_back(EMIO_Request::ReadBlock(reqs[i].addr, blockData, 4*n));
+            blockData += n;
+        }
+    }
+    holdFirst.push_back(num);
+    return true;
+}
+
+void EMIO_Interface::SplitHoldRuns(EMIO_Request *reqs)
+{
+    for (unsigned int j = 0; j < holdReqs.size(); j++) {
+        const EMIO_Request &hreq = holdReqs[j];
+        unsigned int first = holdFirst[j];
+        unsigned int n = holdFirst[j+1]-first;
+        if (n == 1) {
+            reqs[first].status = hreq.status;
+            continue;
+        }
+        if (hreq.status != EMIO_REQ_PENDING) {
+            sessionStats.numHeldRuns++;
+            sessionStats.numHeldQuads += n;
+        }
+        for (unsigned int q = 0; q < n; q++) {
+            EMIO_Request &req = reqs[first+q];
+            req.status = hreq.status;
+            if ((hreq.opType == EMIO_READ_BLOCK) && (hreq.status == EMIO_REQ_OK))
+                *req.data = bswap_32(hreq.data[q]);
+        }
+    }
+}
+
+bool EMIO_Interface::RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass)
+{
+    bool ret = true;
+    EMIO_Error batchError = EMIO_OK;    // each method clears lastError
+    for (unsigned int i = 0; i < num; i++) {
+        EMIO_Request &req = reqs[i];
+        if (!BatchSelect(req, pass))
+            continue;
+        bool ok = false;
+        switch (req.opType) {
+            case EMIO_READ_QUAD:   ok = ReadQuadlet(req.addr, *req.data);
+                                   break;
+            case EMIO_WRITE_QUAD:  ok = WriteQuadlet(req.addr, *req.data);
+                                   break;
+            case EMIO_READ_BLOCK:  ok = ReadBlock(req.addr, req.data, req.nBytes);
+                                   break;
+            case EMIO_WRITE_BLOCK: ok = WriteBlock(req.addr, req.data, req.nBytes);
+                                   break;
+        }
+        req.status = ok ? EMIO_REQ_OK : EMIO_REQ_FAILED;
+        if (!ok) {
+            ret = false;
+            batchError = lastError;
+            if (flags & EMIO_BATCH_STOP_ON_ERR)
+                break;
+        }
+    }
+    lastError = batchError;
+    return ret;
+}
+
+void EMIO_Interface::RecordTiming(EMIO_TimingOp op, const fpgav3_time_t *midTimes)
+{
+    GetCurTime(&endTime);
+    if (procStats)
+        procStats->UpdateMaxLatency(static_cast<uint64_t>((endTime-startTime)*tickPeriod_us*1000.0));
+    uint32_t counters[EMIO_PERF_NUM_COUNTERS];
+    bool hasCounters = perfCounters && perfCounters->Stop(counters);
+    // The grant must be within the transaction (and before the end of the wait). A grant
+    // before the start of the wait (e.g., a kernel timestamp during the request system call)
+    // is counted at the start of the wait, so that arbitration and access add up to the wait.
+    fpgav3_time_t grant = (midTimes && (grantTime >= startTime) && (grantTime <= midTimes[1])) ? grantTime : 0;
+    if (grant && (grant < midTimes[0]))
+        grant = midTimes[0];
+    if (grant && procStats) {
+        // Arbitration from the request (start of wait) to the grant, and access from
+        // the grant to op_done (end of wait)
+        procStats->CountGrant(static_cast<uint64_t>((grant-midTimes[0])*tickPeriod_us*1000.0),
+                              static_cast<uint64_t>((midTimes[1]-grant)*tickPeriod_us*1000.0));
+    }
+    timingRec->Record(op, startTime, midTimes, endTime, hasCounters ? counters : 0, grant);
+}
+
+// Converts the CLOCK_MONOTONIC time to ticks of the current time source, using the
+// current time of both clocks
+void EMIO_Interface::GrantSeenAt(uint64_t grant_ns)
+{
+    if (grantTime != 0)
+        return;
+    fpgav3_time_t now;
+    GetCurTime(&now);
+    uint64_t now_ns = EMIO_EdgeRecorder::GetMonotonic_ns();
+    double ago_ticks = (now_ns > grant_ns) ? (now_ns-grant_ns)/(tickPeriod_us*1000.0) : 0.0;
+    grantTime = now - static_cast<fpgav3_time_t>(ago_ticks);
+}
+
+// Local method to get current time (in ticks)
 void EMIO_Interface::GetCurTime(fpgav3_time_t *curTime)
 {
+    if (timeSource == EMIO_TIME_GLOBAL_TIMER) {
+        *curTime = ReadGlobalTimer();
+        return;
+    }
 #ifdef USE_TIMEOFDAY
-    gettimeofday(&curTime, NULL);
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    *curTime = static_cast<uint64_t>(tv.tv_sec)*1000000000ULL + tv.tv_usec*1000ULL;
 #else
-    clock_gettime(CLOCK_MONOTONIC, curTime);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *curTime = static_cast<uint64_t>(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
 #endif
 }
 
 // Local method to compute time differences in microseconds
-double EMIO_Interface::TimeDiff_us(fpgav3_time_t *startTime, fpgav3_time_t *endTime)
+double EMIO_Interface::TimeDiff_us(const fpgav3_time_t *startTime, const fpgav3_time_t *endTime)
 {
-#ifdef USE_TIMEOFDAY
-    return (endTime->tv_sec-startTime->tv_sec)*1.0e6 + (endTime->tv_usec-startTime->tv_usec);
-#else
-    return (endTime->tv_sec-startTime->tv_sec)*1.0e6 + (endTime->tv_nsec-startTime->tv_nsec)*1.0e-3;
-#endif
+    return static_cast<int64_t>(*endTime-*startTime)*tickPeriod_us;
 }
@@ -21,12 +21,122 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <time.h>
+#include <vector>
+#include "fpgav3_timing.h"
+#include "fpgav3_perf.h"
+#include "fpgav3_buslock.h"
+#include "fpgav3_procstats.h"
 
-#ifdef USE_TIMEOFDAY
-typedef struct timeval fpgav3_time_t;
-#else
-typedef struct timespec fpgav3_time_t;
-#endif
+// Time source for timing measurements
+enum EMIO_TimeSource {
+    EMIO_TIME_CLOCK,          // clock_gettime (CLOCK_MONOTONIC), 1 tick = 1 ns
+    EMIO_TIME_GLOBAL_TIMER    // Cortex-A9 global timer (via /dev/mem), 1 tick = 1 timer cycle
+};
+
+// Strategy for polling op_done (see EMIO_Interface::SetWaitPolicy). In all cases, the
+// elapsed time is only checked every few polls (using the current time source) and
+// the wait fails if op_done is not reached within the timeout.
+enum EMIO_WaitPolicy {
+    EMIO_WAIT_SPIN,           // busy-wait until op_done or timeout (default)
+    EMIO_WAIT_SPIN_YIELD,     // spin for spinCount polls, then call sched_yield between polls
+    EMIO_WAIT_SPIN_SLEEP,     // spin for spinCount polls, then nanosleep between polls
+    EMIO_WAIT_ADAPTIVE        // spin budget based on measured op_done latency, then sched_yield
+};
+
+// Error codes (see EMIO_Interface::GetLastError)
+enum EMIO_Error {
+    EMIO_OK,
+    EMIO_ERR_TIMEOUT,         // op_done not reached within the timeout
+    EMIO_ERR_DEADLINE,        // transaction deadline expired (before or during the transaction)
+    EMIO_ERR_BUS_LOCK,        // cross-process bus lock could not be acquired
+    EMIO_ERR_BUS_STUCK,       // op_done did not clear after an aborted transaction
+    EMIO_ERR_UNSUPPORTED,     // not supported (e.g., block transfer with bus version 0)
+    EMIO_ERR_IO               // other failure (e.g., GPIO or socket error)
+};
+
+// Returns a short description of the error code
+const char *EMIO_ErrorString(EMIO_Error err);
+
+// Recovery statistics (see EMIO_Interface::GetRecoveryStats)
+struct EMIO_RecoveryStats {
+    unsigned long numTimeouts;          // transactions that failed with EMIO_ERR_TIMEOUT
+    unsigned long numDeadlineMisses;    // transactions that failed with EMIO_ERR_DEADLINE
+    unsigned long numAborts;            // transactions aborted (bus lines reset to idle)
+    unsigned long numRecoveries;        // successful recoveries (op_done cleared after abort)
+    unsigned long numRecoveryFailures;  // recoveries that failed with EMIO_ERR_BUS_STUCK
+    unsigned long numRetries;           // retry attempts
+    unsigned long numRetrySuccess;      // transactions that succeeded after a retry
+
+    EMIO_RecoveryStats() : numTimeouts(0), numDeadlineMisses(0), numAborts(0), numRecoveries(0),
+                           numRecoveryFailures(0), numRetries(0), numRetrySuccess(0) {}
+};
+
+// Bus session statistics (see EMIO_Interface::BeginBusSession)
+struct EMIO_SessionStats {
+    unsigned long numSessions;          // sessions started (outermost BeginBusSession)
+    unsigned long numYields;            // bus lock released because the maximum hold time expired
+    unsigned long numHeldRuns;          // batch runs executed as one block transfer (EMIO_BATCH_HOLD_BUS)
+    unsigned long numHeldQuads;         // quadlets in those runs
+    double maxHold_us;                  // longest time that a session held the bus lock
+
+    EMIO_SessionStats() : numSessions(0), numYields(0), numHeldRuns(0), numHeldQuads(0),
+                          maxHold_us(0.0) {}
+};
+
+// Operation types for batched transactions (see EMIO_Interface::ExecuteBatch)
+enum EMIO_OpType { EMIO_READ_QUAD, EMIO_WRITE_QUAD, EMIO_READ_BLOCK, EMIO_WRITE_BLOCK };
+
+// Status of each request in a batch
+enum EMIO_ReqStatus { EMIO_REQ_PENDING, EMIO_REQ_OK, EMIO_REQ_FAILED };
+
+// Flags for EMIO_Interface::ExecuteBatch (can be combined)
+enum EMIO_BatchFlags {
+    EMIO_BATCH_DEFAULT     = 0x00,   // execute in order, continue after errors
+    EMIO_BATCH_STOP_ON_ERR = 0x01,   // stop at first error (remaining requests stay pending)
+    EMIO_BATCH_READS_FIRST = 0x02,   // execute all reads, then all writes (see ExecuteBatch)
+    EMIO_BATCH_HOLD_BUS    = 0x04    // execute runs of quadlets in block ranges as block transfers
+                                     // (see ExecuteBatch and AddBlockRange)
+};
+
+// Maximum number of quadlets in a run that is executed as one block transfer
+// (EMIO_BATCH_HOLD_BUS), which limits the time that req_bus is held, so that the
+// firmware can still serve the FireWire and Ethernet interfaces
+#define EMIO_HOLD_MAX_QUADS 64
+
+// PROM data buffer (see WritePromData), where a block transfer is equivalent to the
+// quadlet transfers at consecutive addresses (see EMIO_Interface::AddBlockRange)
+const uint16_t EMIO_ADDR_PROM_DATA      = 0x2000;
+const unsigned int EMIO_PROM_DATA_QUADS = 256;
+
+// Descriptor for one request in a batch. The data pointer refers to a single quadlet
+// for EMIO_READ_QUAD and EMIO_WRITE_QUAD (nBytes is ignored), or to an array of
+// (nBytes+3)/4 quadlets for EMIO_READ_BLOCK and EMIO_WRITE_BLOCK. As with the
+// individual methods, block data is byte-swapped but quadlet data is not.
+struct EMIO_Request {
+    EMIO_OpType    opType;
+    uint16_t       addr;
+    uint32_t      *data;
+    unsigned int   nBytes;
+    EMIO_ReqStatus status;     // set by ExecuteBatch
+
+    static EMIO_Request ReadQuadlet(uint16_t addr, uint32_t *data)
+    { EMIO_Request req = { EMIO_READ_QUAD, addr, data, 4, EMIO_REQ_PENDING }; return req; }
+
+    static EMIO_Request WriteQuadlet(uint16_t addr, uint32_t *data)
+    { EMIO_Request req = { EMIO_WRITE_QUAD, addr, data, 4, EMIO_REQ_PENDING }; return req; }
+
+    static EMIO_Request ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+    { EMIO_Request req = { EMIO_READ_BLOCK, addr, data, nBytes, EMIO_REQ_PENDING }; return req; }
+
+    static EMIO_Request WriteBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+    { EMIO_Request req = { EMIO_WRITE_BLOCK, addr, data, nBytes, EMIO_REQ_PENDING }; return req; }
+
+    bool IsWrite() const
+    { return (opType == EMIO_WRITE_QUAD) || (opType == EMIO_WRITE_BLOCK); }
+};
+
+// Forward declaration (see fpgav3_emio_trace.h)
+class EMIO_TraceRecorder;
 
 class EMIO_Interface
 {
@@ -39,17 +149,68 @@ protected:
     unsigned int version;      // Version from FPGA
     fpgav3_time_t startTime;   // Start time for measurement
     fpgav3_time_t endTime;     // End time for measurement
+    fpgav3_time_t grantTime;   // Time that grant_bus was seen (0 if not sampled)
     double timingOverhead;     // Overhead due to timing calls
     double timeout_us;         // Timeout in microseconds
+    EMIO_TimingRecorder *timingRec;   // Timing samples and statistics
+    EMIO_PerfCounters *perfCounters;  // Performance counters (0 if not enabled)
+    EMIO_EdgeRecorder *edgeRec;       // Edge timing statistics (0 if not enabled)
+    EMIO_WaitPolicy waitPolicy;       // Strategy for polling op_done
+    unsigned int spinCount;           // Number of polls before yield/sleep
+    unsigned int sleep_ns;            // Sleep time for EMIO_WAIT_SPIN_SLEEP
+    unsigned int adaptPolls16;        // Average number of polls (x16) for EMIO_WAIT_ADAPTIVE
+    EMIO_BusLock *busLock;            // Cross-process bus lock (0 if not enabled)
+    double busLockTimeout_us;         // Timeout for acquiring bus lock
+    unsigned int busLockDepth;        // Number of nested LockBus calls
+    EMIO_TraceRecorder *traceRec;     // Binary trace (0 if not enabled)
+    fpgav3_time_t traceStart;         // Start time of traced transaction
+    fpgav3_time_t traceWait;          // Time waiting for op_done in traced transaction
+    EMIO_ProcessStats *procStats;     // Per-process counters (0 if not enabled)
+    EMIO_Error lastError;             // Error code of most recent transaction
+    bool hasDeadline;                 // true if transactions have a deadline
+    fpgav3_time_t deadlineTicks;      // Transaction deadline (in ticks of the time source)
+    bool abortPending;                // true if the bus must be recovered after an abort
+    unsigned int maxRetries;          // Number of retries after a timeout
+    unsigned int retryCount;          // Number of retries of current transaction
+    EMIO_RecoveryStats recoveryStats; // Timeout, abort and retry counters
+    unsigned int sessionDepth;        // Number of nested BeginBusSession calls
+    bool sessionHoldsLock;            // true if the session holds the bus lock
+    fpgav3_time_t sessionStart;       // Time that the session (last) acquired the bus lock
+    double sessionMaxHold_us;         // Maximum time that a session holds the bus lock
+    EMIO_SessionStats sessionStats;   // Session and held-run counters
+    std::vector<EMIO_Request> holdReqs;   // Batch with runs merged (EMIO_BATCH_HOLD_BUS)
+    std::vector<unsigned int> holdFirst;  // Index of first request of each merged request
+    std::vector<uint32_t> holdData;       // Block data of the merged runs
+
+    // Range of registers where quadlets may be combined into block transfers
+    struct BlockRange {
+        uint16_t addr;
+        unsigned int nQuads;
+    };
+    std::vector<BlockRange> blockRanges;
+
+    // State of a polling wait (see WaitBegin)
+    struct WaitState {
+        unsigned int polls;           // Number of polls so far
+        fpgav3_time_t start;          // Start of wait
+        fpgav3_time_t deadline;       // Timeout (start+timeout_us, or transaction deadline)
+        bool byDeadline;              // true if deadline is the transaction deadline
+    };
 
  public:
 
     EMIO_Interface() : isInput(true), isVerbose(false), useEvents(false), doTiming(0),
-                       version(0), timingOverhead(0.0), timeout_us(250.0)
+                       version(0), grantTime(0), timingOverhead(0.0), timeout_us(250.0), timingRec(0),
+                       perfCounters(0), edgeRec(0),
+                       waitPolicy(EMIO_WAIT_SPIN), spinCount(100), sleep_ns(1000), adaptPolls16(0),
+                       busLock(0), busLockTimeout_us(100000.0), busLockDepth(0), traceRec(0),
+                       traceStart(0), traceWait(0), procStats(EMIO_ProcessStats::Acquire()),
+                       lastError(EMIO_OK), hasDeadline(false), deadlineTicks(0), abortPending(false),
+                       maxRetries(0), retryCount(0), sessionDepth(0), sessionHoldsLock(false),
+                       sessionStart(0), sessionMaxHold_us(1000.0)
     {}
 
-    virtual ~EMIO_Interface()
-    {}
+    virtual ~EMIO_Interface();
 
     // Returns true if successfully initialized
     virtual bool IsOK() const = 0;
@@ -76,10 +237,188 @@ protected:
     //   0 --> no timing
     //   1 --> only total time
     //   2 --> total and intermediate times
+    // Derived classes override SetTimingMode if a mode requires additional resources
+    // (e.g., grant_bus events for mode 2, see EMIO_Interface_Gpiod).
     unsigned int GetTimingMode() const
     { return doTiming; }
 
-    void SetTimingMode(unsigned int newState);
+    virtual void SetTimingMode(unsigned int newState);
+
+    // Get timing statistics (histograms of total time and, for timing mode 2, of each phase)
+    // for all transactions since timing mode was enabled or ResetTimingStats was called.
+    // Timing results are not printed; this method can be called periodically (e.g., from
+    // another thread) to collect the results with negligible impact on the transactions.
+    // Returns false if timing mode was never enabled.
+    bool GetTimingStats(EMIO_TimingStats &stats);
+
+    void ResetTimingStats();
+
+    // Get/Set performance counters (see fpgav3_perf.h). If enabled, the counters (cycles,
+    // instructions, cache misses and context switches) are read at the start and end of
+    // each timed transaction (timing mode > 0) and aggregated per operation in the timing
+    // statistics. The counters only count the calling thread, so this should be called by
+    // the thread that performs the transactions. Returns false if no counter is available.
+    bool GetPerfCounters() const
+    { return (perfCounters != 0); }
+
+    bool SetPerfCounters(bool enable);
+
+    // Get/Set edge timing (see EMIO_EdgeStats). If enabled, the backends that receive op_done
+    // as kernel edge events (gpiod, gpiov2) record, in event mode, the time of each request
+    // (write of req_bus or addr_lsb) and the kernel timestamp of the op_done rising edge, to
+    // separate the firmware response time from the system call and wakeup overhead. Returns
+    // false if the backend does not provide event timestamps. The statistics can be read
+    // from another thread.
+    bool GetEdgeTiming() const
+    { return (edgeRec != 0); }
+
+    bool SetEdgeTiming(bool enable);
+
+    // Returns false if edge timing is not enabled
+    bool GetEdgeTimingStats(EMIO_EdgeStats &stats) const;
+
+    void ResetEdgeTimingStats();
+
+    // Get/Set time source for timing measurements. This setting is shared by all
+    // EMIO_Interface objects in the process and should be changed before calling
+    // SetTimingMode (which calibrates the timing overhead). The global timer is read
+    // directly from user space, which has much lower overhead than clock_gettime, but
+    // requires access to /dev/mem. If it cannot be used, the time source remains (or
+    // reverts to) EMIO_TIME_CLOCK and false is returned.
+    static EMIO_TimeSource GetTimeSource();
+
+    static bool SetTimeSource(EMIO_TimeSource newSource);
+
+    // Returns the duration of one tick of the current time source, in microseconds
+    static double GetTickPeriod_us();
+
+    // Get/Set strategy for polling op_done (not used in event mode). For EMIO_WAIT_SPIN_YIELD
+    // and EMIO_WAIT_SPIN_SLEEP, the interface polls newSpinCount times before calling
+    // sched_yield or nanosleep(newSleep_ns) between polls, so that a loaded system does
+    // not waste a core when the bus is busy. EMIO_WAIT_ADAPTIVE learns the number of polls
+    // typically needed for op_done and spins for a few times that number before yielding.
+    EMIO_WaitPolicy GetWaitPolicy() const
+    { return waitPolicy; }
+
+    void SetWaitPolicy(EMIO_WaitPolicy newPolicy, unsigned int newSpinCount = 100,
+                       unsigned int newSleep_ns = 1000);
+
+    // Returns the number of polls before yield/sleep (for EMIO_WAIT_ADAPTIVE, the current
+    // spin budget)
+    unsigned int GetSpinCount() const;
+
+    // Get/Set cross-process bus lock. If enabled, each transaction (and each batch) holds
+    // the lock (see EMIO_BusLock) with the specified name, so that processes that enable
+    // the lock do not access the EMIO bus at the same time. When the lock was last held
+    // by another owner, the data line direction is re-validated before the transaction.
+    // Returns false if the shared-memory segment could not be opened.
+    bool GetBusLock() const
+    { return (busLock != 0); }
+
+    virtual bool SetBusLock(bool enable, const char *name = EMIO_BUSLOCK_DEFAULT_NAME);
+
+    // Get/Set maximum time to wait for the bus lock, in microseconds (default 100 ms).
+    // If the lock cannot be acquired, the transaction fails.
+    double GetBusLockTimeout_us() const
+    { return busLockTimeout_us; }
+
+    void SetBusLockTimeout_us(double new_timeout_us)
+    { busLockTimeout_us = new_timeout_us; }
+
+    // Get bus lock statistics for this interface and (if sharedStats is not 0) for all
+    // processes. Returns false if the bus lock is not enabled.
+    bool GetBusLockStats(EMIO_BusLockStats &stats, EMIO_BusLockStats *sharedStats = 0) const;
+
+    // Start/Stop binary trace of all transactions, including each request of a batch
+    // (see fpgav3_emio_trace.h). StartTrace creates (or truncates) the specified file,
+    // which holds the most recent maxEntries transactions; any previous trace is stopped.
+    // Returns false if the file could not be created.
+    bool StartTrace(const char *fileName, unsigned int maxEntries = 65536);
+
+    void StopTrace();
+
+    bool IsTracing() const
+    { return (traceRec != 0); }
+
+    // Returns the number of transactions recorded since StartTrace
+    unsigned long GetNumTraced() const;
+
+    // Returns the error code of the most recent transaction (EMIO_OK if it was successful).
+    // For ExecuteBatch, this is the error of the last failed request.
+    EMIO_Error GetLastError() const
+    { return lastError; }
+
+    // Set/Clear transaction deadline. The deadline is an absolute CLOCK_MONOTONIC time that
+    // applies to all subsequent transactions (and batches) until it is changed or cleared,
+    // e.g., the end of the current cycle of a control loop. A transaction that is started
+    // after the deadline fails immediately, and the waits for op_done (and for the bus lock)
+    // are limited to the deadline; in both cases, the error is EMIO_ERR_DEADLINE.
+    void SetDeadline(const struct timespec &deadline);
+
+    void ClearDeadline()
+    { hasDeadline = false; }
+
+    bool HasDeadline() const
+    { return hasDeadline; }
+
+    // Get/Set number of retries (default 0) of a transaction that failed with
+    // EMIO_ERR_TIMEOUT (a deadline miss is not retried). The individual requests of a
+    // batch are not retried.
+    unsigned int GetMaxRetries() const
+    { return maxRetries; }
+
+    void SetMaxRetries(unsigned int newMaxRetries)
+    { maxRetries = newMaxRetries; }
+
+    // Get/Reset timeout, abort, recovery and retry counters. When a transaction fails
+    // with EMIO_ERR_TIMEOUT or EMIO_ERR_DEADLINE, it is aborted: req_bus, blk_start and
+    // blk_end are cleared and the data lines are set to input. The next transaction first
+    // waits (up to the timeout) for op_done to clear; if it does not, that transaction
+    // fails with EMIO_ERR_BUS_STUCK (and recovery is attempted again by the next one).
+    // Recovery failures are only printed in verbose mode (see SetVerbose).
+    const EMIO_RecoveryStats &GetRecoveryStats() const
+    { return recoveryStats; }
+
+    void ResetRecoveryStats()
+    { recoveryStats = EMIO_RecoveryStats(); }
+
+    // Bus sessions
+    //   BeginBusSession starts a sequence of transactions (and batches) that is not
+    //   interleaved with the transactions of other processes, e.g., to read a consistent
+    //   set of registers. The cross-process bus lock (see SetBusLock) is acquired once and
+    //   held until EndBusSession, so the transactions in the session do not acquire it (or
+    //   re-validate the data line direction) individually. To avoid starving the other
+    //   processes, a transaction that starts after the session has held the lock for longer
+    //   than the maximum hold time first releases and re-acquires it (a batch is never split).
+    //   Sessions can be nested; only the outermost EndBusSession releases the lock.
+    //
+    //   The firmware arbitrates the FPGA bus (against FireWire and Ethernet) for each
+    //   request, since the protocol only allows req_bus to be held across the quadlets of a
+    //   block transfer. To also hold req_bus, submit the accesses with ExecuteBatch and
+    //   EMIO_BATCH_HOLD_BUS, which executes each run of quadlets at consecutive addresses
+    //   in a block range (see AddBlockRange) as one block transfer.
+    // Returns: false (with the error code set) if the bus lock could not be acquired
+    bool BeginBusSession();
+
+    void EndBusSession();
+
+    bool InBusSession() const
+    { return (sessionDepth > 0); }
+
+    // Get/Set maximum time that a session holds the bus lock, in microseconds
+    // (default 1000; 0 for no limit)
+    double GetBusSessionMaxHold_us() const
+    { return sessionMaxHold_us; }
+
+    void SetBusSessionMaxHold_us(double newMaxHold_us)
+    { sessionMaxHold_us = newMaxHold_us; }
+
+    // Get/Reset bus session (and EMIO_BATCH_HOLD_BUS) statistics
+    const EMIO_SessionStats &GetBusSessionStats() const
+    { return sessionStats; }
+
+    void ResetBusSessionStats()
+    { sessionStats = EMIO_SessionStats(); }
 
     // Get/Set event flag (true -> use events instead of polling)
     bool GetEventMode() const
@@ -131,12 +470,259 @@ protected:
     // Returns:    true if success
     bool WritePromData(char *data, unsigned int nBytes);
 
+    // ExecuteBatch
+    //   Executes a list of read/write requests. The derived classes process the list
+    //   in a single loop, without the per-call overhead (e.g., timing measurements)
+    //   of the individual methods, and only change the data bus direction when a read
+    //   is followed by a write (or vice-versa). If EMIO_BATCH_READS_FIRST is specified,
+    //   all reads are executed (in order) before all writes (in order), so there is at
+    //   most one direction change; this should only be used when none of the reads
+    //   depends on a write in the same batch.
+    //   If EMIO_BATCH_HOLD_BUS is specified (and the version is at least 1), each run of
+    //   adjacent quadlet reads (or writes) at consecutive addresses within one block range
+    //   (see AddBlockRange), up to EMIO_HOLD_MAX_QUADS, is executed as one block transfer,
+    //   which holds req_bus for the whole run. This is faster than individual quadlets and,
+    //   because the firmware does not re-arbitrate the FPGA bus, gives a consistent snapshot
+    //   of the registers. All requests of a run get the status of the block transfer.
+    // Parameters:
+    //     reqs   array of requests (status of each request is updated)
+    //     num    number of requests
+    //     flags  combination of EMIO_BatchFlags
+    // Returns:   true if all requests were successful
+    bool ExecuteBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags = EMIO_BATCH_DEFAULT);
+
+    // Block ranges
+    //   A block transfer is not always equivalent to the quadlet transfers at consecutive
+    //   addresses (e.g., a block write to address 0 is the real-time block write). Quadlets
+    //   are therefore only combined into block transfers (EMIO_BATCH_HOLD_BUS, and
+    //   EMIO_Interface_WriteCombined) within the ranges added by the caller, for which the
+    //   firmware is known to treat them the same (e.g., EMIO_ADDR_PROM_DATA). No ranges
+    //   are added by default, so no quadlets are combined.
+    // Returns: false if the range is empty or exceeds the address space
+    bool AddBlockRange(uint16_t addr, unsigned int nQuads);
+
+    void ClearBlockRanges()
+    { blockRanges.clear(); }
+
+    // Returns the number of quadlets from addr to the end of the block range that
+    // contains it (0 if addr is not in a block range)
+    unsigned int BlockRangeQuads(uint16_t addr) const;
+
 protected:
 
+    // Pass selection for RunBatch
+    enum BatchPass { BATCH_ALL, BATCH_READS, BATCH_WRITES };
+
+    static bool BatchSelect(const EMIO_Request &req, BatchPass pass)
+    { return (pass == BATCH_ALL) || (req.IsWrite() == (pass == BATCH_WRITES)); }
+
+    // RunBatch
+    //   Executes the requests selected by pass; called by ExecuteBatch. The default
+    //   implementation calls the virtual read/write methods; derived classes should
+    //   override it with a native loop.
+    virtual bool RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass);
+
+    // Start a transaction (or batch) and acquire the cross-process bus lock, if enabled.
+    // Calls can be nested (e.g., a batch that calls the individual methods). LockBus
+    // clears the error code and returns false (with the error code set) if the deadline
+    // has expired, the bus lock cannot be acquired or the bus cannot be recovered after
+    // an aborted transaction (see BeginTransaction).
+    bool LockBus()
+    {
+        lastError = EMIO_OK;
+        retryCount = 0;
+        return (!busLock && !hasDeadline && !abortPending) || BeginTransaction();
+    }
+
+    void UnlockBus()
+    { if (busLock) ReleaseBusLock(); }
+
+    bool BeginTransaction();
+    bool AcquireBusLock();
+    void ReleaseBusLock();
+
+    // Returns true if the bus lock is only held by the session and the maximum hold
+    // time has expired (see BeginBusSession)
+    bool SessionMustYield();
+
+    // Update the maximum hold time of the session (when the lock is released)
+    void SessionHoldEnd();
+
+    // Merge runs of quadlets into block requests in holdReqs (EMIO_BATCH_HOLD_BUS); returns
+    // false if there are no runs to merge. HoldRunLength returns the number of requests
+    // (at least 1) in the run that starts at reqs[i] (within one block range).
+    unsigned int HoldRunLength(const EMIO_Request *reqs, unsigned int num, unsigned int i) const;
+    bool MergeHoldRuns(const EMIO_Request *reqs, unsigned int num);
+
+    // Copy the status (and read data) of the merged requests to the original requests
+    void SplitHoldRuns(EMIO_Request *reqs);
+
+    // Returns true if the transaction deadline has expired
+    bool DeadlineExpired() const;
+
+    // Returns limit_us, or the time until the deadline (at least 0) if that is shorter
+    double DeadlineLimit_us(double limit_us) const;
+
+    // Abort the current transaction after a timeout: clear req_bus, blk_start and blk_end
+    // and set the data lines to input. Returns false if not supported by the interface
+    // (in which case the bus is not recovered before the next transaction).
+    virtual bool AbortTransaction()
+    { return false; }
+
+    // Wait (using the wait policy and timeout) for op_done to be cleared after an abort
+    virtual bool WaitBusIdle()
+    { return true; }
+
+    // Recover the bus after an abort (see WaitBusIdle); called before the next transaction,
+    // and by the derived classes before each request of a batch. Returns false (with error
+    // code EMIO_ERR_BUS_STUCK or EMIO_ERR_DEADLINE) if op_done did not clear.
+    bool RecoverBus();
+
+    // Called by the derived classes before each request of a batch (see RecoverBus)
+    bool BeginRequest()
+    { return !abortPending || RecoverBus(); }
+
+    // Called after a failed transaction, so that it can be retried:
+    //    do {
+    //        ret = <transaction>;
+    //    } while (!ret && RetryTransaction());
+    // Returns true if the transaction failed with EMIO_ERR_TIMEOUT, fewer than maxRetries
+    // retries were made and the bus was recovered.
+    bool RetryTransaction()
+    { return (retryCount < maxRetries) && PrepareRetry(); }
+
+    bool PrepareRetry();
+
+    // Re-validate the cached data line direction (isInput) and other line configuration,
+    // which may have been changed by another process; called when acquiring the bus lock.
+    virtual void RevalidateDirection()
+    {}
+
+    // Methods for polling op_done using the wait policy, used as follows:
+    //    if (!done) {
+    //        WaitBegin(ws);
+    //        while (!(done = <poll>) && WaitContinue(ws));
+    //        WaitEnd(ws, done);
+    //    }
+    // WaitContinue returns false when the timeout (or transaction deadline) has expired,
+    // in which case WaitEnd sets the error code.
+    void WaitBegin(WaitState &ws) const;
+    bool WaitContinue(WaitState &ws) const;
+    void WaitEnd(const WaitState &ws, bool done);
+
+    // Returns the elapsed time of the wait, in microseconds
+    double WaitElapsed_us(const WaitState &ws) const;
+
+    // Returns true if the backend waits for op_done via kernel edge events with timestamps
+    // (see SetEdgeTiming)
+    virtual bool HasEdgeTimestamps() const
+    { return false; }
+
+    // Edge timing (no effect if not enabled or not in event mode): called before and after
+    // the write that requests a quadlet, and with the kernel timestamp of the op_done edge
+    // (CLOCK_MONOTONIC, in nanoseconds) after the wait returned
+    void EdgeRequestBegin()
+    { if (edgeRec && useEvents) edgeRec->RequestBegin(); }
+
+    void EdgeRequestEnd()
+    { if (edgeRec && useEvents) edgeRec->RequestEnd(); }
+
+    void EdgeRecord(bool isWrite, uint64_t edge_ns, uint64_t wake_ns)
+    { if (edgeRec) edgeRec->Record(isWrite, edge_ns, wake_ns); }
+
+    // Begin trace entry for a transaction (no effect if tracing is not enabled)
+    void TraceBegin()
+    { if (traceRec) { GetCurTime(&traceStart); traceWait = 0; } }
+
+    // End of a transaction (or of one request of a batch): counts it in the per-process
+    // counters (see fpgav3_procstats.h), records the trace entry (using the time since
+    // TraceBegin and the wait time added by TraceWait) and, if it failed, sets the error
+    // code and aborts the transaction (see TransactionFailed).
+    void EndTransaction(EMIO_OpType opType, uint16_t addr, const uint32_t *data, unsigned int nBytes, bool ok)
+    {
+        if (procStats) CountOp(opType, nBytes, ok);
+        if (traceRec) RecordTrace(opType, addr, data, nBytes, ok);
+        if (!ok)
+            TransactionFailed();
+        else if (retryCount > 0)
+            RetrySucceeded();
+    }
+
+    void TransactionFailed();
+    void RetrySucceeded();
+
+    void CountOp(EMIO_OpType opType, unsigned int nBytes, bool ok)
+    {
+        bool isBlock = (opType == EMIO_READ_BLOCK) || (opType == EMIO_WRITE_BLOCK);
+        bool isWrite = (opType == EMIO_WRITE_QUAD) || (opType == EMIO_WRITE_BLOCK);
+        procStats->CountOp(opType, isBlock ? ((nBytes+3)&~3u) : 4, isWrite, ok);
+    }
+
+    // Update per-process counters for a data line direction change
+    void CountDirSwitch()
+    { if (procStats) procStats->CountDirSwitch(); }
+
+    // Set the error code (EMIO_ERR_TIMEOUT or EMIO_ERR_DEADLINE) and update per-process
+    // counters for a timeout of a wait that does not use WaitBegin/WaitEnd (e.g., events).
+    // Such waits should be limited to DeadlineLimit_us(timeout_us).
+    void WaitTimeout();
+
+    void RecordTrace(EMIO_OpType opType, uint16_t addr, const uint32_t *data, unsigned int nBytes, bool ok);
+
+    // Add the time since waitStart to the wait time of the traced transaction (called by
+    // WaitEnd, and by the derived classes for waits that do not use WaitBegin/WaitEnd)
+    void TraceWait(fpgav3_time_t waitStart);
+
+    // Start timing measurement (and performance counters, if enabled); called if doTiming > 0
+    void StartTiming()
+    { if (perfCounters) perfCounters->Start(); grantTime = 0; GetCurTime(&startTime); }
+
+    // Record timing sample, using startTime and the current time. If not 0, midTimes
+    // contains the two intermediate times for the three phases (EMIO_TimingPhase), and the
+    // wait phase is split at grantTime, if grant_bus was sampled (see GrantSeen).
+    void RecordTiming(EMIO_TimingOp op, const fpgav3_time_t *midTimes = 0);
+
+    // Returns true if grant_bus should be sampled while waiting for op_done (timing mode 2,
+    // version 1+), so that arbitration and access times are recorded (see EMIO_OpTimingStats)
+    bool SampleGrant() const
+    { return (doTiming > 1) && (version >= 1); }
+
+    // Record the time that grant_bus was first seen set (now, or at the specified
+    // CLOCK_MONOTONIC time, e.g., the kernel timestamp of a grant_bus event)
+    void GrantSeen()
+    { if (grantTime == 0) GetCurTime(&grantTime); }
+
+    void GrantSeenAt(uint64_t grant_ns);
+
     // Local methods for timing measurements
     static void GetCurTime(fpgav3_time_t *curTime);
-    static double TimeDiff_us(fpgav3_time_t *startTime, fpgav3_time_t *endTime);
+    static double TimeDiff_us(const fpgav3_time_t *startTime, const fpgav3_time_t *endTime);
+
+};
+
+// Bus session for the lifetime of the object (see EMIO_Interface::BeginBusSession), e.g.:
+//    {
+//        EMIO_BusSession session(emio);
+//        if (session.IsOK()) { ... }
+//    }
+class EMIO_BusSession
+{
+    EMIO_Interface *emio;
+    bool ok;
+
+    EMIO_BusSession(const EMIO_BusSession &);
+    EMIO_BusSession &operator=(const EMIO_BusSession &);
+
+public:
+
+    EMIO_BusSession(EMIO_Interface *emioIntf) : emio(emioIntf), ok(emioIntf->BeginBusSession()) {}
+
+    ~EMIO_BusSession()
+    { if (ok) emio->EndBusSession(); }
 
+    // Returns true if the session was started (see BeginBusSession)
+    bool IsOK() const
+    { return ok; }
 };
 
 #endif // FPGAV3_EMIO_H
@@ -0,0 +1,197 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <sched.h>
+#include <time.h>
+#include "fpgav3_emio_async.h"
+#include "fpgav3_futex.h"
+
+// Maximum sleep time of the worker when the queue is empty (it is normally woken up
+// by Submit; the timeout only bounds the time to notice a Stop request)
+const long ASYNC_WORKER_SLEEP_NS = 100000000;    // 100 ms
+
+// ---------------------------------------------------------------------------------
+// EMIO_AsyncOp
+
+bool EMIO_AsyncOp::Wait(double timeout_us)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (;;) {
+        uint32_t s = __atomic_load_n(&state, __ATOMIC_ACQUIRE);
+        if ((s == OP_IDLE) || (s == OP_DONE))
+            return true;
+        // Tell the worker to wake us up (see EMIO_AsyncWorker::Execute)
+        if ((s == OP_PENDING) &&
+            !__atomic_compare_exchange_n(&state, &s, static_cast<uint32_t>(OP_WAITING), false,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
+        struct timespec timeout;
+        struct timespec *pTimeout = 0;
+        if (timeout_us >= 0.0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            double remaining_us = timeout_us - ((now.tv_sec-start.tv_sec)*1.0e6 +
+                                                (now.tv_nsec-start.tv_nsec)*1.0e-3);
+            if (remaining_us <= 0.0)
+                return false;
+            timeout.tv_sec = static_cast<time_t>(remaining_us*1.0e-6);
+            timeout.tv_nsec = static_cast<long>((remaining_us-timeout.tv_sec*1.0e6)*1.0e3);
+            pTimeout = &timeout;
+        }
+        FutexWait(&state, OP_WAITING, pTimeout);
+    }
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_AsyncWorker
+
+EMIO_AsyncWorker::EMIO_AsyncWorker(EMIO_Interface *emioIntf, int cpuCore, int rtPriority) :
+    emio(emioIntf), cpu(cpuCore), priority(rtPriority), spinCount(1000), isRunning(false),
+    queue(0), doorbell(0), workerWaiting(0), stopRequested(false)
+{
+}
+
+EMIO_AsyncWorker::~EMIO_AsyncWorker()
+{
+    Stop();
+}
+
+bool EMIO_AsyncWorker::Start()
+{
+    if (isRunning)
+        return true;
+    __atomic_store_n(&stopRequested, false, __ATOMIC_RELAXED);
+    int ret = pthread_create(&thread, NULL, ThreadEntry, this);
+    if (ret != 0) {
+        std::cout << "EMIO_AsyncWorker: failed to create thread (error " << ret << ")" << std::endl;
+        return false;
+    }
+    isRunning = true;
+    if (cpu >= 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        if (pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet) != 0)
+            std::cout << "EMIO_AsyncWorker: failed to pin worker to CPU " << cpu << std::endl;
+    }
+    if (priority > 0) {
+        struct sched_param param;
+        param.sched_priority = priority;
+        if (pthread_setschedparam(thread, SCHED_FIFO, &param) != 0)
+            std::cout << "EMIO_AsyncWorker: failed to set real-time priority " << priority
+                      << " (requires root or CAP_SYS_NICE)" << std::endl;
+    }
+    return true;
+}
+
+void EMIO_AsyncWorker::Stop()
+{
+    if (!isRunning)
+        return;
+    __atomic_store_n(&stopRequested, true, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&doorbell, 1, __ATOMIC_SEQ_CST);
+    FutexWake(&doorbell, 1);
+    pthread_join(thread, NULL);
+    isRunning = false;
+}
+
+bool EMIO_AsyncWorker::Submit(EMIO_AsyncOp &op, EMIO_Request *reqs, unsigned int num,
+                              unsigned int flags, EMIO_AsyncCallback cb, void *cbArg)
+{
+    if (!isRunning || !op.IsDone())
+        return false;
+    op.reqs = reqs;
+    op.num = num;
+    op.flags = flags;
+    op.callback = cb;
+    op.cbArg = cbArg;
+    op.result = false;
+    __atomic_store_n(&op.state, static_cast<uint32_t>(EMIO_AsyncOp::OP_PENDING), __ATOMIC_RELAXED);
+
+    // Push onto queue (lock-free stack; the worker restores submission order)
+    EMIO_AsyncOp *head = __atomic_load_n(&queue, __ATOMIC_RELAXED);
+    do {
+        op.next = head;
+    } while (!__atomic_compare_exchange_n(&queue, &head, &op, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // The sequentially consistent operations ensure that either the worker sees the new
+    // doorbell value before sleeping, or this thread sees that the worker is waiting.
+    __atomic_fetch_add(&doorbell, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&workerWaiting, __ATOMIC_SEQ_CST))
+        FutexWake(&doorbell, 1);
+    return true;
+}
+
+bool EMIO_AsyncWorker::Submit(EMIO_AsyncOp &op, const EMIO_Request &req, EMIO_AsyncCallback cb, void *cbArg)
+{
+    if (!op.IsDone())
+        return false;
+    op.single = req;
+    return Submit(op, &op.single, 1, EMIO_BATCH_DEFAULT, cb, cbArg);
+}
+
+void *EMIO_AsyncWorker::ThreadEntry(void *arg)
+{
+    static_cast<EMIO_AsyncWorker *>(arg)->Run();
+    return 0;
+}
+
+void EMIO_AsyncWorker::Execute(EMIO_AsyncOp *op)
+{
+    op->result = emio->ExecuteBatch(op->reqs, op->num, op->flags);
+    stats.numOps++;
+    stats.numRequests += op->num;
+    if (op->callback)
+        (*op->callback)(*op, op->cbArg);
+    // The caller may reuse or destroy op as soon as it is done, so op is not accessed
+    // after this (the futex wake only uses its address)
+    uint32_t *statePtr = &op->state;
+    if (__atomic_exchange_n(statePtr, static_cast<uint32_t>(EMIO_AsyncOp::OP_DONE), __ATOMIC_ACQ_REL)
+        == EMIO_AsyncOp::OP_WAITING)
+        FutexWake(statePtr, INT32_MAX);
+}
+
+void EMIO_AsyncWorker::Run()
+{
+    const struct timespec sleepTime = { 0, ASYNC_WORKER_SLEEP_NS };
+    unsigned int idlePolls = 0;
+    for (;;) {
+        uint32_t bell = __atomic_load_n(&doorbell, __ATOMIC_ACQUIRE);
+        EMIO_AsyncOp *ops = __atomic_exchange_n(&queue, static_cast<EMIO_AsyncOp *>(0), __ATOMIC_ACQUIRE);
+        if (ops) {
+            // Reverse the list, to execute in submission order
+            EMIO_AsyncOp *list = 0;
+            unsigned int numQueued = 0;
+            while (ops) {
+                EMIO_AsyncOp *next = ops->next;
+                ops->next = list;
+                list = ops;
+                ops = next;
+                numQueued++;
+            }
+            stats.numDrains++;
+            if (numQueued > stats.maxQueued)
+                stats.maxQueued = numQueued;
+            while (list) {
+                EMIO_AsyncOp *next = list->next;
+                Execute(list);
+                list = next;
+            }
+            idlePolls = 0;
+            continue;
+        }
+        // All submitted operations are executed before stopping
+        if (__atomic_load_n(&stopRequested, __ATOMIC_ACQUIRE))
+            break;
+        if (++idlePolls < spinCount)
+            continue;
+        idlePolls = 0;
+        stats.numSleeps++;
+        __atomic_store_n(&workerWaiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&doorbell, __ATOMIC_SEQ_CST) == bell)
+            FutexWait(&doorbell, bell, &sleepTime);
+        __atomic_store_n(&workerWaiting, 0, __ATOMIC_RELAXED);
+    }
+}
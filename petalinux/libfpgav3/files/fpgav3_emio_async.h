@@ -0,0 +1,142 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_async (Linux library)
+ *
+ * Asynchronous front end for an EMIO_Interface. Transactions are submitted (by any
+ * number of application threads) to a lock-free queue and executed by a single worker
+ * thread, which can be pinned to a CPU core and given a real-time priority. The caller
+ * provides an EMIO_AsyncOp, which acts as the completion token: it can be polled
+ * (IsDone), waited on (Wait), or a callback can be specified, so that the caller can
+ * continue computing while the worker waits for the EMIO bus.
+ *
+ * The worker thread is the only thread that accesses the EMIO_Interface while it is
+ * running, so it also serializes all access to the hardware within the process.
+ */
+
+#ifndef FPGAV3_EMIO_ASYNC_H
+#define FPGAV3_EMIO_ASYNC_H
+
+#include <pthread.h>
+#include "fpgav3_emio.h"
+
+class EMIO_AsyncOp;
+
+// Completion callback, called by the worker thread just before the operation is
+// marked as done. It must not block and must not submit or wait for operations.
+typedef void (*EMIO_AsyncCallback)(EMIO_AsyncOp &op, void *arg);
+
+// Completion token for one asynchronous operation (a batch of one or more requests).
+// The EMIO_AsyncOp, the requests and their data must remain valid until the operation
+// is done. An EMIO_AsyncOp can be reused after it is done.
+class EMIO_AsyncOp
+{
+    friend class EMIO_AsyncWorker;
+
+    enum OpState { OP_IDLE, OP_PENDING, OP_WAITING, OP_DONE };
+
+    uint32_t state;                // OpState (futex for Wait)
+    EMIO_AsyncOp *next;            // link in submission queue
+    EMIO_Request *reqs;
+    unsigned int num;
+    unsigned int flags;            // EMIO_BatchFlags
+    EMIO_Request single;           // request for single operations (see Submit)
+    EMIO_AsyncCallback callback;
+    void *cbArg;
+    bool result;
+
+public:
+
+    EMIO_AsyncOp() : state(OP_IDLE), next(0), reqs(0), num(0), flags(0), callback(0), cbArg(0),
+                     result(false) {}
+
+    // Returns true if the operation has completed (or was never submitted)
+    bool IsDone() const
+    { uint32_t s = __atomic_load_n(&state, __ATOMIC_ACQUIRE); return (s == OP_IDLE) || (s == OP_DONE); }
+
+    // Wait for the operation to complete, up to timeout_us (negative for no timeout).
+    // Returns false on timeout.
+    bool Wait(double timeout_us = -1.0);
+
+    // Returns true if all requests were successful (valid when done)
+    bool GetResult() const
+    { return result; }
+
+    // Returns the requests of the operation (e.g., for the status of each request)
+    EMIO_Request *GetRequests() const
+    { return reqs; }
+
+    unsigned int GetNumRequests() const
+    { return num; }
+};
+
+// Worker statistics
+struct EMIO_AsyncStats {
+    unsigned long numOps;           // number of operations executed
+    unsigned long numRequests;      // number of requests executed
+    unsigned long numDrains;        // number of times the queue was taken by the worker
+    unsigned long numSleeps;        // number of times the worker slept (queue empty)
+    unsigned int  maxQueued;        // maximum number of operations taken at once
+
+    EMIO_AsyncStats() : numOps(0), numRequests(0), numDrains(0), numSleeps(0), maxQueued(0) {}
+};
+
+class EMIO_AsyncWorker
+{
+    EMIO_Interface *emio;                  // interface (not owned)
+    int cpu;                               // CPU core for worker (-1 for any)
+    int priority;                          // SCHED_FIFO priority (0 for default scheduling)
+    unsigned int spinCount;                // polls of queue before sleeping
+    pthread_t thread;
+    bool isRunning;
+    EMIO_AsyncOp *queue;                   // submitted operations (most recent first)
+    uint32_t doorbell;                     // incremented by each submission (futex)
+    uint32_t workerWaiting;                // 1 if worker is (about to be) sleeping
+    bool stopRequested;
+    EMIO_AsyncStats stats;                 // only updated by worker thread
+
+    static void *ThreadEntry(void *arg);
+
+    void Run();
+
+    void Execute(EMIO_AsyncOp *op);
+
+public:
+
+    // The worker thread is created by Start. By default, it is pinned to CPU 1 (the
+    // second Cortex-A9 core), since Linux tends to handle interrupts on CPU 0.
+    EMIO_AsyncWorker(EMIO_Interface *emioIntf, int cpuCore = 1, int rtPriority = 0);
+
+    // Stops the worker, after executing any submitted operations
+    ~EMIO_AsyncWorker();
+
+    // Number of queue polls before the worker sleeps (default 1000); the worker wakes up
+    // when an operation is submitted.
+    void SetSpinCount(unsigned int newSpinCount)
+    { spinCount = newSpinCount; }
+
+    // Start the worker thread. If the CPU affinity or priority cannot be set, a message
+    // is printed and the worker runs with default settings. Returns false on error.
+    bool Start();
+
+    // Stop the worker thread, after executing any submitted operations
+    void Stop();
+
+    bool IsRunning() const
+    { return isRunning; }
+
+    // Submit a batch of requests (see EMIO_Interface::ExecuteBatch). Returns false if
+    // the worker is not running or op is still in progress.
+    bool Submit(EMIO_AsyncOp &op, EMIO_Request *reqs, unsigned int num,
+                unsigned int flags = EMIO_BATCH_DEFAULT, EMIO_AsyncCallback cb = 0, void *cbArg = 0);
+
+    // Submit a single request (copied to op)
+    bool Submit(EMIO_AsyncOp &op, const EMIO_Request &req, EMIO_AsyncCallback cb = 0, void *cbArg = 0);
+
+    // Get statistics (approximate while the worker is running)
+    const EMIO_AsyncStats &GetStats() const
+    { return stats; }
+};
+
+#endif // FPGAV3_EMIO_ASYNC_H
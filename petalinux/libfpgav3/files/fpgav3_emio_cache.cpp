@@ -0,0 +1,252 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <byteswap.h>
+#include "fpgav3_emio_cache.h"
+
+EMIO_Interface_Cached::EMIO_Interface_Cached(EMIO_Interface *emioIntf, bool useDefaultRanges) :
+    EMIO_Interface(), emio(emioIntf)
+{
+    if (emio) {
+        isVerbose = emio->GetVerbose();
+        useEvents = emio->GetEventMode();
+        version = emio->GetVersion();
+    }
+    if (useDefaultRanges)
+        AddDefaultRanges();
+}
+
+void EMIO_Interface_Cached::SetEventMode(bool newState)
+{
+    emio->SetEventMode(newState);
+    useEvents = emio->GetEventMode();
+}
+
+bool EMIO_Interface_Cached::SetBusLock(bool enable, const char *name)
+{
+    return emio->SetBusLock(enable, name);
+}
+
+bool EMIO_Interface_Cached::SetPolicy(uint16_t addr, unsigned int nQuads, EMIO_CachePolicy policy)
+{
+    if ((nQuads == 0) || (addr+nQuads > 0x10000)) {
+        std::cout << "EMIO_Interface_Cached: invalid range " << std::hex << addr << std::dec
+                  << ", " << nQuads << " quadlets" << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < ranges.size(); i++) {
+        Range &r = ranges[i];
+        if ((r.addr == addr) && (r.nQuads == nQuads)) {
+            r.policy = policy;
+            Invalidate(addr, nQuads);
+            return true;
+        }
+        if ((addr < r.addr+r.nQuads) && (r.addr < addr+nQuads)) {
+            std::cout << "EMIO_Interface_Cached: range " << std::hex << addr << " overlaps range "
+                      << r.addr << std::dec << std::endl;
+            return false;
+        }
+    }
+    if (policy != EMIO_CACHE_NONE) {
+        Range r = { addr, nQuads, policy, static_cast<unsigned int>(values.size()) };
+        ranges.push_back(r);
+        values.resize(values.size()+nQuads, 0);
+        valid.resize(valid.size()+nQuads, false);
+    }
+    return true;
+}
+
+EMIO_CachePolicy EMIO_Interface_Cached::GetPolicy(uint16_t addr) const
+{
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if ((addr >= ranges[i].addr) && (addr < ranges[i].addr+ranges[i].nQuads))
+            return ranges[i].policy;
+    }
+    return EMIO_CACHE_NONE;
+}
+
+void EMIO_Interface_Cached::AddDefaultRanges()
+{
+    SetPolicy(EMIO_CACHE_ADDR_HW_VERSION, 1, EMIO_CACHE_IMMUTABLE);
+    SetPolicy(EMIO_CACHE_ADDR_ETH_CTRL, 1, EMIO_CACHE_WRITE_THROUGH);
+    SetPolicy(EMIO_CACHE_ADDR_PROM, EMIO_CACHE_PROM_QUADS, EMIO_CACHE_WRITE_THROUGH);
+}
+
+void EMIO_Interface_Cached::Invalidate()
+{
+    valid.assign(valid.size(), false);
+    stats.numInvalidations++;
+}
+
+void EMIO_Interface_Cached::Invalidate(uint16_t addr, unsigned int nQuads)
+{
+    for (unsigned int q = 0; q < nQuads; q++) {
+        int idx = FindEntry(addr+q);
+        if (idx >= 0)
+            valid[idx] = false;
+    }
+    stats.numInvalidations++;
+}
+
+int EMIO_Interface_Cached::FindEntry(uint16_t addr) const
+{
+    for (size_t i = 0; i < ranges.size(); i++) {
+        const Range &r = ranges[i];
+        if ((addr >= r.addr) && (addr < r.addr+r.nQuads))
+            return (r.policy != EMIO_CACHE_NONE) ? static_cast<int>(r.first + (addr-r.addr)) : -1;
+    }
+    return -1;
+}
+
+bool EMIO_Interface_Cached::IsCached(uint16_t addr, unsigned int nQuads) const
+{
+    for (size_t i = 0; i < ranges.size(); i++) {
+        if ((ranges[i].policy != EMIO_CACHE_NONE) &&
+            (addr < ranges[i].addr+ranges[i].nQuads) && (ranges[i].addr < addr+nQuads))
+            return true;
+    }
+    return false;
+}
+
+bool EMIO_Interface_Cached::Lookup(uint16_t addr, uint32_t *data, unsigned int nQuads, bool isBlock) const
+{
+    for (unsigned int q = 0; q < nQuads; q++) {
+        int idx = FindEntry(addr+q);
+        if ((idx < 0) || !valid[idx])
+            return false;
+        if (data)
+            data[q] = isBlock ? bswap_32(values[idx]) : values[idx];
+    }
+    return true;
+}
+
+void EMIO_Interface_Cached::Update(uint16_t addr, const uint32_t *data, unsigned int nQuads, bool isBlock,
+                                   bool isWrite, bool ok)
+{
+    bool updated = false;
+    for (unsigned int q = 0; q < nQuads; q++) {
+        int idx = FindEntry(addr+q);
+        if (idx < 0)
+            continue;
+        // Writes to immutable registers (or failed writes) invalidate the entry, since the
+        // value read back may differ
+        if (ok && (!isWrite || (GetPolicy(addr+q) == EMIO_CACHE_WRITE_THROUGH))) {
+            values[idx] = isBlock ? bswap_32(data[q]) : data[q];
+            valid[idx] = true;
+            updated = true;
+        }
+        else {
+            valid[idx] = false;
+        }
+    }
+    if (isWrite && updated)
+        stats.numWrites++;
+}
+
+bool EMIO_Interface_Cached::CachedRead(uint16_t addr, uint32_t *data, unsigned int nBytes, bool isBlock)
+{
+    unsigned int nQuads = isBlock ? (nBytes+3)/4 : 1;
+    if (!IsCached(addr, nQuads)) {
+        stats.numUncached++;
+        return isBlock ? emio->ReadBlock(addr, data, nBytes) : emio->ReadQuadlet(addr, *data);
+    }
+    if (Lookup(addr, data, nQuads, isBlock)) {
+        stats.numHits++;
+        return true;
+    }
+    stats.numMisses++;
+    bool ok = isBlock ? emio->ReadBlock(addr, data, nBytes) : emio->ReadQuadlet(addr, *data);
+    if (ok)
+        Update(addr, data, nQuads, isBlock, false, true);
+    return ok;
+}
+
+bool EMIO_Interface_Cached::ReadQuadlet(uint16_t addr, uint32_t &data)
+{
+    return CachedRead(addr, &data, 4, false);
+}
+
+bool EMIO_Interface_Cached::WriteQuadlet(uint16_t addr, uint32_t data)
+{
+    bool ok = emio->WriteQuadlet(addr, data);
+    if (IsCached(addr, 1))
+        Update(addr, &data, 1, false, true, ok);
+    return ok;
+}
+
+bool EMIO_Interface_Cached::ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+{
+    return CachedRead(addr, data, nBytes, true);
+}
+
+bool EMIO_Interface_Cached::WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes)
+{
+    unsigned int nQuads = (nBytes+3)/4;
+    bool ok = emio->WriteBlock(addr, data, nBytes);
+    if (IsCached(addr, nQuads))
+        Update(addr, data, nQuads, true, true, ok);
+    return ok;
+}
+
+bool EMIO_Interface_Cached::RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass)
+{
+    // Reads that can be served from the cache are removed from the batch; the other
+    // requests are forwarded (in order) to the underlying interface as one batch. The
+    // cache is then updated in request order, so that a read served from the cache
+    // reflects any earlier write in the batch.
+    fwdReqs.clear();
+    fwdIndex.clear();
+    unsigned int i;
+    for (i = 0; i < num; i++) {
+        const EMIO_Request &req = reqs[i];
+        if (!BatchSelect(req, pass))
+            continue;
+        bool isBlock = (req.opType == EMIO_READ_BLOCK);
+        unsigned int nQuads = isBlock ? (req.nBytes+3)/4 : 1;
+        if (!req.IsWrite() && Lookup(req.addr, 0, nQuads, isBlock))
+            continue;
+        fwdReqs.push_back(req);
+        fwdIndex.push_back(i);
+    }
+
+    bool ret = true;
+    if (!fwdReqs.empty())
+        ret = emio->ExecuteBatch(&fwdReqs[0], fwdReqs.size(), flags & EMIO_BATCH_STOP_ON_ERR);
+
+    size_t f = 0;
+    for (i = 0; i < num; i++) {
+        EMIO_Request &req = reqs[i];
+        if (!BatchSelect(req, pass))
+            continue;
+        bool isBlock = (req.opType == EMIO_READ_BLOCK) || (req.opType == EMIO_WRITE_BLOCK);
+        unsigned int nQuads = isBlock ? (req.nBytes+3)/4 : 1;
+        if ((f < fwdIndex.size()) && (fwdIndex[f] == i)) {
+            req.status = fwdReqs[f++].status;
+            if (req.status == EMIO_REQ_PENDING)
+                break;                      // batch stopped on error
+            bool ok = (req.status == EMIO_REQ_OK);
+            bool isCached = IsCached(req.addr, nQuads);
+            if (!req.IsWrite()) {
+                if (isCached) stats.numMisses++;
+                else stats.numUncached++;
+            }
+            if (isCached && (ok || req.IsWrite()))
+                Update(req.addr, req.data, nQuads, isBlock, req.IsWrite(), ok);
+        }
+        else if (Lookup(req.addr, req.data, nQuads, isBlock)) {
+            stats.numHits++;
+            req.status = EMIO_REQ_OK;
+        }
+        else {
+            // Invalidated by an earlier write in the batch
+            req.status = CachedRead(req.addr, req.data, req.nBytes, isBlock) ? EMIO_REQ_OK : EMIO_REQ_FAILED;
+        }
+        if (req.status == EMIO_REQ_FAILED) {
+            ret = false;
+            if (flags & EMIO_BATCH_STOP_ON_ERR)
+                break;
+        }
+    }
+    return ret;
+}
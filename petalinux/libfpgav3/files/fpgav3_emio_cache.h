@@ -0,0 +1,142 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_cache (Linux library)
+ *
+ * This file defines EMIO_Interface_Cached, a derived class that adds a shadow-register
+ * cache to another EMIO_Interface (e.g., EMIO_Interface_Mmap), so that reads of registers
+ * whose value is already known do not require a bus transaction. The cache is organized
+ * as address ranges, each with a policy:
+ *
+ *    EMIO_CACHE_IMMUTABLE      the register does not change (e.g., hardware version);
+ *                              it is read from the FPGA once and then served from the cache
+ *    EMIO_CACHE_WRITE_THROUGH  the register only changes when written by this process
+ *                              (e.g., Ethernet control); writes go to the FPGA and update
+ *                              the cache, reads are served from the cache when valid
+ *    EMIO_CACHE_NONE           uncached (the default for all other addresses)
+ *
+ * The cache cannot detect changes made by other processes or by reprogramming the FPGA;
+ * in that case, the application must call Invalidate.
+ */
+
+#ifndef FPGAV3_EMIO_CACHE_H
+#define FPGAV3_EMIO_CACHE_H
+
+#include <vector>
+#include "fpgav3_emio.h"
+
+enum EMIO_CachePolicy { EMIO_CACHE_NONE, EMIO_CACHE_IMMUTABLE, EMIO_CACHE_WRITE_THROUGH };
+
+// Registers cached by default (see EMIO_Interface_Cached::AddDefaultRanges)
+const uint16_t EMIO_CACHE_ADDR_HW_VERSION = 4;        // hardware version (BCFG)
+const uint16_t EMIO_CACHE_ADDR_ETH_CTRL   = 12;       // Ethernet control
+const uint16_t EMIO_CACHE_ADDR_PROM       = EMIO_ADDR_PROM_DATA;    // PROM data (see WritePromData)
+const unsigned int EMIO_CACHE_PROM_QUADS  = EMIO_PROM_DATA_QUADS;
+
+// Cache statistics (a block transfer is counted as one access)
+struct EMIO_CacheStats {
+    unsigned long numHits;          // reads served from the cache
+    unsigned long numMisses;        // reads of cached addresses that accessed the FPGA
+    unsigned long numUncached;      // reads of uncached addresses
+    unsigned long numWrites;        // writes that updated the cache
+    unsigned long numInvalidations; // calls to Invalidate
+
+    EMIO_CacheStats() : numHits(0), numMisses(0), numUncached(0), numWrites(0), numInvalidations(0) {}
+};
+
+class EMIO_Interface_Cached : public EMIO_Interface
+{
+    struct Range {
+        uint16_t addr;
+        unsigned int nQuads;
+        EMIO_CachePolicy policy;
+        unsigned int first;         // index of first entry in values/valid
+    };
+
+    EMIO_Interface *emio;           // underlying interface (not owned)
+    std::vector<Range> ranges;
+    std::vector<uint32_t> values;   // cached values (as returned by ReadQuadlet)
+    std::vector<bool> valid;
+    EMIO_CacheStats stats;
+    std::vector<EMIO_Request> fwdReqs;      // requests forwarded by RunBatch
+    std::vector<unsigned int> fwdIndex;     // index of each forwarded request
+
+public:
+
+    // If useDefaultRanges is true, AddDefaultRanges is called
+    EMIO_Interface_Cached(EMIO_Interface *emioIntf, bool useDefaultRanges = true);
+
+    bool IsOK() const
+    { return emio && emio->IsOK(); }
+
+    unsigned int GetVersion() const
+    { return emio->GetVersion(); }
+
+    // Returns the underlying interface
+    EMIO_Interface *GetInterface() const
+    { return emio; }
+
+    // The event mode and bus lock are set on the underlying interface. The deadline, retries
+    // and error code (see EMIO_Interface::SetDeadline) are those of the underlying interface.
+    void SetEventMode(bool newState);
+
+    bool SetBusLock(bool enable, const char *name = EMIO_BUSLOCK_DEFAULT_NAME);
+
+    // SetPolicy
+    //   Sets the policy of nQuads registers starting at addr. If the range was previously
+    //   added (same addr and nQuads), its policy is changed and its entries are invalidated.
+    //   Otherwise, a new range is added (ranges cannot overlap); EMIO_CACHE_NONE does not
+    //   add a range, but can be used to disable caching of an existing range.
+    // Returns: false if the range overlaps another range
+    bool SetPolicy(uint16_t addr, unsigned int nQuads, EMIO_CachePolicy policy);
+
+    // Returns the policy for the specified address
+    EMIO_CachePolicy GetPolicy(uint16_t addr) const;
+
+    // Adds the hardware version (immutable), Ethernet control and PROM data (write-through)
+    void AddDefaultRanges();
+
+    // Invalidate the whole cache, or nQuads registers starting at addr
+    void Invalidate();
+
+    void Invalidate(uint16_t addr, unsigned int nQuads = 1);
+
+    // Get/Reset statistics
+    const EMIO_CacheStats &GetStats() const
+    { return stats; }
+
+    void ResetStats()
+    { stats = EMIO_CacheStats(); }
+
+    bool ReadQuadlet(uint16_t addr, uint32_t &data);
+
+    bool WriteQuadlet(uint16_t addr, uint32_t data);
+
+    bool ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes);
+
+    bool WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes);
+
+protected:
+
+    // Returns the index of the cache entry for addr, or -1 if not cached
+    int FindEntry(uint16_t addr) const;
+
+    // Returns true if any of the nQuads registers starting at addr is cached
+    bool IsCached(uint16_t addr, unsigned int nQuads) const;
+
+    // Returns true if all nQuads registers starting at addr are in the cache; if data is
+    // not 0, the values are copied to it (byte-swapped if isBlock)
+    bool Lookup(uint16_t addr, uint32_t *data, unsigned int nQuads, bool isBlock) const;
+
+    // Updates the cache after a read or write of the FPGA (ok is false if it failed)
+    void Update(uint16_t addr, const uint32_t *data, unsigned int nQuads, bool isBlock,
+                bool isWrite, bool ok);
+
+    // Read via the cache
+    bool CachedRead(uint16_t addr, uint32_t *data, unsigned int nBytes, bool isBlock);
+
+    bool RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass);
+};
+
+#endif // FPGAV3_EMIO_CACHE_H
@@ -0,0 +1,349 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include "fpgav3_emio_cyclic.h"
+
+// Maximum number of attempts to get a consistent copy of a double buffer
+const unsigned int CYCLIC_COPY_RETRIES = 100;
+
+// Local functions for timespec arithmetic
+static inline void AddNs(struct timespec &ts, long ns)
+{
+    ts.tv_nsec += ns;
+    while (ts.tv_nsec >= 1000000000L) {
+        ts.tv_nsec -= 1000000000L;
+        ts.tv_sec++;
+    }
+}
+
+static inline int64_t DiffNs(const struct timespec &t1, const struct timespec &t0)
+{
+    return static_cast<int64_t>(t1.tv_sec-t0.tv_sec)*1000000000LL + (t1.tv_nsec-t0.tv_nsec);
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_CyclicStats
+
+void EMIO_CyclicStats::Clear()
+{
+    numCycles = 0;
+    numOverruns = 0;
+    numMissed = 0;
+    numErrors = 0;
+    numDeadlineMisses = 0;
+    wakeLatency.Clear();
+    execTime.Clear();
+}
+
+void EMIO_CyclicStats::Print(std::ostream &outStr) const
+{
+    std::ios_base::fmtflags oldFlags = outStr.flags();
+    std::streamsize oldPrec = outStr.precision();
+    outStr << std::fixed << std::setprecision(3);
+    outStr << "Cycles: " << numCycles << ", overruns: " << numOverruns << ", missed: " << numMissed
+           << ", errors: " << numErrors << ", deadline misses: " << numDeadlineMisses << std::endl;
+    outStr << "                       mean       p50       p99     p99.9       max (us)" << std::endl;
+    const EMIO_Histogram *h[2] = { &wakeLatency, &execTime };
+    const char *names[2] = { "Wake latency", "Execution" };
+    for (unsigned int i = 0; i < 2; i++) {
+        outStr << std::left << std::setw(16) << names[i] << std::right
+               << std::setw(11) << h[i]->GetMean_us() << std::setw(10) << h[i]->GetPercentile_us(50.0)
+               << std::setw(10) << h[i]->GetPercentile_us(99.0) << std::setw(10) << h[i]->GetPercentile_us(99.9)
+               << std::setw(10) << h[i]->GetMax_us() << std::endl;
+    }
+    outStr.flags(oldFlags);
+    outStr.precision(oldPrec);
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_CyclicScheduler
+
+EMIO_CyclicScheduler::EMIO_CyclicScheduler(EMIO_Interface *emioIntf, double rate_hz, int cpuCore,
+                                           int rtPriority) :
+    emio(emioIntf), baseRate_hz(rate_hz), cpu(cpuCore), priority(rtPriority), callback(0), cbArg(0),
+    isRunning(false), stopRequested(false), useDeadline(false)
+{
+    period_ns = (rate_hz > 0.0) ? static_cast<long>(1.0e9/rate_hz+0.5) : 0;
+}
+
+EMIO_CyclicScheduler::~EMIO_CyclicScheduler()
+{
+    Stop();
+    for (size_t i = 0; i < transfers.size(); i++)
+        delete transfers[i];
+}
+
+int EMIO_CyclicScheduler::AddTransfer(EMIO_OpType opType, uint16_t addr, unsigned int nQuads,
+                                      double rate_hz, unsigned int phase)
+{
+    if (isRunning) {
+        std::cout << "EMIO_CyclicScheduler: cannot add transfer while running" << std::endl;
+        return -1;
+    }
+    if ((opType == EMIO_READ_QUAD) || (opType == EMIO_WRITE_QUAD))
+        nQuads = 1;
+    if (nQuads == 0)
+        return -1;
+    unsigned int divisor = 1;
+    if (rate_hz > 0.0) {
+        divisor = static_cast<unsigned int>(baseRate_hz/rate_hz+0.5);
+        if ((divisor == 0) || (std::abs(divisor*rate_hz-baseRate_hz) > 1.0e-6*baseRate_hz)) {
+            std::cout << "EMIO_CyclicScheduler: rate " << rate_hz << " Hz does not divide base rate "
+                      << baseRate_hz << " Hz" << std::endl;
+            return -1;
+        }
+    }
+    if (phase >= divisor) {
+        std::cout << "EMIO_CyclicScheduler: invalid phase " << phase << std::endl;
+        return -1;
+    }
+    Transfer *xfer = new Transfer;
+    xfer->opType = opType;
+    xfer->addr = addr;
+    xfer->nQuads = nQuads;
+    xfer->divisor = divisor;
+    xfer->phase = phase;
+    xfer->seq = 0;
+    for (unsigned int i = 0; i < 2; i++) {
+        xfer->buffer[i].assign(nQuads, 0);
+        memset(&xfer->info[i], 0, sizeof(EMIO_CyclicSnapshot));
+    }
+    transfers.push_back(xfer);
+    batch.reserve(transfers.size());
+    batchIds.reserve(transfers.size());
+    return static_cast<int>(transfers.size()-1);
+}
+
+bool EMIO_CyclicScheduler::GetReadData(int id, uint32_t *data, EMIO_CyclicSnapshot *info) const
+{
+    if ((id < 0) || (static_cast<size_t>(id) >= transfers.size()))
+        return false;
+    const Transfer *xfer = transfers[id];
+    if ((xfer->opType != EMIO_READ_QUAD) && (xfer->opType != EMIO_READ_BLOCK))
+        return false;
+    // The scheduler only overwrites buffer[seq&1] after it has published seq+1, so the
+    // copy is consistent if seq did not change
+    for (unsigned int n = 0; n < CYCLIC_COPY_RETRIES; n++) {
+        uint32_t seq = __atomic_load_n(&xfer->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0)
+            return false;
+        memcpy(data, &xfer->buffer[seq&1][0], xfer->nQuads*sizeof(uint32_t));
+        EMIO_CyclicSnapshot snap = xfer->info[seq&1];
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&xfer->seq, __ATOMIC_RELAXED) == seq) {
+            if (info) {
+                *info = snap;
+                info->seq = seq;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+bool EMIO_CyclicScheduler::SetWriteData(int id, const uint32_t *data)
+{
+    if ((id < 0) || (static_cast<size_t>(id) >= transfers.size()))
+        return false;
+    Transfer *xfer = transfers[id];
+    if ((xfer->opType != EMIO_WRITE_QUAD) && (xfer->opType != EMIO_WRITE_BLOCK))
+        return false;
+    // Same protocol as for read data, with the roles reversed
+    uint32_t seq = __atomic_load_n(&xfer->seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&xfer->buffer[(seq+1)&1][0], data, xfer->nQuads*sizeof(uint32_t));
+    __atomic_store_n(&xfer->seq, seq+1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool EMIO_CyclicScheduler::Start()
+{
+    if (isRunning)
+        return true;
+    if (period_ns <= 0) {
+        std::cout << "EMIO_CyclicScheduler: invalid rate " << baseRate_hz << " Hz" << std::endl;
+        return false;
+    }
+    // Data for write transfers (copied from the double buffer before each cycle)
+    for (size_t i = 0; i < transfers.size(); i++) {
+        Transfer *xfer = transfers[i];
+        if ((xfer->opType == EMIO_WRITE_QUAD) || (xfer->opType == EMIO_WRITE_BLOCK))
+            xfer->work.assign(xfer->nQuads, 0);
+    }
+    __atomic_store_n(&stopRequested, false, __ATOMIC_RELAXED);
+    int ret = pthread_create(&thread, NULL, ThreadEntry, this);
+    if (ret != 0) {
+        std::cout << "EMIO_CyclicScheduler: failed to create thread (error " << ret << ")" << std::endl;
+        return false;
+    }
+    isRunning = true;
+    if (cpu >= 0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        if (pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet) != 0)
+            std::cout << "EMIO_CyclicScheduler: failed to pin scheduler to CPU " << cpu << std::endl;
+    }
+    if (priority > 0) {
+        struct sched_param param;
+        param.sched_priority = priority;
+        if (pthread_setschedparam(thread, SCHED_FIFO, &param) != 0)
+            std::cout << "EMIO_CyclicScheduler: failed to set real-time priority " << priority
+                      << " (requires root or CAP_SYS_NICE)" << std::endl;
+    }
+    return true;
+}
+
+void EMIO_CyclicScheduler::Stop()
+{
+    if (!isRunning)
+        return;
+    __atomic_store_n(&stopRequested, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    isRunning = false;
+}
+
+void EMIO_CyclicScheduler::GetStats(EMIO_CyclicStats &outStats)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    outStats = stats;
+}
+
+void EMIO_CyclicScheduler::ResetStats()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats.Clear();
+}
+
+void *EMIO_CyclicScheduler::ThreadEntry(void *arg)
+{
+    static_cast<EMIO_CyclicScheduler *>(arg)->Run();
+    return 0;
+}
+
+bool EMIO_CyclicScheduler::RunCycle(uint64_t cycle)
+{
+    batch.clear();
+    batchIds.clear();
+    for (size_t i = 0; i < transfers.size(); i++) {
+        Transfer *xfer = transfers[i];
+        if ((cycle % xfer->divisor) != xfer->phase)
+            continue;
+        uint32_t seq = __atomic_load_n(&xfer->seq, __ATOMIC_ACQUIRE);
+        EMIO_Request req;
+        if ((xfer->opType == EMIO_READ_QUAD) || (xfer->opType == EMIO_READ_BLOCK)) {
+            // Read into the buffer that is not published
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            req = EMIO_Request::ReadBlock(xfer->addr, &xfer->buffer[(seq+1)&1][0], 4*xfer->nQuads);
+        }
+        else {
+            // Skip write transfer until data has been provided
+            if (seq == 0)
+                continue;
+            unsigned int n;
+            for (n = 0; n < CYCLIC_COPY_RETRIES; n++) {
+                memcpy(&xfer->work[0], &xfer->buffer[seq&1][0], xfer->nQuads*sizeof(uint32_t));
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                uint32_t seq2 = __atomic_load_n(&xfer->seq, __ATOMIC_ACQUIRE);
+                if (seq2 == seq)
+                    break;
+                seq = seq2;
+            }
+            if (n == CYCLIC_COPY_RETRIES)
+                continue;
+            req = EMIO_Request::WriteBlock(xfer->addr, &xfer->work[0], 4*xfer->nQuads);
+        }
+        req.opType = xfer->opType;
+        batch.push_back(req);
+        batchIds.push_back(i);
+    }
+    if (batch.empty())
+        return true;
+
+    bool ret = emio->ExecuteBatch(&batch[0], batch.size());
+
+    // Publish read data
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (size_t j = 0; j < batch.size(); j++) {
+        Transfer *xfer = transfers[batchIds[j]];
+        if ((xfer->opType != EMIO_READ_QUAD) && (xfer->opType != EMIO_READ_BLOCK))
+            continue;
+        uint32_t seq = xfer->seq;
+        EMIO_CyclicSnapshot &snap = xfer->info[(seq+1)&1];
+        snap.cycle = cycle;
+        snap.time = now;
+        snap.seq = seq+1;
+        snap.ok = (batch[j].status == EMIO_REQ_OK);
+        __atomic_store_n(&xfer->seq, seq+1, __ATOMIC_RELEASE);
+    }
+    return ret;
+}
+
+void EMIO_CyclicScheduler::Run()
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    AddNs(deadline, period_ns);
+    uint64_t cycle = 0;
+    while (!__atomic_load_n(&stopRequested, __ATOMIC_ACQUIRE)) {
+        // Sleep until the absolute deadline (restart if interrupted by a signal)
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0);
+        struct timespec wake, end;
+        clock_gettime(CLOCK_MONOTONIC, &wake);
+
+        EMIO_CyclicCycleInfo info;
+        info.cycle = cycle;
+        info.deadline = deadline;
+        info.wakeLatency_us = DiffNs(wake, deadline)*1.0e-3;
+        bool deadlineMiss = false;
+        if (useDeadline) {
+            struct timespec cycleEnd = deadline;
+            AddNs(cycleEnd, period_ns);
+            emio->SetDeadline(cycleEnd);
+            info.ok = RunCycle(cycle);
+            deadlineMiss = !info.ok && (emio->GetLastError() == EMIO_ERR_DEADLINE);
+            emio->ClearDeadline();
+        }
+        else {
+            info.ok = RunCycle(cycle);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        info.exec_us = DiffNs(end, wake)*1.0e-3;
+        if (callback) {
+            (*callback)(info, cbArg);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+        }
+
+        // Next deadline; after an overrun, skip the cycles whose deadline has passed
+        // (rather than running them late, back-to-back)
+        AddNs(deadline, period_ns);
+        cycle++;
+        unsigned long missed = 0;
+        bool overrun = (DiffNs(end, deadline) > 0);
+        while (DiffNs(end, deadline) > 0) {
+            AddNs(deadline, period_ns);
+            cycle++;
+            missed++;
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.numCycles++;
+        if (overrun)
+            stats.numOverruns++;
+        stats.numMissed += missed;
+        if (!info.ok)
+            stats.numErrors++;
+        if (deadlineMiss)
+            stats.numDeadlineMisses++;
+        int64_t lat_ns = DiffNs(wake, info.deadline);
+        stats.wakeLatency.Add((lat_ns > 0) ? static_cast<uint64_t>(lat_ns) : 0);
+        stats.execTime.Add(static_cast<uint64_t>(DiffNs(end, wake)));
+    }
+}
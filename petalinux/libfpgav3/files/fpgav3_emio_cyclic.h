@@ -0,0 +1,174 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_cyclic (Linux library)
+ *
+ * Cyclic I/O scheduler for an EMIO_Interface. A set of periodic block (or quadlet)
+ * transfers is registered, each with a rate that divides the base rate of the
+ * scheduler (e.g., 4 kHz base rate, some blocks at 1 kHz). A dedicated thread wakes
+ * up at absolute deadlines (clock_nanosleep with TIMER_ABSTIME, so that errors do not
+ * accumulate) and executes the transfers that are due as a single batch.
+ *
+ * The data of each read transfer is published in a double buffer with a sequence
+ * number, so that consumers (other threads) can get a consistent snapshot without
+ * locking (GetReadData). Similarly, consumers provide the data for write transfers
+ * with SetWriteData, and the scheduler uses the most recent data.
+ *
+ * For each cycle, the scheduler records the wake-up latency (jitter with respect to the
+ * deadline) and execution time in histograms, and counts overruns (cycles that did not
+ * finish before the next deadline) and missed cycles (skipped after an overrun). Optionally
+ * (SetCycleDeadline), the transfers of each cycle are bounded by the next deadline, so
+ * that a stalled bus aborts the transfers instead of delaying the following cycles.
+ */
+
+#ifndef FPGAV3_EMIO_CYCLIC_H
+#define FPGAV3_EMIO_CYCLIC_H
+
+#include <pthread.h>
+#include <mutex>
+#include <vector>
+#include "fpgav3_emio.h"
+
+// Information about one cycle, passed to the cycle callback
+struct EMIO_CyclicCycleInfo {
+    uint64_t cycle;                 // cycle number (including missed cycles)
+    struct timespec deadline;       // start time of the cycle (CLOCK_MONOTONIC)
+    double wakeLatency_us;          // wake-up time minus deadline
+    double exec_us;                 // time to execute the transfers
+    bool ok;                        // true if all transfers were successful
+};
+
+// Called by the scheduler thread after the transfers of each cycle are executed
+// and published (e.g., to compute the next write data); it should be short.
+typedef void (*EMIO_CyclicCallback)(const EMIO_CyclicCycleInfo &info, void *arg);
+
+// Scheduler statistics
+struct EMIO_CyclicStats {
+    unsigned long numCycles;        // number of cycles executed
+    unsigned long numOverruns;      // number of cycles that finished after the next deadline
+    unsigned long numMissed;        // number of cycles skipped due to overruns
+    unsigned long numErrors;        // number of cycles with at least one failed transfer
+    unsigned long numDeadlineMisses;  // number of cycles whose transfers were aborted at the deadline
+    EMIO_Histogram wakeLatency;     // wake-up latency (jitter)
+    EMIO_Histogram execTime;        // execution time of transfers (and callback)
+
+    EMIO_CyclicStats() : numCycles(0), numOverruns(0), numMissed(0), numErrors(0), numDeadlineMisses(0) {}
+
+    void Clear();
+
+    void Print(std::ostream &outStr) const;
+};
+
+// Snapshot information returned by GetReadData
+struct EMIO_CyclicSnapshot {
+    uint64_t cycle;                 // cycle in which the data was read
+    struct timespec time;           // time at which the data was read (CLOCK_MONOTONIC)
+    uint32_t seq;                   // number of times the data was published
+    bool ok;                        // true if the read was successful
+};
+
+class EMIO_CyclicScheduler
+{
+    struct Transfer {
+        EMIO_OpType opType;
+        uint16_t addr;
+        unsigned int nQuads;
+        unsigned int divisor;       // executed every divisor cycles
+        unsigned int phase;         // executed when (cycle % divisor) == phase
+        uint32_t seq;               // incremented when buffer[seq&1] is published
+        std::vector<uint32_t> buffer[2];
+        EMIO_CyclicSnapshot info[2];
+        std::vector<uint32_t> work;   // write data used by the scheduler
+    };
+
+    EMIO_Interface *emio;           // interface (not owned)
+    double baseRate_hz;
+    long period_ns;
+    int cpu;                        // CPU core for scheduler thread (-1 for any)
+    int priority;                   // SCHED_FIFO priority (0 for default scheduling)
+    std::vector<Transfer *> transfers;
+    std::vector<EMIO_Request> batch;
+    std::vector<unsigned int> batchIds;   // transfer of each request in batch
+    EMIO_CyclicCallback callback;
+    void *cbArg;
+    pthread_t thread;
+    bool isRunning;
+    bool stopRequested;
+    bool useDeadline;               // true if transfers are bounded by the next deadline
+    std::mutex statsMutex;
+    EMIO_CyclicStats stats;
+
+    static void *ThreadEntry(void *arg);
+
+    void Run();
+
+    // Execute the transfers that are due in the specified cycle
+    bool RunCycle(uint64_t cycle);
+
+public:
+
+    // The scheduler thread is created by Start. By default, it is pinned to CPU 1
+    // (see EMIO_AsyncWorker) and uses default scheduling; a real-time priority
+    // (e.g., 80) is recommended for 1-4 kHz loops.
+    EMIO_CyclicScheduler(EMIO_Interface *emioIntf, double rate_hz, int cpuCore = 1, int rtPriority = 0);
+
+    ~EMIO_CyclicScheduler();
+
+    double GetBaseRate_hz() const
+    { return baseRate_hz; }
+
+    // AddTransfer
+    //   Registers a periodic transfer (only while the scheduler is stopped).
+    // Parameters:
+    //     opType   EMIO_READ_BLOCK, EMIO_WRITE_BLOCK, EMIO_READ_QUAD or EMIO_WRITE_QUAD
+    //     addr     16-bit register address
+    //     nQuads   number of quadlets (1 for quadlet transfers)
+    //     rate_hz  transfer rate; the base rate must be a multiple of it (0 for base rate)
+    //     phase    cycle offset (0 to divisor-1), to spread slower transfers over cycles
+    // Returns: transfer id (0, 1, ...), or -1 on error
+    int AddTransfer(EMIO_OpType opType, uint16_t addr, unsigned int nQuads, double rate_hz = 0.0,
+                    unsigned int phase = 0);
+
+    void SetCycleCallback(EMIO_CyclicCallback cb, void *arg)
+    { callback = cb; cbArg = arg; }
+
+    // Enable/disable cycle deadline (only while the scheduler is stopped). If enabled, the
+    // deadline of the interface (see EMIO_Interface::SetDeadline) is set to the start of the
+    // next cycle while the transfers are executed, so that transfers that would overrun the
+    // cycle are aborted (and counted in numDeadlineMisses).
+    void SetCycleDeadline(bool enable)
+    { useDeadline = enable; }
+
+    // Start the scheduler thread; the first cycle starts one period later. Returns false
+    // on error. If the CPU affinity or priority cannot be set, a message is printed and the
+    // scheduler runs with default settings.
+    bool Start();
+
+    // Stop the scheduler thread (after the current cycle)
+    void Stop();
+
+    bool IsRunning() const
+    { return isRunning; }
+
+    // GetReadData
+    //   Gets the most recent data of a read transfer, without blocking the scheduler.
+    // Parameters:
+    //     id     transfer id
+    //     data   array of nQuads quadlets (as returned by ReadBlock or ReadQuadlet)
+    //     info   if not 0, set to information about the snapshot
+    // Returns:   false if id is not a read transfer or no data has been read yet
+    bool GetReadData(int id, uint32_t *data, EMIO_CyclicSnapshot *info = 0) const;
+
+    // SetWriteData
+    //   Sets the data for a write transfer, used from the next time the transfer is
+    //   executed. Only one thread should call SetWriteData for a given transfer.
+    bool SetWriteData(int id, const uint32_t *data);
+
+    // Get/Reset statistics (can be called while running)
+    void GetStats(EMIO_CyclicStats &outStats);
+
+    void ResetStats();
+};
+
+#endif // FPGAV3_EMIO_CYCLIC_H
@@ -5,6 +5,7 @@
 #include <gpiod.h>
 #include <byteswap.h>
 #include "fpgav3_emio_gpiod.h"
+#include "fpgav3_probes.h"
 
 // Some hard-coded values
 const unsigned int INDEX_EMIO_START = 54;
@@ -15,8 +16,17 @@ const unsigned int INDEX_EMIO_END = 118;
 // Thus, moved CTRL_REQ_BUS to a separate line (req_bus_line).
 enum { CTRL_REG_WEN=0, CTRL_BLK_START, CTRL_BLK_END, CTRL_MAX };
 
-int ctrl_zero[CTRL_MAX];    // all 0
-int ctrl_qwrite[CTRL_MAX];  // quadlet write (reg_wen, blk_end)
+// Bit masks of ctrl line values (see SetCtrlLines)
+const uint32_t CTRL_BIT_BLK_START = (1 << CTRL_BLK_START);
+const uint32_t CTRL_BIT_BLK_END = (1 << CTRL_BLK_END);
+
+// For quadlet write, set reg_wen, blk_end and req_bus to 1
+// Rising edge of req_bus requests firmware to write register; note that this
+// can be set at the same time as the other signals because it is delayed in
+// the firmware.
+// Note that reg_wen is no longer used (version 1) and blk_end is no longer used
+// for quadlet write (version 1).
+const uint32_t CTRL_BITS_QWRITE = (1 << CTRL_REG_WEN) | (1 << CTRL_BLK_END);
 
 // Return GPIOD library version string
 const char *EMIO_gpiod_version_string()
@@ -37,7 +47,8 @@ struct gpiod_info {
     struct gpiod_line_bulk ctrl_lines;
 };
 
-EMIO_Interface_Gpiod::EMIO_Interface_Gpiod() : EMIO_Interface()
+EMIO_Interface_Gpiod::EMIO_Interface_Gpiod() : EMIO_Interface(), grantEvents(false), shadowValid(0),
+                                               numLineWrites(0), numLineWritesSkipped(0)
 {
     if (!Init()) {
         delete info;
@@ -58,6 +69,7 @@ bool EMIO_Interface_Gpiod::Init()
     unsigned int bus_grant_offset;
     unsigned int addr_lsb_offset;
     unsigned int ctrl_offsets[CTRL_MAX];
+    int ctrl_values[CTRL_MAX];
     int version_values[4];
     int reg_addr_values[16];
     size_t i;
@@ -72,17 +84,8 @@ bool EMIO_Interface_Gpiod::Init()
         reg_addr_offsets[i] = INDEX_EMIO_START+47-i;
         reg_addr_values[i] = 0;
     }
-    for (i = 0; i < CTRL_MAX; i++) {
-        ctrl_zero[i] = 0;
-        ctrl_qwrite[i] = 0;
-    }
-
-    // For quadlet write, set reg_wen, blk_end and req_bus to 1
-    // Rising edge of req_bus requests firmware to write register; note that this
-    // can be set at the same time as the other signals because it is delayed in
-    // the firmware.
-    ctrl_qwrite[CTRL_REG_WEN] = 1;   // no longer used (version 1)
-    ctrl_qwrite[CTRL_BLK_END] = 1;   // no longer used for quadlet write (version 1)
+    for (i = 0; i < CTRL_MAX; i++)
+        ctrl_values[i] = 0;
 
     req_bus_offset = INDEX_EMIO_START+48;
     op_done_offset = INDEX_EMIO_START+49;
@@ -177,9 +180,10 @@ bool EMIO_Interface_Gpiod::Init()
         return false;
     }
 
-    // Following only available in version 1+, and is not currently used anyway
+    // Following only available in version 1+; used to measure the bus arbitration time
+    // (see GrantSample). The line is only requested (for events) in timing mode 2.
     info->bus_grant_line = gpiod_chip_get_line(info->chip, bus_grant_offset);
-    gpiod_line_request_rising_edge_events(info->bus_grant_line, "libfpgav3");
+    grantEvents = false;
 
     // Get req_bus line (previously was included in ctrl_lines)
     info->req_bus_line = gpiod_chip_get_line(info->chip, req_bus_offset);
@@ -202,12 +206,19 @@ bool EMIO_Interface_Gpiod::Init()
         return false;
     }
     // Set all lines to output, initialized to 0
-    if (gpiod_line_request_bulk_output(&info->ctrl_lines, "libfpgav3", ctrl_zero) != 0) {
+    if (gpiod_line_request_bulk_output(&info->ctrl_lines, "libfpgav3", ctrl_values) != 0) {
         std::cout << "Failed to set ctrl_lines to output" << std::endl;
         gpiod_chip_close(info->chip);
         return false;
     }
 
+    // All output lines were initialized to 0 (data lines are input)
+    shadowValid = 0;
+    UpdateShadow(SHADOW_ADDR, 0, true);
+    UpdateShadow(SHADOW_LSB, 0, true);
+    UpdateShadow(SHADOW_CTRL, 0, true);
+    UpdateShadow(SHADOW_REQ_BUS, 0, true);
+
     // Make sure event mode is properly initialized
     SetEventMode(useEvents);
 
@@ -241,16 +252,28 @@ void EMIO_Interface_Gpiod::SetEventMode(bool newState)
     }
 }
 
-// Local method to wait for op_done to be set, using either events or polling (default)
-bool EMIO_Interface_Gpiod::WaitOpDone(const char *opType, unsigned int num)
+// Local method to wait for op_done to be set, using either events or polling (default).
+// isWrite selects the edge statistics (see EdgeRecord) and the operation in messages.
+bool EMIO_Interface_Gpiod::WaitOpDone(bool isWrite, unsigned int num)
 {
+    const char *opType = isWrite ? "write" : "read";
     bool ret;
+    FPGAV3_PROBE3(emio_wait_start, opType, num, 1);
     if (useEvents) {
+        fpgav3_time_t waitStart = 0;
+        if (traceRec)
+            GetCurTime(&waitStart);
         struct timespec timeout;
         struct gpiod_line_event event;
-        timeout.tv_sec = timeout_us*1.0e-6;
-        timeout.tv_nsec = (timeout_us - 1.0e6*timeout.tv_sec)*1.0e3;
+        double waitLimit_us = DeadlineLimit_us(timeout_us);
+        timeout.tv_sec = waitLimit_us*1.0e-6;
+        timeout.tv_nsec = (waitLimit_us - 1.0e6*timeout.tv_sec)*1.0e3;
         int rc = gpiod_line_event_wait(info->op_done_line, &timeout);
+        uint64_t wake_ns = edgeRec ? EMIO_EdgeRecorder::GetMonotonic_ns() : 0;
+        if (traceRec)
+            TraceWait(waitStart);
+        if (rc == 0)
+            WaitTimeout();
         if (isVerbose) {
             if (rc == 0)
                 std::cout << "EMIO event timeout waiting for " << opType << " quadlet " << num << std::endl;
@@ -262,7 +285,12 @@ bool EMIO_Interface_Gpiod::WaitOpDone(const char *opType, unsigned int num)
             if (gpiod_line_event_read(info->op_done_line, &event) != 0) {
                 if (isVerbose)
                     std::cout << "EMIO error reading event for " << opType << " quadlet " << num << std::endl;
-                return false;
+                rc = -1;
+            }
+            else {
+                // The event timestamp is CLOCK_MONOTONIC (Linux 5.7 and later)
+                EdgeRecord(isWrite,
+                           static_cast<uint64_t>(event.ts.tv_sec)*1000000000ULL + event.ts.tv_nsec, wake_ns);
             }
         }
         ret = (rc == 1);
@@ -270,47 +298,231 @@ bool EMIO_Interface_Gpiod::WaitOpDone(const char *opType, unsigned int num)
     else {
        // First, check if op_done is set, since this is often the case
        int val = gpiod_line_get_value(info->op_done_line);
-       if (val <= 0) {
-           fpgav3_time_t waitStart;
-           fpgav3_time_t curTime;
-           GetCurTime(&waitStart);
-           double dt = 0.0;   // elapsed time in us
-           while ((val <= 0) && (dt < timeout_us)) {
-               val = gpiod_line_get_value(info->op_done_line);
-               GetCurTime(&curTime);
-               dt = TimeDiff_us(&waitStart, &curTime);
-           }
+       if (val == 0) {
+           // Poll using the wait policy (see EMIO_Interface::SetWaitPolicy); each poll is
+           // a system call, so EMIO_WAIT_SPIN_YIELD or EMIO_WAIT_ADAPTIVE is recommended
+           // on a loaded system
+           WaitState ws;
+           WaitBegin(ws);
+           while (((val = gpiod_line_get_value(info->op_done_line)) == 0) && WaitContinue(ws));
+           WaitEnd(ws, val == 1);
+           if (val < 0)
+               lastError = EMIO_ERR_IO;
            if (isVerbose) {
                if (val < 0)
                    std::cout << "EMIO error polling op_done for " << opType << " quadlet " << num << std::endl;
                else if (val == 0)
                    std::cout << "EMIO polling timeout waiting for " << opType << " quadlet " << num << std::endl;
                else
-                   std::cout << "Waited " << dt << " us for " << opType << " quadlet " << num << std::endl;
+                   std::cout << "Waited " << WaitElapsed_us(ws) << " us for " << opType << " quadlet " << num
+                             << std::endl;
            }
         }
         ret = (val == 1);
     }
+    FPGAV3_PROBE4(emio_wait_end, opType, num, 1, ret);
     return ret;
 }
 
-// ReadQuadlet: read quadlet from specified address
-bool EMIO_Interface_Gpiod::ReadQuadlet(uint16_t addr, uint32_t &data)
+void EMIO_Interface_Gpiod::SetTimingMode(unsigned int newState)
 {
-    int reg_rdata_values[32];
-    int reg_addr_values[16];
-    size_t i;
+    EMIO_Interface::SetTimingMode(newState);
+    SetGrantEvents(SampleGrant());
+}
 
-    // For timing measurements
-    fpgav3_time_t beforeWait;
-    fpgav3_time_t afterWait;
+// Local method to request bus_grant_line for rising edge events (enable), or to release it
+void EMIO_Interface_Gpiod::SetGrantEvents(bool enable)
+{
+    if (!info || !info->bus_grant_line || (enable == grantEvents))
+        return;
+    if (enable) {
+        grantEvents = (gpiod_line_request_rising_edge_events(info->bus_grant_line, "libfpgav3") == 0);
+        if (!grantEvents && isVerbose)
+            std::cout << "SetTimingMode (gpiod): could not request grant_bus events" << std::endl;
+    }
+    else {
+        gpiod_line_release(info->bus_grant_line);
+        grantEvents = false;
+    }
+}
 
-    // Get start time for measurement
-    if (doTiming > 0)
-        GetCurTime(&startTime);
+void EMIO_Interface_Gpiod::GrantDrain()
+{
+    if (!grantEvents || !SampleGrant())
+        return;
+    struct timespec zero = { 0, 0 };
+    struct gpiod_line_event event;
+    while (gpiod_line_event_wait(info->bus_grant_line, &zero) == 1) {
+        if (gpiod_line_event_read(info->bus_grant_line, &event) != 0)
+            break;
+    }
+}
+
+// Local method called after op_done (and after the end time of the wait phase, so
+// that the system calls are not included in the access time); the bus is granted once
+// per transaction (including block transactions)
+void EMIO_Interface_Gpiod::GrantSample()
+{
+    if (!grantEvents || !SampleGrant())
+        return;
+    struct timespec zero = { 0, 0 };
+    struct gpiod_line_event event;
+    if ((gpiod_line_event_wait(info->bus_grant_line, &zero) == 1) &&
+        (gpiod_line_event_read(info->bus_grant_line, &event) == 0))
+        GrantSeenAt(static_cast<uint64_t>(event.ts.tv_sec)*1000000000ULL + event.ts.tv_nsec);
+}
+
+// Local method called when the bus lock was last held by another owner. The kernel
+// does not report changes to the line direction made by another process (e.g., via mmap),
+// so the data lines are set to input. The other process may also have changed the output
+// lines, so all shadows are invalidated.
+void EMIO_Interface_Gpiod::RevalidateDirection()
+{
+    if (gpiod_line_set_direction_input_bulk(&info->reg_data_lines) != 0)
+        std::cout << "RevalidateDirection (gpiod): could not set data lines as input" << std::endl;
+    isInput = true;
+    shadowValid = 0;
+}
+
+bool EMIO_Interface_Gpiod::NeedsWrite(ShadowGroup group, uint32_t value)
+{
+    if ((shadowValid & (1u << group)) && (shadow[group] == value)) {
+        numLineWritesSkipped++;
+        return false;
+    }
+    numLineWrites++;
+    return true;
+}
 
-    for (i = 0; i < 16; i++)
+// Local method to record the result of a line write; if the write failed, the state of
+// the lines is not known, so the shadow is invalidated (i.e., the next write is issued)
+void EMIO_Interface_Gpiod::UpdateShadow(ShadowGroup group, uint32_t value, bool ok)
+{
+    if (ok) {
+        shadow[group] = value;
+        shadowValid |= (1u << group);
+    }
+    else {
+        shadowValid &= ~(1u << group);
+    }
+}
+
+bool EMIO_Interface_Gpiod::SetAddrLines(uint16_t addr)
+{
+    if (!NeedsWrite(SHADOW_ADDR, addr))
+        return true;
+    int reg_addr_values[16];
+    for (size_t i = 0; i < 16; i++)
         reg_addr_values[i] = (addr&(0x8000>>i)) ? 1 : 0;
+    bool ok = (gpiod_line_set_value_bulk(&info->reg_addr_lines, reg_addr_values) == 0);
+    UpdateShadow(SHADOW_ADDR, addr, ok);
+    return ok;
+}
+
+// The addr_lsb write requests the next quadlet of a block (see EdgeRequestBegin)
+bool EMIO_Interface_Gpiod::SetLsbLine(int value)
+{
+    if (!NeedsWrite(SHADOW_LSB, value))
+        return true;
+    EdgeRequestBegin();
+    bool ok = (gpiod_line_set_value(info->addr_lsb_line, value) == 0);
+    EdgeRequestEnd();
+    UpdateShadow(SHADOW_LSB, value, ok);
+    return ok;
+}
+
+bool EMIO_Interface_Gpiod::SetCtrlLines(uint32_t ctrl)
+{
+    if (!NeedsWrite(SHADOW_CTRL, ctrl))
+        return true;
+    int ctrl_values[CTRL_MAX];
+    for (size_t i = 0; i < CTRL_MAX; i++)
+        ctrl_values[i] = (ctrl&(1u<<i)) ? 1 : 0;
+    bool ok = (gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_values) == 0);
+    UpdateShadow(SHADOW_CTRL, ctrl, ok);
+    return ok;
+}
+
+// The rising edge of req_bus requests a quadlet (or the first quadlet of a block)
+bool EMIO_Interface_Gpiod::SetReqBus(int value)
+{
+    if (!NeedsWrite(SHADOW_REQ_BUS, value))
+        return true;
+    if (value) {
+        GrantDrain();
+        EdgeRequestBegin();
+    }
+    bool ok = (gpiod_line_set_value(info->req_bus_line, value) == 0);
+    if (value)
+        EdgeRequestEnd();
+    UpdateShadow(SHADOW_REQ_BUS, value, ok);
+    return ok;
+}
+
+bool EMIO_Interface_Gpiod::SetDataLines(uint32_t data)
+{
+    if (!NeedsWrite(SHADOW_DATA, data))
+        return true;
+    int reg_wdata_values[32];
+    for (size_t i = 0; i < 32; i++)
+        reg_wdata_values[i] = (data&(0x80000000>>i)) ? 1 : 0;
+    bool ok = (gpiod_line_set_value_bulk(&info->reg_data_lines, reg_wdata_values) == 0);
+    UpdateShadow(SHADOW_DATA, data, ok);
+    return ok;
+}
+
+// Local method to set the data lines to output; the direction change also writes the
+// values, so the previous shadow (if any) does not apply
+bool EMIO_Interface_Gpiod::SetDataOutput(uint32_t data)
+{
+    int reg_wdata_values[32];
+    for (size_t i = 0; i < 32; i++)
+        reg_wdata_values[i] = (data&(0x80000000>>i)) ? 1 : 0;
+    numLineWrites++;
+    bool ok = (gpiod_line_set_direction_output_bulk(&info->reg_data_lines, reg_wdata_values) == 0);
+    UpdateShadow(SHADOW_DATA, data, ok);
+    if (ok) {
+        isInput = false;
+        CountDirSwitch();
+    }
+    return ok;
+}
+
+// Local method to abort a transaction after a timeout (see EMIO_Interface::TransactionFailed):
+// clears req_bus and the ctrl lines (blk_start, blk_end) and sets the data lines to input
+bool EMIO_Interface_Gpiod::AbortTransaction()
+{
+    SetReqBus(0);
+    SetCtrlLines(0);
+    if (!isInput) {
+        if (gpiod_line_set_direction_input_bulk(&info->reg_data_lines) != 0)
+            std::cout << "AbortTransaction (gpiod): could not set data lines as input" << std::endl;
+        isInput = true;
+        CountDirSwitch();
+    }
+    return true;
+}
+
+// Local method to wait for op_done to be cleared after an abort (the value can be read
+// even if the line is requested for events)
+bool EMIO_Interface_Gpiod::WaitBusIdle()
+{
+    int val = gpiod_line_get_value(info->op_done_line);
+    if (val == 1) {
+        WaitState ws;
+        WaitBegin(ws);
+        while (((val = gpiod_line_get_value(info->op_done_line)) == 1) && WaitContinue(ws));
+        WaitEnd(ws, val == 0);
+    }
+    if (val < 0)
+        lastError = EMIO_ERR_IO;
+    return (val == 0);
+}
+
+bool EMIO_Interface_Gpiod::DoReadQuadlet(uint16_t addr, uint32_t &data, fpgav3_time_t *midTimes)
+{
+    int reg_rdata_values[32];
+    size_t i;
 
     // Set all data lines to input
     if (!isInput) {
@@ -319,33 +531,35 @@ bool EMIO_Interface_Gpiod::ReadQuadlet(uint16_t addr, uint32_t &data)
             return false;
         }
         isInput = true;
+        CountDirSwitch();
     }
 
-    // Write reg_addr (read address)
-    gpiod_line_set_value_bulk(&info->reg_addr_lines, reg_addr_values);
-    // Set ctrl_lines to 0
-    gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+    // Write reg_addr (read address) and set ctrl_lines to 0, if changed
+    SetAddrLines(addr);
+    SetCtrlLines(0);
     // Set req_bus to 1 (rising edge requests firmware to read register)
-    gpiod_line_set_value(info->req_bus_line, 1);
+    SetReqBus(1);
 
     // Get time before wait
-    if (doTiming > 1)
-        GetCurTime(&beforeWait);
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
 
-    if (!WaitOpDone("read", 0)) {
-        gpiod_line_set_value(info->req_bus_line, 0);
+    if (!WaitOpDone(false, 0)) {
+        SetReqBus(0);
         return false;
     }
 
     // Get time after wait
-    if (doTiming > 1)
-        GetCurTime(&afterWait);
+    if (midTimes) {
+        GetCurTime(&midTimes[1]);
+        GrantSample();
+    }
 
     // Read data from reg_data
     bool ret = gpiod_line_get_value_bulk(&info->reg_data_lines, reg_rdata_values);
 
     // Set req_bus to 0
-    gpiod_line_set_value(info->req_bus_line, 0);
+    SetReqBus(0);
 
     if (ret != 0) {
         if (isVerbose)
@@ -357,121 +571,66 @@ bool EMIO_Interface_Gpiod::ReadQuadlet(uint16_t addr, uint32_t &data)
     for (i = 0; i < 32; i++)
         data = (data<<1)|reg_rdata_values[i];
 
-    // Get end time
-    if (doTiming > 0) {
-        GetCurTime(&endTime);
-        double dt = TimeDiff_us(&startTime, &endTime)-timingOverhead;
-        if (doTiming > 1) dt -= 2*timingOverhead;
-        std::cout << "ReadQuadlet total time = " << dt << " us" << std::endl;
-        if (doTiming > 1) {
-            std::cout << "Start-wait-end times = " 
-                      << TimeDiff_us(&startTime, &beforeWait)-timingOverhead << ", "
-                      << TimeDiff_us(&beforeWait, &afterWait)-timingOverhead << ", "
-                      << TimeDiff_us(&afterWait, &endTime)-timingOverhead << " us" << std::endl;
-        }
-    }
-
     return true;
 }
 
-// WriteQuadlet: write quadlet to specified address
-bool EMIO_Interface_Gpiod::WriteQuadlet(uint16_t addr, uint32_t data)
+bool EMIO_Interface_Gpiod::DoWriteQuadlet(uint16_t addr, uint32_t data, fpgav3_time_t *midTimes)
 {
-    int reg_wdata_values[32];
-    int reg_addr_values[16];
-    size_t i;
-
-    // For timing measurements
-    fpgav3_time_t beforeWait;
-    fpgav3_time_t afterWait;
-
-    // Get start time for measurement
-    if (doTiming > 0)
-        GetCurTime(&startTime);
-
-    for (i = 0; i < 16; i++)
-        reg_addr_values[i] = (addr&(0x8000>>i)) ? 1 : 0;
-
-    for (i = 0; i < 32; i++)
-        reg_wdata_values[i] = (data&(0x80000000>>i)) ? 1 : 0;
-
     if (isInput) {
         // Set all data lines to output and write values
-        if (gpiod_line_set_direction_output_bulk(&info->reg_data_lines, reg_wdata_values) != 0) {
+        if (!SetDataOutput(data)) {
             std::cout << "WriteQuadlet (gpiod): could not set data lines as output" << std::endl;
             return false;
         }
-        isInput = false;
     }
     else {
-        // Output already set, just write values
-        gpiod_line_set_value_bulk(&info->reg_data_lines, reg_wdata_values);
+        // Output already set, just write values (if changed)
+        SetDataLines(data);
     }
 
-    // Write reg_addr (write address)
-    gpiod_line_set_value_bulk(&info->reg_addr_lines, reg_addr_values);
+    // Write reg_addr (write address), if changed
+    SetAddrLines(addr);
 
     // Set ctrl_lines for quadlet write
-    gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_qwrite);
+    SetCtrlLines(CTRL_BITS_QWRITE);
     // Set req_bus to 1 (rising edge requests firmware to write register)
-    gpiod_line_set_value(info->req_bus_line, 1);
+    SetReqBus(1);
 
     // Get time before wait
-    if (doTiming > 1)
-        GetCurTime(&beforeWait);
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
 
     // op_done should be set quickly by firmware, to indicate
     // that write has completed
-    bool ret = WaitOpDone("write", 0);
+    bool ret = WaitOpDone(true, 0);
 
     // Get time after wait
-    if (ret && (doTiming > 1))
-        GetCurTime(&afterWait);
-
-    // Set req_bus (and other ctrl lines) to 0
-    gpiod_line_set_value(info->req_bus_line, 0);
-    gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
-
-    // Get end time
-    if (ret && (doTiming > 0)) {
-        GetCurTime(&endTime);
-        double dt = TimeDiff_us(&startTime, &endTime)-timingOverhead;
-        if (doTiming > 1) dt -= 2*timingOverhead;
-        std::cout << "WriteQuadlet total time = " << dt << " us" << std::endl;
-        if (doTiming > 1) {
-            std::cout << "Start-wait-end times = "
-                      << TimeDiff_us(&startTime,  &beforeWait)-timingOverhead << ", "
-                      << TimeDiff_us(&beforeWait, &afterWait)-timingOverhead << ", "
-                      << TimeDiff_us(&afterWait,  &endTime)-timingOverhead << " us" << std::endl;
-        }
+    if (ret && midTimes) {
+        GetCurTime(&midTimes[1]);
+        GrantSample();
     }
 
+    // Set req_bus to 0. The ctrl lines are left set, since the firmware only uses them
+    // while req_bus is set and every transaction sets them before req_bus; thus,
+    // consecutive quadlet writes do not rewrite the ctrl lines.
+    SetReqBus(0);
+
     return ret;
 }
 
-// Read block of data
-bool EMIO_Interface_Gpiod::ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+bool EMIO_Interface_Gpiod::DoReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes, fpgav3_time_t *midTimes)
 {
     unsigned int i, q;
     unsigned int nQuads = (nBytes+3)/4;
     int reg_rdata_values[32];
-    int reg_addr_values[16];
-    int ctrl_values[CTRL_MAX];
     uint32_t val;
 
-    // For timing measurements
-    fpgav3_time_t firstRead;
-    fpgav3_time_t lastRead;
-
     if (version < 1) {
         std::cout << "ReadBlock (gpiod): not supported for version " << version << std::endl;
+        lastError = EMIO_ERR_UNSUPPORTED;
         return false;
     }
 
-    // Get start time for measurement
-    if (doTiming > 0)
-        GetCurTime(&startTime);
-
     // Set all data lines to input
     if (!isInput) {
         if (gpiod_line_set_direction_input_bulk(&info->reg_data_lines) != 0) {
@@ -479,79 +638,72 @@ bool EMIO_Interface_Gpiod::ReadBlock(uint16_t addr, uint32_t *data, unsigned int
             return false;
         }
         isInput = true;
+        CountDirSwitch();
     }
 
     // Set blk_start to 1
-    ctrl_values[CTRL_REG_WEN] = 0;
-    ctrl_values[CTRL_BLK_START] = 1;
-    ctrl_values[CTRL_BLK_END] = 0;
-    if (gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_values) != 0) {
+    if (!SetCtrlLines(CTRL_BIT_BLK_START)) {
         if (isVerbose)
             std::cout << "_ReadBlock (gpiod): error setting ctrl (blk_start)" << std::endl;
         return false;
     }
 
-    // Initialize reg_addr_values
-    for (i = 0; i < 16; i++)
-        reg_addr_values[i] = (addr&(0x8000>>i)) ? 1 : 0;
-
     // Write reg_addr (read address)
-    if (gpiod_line_set_value_bulk(&info->reg_addr_lines, reg_addr_values) != 0) {
+    if (!SetAddrLines(addr)) {
         if (isVerbose)
             std::cout << "ReadBlock (gpiod): error setting initial address "
                       << std::hex << addr << std::dec << std::endl;
-        gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+        SetCtrlLines(0);
         return false;
     }
-    // Make sure addr_lsb_line is set to reg_addr_values[15] (lsb)
-    gpiod_line_set_value(info->addr_lsb_line, reg_addr_values[15]);
+    // Make sure addr_lsb_line is set to lsb of address
+    int addr_lsb = addr&1;
+    SetLsbLine(addr_lsb);
 
     // Set req_bus
-    if (gpiod_line_set_value(info->req_bus_line, 1) != 0) {
+    if (!SetReqBus(1)) {
         if (isVerbose)
             std::cout << "EMIO_ReadBlock: error setting req_bus" << std::endl;
-        gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+        SetCtrlLines(0);
         return false;
     }
 
-    if (doTiming > 1)
-        GetCurTime(&firstRead);
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
 
     for (q = 0; q < nQuads; q++) {
 
         if (q > 0) {
             if (q == nQuads-1) {
                 // Set blk_end to 1 to indicate end of block write
-                ctrl_values[CTRL_BLK_START] = 0;
-                ctrl_values[CTRL_BLK_END] = 1;
-                if (gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_values) != 0) {
+                if (!SetCtrlLines(CTRL_BIT_BLK_END)) {
                     if (isVerbose)
                         std::cout << "ReadBlock (gpiod): error setting ctrl (blk_end)" << std::endl;
-                    gpiod_line_set_value(info->req_bus_line, 0);
-                    gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+                    SetReqBus(0);
+                    SetCtrlLines(0);
                     return false;
                  }
             }
 
             // Increment lsb of address
-            reg_addr_values[15] = ~reg_addr_values[15];
+            addr_lsb = !addr_lsb;
 
             // Write reg_addr_lsb (lsb of read address) last because address change
             // will trigger read
-            if (gpiod_line_set_value(info->addr_lsb_line, reg_addr_values[15]) != 0) {
+            if (!SetLsbLine(addr_lsb)) {
                 if (isVerbose)
                     std::cout << "ReadBlock (gpiod): error setting address for quadlet " << q << std::endl;
-                gpiod_line_set_value(info->req_bus_line, 0);
-                gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+                SetReqBus(0);
+                SetCtrlLines(0);
                 return false;
             }
         }
 
         // op_done set by firmware, to indicate that quadlet
         // has been read
-        if (!WaitOpDone("read", q)) {
-            gpiod_line_set_value(info->req_bus_line, 0);
-            gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+        if (!WaitOpDone(false, q)) {
+            SetReqBus(0);
+            SetCtrlLines(0);
             return false;
         }
 
@@ -561,8 +713,8 @@ bool EMIO_Interface_Gpiod::ReadBlock(uint16_t addr, uint32_t *data, unsigned int
                 std::cout << "ReadBlock (gpiod): error reading quadlet " << q
                           << " (of " << nQuads << ")" << std::endl;
             // Set all lines to 0
-            gpiod_line_set_value(info->req_bus_line, 0);
-            gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+            SetReqBus(0);
+            SetCtrlLines(0);
             return false;
         }
 
@@ -572,149 +724,291 @@ bool EMIO_Interface_Gpiod::ReadBlock(uint16_t addr, uint32_t *data, unsigned int
         data[q] = bswap_32(val);
     }
 
-    if (doTiming > 1)
-        GetCurTime(&lastRead);
+    if (midTimes) {
+        GetCurTime(&midTimes[1]);
+        GrantSample();
+    }
 
     // Set all lines to 0
-    gpiod_line_set_value(info->req_bus_line, 0);
-    gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
-
-    // Get end time
-    if (doTiming > 0) {
-        GetCurTime(&endTime);
-        double dt = TimeDiff_us(&startTime, &endTime)-timingOverhead;
-        if (doTiming > 1) dt -= 2*timingOverhead;
-        std::cout << "ReadBlock total time = " << dt << " us" << std::endl;
-        if (doTiming > 1) {
-            std::cout << "Start-loop-end times = "
-                      << TimeDiff_us(&startTime, &firstRead)-timingOverhead << ", "
-                      << TimeDiff_us(&firstRead, &lastRead)-timingOverhead << ", "
-                      << TimeDiff_us(&lastRead,  &endTime)-timingOverhead << " us" << std::endl;
-        }
-    }
+    SetReqBus(0);
+    SetCtrlLines(0);
 
     return true;
 }
 
-// Write block of data.
-bool EMIO_Interface_Gpiod::WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes)
+bool EMIO_Interface_Gpiod::DoWriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes,
+                                        fpgav3_time_t *midTimes)
 {
-    int reg_wdata_values[32];
-    int reg_addr_values[16];
-    int ctrl_values[CTRL_MAX];
-    unsigned int i, q;
-
-    // For timing measurements
-    fpgav3_time_t firstWrite;
-    fpgav3_time_t lastWrite;
+    unsigned int q;
 
     unsigned int nQuads = (nBytes+3)/4;
 
     if (version < 1) {
         std::cout << "WriteBlock (gpiod): not supported for version " << version << std::endl;
+        lastError = EMIO_ERR_UNSUPPORTED;
         return false;
     }
 
-    // Get start time for measurement
-    if (doTiming > 0)
-        GetCurTime(&startTime);
-
     uint32_t val = bswap_32(data[0]);
-    for (i = 0; i < 32; i++)
-        reg_wdata_values[i] = (val&(0x80000000>>i)) ? 1 : 0;
-
     if (isInput) {
         // Set all data lines to output (and write values)
-        if (gpiod_line_set_direction_output_bulk(&info->reg_data_lines, reg_wdata_values) != 0) {
+        if (!SetDataOutput(val)) {
             std::cout << "WriteBlock (gpiod): could not set data lines as output" << std::endl;
             return false;
         }
-        isInput = false;
+    }
+    else {
+        // Output already set, just write values (if changed)
+        SetDataLines(val);
     }
 
     // Write initial address
-    for (i = 0; i < 16; i++)
-        reg_addr_values[i] = (addr&(0x8000>>i)) ? 1 : 0;
-    gpiod_line_set_value_bulk(&info->reg_addr_lines, reg_addr_values);
-    // Make sure addr_lsb_line is set to reg_addr_values[15] (lsb)
-    gpiod_line_set_value(info->addr_lsb_line, reg_addr_values[15]);
+    SetAddrLines(addr);
+    // Make sure addr_lsb_line is set to lsb of address
+    int addr_lsb = addr&1;
+    SetLsbLine(addr_lsb);
 
     // Set blk_start and req_bus to 1 (reg_wen no longer used)
-    ctrl_values[CTRL_REG_WEN] = 0;
-    ctrl_values[CTRL_BLK_START] = 1;
-    ctrl_values[CTRL_BLK_END] = 0;
-    gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_values);
-    gpiod_line_set_value(info->req_bus_line, 1);
+    SetCtrlLines(CTRL_BIT_BLK_START);
+    SetReqBus(1);
+
+    // Get time before first quadlet (as for the other transactions)
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
 
     // op_done set by firmware, to indicate that blk_start has been
     // generated and first quadlet has been written
-    if (!WaitOpDone("write", 0)) {
-        gpiod_line_set_value(info->req_bus_line, 0);
-        gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+    if (!WaitOpDone(true, 0)) {
+        SetReqBus(0);
+        SetCtrlLines(0);
         return false;
     }
 
-    if (doTiming > 1)
-        GetCurTime(&firstWrite);
-
     for (q = 1; q < nQuads; q++) {
 
         // Increment lsb of address
-        reg_addr_values[15] = ~reg_addr_values[15];
+        addr_lsb = !addr_lsb;
 
-        val = bswap_32(data[q]);
-        for (i = 0; i < 32; i++)
-            reg_wdata_values[i] = (val&(0x80000000>>i)) ? 1 : 0;
-
-        // Write reg_data
-        gpiod_line_set_value_bulk(&info->reg_data_lines, reg_wdata_values);
+        // Write reg_data (if changed)
+        SetDataLines(bswap_32(data[q]));
 
         if (q == nQuads-1) {
             // Set blk_end to 1 to indicate end of block write
-            ctrl_values[CTRL_BLK_START] = 0;
-            ctrl_values[CTRL_BLK_END] = 1;
-            gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_values);
+            SetCtrlLines(CTRL_BIT_BLK_END);
         }
 
         // Write reg_addr_lsb (lsb of write address) last because address change
         // will trigger actual write
-        if (gpiod_line_set_value(info->addr_lsb_line, reg_addr_values[15]) != 0) {
+        if (!SetLsbLine(addr_lsb)) {
             if (isVerbose)
                 std::cout << "WriteBlock (gpiod): error setting address for quadlet " << q << std::endl;
-            gpiod_line_set_value(info->req_bus_line, 0);
-            gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+            SetReqBus(0);
+            SetCtrlLines(0);
             return false;
         }
 
         // op_done set by firmware, to indicate that quadlet
         // has been written
-        if (!WaitOpDone("write", q)) {
-            gpiod_line_set_value(info->req_bus_line, 0);
-            gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+        if (!WaitOpDone(true, q)) {
+            SetReqBus(0);
+            SetCtrlLines(0);
             return false;
         }
     }
 
-    if (doTiming > 1)
-        GetCurTime(&lastWrite);
+    if (midTimes) {
+        GetCurTime(&midTimes[1]);
+        GrantSample();
+    }
 
     // Set all lines to 0
-    gpiod_line_set_value(info->req_bus_line, 0);
-    gpiod_line_set_value_bulk(&info->ctrl_lines, ctrl_zero);
+    SetReqBus(0);
+    SetCtrlLines(0);
+
+    return true;
+}
+
+// ReadQuadlet: read quadlet from specified address
+bool EMIO_Interface_Gpiod::ReadQuadlet(uint16_t addr, uint32_t &data)
+{
+    // For timing measurements (before and after wait)
+    fpgav3_time_t midTimes[2];
+
+    FPGAV3_PROBE3(emio_entry, EMIO_READ_QUAD, addr, 4);
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus()) {
+        FPGAV3_PROBE4(emio_exit, EMIO_READ_QUAD, addr, 4, 0);
+        return false;
+    }
+    BeginShadowing();
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoReadQuadlet(addr, data, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_READ_QUAD, addr, &data, 4, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    FPGAV3_PROBE4(emio_exit, EMIO_READ_QUAD, addr, 4, ret);
+    if (!ret)
+        return false;
 
     // Get end time
-    if (doTiming > 0) {
-        GetCurTime(&endTime);
-        double dt = TimeDiff_us(&startTime, &endTime)-timingOverhead;
-        if (doTiming > 1) dt -= 2*timingOverhead;
-        std::cout << "WriteBlock total time = " << dt << " us" << std::endl;
-        if (doTiming > 1) {
-            std::cout << "Start-loop-end times = "
-                      << TimeDiff_us(&startTime,  &firstWrite)-timingOverhead << ", "
-                      << TimeDiff_us(&firstWrite, &lastWrite)-timingOverhead << ", "
-                      << TimeDiff_us(&lastWrite,  &endTime)-timingOverhead << " us" << std::endl;
-        }
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_READ_QUAD, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// WriteQuadlet: write quadlet to specified address
+bool EMIO_Interface_Gpiod::WriteQuadlet(uint16_t addr, uint32_t data)
+{
+    // For timing measurements (before and after wait)
+    fpgav3_time_t midTimes[2];
+
+    FPGAV3_PROBE3(emio_entry, EMIO_WRITE_QUAD, addr, 4);
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus()) {
+        FPGAV3_PROBE4(emio_exit, EMIO_WRITE_QUAD, addr, 4, 0);
+        return false;
     }
+    BeginShadowing();
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoWriteQuadlet(addr, data, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_WRITE_QUAD, addr, &data, 4, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    FPGAV3_PROBE4(emio_exit, EMIO_WRITE_QUAD, addr, 4, ret);
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_WRITE_QUAD, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// Read block of data
+bool EMIO_Interface_Gpiod::ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+{
+    // For timing measurements (first and last read)
+    fpgav3_time_t midTimes[2];
+
+    FPGAV3_PROBE3(emio_entry, EMIO_READ_BLOCK, addr, nBytes);
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus()) {
+        FPGAV3_PROBE4(emio_exit, EMIO_READ_BLOCK, addr, nBytes, 0);
+        return false;
+    }
+    BeginShadowing();
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoReadBlock(addr, data, nBytes, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_READ_BLOCK, addr, data, nBytes, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    FPGAV3_PROBE4(emio_exit, EMIO_READ_BLOCK, addr, nBytes, ret);
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_READ_BLOCK, (doTiming > 1) ? midTimes : 0);
 
     return true;
 }
+
+// Write block of data.
+bool EMIO_Interface_Gpiod::WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes)
+{
+    // For timing measurements (first and last write)
+    fpgav3_time_t midTimes[2];
+
+    FPGAV3_PROBE3(emio_entry, EMIO_WRITE_BLOCK, addr, nBytes);
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus()) {
+        FPGAV3_PROBE4(emio_exit, EMIO_WRITE_BLOCK, addr, nBytes, 0);
+        return false;
+    }
+    BeginShadowing();
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoWriteBlock(addr, data, nBytes, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_WRITE_BLOCK, addr, data, nBytes, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    FPGAV3_PROBE4(emio_exit, EMIO_WRITE_BLOCK, addr, nBytes, ret);
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_WRITE_BLOCK, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// Execute batch of requests (see EMIO_Interface::ExecuteBatch)
+bool EMIO_Interface_Gpiod::RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass)
+{
+    BeginShadowing();
+    bool ret = true;
+    for (unsigned int i = 0; i < num; i++) {
+        EMIO_Request &req = reqs[i];
+        if (!BatchSelect(req, pass))
+            continue;
+        bool ok = false;
+        FPGAV3_PROBE3(emio_entry, req.opType, req.addr, req.nBytes);
+        TraceBegin();
+        // Recover the bus if the previous request was aborted
+        if (BeginRequest()) {
+            switch (req.opType) {
+                case EMIO_READ_QUAD:   ok = DoReadQuadlet(req.addr, *req.data);
+                                       break;
+                case EMIO_WRITE_QUAD:  ok = DoWriteQuadlet(req.addr, *req.data);
+                                       break;
+                case EMIO_READ_BLOCK:  ok = DoReadBlock(req.addr, req.data, req.nBytes);
+                                       break;
+                case EMIO_WRITE_BLOCK: ok = DoWriteBlock(req.addr, req.data, req.nBytes);
+                                       break;
+            }
+        }
+        EndTransaction(req.opType, req.addr, req.data, req.nBytes, ok);
+        FPGAV3_PROBE4(emio_exit, req.opType, req.addr, req.nBytes, ok);
+        req.status = ok ? EMIO_REQ_OK : EMIO_REQ_FAILED;
+        if (!ok) {
+            ret = false;
+            if (flags & EMIO_BATCH_STOP_ON_ERR)
+                break;
+        }
+    }
+    return ret;
+}
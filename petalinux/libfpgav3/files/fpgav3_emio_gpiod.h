@@ -12,6 +12,16 @@
  * (PS input when reading, PS output when writing).
  *
  * This derived class uses the Linux gpiod driver.
+ *
+ * Each group of output lines (address, addr_lsb, ctrl, req_bus and, when output, data)
+ * has a shadow of its current value, so that a line write (one ioctl) is only issued
+ * when the value of the group changes. Note that libgpiod v1 always sets all lines of
+ * a bulk request, so sequential addresses still require one write of the address lines.
+ * The shadows are only valid while no other process can change the lines, so they
+ * are kept between transactions only if the bus lock is enabled (see SetBusLock); all
+ * processes that access the EMIO bus (including those using mmap, e.g., fpgav3block)
+ * must then enable the lock. Without the lock, the shadows are discarded at the start
+ * of each transaction (and batch), so only writes within a transaction are skipped.
  */
 
 #ifndef FPGAV3_EMIO_GPIOD_H
@@ -29,6 +39,16 @@ class EMIO_Interface_Gpiod : public EMIO_Interface
 {
 
     gpiod_info *info;
+    bool grantEvents;          // true if bus_grant_line was requested for events
+
+    // Output line groups with a shadow value (bit n of shadowValid is set if shadow[n]
+    // is the current value of group n)
+    enum ShadowGroup { SHADOW_ADDR, SHADOW_LSB, SHADOW_CTRL, SHADOW_REQ_BUS, SHADOW_DATA, SHADOW_MAX };
+    uint32_t shadow[SHADOW_MAX];
+    unsigned int shadowValid;
+
+    unsigned long numLineWrites;          // line writes issued (one ioctl each)
+    unsigned long numLineWritesSkipped;   // line writes skipped (value unchanged)
 
 public:
 
@@ -41,6 +61,10 @@ public:
 
     void SetEventMode(bool newState);
 
+    // Timing mode 2 also requests bus_grant_line for events, to measure the bus
+    // arbitration time; the line is released when another timing mode is set
+    void SetTimingMode(unsigned int newState);
+
     bool ReadQuadlet(uint16_t addr, uint32_t &data);
 
     bool WriteQuadlet(uint16_t addr, uint32_t data);
@@ -49,11 +73,68 @@ public:
 
     bool WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes);
 
+    // Get or reset the number of output line writes that were issued and skipped
+    // (because the shadow showed that the value did not change)
+    void GetLineWriteStats(unsigned long &numWrites, unsigned long &numSkipped) const
+    { numWrites = numLineWrites; numSkipped = numLineWritesSkipped; }
+    void ResetLineWriteStats()
+    { numLineWrites = 0; numLineWritesSkipped = 0; }
+
 protected:
 
     bool Init();
 
-    bool WaitOpDone(const char *opType, unsigned int num);
+    // Wait for op_done to be set, for quadlet num of a read or write (isWrite)
+    bool WaitOpDone(bool isWrite, unsigned int num);
+
+    // Returns true if the output line group must be written (i.e., value differs from
+    // shadow); UpdateShadow then records the result of the write
+    bool NeedsWrite(ShadowGroup group, uint32_t value);
+    void UpdateShadow(ShadowGroup group, uint32_t value, bool ok);
+
+    // Called at the start of each transaction (and batch): without the bus lock, another
+    // process may have changed the output lines since the last transaction, so the
+    // shadows are invalidated (with the lock, see RevalidateDirection)
+    void BeginShadowing()
+    { if (!GetBusLock()) shadowValid = 0; }
+
+    // Set the output line groups, if changed. The ctrl value is a bit mask of the
+    // CTRL_BIT values (see fpgav3_emio_gpiod.cpp). SetDataLines requires the data
+    // lines to be output; SetDataOutput sets them to output and writes the value.
+    bool SetAddrLines(uint16_t addr);
+    bool SetLsbLine(int value);
+    bool SetCtrlLines(uint32_t ctrl);
+    bool SetReqBus(int value);
+    bool SetDataLines(uint32_t data);
+    bool SetDataOutput(uint32_t data);
+
+    // Sample grant_bus via its rising edge events (see EMIO_Interface::SampleGrant):
+    // GrantDrain discards events of earlier transactions (before a request) and
+    // GrantSample records the kernel timestamp of the grant (after op_done)
+    void GrantDrain();
+    void GrantSample();
+    void SetGrantEvents(bool enable);
+
+    // op_done events carry kernel timestamps (see SetEdgeTiming)
+    bool HasEdgeTimestamps() const
+    { return true; }
+
+    // Set data lines to input, since they may have been changed by another process
+    void RevalidateDirection();
+
+    // Abort a transaction and wait for the bus to become idle (see EMIO_Interface)
+    bool AbortTransaction();
+    bool WaitBusIdle();
+
+    // Low-level transactions, without timing measurements (used by the public methods
+    // and RunBatch). If midTimes is not 0, it is used to store the times before and
+    // after the wait (quadlet) or the first and last quadlet (block).
+    bool DoReadQuadlet(uint16_t addr, uint32_t &data, fpgav3_time_t *midTimes = 0);
+    bool DoWriteQuadlet(uint16_t addr, uint32_t data, fpgav3_time_t *midTimes = 0);
+    bool DoReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes, fpgav3_time_t *midTimes = 0);
+    bool DoWriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes, fpgav3_time_t *midTimes = 0);
+
+    bool RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass);
 
 };
 
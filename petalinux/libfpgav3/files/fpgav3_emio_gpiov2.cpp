@@ -0,0 +1,674 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <byteswap.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "fpgav3_emio_gpiov2.h"
+#include "fpgav3_emio_regs.h"
+
+// First EMIO line of the Zynq GPIO controller (see EMIO_Interface_Gpiod)
+const unsigned int INDEX_EMIO_START = 54;
+const unsigned int NUM_EMIO_LINES = 64;
+
+// Masks for the line values, where bit n is emio[n]
+const uint64_t LINES_DATA     = 0x00000000ffffffffULL;
+const uint64_t LINES_OUTPUTS  = static_cast<uint64_t>(Bits_UpperOutputs) << 32;
+const uint64_t LINES_OP_DONE  = static_cast<uint64_t>(Bits_OpDone) << 32;
+const uint64_t LINES_VERSION  = static_cast<uint64_t>(Bits_Version) << 32;
+
+// Returns the line values for the specified upper EMIO bits
+static inline uint64_t UpperLines(uint32_t upper)
+{
+    return static_cast<uint64_t>(upper) << 32;
+}
+
+EMIO_Interface_GpioV2::EMIO_Interface_GpioV2(const char *chipName) : EMIO_Interface(), lineFd(-1),
+                                                                       outValues(0)
+{
+    if (!Init(chipName)) {
+        if (lineFd >= 0) close(lineFd);
+        lineFd = -1;
+    }
+}
+
+bool EMIO_Interface_GpioV2::Init(const char *chipName)
+{
+    int chipFd = open(chipName, O_RDWR | O_CLOEXEC);
+    if (chipFd < 0) {
+        std::cout << "Failed to open " << chipName << std::endl;
+        return false;
+    }
+
+    // Request all EMIO lines, initially as inputs (to read the version without driving
+    // any lines); the outputs are configured by Configure
+    struct gpio_v2_line_request req;
+    memset(&req, 0, sizeof(req));
+    for (unsigned int i = 0; i < NUM_EMIO_LINES; i++)
+        req.offsets[i] = INDEX_EMIO_START+i;
+    strncpy(req.consumer, "libfpgav3", sizeof(req.consumer)-1);
+    req.num_lines = NUM_EMIO_LINES;
+    req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    int ret = ioctl(chipFd, GPIO_V2_GET_LINE_IOCTL, &req);
+    close(chipFd);
+    if (ret < 0) {
+        std::cout << "Failed to request EMIO lines from " << chipName << " (" << strerror(errno) << ")"
+                  << std::endl;
+        return false;
+    }
+    lineFd = req.fd;
+
+    // Read version
+    uint64_t values;
+    if (!GetValues(LINES_VERSION, values)) {
+        std::cout << "Failed to read EMIO bus interface version" << std::endl;
+        return false;
+    }
+    version = (values & LINES_VERSION) >> 60;
+
+    if (version > 1) {
+        std::cout << "EMIO bus interface version " << version << " not supported" << std::endl;
+        return false;
+    }
+
+    // Data lines are input, address and control lines are output (0)
+    isInput = true;
+    outValues = 0;
+    if (!Configure()) {
+        std::cout << "Failed to configure EMIO lines" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+EMIO_Interface_GpioV2::~EMIO_Interface_GpioV2()
+{
+    if (lineFd >= 0)
+        close(lineFd);
+}
+
+bool EMIO_Interface_GpioV2::Configure()
+{
+    struct gpio_v2_line_config config;
+    memset(&config, 0, sizeof(config));
+    config.flags = GPIO_V2_LINE_FLAG_INPUT;
+    uint64_t outMask = isInput ? LINES_OUTPUTS : (LINES_OUTPUTS | LINES_DATA);
+    unsigned int n = 0;
+    config.attrs[n].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+    config.attrs[n].attr.flags = GPIO_V2_LINE_FLAG_OUTPUT;
+    config.attrs[n].mask = outMask;
+    n++;
+    config.attrs[n].attr.id = GPIO_V2_LINE_ATTR_ID_OUTPUT_VALUES;
+    config.attrs[n].attr.values = outValues;
+    config.attrs[n].mask = outMask;
+    n++;
+    if (useEvents) {
+        config.attrs[n].attr.id = GPIO_V2_LINE_ATTR_ID_FLAGS;
+        config.attrs[n].attr.flags = GPIO_V2_LINE_FLAG_INPUT | GPIO_V2_LINE_FLAG_EDGE_RISING;
+        config.attrs[n].mask = LINES_OP_DONE;
+        n++;
+    }
+    config.num_attrs = n;
+    return (ioctl(lineFd, GPIO_V2_LINE_SET_CONFIG_IOCTL, &config) == 0);
+}
+
+bool EMIO_Interface_GpioV2::SetValues(uint64_t mask, uint64_t values)
+{
+    struct gpio_v2_line_values lv;
+    lv.mask = mask;
+    lv.bits = values;
+    if (ioctl(lineFd, GPIO_V2_LINE_SET_VALUES_IOCTL, &lv) != 0)
+        return false;
+    outValues = (outValues & ~mask) | (values & mask);
+    return true;
+}
+
+bool EMIO_Interface_GpioV2::GetValues(uint64_t mask, uint64_t &values)
+{
+    struct gpio_v2_line_values lv;
+    lv.mask = mask;
+    lv.bits = 0;
+    if (ioctl(lineFd, GPIO_V2_LINE_GET_VALUES_IOCTL, &lv) != 0)
+        return false;
+    values = lv.bits;
+    return true;
+}
+
+void EMIO_Interface_GpioV2::SetEventMode(bool newState)
+{
+    useEvents = newState;
+    if ((lineFd >= 0) && !Configure() && isVerbose)
+        std::cout << "SetEventMode (gpiov2): failed to configure op_done line" << std::endl;
+}
+
+// Local method to wait for op_done to be set, using either events or polling (default).
+// isWrite selects the edge statistics (see EdgeRecord) and the operation in messages.
+bool EMIO_Interface_GpioV2::WaitOpDone(bool isWrite, unsigned int num)
+{
+    const char *opType = isWrite ? "write" : "read";
+    if (useEvents) {
+        // As in EMIO_Interface_Mmap::WaitOpDoneEvent: op_done is often already set, so check
+        // it first. Otherwise, discard any events from previous transactions (whose op_done
+        // was seen without reading the event), then check op_done again before sleeping. Any
+        // rising edge after this check generates a new event, so the wakeup cannot be missed.
+        uint64_t values = 0;
+        bool ok = GetValues(LINES_OP_DONE, values);
+        bool opdone = ok && (values & LINES_OP_DONE);
+        if (!ok || opdone) {
+            if (!ok)
+                lastError = EMIO_ERR_IO;
+            return opdone;
+        }
+        fpgav3_time_t waitStart, curTime;
+        GetCurTime(&waitStart);
+        double waitLimit_us = DeadlineLimit_us(timeout_us);
+        struct pollfd pfd;
+        pfd.fd = lineFd;
+        pfd.events = POLLIN;
+        struct gpio_v2_line_event event;
+        struct timespec zero = { 0, 0 };
+        while (ppoll(&pfd, 1, &zero, NULL) == 1) {
+            if (read(lineFd, &event, sizeof(event)) != sizeof(event))
+                break;
+        }
+        int rc = 0;
+        if (!(ok = GetValues(LINES_OP_DONE, values)))
+            rc = -1;
+        else if (!(opdone = (values & LINES_OP_DONE))) {
+            struct timespec timeout;
+            timeout.tv_sec = waitLimit_us*1.0e-6;
+            timeout.tv_nsec = (waitLimit_us - 1.0e6*timeout.tv_sec)*1.0e3;
+            rc = ppoll(&pfd, 1, &timeout, NULL);
+            uint64_t wake_ns = edgeRec ? EMIO_EdgeRecorder::GetMonotonic_ns() : 0;
+            if (rc == 1) {
+                if (read(lineFd, &event, sizeof(event)) == sizeof(event)) {
+                    // The event timestamp is CLOCK_MONOTONIC (default event clock)
+                    EdgeRecord(isWrite, event.timestamp_ns, wake_ns);
+                    opdone = true;
+                }
+                else
+                    rc = -1;
+            }
+            else if (rc == 0)
+                opdone = GetValues(LINES_OP_DONE, values) && (values & LINES_OP_DONE);
+        }
+        if (traceRec)
+            TraceWait(waitStart);
+        if (!opdone) {
+            if (rc == 0)
+                WaitTimeout();
+            else
+                lastError = EMIO_ERR_IO;
+        }
+        if (isVerbose) {
+            GetCurTime(&curTime);
+            if (opdone)
+                std::cout << "Waited " << TimeDiff_us(&waitStart, &curTime) << " us (event) for ";
+            else
+                std::cout << "EMIO event " << ((rc == 0) ? "timeout" : "error") << " waiting for ";
+            std::cout << opType << " quadlet " << num << std::endl;
+        }
+        return opdone;
+    }
+
+    // First, check if op_done is set, since this is often the case
+    uint64_t values = 0;
+    bool ok = GetValues(LINES_OP_DONE, values);
+    bool opdone = ok && (values & LINES_OP_DONE);
+    if (ok && !opdone) {
+        // Poll using the wait policy (see EMIO_Interface::SetWaitPolicy); as with gpiod,
+        // each poll is a system call
+        WaitState ws;
+        WaitBegin(ws);
+        while ((ok = GetValues(LINES_OP_DONE, values)) && !(opdone = (values & LINES_OP_DONE)) &&
+               WaitContinue(ws));
+        WaitEnd(ws, opdone);
+        if (!ok)
+            lastError = EMIO_ERR_IO;
+        if (isVerbose) {
+            if (!ok)
+                std::cout << "EMIO error polling op_done for " << opType << " quadlet " << num << std::endl;
+            else if (!opdone)
+                std::cout << "EMIO polling timeout waiting for " << opType << " quadlet " << num << std::endl;
+            else
+                std::cout << "Waited " << WaitElapsed_us(ws) << " us for " << opType << " quadlet " << num << std::endl;
+        }
+    }
+    return opdone;
+}
+
+// Local method to set data lines to input or output. The direction is changed by
+// reconfiguring the line request; the current output values are kept.
+bool EMIO_Interface_GpioV2::SetDataInput(bool input)
+{
+    if (input != isInput) {
+        isInput = input;
+        if (!Configure()) {
+            std::cout << "SetDataInput (gpiov2): could not set data lines as "
+                      << (input ? "input" : "output") << std::endl;
+            isInput = !input;
+            return false;
+        }
+        CountDirSwitch();
+    }
+    return true;
+}
+
+// Local method called when the bus lock was last held by another owner. The kernel
+// does not report changes to the line direction made by another process (e.g., via mmap),
+// so the line request is reconfigured with the data lines as input.
+void EMIO_Interface_GpioV2::RevalidateDirection()
+{
+    isInput = true;
+    if (!Configure())
+        std::cout << "RevalidateDirection (gpiov2): could not configure lines" << std::endl;
+}
+
+// Local method to abort a transaction after a timeout (see EMIO_Interface::TransactionFailed):
+// clears all outputs (req_bus, blk_start, blk_end) and sets the data lines to input
+bool EMIO_Interface_GpioV2::AbortTransaction()
+{
+    if (!SetValues(LINES_OUTPUTS, 0))
+        std::cout << "AbortTransaction (gpiov2): error clearing outputs" << std::endl;
+    SetDataInput(true);
+    return true;
+}
+
+// Local method to wait for op_done to be cleared after an abort
+bool EMIO_Interface_GpioV2::WaitBusIdle()
+{
+    uint64_t values = 0;
+    bool ok = GetValues(LINES_OP_DONE, values);
+    bool idle = ok && !(values & LINES_OP_DONE);
+    if (ok && !idle) {
+        WaitState ws;
+        WaitBegin(ws);
+        while ((ok = GetValues(LINES_OP_DONE, values)) && !(idle = !(values & LINES_OP_DONE)) &&
+               WaitContinue(ws));
+        WaitEnd(ws, idle);
+    }
+    if (!ok)
+        lastError = EMIO_ERR_IO;
+    return idle;
+}
+
+bool EMIO_Interface_GpioV2::DoReadQuadlet(uint16_t addr, uint32_t &data, fpgav3_time_t *midTimes)
+{
+    // Set all data lines to input
+    if (!SetDataInput(true))
+        return false;
+
+    // Write reg_addr (read address) and set req_bus to 1 (rising edge requests firmware
+    // to read register)
+    EdgeRequestBegin();
+    bool ok = SetValues(LINES_OUTPUTS, UpperLines(addr | Bits_RequestBus));
+    EdgeRequestEnd();
+    if (!ok) {
+        if (isVerbose)
+            std::cout << "ReadQuadlet (gpiov2): error setting address" << std::endl;
+        return false;
+    }
+
+    // Get time before wait
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
+
+    if (!WaitOpDone(false, 0)) {
+        SetValues(LINES_OUTPUTS, 0);
+        return false;
+    }
+
+    // Get time after wait
+    if (midTimes)
+        GetCurTime(&midTimes[1]);
+
+    // Read data, then set req_bus (and address) to 0
+    uint64_t values;
+    bool ret = GetValues(LINES_DATA, values);
+    SetValues(LINES_OUTPUTS, 0);
+    if (!ret) {
+        if (isVerbose)
+            std::cout << "ReadQuadlet (gpiov2): error reading data lines" << std::endl;
+        return false;
+    }
+    data = static_cast<uint32_t>(values);
+    return true;
+}
+
+bool EMIO_Interface_GpioV2::DoWriteQuadlet(uint16_t addr, uint32_t data, fpgav3_time_t *midTimes)
+{
+    // Set all data lines to output; if the direction changes, the data is output when
+    // the lines are reconfigured
+    outValues = (outValues & ~LINES_DATA) | data;
+    if (!SetDataInput(false))
+        return false;
+
+    // Write data, address and reg_wen (no longer used), and set req_bus to 1 (rising
+    // edge requests firmware to write register). The values are set in order of line
+    // offset, so the data is set before req_bus.
+    EdgeRequestBegin();
+    bool ok = SetValues(LINES_OUTPUTS | LINES_DATA, UpperLines(addr | Bits_RegWen | Bits_RequestBus) | data);
+    EdgeRequestEnd();
+    if (!ok) {
+        if (isVerbose)
+            std::cout << "WriteQuadlet (gpiov2): error setting data and address" << std::endl;
+        return false;
+    }
+
+    // Get time before wait
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
+
+    // op_done should be set quickly by firmware, to indicate that write has completed
+    bool ret = WaitOpDone(true, 0);
+
+    // Get time after wait
+    if (ret && midTimes)
+        GetCurTime(&midTimes[1]);
+
+    // Set req_bus (and address and reg_wen) to 0
+    SetValues(LINES_OUTPUTS, 0);
+
+    return ret;
+}
+
+bool EMIO_Interface_GpioV2::DoReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes, fpgav3_time_t *midTimes)
+{
+    if (version < 1) {
+        std::cout << "ReadBlock (gpiov2): not supported for version " << version << std::endl;
+        lastError = EMIO_ERR_UNSUPPORTED;
+        return false;
+    }
+
+    // Set all data lines to input
+    if (!SetDataInput(true))
+        return false;
+
+    unsigned int q;
+    unsigned int nQuads = (nBytes+3)/4;
+    uint64_t values;
+
+    // Set base address, blk_start and req_bus (see EMIO_MmapCore::DoReadBlock)
+    uint32_t outreg = addr | Bits_BlkStart | Bits_RequestBus;
+
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
+
+    for (q = 0; q < nQuads; q++) {
+
+        if (q == nQuads-1) {
+            // Set blk_end to 1 to indicate end of block
+            outreg &= ~Bits_BlkStart;
+            outreg |=  Bits_BlkEnd;
+        }
+        // Update LSB (address change triggers read of next quadlet)
+        if (addr&0x0001) outreg |=  Bits_LSB;
+        else             outreg &= ~Bits_LSB;
+        EdgeRequestBegin();
+        bool ok = SetValues(LINES_OUTPUTS, UpperLines(outreg));
+        EdgeRequestEnd();
+        if (!ok) {
+            if (isVerbose)
+                std::cout << "ReadBlock (gpiov2): error setting address for quadlet " << q << std::endl;
+            SetValues(LINES_OUTPUTS, 0);
+            return false;
+        }
+
+        // Increment address (it would be enough to toggle LSB)
+        addr++;
+
+        // op_done set by firmware, to indicate that quadlet has been read
+        if (!WaitOpDone(false, q)) {
+            SetValues(LINES_OUTPUTS, 0);
+            return false;
+        }
+
+        // Read data from reg_data
+        if (!GetValues(LINES_DATA, values)) {
+            if (isVerbose)
+                std::cout << "ReadBlock (gpiov2): error reading quadlet " << q
+                          << " (of " << nQuads << ")" << std::endl;
+            SetValues(LINES_OUTPUTS, 0);
+            return false;
+        }
+        data[q] = bswap_32(static_cast<uint32_t>(values));
+    }
+
+    if (midTimes)
+        GetCurTime(&midTimes[1]);
+
+    // Set all lines to 0
+    SetValues(LINES_OUTPUTS, 0);
+
+    return true;
+}
+
+bool EMIO_Interface_GpioV2::DoWriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes,
+                                         fpgav3_time_t *midTimes)
+{
+    if (version < 1) {
+        std::cout << "WriteBlock (gpiov2): not supported for version " << version << std::endl;
+        lastError = EMIO_ERR_UNSUPPORTED;
+        return false;
+    }
+
+    unsigned int q;
+    unsigned int nQuads = (nBytes+3)/4;
+
+    // Set all data lines to output (with first quadlet)
+    uint32_t val = bswap_32(data[0]);
+    outValues = (outValues & ~LINES_DATA) | val;
+    if (!SetDataInput(false))
+        return false;
+
+    // Set addr, blk_start and req_bus (see EMIO_MmapCore::DoWriteBlock)
+    uint32_t outreg = addr | Bits_BlkStart | Bits_RequestBus;
+
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
+
+    for (q = 0; q < nQuads; q++) {
+
+        val = bswap_32(data[q]);
+
+        if (q == nQuads-1) {
+            // Set blk_end to 1 to indicate end of block write
+            outreg &= ~Bits_BlkStart;
+            outreg |=  Bits_BlkEnd;
+        }
+        // Update LSB (address change triggers write of quadlet); the data lines have
+        // lower offsets, so they are set first
+        if (addr&0x0001) outreg |=  Bits_LSB;
+        else             outreg &= ~Bits_LSB;
+        EdgeRequestBegin();
+        bool ok = SetValues(LINES_OUTPUTS | LINES_DATA, UpperLines(outreg) | val);
+        EdgeRequestEnd();
+        if (!ok) {
+            if (isVerbose)
+                std::cout << "WriteBlock (gpiov2): error setting address for quadlet " << q << std::endl;
+            SetValues(LINES_OUTPUTS, 0);
+            return false;
+        }
+
+        // Increment address (it would be enough to toggle LSB)
+        addr++;
+
+        // op_done set by firmware, to indicate that quadlet has been written
+        if (!WaitOpDone(true, q)) {
+            SetValues(LINES_OUTPUTS, 0);
+            return false;
+        }
+    }
+
+    if (midTimes)
+        GetCurTime(&midTimes[1]);
+
+    // Set all lines to 0
+    SetValues(LINES_OUTPUTS, 0);
+
+    return true;
+}
+
+// ReadQuadlet: read quadlet from specified address
+bool EMIO_Interface_GpioV2::ReadQuadlet(uint16_t addr, uint32_t &data)
+{
+    // For timing measurements (before and after wait)
+    fpgav3_time_t midTimes[2];
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus())
+        return false;
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoReadQuadlet(addr, data, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_READ_QUAD, addr, &data, 4, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_READ_QUAD, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// WriteQuadlet: write quadlet to specified address
+bool EMIO_Interface_GpioV2::WriteQuadlet(uint16_t addr, uint32_t data)
+{
+    // For timing measurements (before and after wait)
+    fpgav3_time_t midTimes[2];
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus())
+        return false;
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoWriteQuadlet(addr, data, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_WRITE_QUAD, addr, &data, 4, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_WRITE_QUAD, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// Read block of data
+bool EMIO_Interface_GpioV2::ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+{
+    // For timing measurements (first and last read)
+    fpgav3_time_t midTimes[2];
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus())
+        return false;
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoReadBlock(addr, data, nBytes, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_READ_BLOCK, addr, data, nBytes, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_READ_BLOCK, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// Write block of data
+bool EMIO_Interface_GpioV2::WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes)
+{
+    // For timing measurements (first and last write)
+    fpgav3_time_t midTimes[2];
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus())
+        return false;
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoWriteBlock(addr, data, nBytes, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_WRITE_BLOCK, addr, data, nBytes, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_WRITE_BLOCK, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// Execute batch of requests (see EMIO_Interface::ExecuteBatch)
+bool EMIO_Interface_GpioV2::RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass)
+{
+    bool ret = true;
+    for (unsigned int i = 0; i < num; i++) {
+        EMIO_Request &req = reqs[i];
+        if (!BatchSelect(req, pass))
+            continue;
+        bool ok = false;
+        TraceBegin();
+        // Recover the bus if the previous request was aborted
+        if (BeginRequest()) {
+            switch (req.opType) {
+                case EMIO_READ_QUAD:   ok = DoReadQuadlet(req.addr, *req.data);
+                                       break;
+                case EMIO_WRITE_QUAD:  ok = DoWriteQuadlet(req.addr, *req.data);
+                                       break;
+                case EMIO_READ_BLOCK:  ok = DoReadBlock(req.addr, req.data, req.nBytes);
+                                       break;
+                case EMIO_WRITE_BLOCK: ok = DoWriteBlock(req.addr, req.data, req.nBytes);
+                                       break;
+            }
+        }
+        EndTransaction(req.opType, req.addr, req.data, req.nBytes, ok);
+        req.status = ok ? EMIO_REQ_OK : EMIO_REQ_FAILED;
+        if (!ok) {
+            ret = false;
+            if (flags & EMIO_BATCH_STOP_ON_ERR)
+                break;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,113 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_gpiov2 (Linux library)
+ *
+ * This library provides an interface from the Zynq PS to the read and write buses
+ * on the FPGA (PL), via the EMIO bits. The read and write buses each consist of
+ * a 16-bit address bus and a 32-bit data bus. The EMIO interface uses the same
+ * 16 bits for the read/write address and the same 32 bits for the read/write data.
+ * The address bus is always output from the PS, whereas the data bus is bidirectional
+ * (PS input when reading, PS output when writing).
+ *
+ * This derived class uses the GPIO character device uAPI (v2) of the Linux kernel
+ * directly, instead of libgpiod. All 64 EMIO lines are requested as a single line
+ * request, so that the line values have the same bit assignments as the GPIO registers
+ * used by EMIO_Interface_Mmap (see fpgav3_emio_regs.h) and all outputs (e.g., address,
+ * req_bus and write data) can be set with one GPIO_V2_LINE_SET_VALUES ioctl. This
+ * requires fewer system calls per transaction than EMIO_Interface_Gpiod, and does not
+ * require access to /dev/mem.
+ *
+ * The GPIO chip can be specified, so that the interface can be exercised without the
+ * FPGA using the gpio-sim module on a stock kernel: create a chip with (at least) 118
+ * lines via configfs and pull up line 103 (op_done) and line 114 (version 1), e.g.:
+ *
+ *    modprobe gpio-sim
+ *    mkdir -p /sys/kernel/config/gpio-sim/emio/bank0
+ *    echo 118 > /sys/kernel/config/gpio-sim/emio/bank0/num_lines
+ *    echo 1 > /sys/kernel/config/gpio-sim/emio/live
+ *    echo pull-up > /sys/devices/platform/<dev_name>/<chip_name>/sim_gpio103/pull
+ *    echo pull-up > /sys/devices/platform/<dev_name>/<chip_name>/sim_gpio114/pull
+ *
+ * and then, for example, run "fpgav3bench -G/dev/gpiochipN". Every transaction then
+ * completes immediately (read data is 0), which measures the system call overhead.
+ * "fpgav3bench -V" creates such a chip itself and checks the version read and the
+ * read handshake, by driving op_done via the gpio-sim pull.
+ */
+
+#ifndef FPGAV3_EMIO_GPIOV2_H
+#define FPGAV3_EMIO_GPIOV2_H
+
+#include "fpgav3_emio.h"
+
+// Default GPIO chip (Zynq GPIO controller)
+#define EMIO_GPIOV2_DEFAULT_CHIP "/dev/gpiochip0"
+
+class EMIO_Interface_GpioV2 : public EMIO_Interface
+{
+    int lineFd;                // file descriptor of line request (-1 if not open)
+    uint64_t outValues;        // current values of output lines
+
+public:
+
+    EMIO_Interface_GpioV2(const char *chipName = EMIO_GPIOV2_DEFAULT_CHIP);
+
+    ~EMIO_Interface_GpioV2();
+
+    bool IsOK() const
+    { return (lineFd >= 0); }
+
+    void SetEventMode(bool newState);
+
+    bool ReadQuadlet(uint16_t addr, uint32_t &data);
+
+    bool WriteQuadlet(uint16_t addr, uint32_t data);
+
+    bool ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes);
+
+    bool WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes);
+
+protected:
+
+    bool Init(const char *chipName);
+
+    // Configure the line request: data lines are input or output (isInput), the control
+    // and address lines are outputs, and op_done reports rising edges if useEvents is set.
+    // The output lines are set to outValues.
+    bool Configure();
+
+    // Set or get the lines in mask (one ioctl each)
+    bool SetValues(uint64_t mask, uint64_t values);
+    bool GetValues(uint64_t mask, uint64_t &values);
+
+    // Wait for op_done to be set, for quadlet num of a read or write (isWrite)
+    bool WaitOpDone(bool isWrite, unsigned int num);
+
+    // Set data lines to input (true) or output (false), if not already set
+    bool SetDataInput(bool input);
+
+    // op_done events carry kernel timestamps (see SetEdgeTiming)
+    bool HasEdgeTimestamps() const
+    { return true; }
+
+    // Set data lines to input, since they may have been changed by another process
+    void RevalidateDirection();
+
+    // Abort a transaction and wait for the bus to become idle (see EMIO_Interface)
+    bool AbortTransaction();
+    bool WaitBusIdle();
+
+    // Low-level transactions, without timing measurements (used by the public methods
+    // and RunBatch). If midTimes is not 0, it is used to store the times before and
+    // after the wait (quadlet) or the first and last quadlet (block).
+    bool DoReadQuadlet(uint16_t addr, uint32_t &data, fpgav3_time_t *midTimes = 0);
+    bool DoWriteQuadlet(uint16_t addr, uint32_t data, fpgav3_time_t *midTimes = 0);
+    bool DoReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes, fpgav3_time_t *midTimes = 0);
+    bool DoWriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes, fpgav3_time_t *midTimes = 0);
+
+    bool RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass);
+
+};
+
+#endif // FPGAV3_EMIO_GPIOV2_H
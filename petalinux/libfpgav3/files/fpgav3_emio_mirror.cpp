@@ -0,0 +1,290 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <byteswap.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fpgav3_emio_mirror.h"
+
+// Identifies (and versions) the layout of the shared-memory segment
+const uint32_t MIRROR_MAGIC = 0x454d4d31;    // 'EMM1'
+
+// Maximum number of attempts to copy a snapshot (the publisher may have terminated
+// during an update)
+const unsigned int MIRROR_MAX_RETRIES = 100000;
+
+struct MirrorRange {
+    uint32_t addr;
+    uint32_t nQuads;
+    uint32_t offset;           // offset in data area (quadlets)
+};
+
+// Shared-memory segment, created (all zero) by the publisher. The range table is
+// written before the magic number and does not change afterwards.
+struct EMIO_MirrorShared {
+    uint32_t magic;            // written last by publisher (0 when publisher exits)
+    int32_t  publisherPid;
+    uint32_t numRanges;
+    uint32_t pad1[13];
+    MirrorRange ranges[EMIO_MIRROR_MAX_RANGES];
+    uint32_t seq;              // sequence lock (odd while the data is updated)
+    uint32_t ok;               // 1 if all reads were successful
+    uint64_t time_ns;          // time of update (CLOCK_MONOTONIC)
+    uint32_t pad2[12];
+    uint32_t data[EMIO_MIRROR_MAX_QUADS];
+};
+
+// ---------------------------------------------------------------------------------
+// EMIO_MirrorPublisher
+
+EMIO_MirrorPublisher::EMIO_MirrorPublisher(EMIO_Interface *emioIntf, const char *name) :
+    emio(emioIntf), shared(0), stopRequested(false), numUpdates(0), numErrors(0)
+{
+    path = std::string("/dev/shm/") + name;
+}
+
+EMIO_MirrorPublisher::~EMIO_MirrorPublisher()
+{
+    if (shared) {
+        __atomic_store_n(&shared->magic, 0, __ATOMIC_RELEASE);
+        shared->publisherPid = 0;
+        munmap(shared, sizeof(EMIO_MirrorShared));
+        unlink(path.c_str());
+    }
+}
+
+bool EMIO_MirrorPublisher::AddRange(uint16_t addr, unsigned int nQuads)
+{
+    if (shared) {
+        std::cout << "EMIO_MirrorPublisher: cannot add range after Open" << std::endl;
+        return false;
+    }
+    if ((nQuads == 0) || (reqs.size() >= EMIO_MIRROR_MAX_RANGES) ||
+        (buffer.size()+nQuads > EMIO_MIRROR_MAX_QUADS)) {
+        std::cout << "EMIO_MirrorPublisher: cannot add range " << std::hex << addr << std::dec
+                  << " (" << nQuads << " quadlets)" << std::endl;
+        return false;
+    }
+    // The requests point into buffer, so they are created in Open
+    EMIO_Request req = EMIO_Request::ReadBlock(addr, 0, 4*nQuads);
+    if (nQuads == 1)
+        req.opType = EMIO_READ_QUAD;
+    reqs.push_back(req);
+    buffer.resize(buffer.size()+nQuads, 0);
+    return true;
+}
+
+bool EMIO_MirrorPublisher::Open()
+{
+    if (shared)
+        return true;
+    if (reqs.empty()) {
+        std::cout << "EMIO_MirrorPublisher: no ranges specified" << std::endl;
+        return false;
+    }
+    // Replace any existing segment (e.g., from a previous publisher), so that the new
+    // segment is all zero; readers of the previous publisher see that it terminated.
+    unlink(path.c_str());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        std::cout << "EMIO_MirrorPublisher: failed to create " << path << std::endl;
+        return false;
+    }
+    // Allow other users to read
+    fchmod(fd, 0644);
+    if (ftruncate(fd, sizeof(EMIO_MirrorShared)) != 0) {
+        std::cout << "EMIO_MirrorPublisher: failed to set size of " << path << std::endl;
+        close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+    void *region = mmap(NULL, sizeof(EMIO_MirrorShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        std::cout << "EMIO_MirrorPublisher: failed to mmap " << path << std::endl;
+        unlink(path.c_str());
+        return false;
+    }
+    shared = reinterpret_cast<EMIO_MirrorShared *>(region);
+    shared->publisherPid = getpid();
+    shared->numRanges = reqs.size();
+    unsigned int offset = 0;
+    for (size_t i = 0; i < reqs.size(); i++) {
+        unsigned int nQuads = reqs[i].nBytes/4;
+        reqs[i].data = &buffer[offset];
+        shared->ranges[i].addr = reqs[i].addr;
+        shared->ranges[i].nQuads = nQuads;
+        shared->ranges[i].offset = offset;
+        offset += nQuads;
+    }
+    // Readers only connect after the magic number is set
+    __atomic_store_n(&shared->magic, MIRROR_MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool EMIO_MirrorPublisher::Update()
+{
+    if (!shared)
+        return false;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bool ok = emio->ExecuteBatch(&reqs[0], reqs.size());
+    numUpdates++;
+    if (!ok)
+        numErrors++;
+
+    // Write side of the sequence lock; there is only one writer, so the sequence number
+    // does not need to be incremented atomically. The release fence ensures that the
+    // odd sequence number is visible before any of the data.
+    uint32_t seq = shared->seq;
+    __atomic_store_n(&shared->seq, seq+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (size_t i = 0; i < reqs.size(); i++) {
+        const MirrorRange &r = shared->ranges[i];
+        bool isBlock = (reqs[i].opType == EMIO_READ_BLOCK);
+        for (unsigned int q = 0; q < r.nQuads; q++) {
+            uint32_t val = buffer[r.offset+q];
+            __atomic_store_n(&shared->data[r.offset+q], isBlock ? bswap_32(val) : val, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_store_n(&shared->ok, ok ? 1 : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&shared->time_ns, static_cast<uint64_t>(now.tv_sec)*1000000000ULL + now.tv_nsec,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&shared->seq, seq+2, __ATOMIC_RELEASE);
+    return ok;
+}
+
+void EMIO_MirrorPublisher::Run(double rate_hz)
+{
+    if (!shared || (rate_hz <= 0.0))
+        return;
+    long period_ns = static_cast<long>(1.0e9/rate_hz);
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    while (!stopRequested) {
+        Update();
+        deadline.tv_nsec += period_ns;
+        while (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_nsec -= 1000000000L;
+            deadline.tv_sec++;
+        }
+        // If an update took longer than the period, start from the current time
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec > deadline.tv_sec) ||
+            ((now.tv_sec == deadline.tv_sec) && (now.tv_nsec > deadline.tv_nsec)))
+            deadline = now;
+        else
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_MirrorReader
+
+EMIO_MirrorReader::EMIO_MirrorReader(const char *name) : shared(0), numRetries(0)
+{
+    std::string path = std::string("/dev/shm/") + name;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cout << "EMIO_MirrorReader: failed to open " << path << " (is the publisher running?)"
+                  << std::endl;
+        return;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size < static_cast<off_t>(sizeof(EMIO_MirrorShared)))) {
+        std::cout << "EMIO_MirrorReader: invalid size of " << path << std::endl;
+        close(fd);
+        return;
+    }
+    void *region = mmap(NULL, sizeof(EMIO_MirrorShared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        std::cout << "EMIO_MirrorReader: failed to mmap " << path << std::endl;
+        return;
+    }
+    shared = reinterpret_cast<const EMIO_MirrorShared *>(region);
+    if (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != MIRROR_MAGIC) {
+        std::cout << "EMIO_MirrorReader: publisher not running" << std::endl;
+        munmap(const_cast<EMIO_MirrorShared *>(shared), sizeof(EMIO_MirrorShared));
+        shared = 0;
+    }
+}
+
+EMIO_MirrorReader::~EMIO_MirrorReader()
+{
+    if (shared)
+        munmap(const_cast<EMIO_MirrorShared *>(shared), sizeof(EMIO_MirrorShared));
+}
+
+bool EMIO_MirrorReader::IsPublisherRunning() const
+{
+    if (!shared || (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != MIRROR_MAGIC))
+        return false;
+    pid_t pid = shared->publisherPid;
+    return (pid > 0) && ((kill(pid, 0) == 0) || (errno == EPERM));
+}
+
+unsigned int EMIO_MirrorReader::GetNumRanges() const
+{
+    return shared ? shared->numRanges : 0;
+}
+
+bool EMIO_MirrorReader::GetRange(unsigned int index, uint16_t &addr, unsigned int &nQuads) const
+{
+    if (index >= GetNumRanges())
+        return false;
+    addr = shared->ranges[index].addr;
+    nQuads = shared->ranges[index].nQuads;
+    return true;
+}
+
+bool EMIO_MirrorReader::Read(uint16_t addr, uint32_t *data, unsigned int nQuads, EMIO_MirrorSnapshot *info)
+{
+    if (!shared || (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != MIRROR_MAGIC))
+        return false;
+    // Find the range that contains the registers
+    const uint32_t *src = 0;
+    for (unsigned int i = 0; i < shared->numRanges; i++) {
+        const MirrorRange &r = shared->ranges[i];
+        if ((addr >= r.addr) && (addr+nQuads <= r.addr+r.nQuads)) {
+            src = &shared->data[r.offset + (addr-r.addr)];
+            break;
+        }
+    }
+    if (!src)
+        return false;
+
+    // Read side of the sequence lock: copy the data, then check that the sequence number
+    // is even and did not change. The acquire fence ensures that the data is read before
+    // the sequence number is checked again.
+    for (unsigned int n = 0; n < MIRROR_MAX_RETRIES; n++) {
+        uint32_t seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+        if (seq == 0)
+            return false;                   // no data published yet
+        if ((seq & 1) == 0) {
+            for (unsigned int q = 0; q < nQuads; q++)
+                data[q] = __atomic_load_n(&src[q], __ATOMIC_RELAXED);
+            bool ok = __atomic_load_n(&shared->ok, __ATOMIC_RELAXED);
+            uint64_t time_ns = __atomic_load_n(&shared->time_ns, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == seq) {
+                if (info) {
+                    info->seq = seq/2;
+                    info->time.tv_sec = time_ns/1000000000ULL;
+                    info->time.tv_nsec = time_ns%1000000000ULL;
+                    info->ok = ok;
+                }
+                return true;
+            }
+        }
+        numRetries++;
+    }
+    return false;
+}
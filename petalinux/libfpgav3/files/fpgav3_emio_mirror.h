@@ -0,0 +1,138 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_mirror (Linux library)
+ *
+ * Shared-memory mirror of FPGA registers, for processes that only monitor the FPGA
+ * (e.g., GUI, logger, health checks). One process (EMIO_MirrorPublisher, e.g., the
+ * fpgav3mirror application) periodically reads a configured set of address ranges via
+ * an EMIO_Interface, as a single batch, and publishes the data in a shared-memory
+ * segment (a file in /dev/shm). Any number of processes (EMIO_MirrorReader) can then
+ * get consistent snapshots of the registers without any bus transactions or system
+ * calls.
+ *
+ * The data is protected by a sequence lock: the publisher increments the sequence
+ * number before and after updating the data (so it is odd during the update), and the
+ * readers copy the data and retry if the sequence number was odd or changed. Readers
+ * never block the publisher.
+ *
+ * The data is stored as register values (i.e., as returned by ReadQuadlet, even for
+ * ranges that are read with ReadBlock).
+ */
+
+#ifndef FPGAV3_EMIO_MIRROR_H
+#define FPGAV3_EMIO_MIRROR_H
+
+#include <string>
+#include <vector>
+#include "fpgav3_emio.h"
+
+// Default name of shared-memory segment (/dev/shm/fpgav3mirror)
+#define EMIO_MIRROR_DEFAULT_NAME "fpgav3mirror"
+
+const unsigned int EMIO_MIRROR_MAX_RANGES = 32;
+const unsigned int EMIO_MIRROR_MAX_QUADS = 4096;    // total for all ranges
+
+struct EMIO_MirrorShared;
+
+// Information about a snapshot
+struct EMIO_MirrorSnapshot {
+    uint32_t seq;                   // number of updates published (increments by 1)
+    struct timespec time;           // time at which the data was read (CLOCK_MONOTONIC)
+    bool ok;                        // true if all reads were successful
+};
+
+class EMIO_MirrorPublisher
+{
+    EMIO_Interface *emio;             // interface (not owned)
+    EMIO_MirrorShared *shared;        // shared-memory segment (0 until Open)
+    std::string path;                 // path of shared-memory segment
+    std::vector<EMIO_Request> reqs;   // one request per range
+    std::vector<uint32_t> buffer;     // data read by reqs
+    volatile bool stopRequested;
+    unsigned long numUpdates;
+    unsigned long numErrors;
+
+public:
+
+    EMIO_MirrorPublisher(EMIO_Interface *emioIntf, const char *name = EMIO_MIRROR_DEFAULT_NAME);
+
+    // Clears the magic number (so readers know that the data is no longer updated) and
+    // removes the shared-memory segment
+    ~EMIO_MirrorPublisher();
+
+    // Add a range of registers to mirror (only before Open). Returns false if the
+    // maximum number of ranges or quadlets is exceeded.
+    bool AddRange(uint16_t addr, unsigned int nQuads);
+
+    // Create the shared-memory segment (replacing any existing segment) and publish
+    // the range table. Readers can connect after this call. Returns false on error.
+    bool Open();
+
+    bool IsOK() const
+    { return (shared != 0); }
+
+    // Read all ranges (one batch) and publish the data. Returns false if any read failed
+    // (the data is still published, with ok set to false).
+    bool Update();
+
+    // Call Update at the specified rate (absolute deadlines) until Stop is called
+    // (e.g., from a signal handler)
+    void Run(double rate_hz);
+
+    void Stop()
+    { stopRequested = true; }
+
+    unsigned long GetNumUpdates() const
+    { return numUpdates; }
+
+    unsigned long GetNumErrors() const
+    { return numErrors; }
+};
+
+class EMIO_MirrorReader
+{
+    const EMIO_MirrorShared *shared;  // shared-memory segment (mapped read-only)
+    unsigned long numRetries;         // number of times a copy was retried
+
+public:
+
+    EMIO_MirrorReader(const char *name = EMIO_MIRROR_DEFAULT_NAME);
+
+    ~EMIO_MirrorReader();
+
+    // Returns true if connected to a publisher (the publisher may have terminated since;
+    // see IsPublisherRunning)
+    bool IsOK() const
+    { return (shared != 0); }
+
+    // Returns true if the publisher has not terminated (uses a system call)
+    bool IsPublisherRunning() const;
+
+    // Get the range table
+    unsigned int GetNumRanges() const;
+
+    bool GetRange(unsigned int index, uint16_t &addr, unsigned int &nQuads) const;
+
+    // Read
+    //   Copies a consistent snapshot of nQuads registers starting at addr, which must
+    //   be within one of the mirrored ranges.
+    // Parameters:
+    //     addr    16-bit register address
+    //     data    array of nQuads quadlets (register values)
+    //     nQuads  number of quadlets
+    //     info    if not 0, set to information about the snapshot
+    // Returns:    false if the registers are not mirrored, no data has been published
+    //             yet, or the publisher has terminated
+    bool Read(uint16_t addr, uint32_t *data, unsigned int nQuads, EMIO_MirrorSnapshot *info = 0);
+
+    bool ReadQuadlet(uint16_t addr, uint32_t &data, EMIO_MirrorSnapshot *info = 0)
+    { return Read(addr, &data, 1, info); }
+
+    // Returns the number of times a copy was retried because it overlapped an update
+    unsigned long GetNumRetries() const
+    { return numRetries; }
+};
+
+#endif // FPGAV3_EMIO_MIRROR_H
@@ -2,50 +2,24 @@
 /* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
 
 #include <iostream>
+#include <gpiod.h>
 #include <byteswap.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include "fpgav3_emio_mmap.h"
-
-// System level control registers
-const uint32_t SLCR_BASE_ADDR     = 0xF8000000;
-const uint32_t APER_CLK_CTRL      = 0x0000012C;   // APER clock control register
-const uint32_t GPIO_CLK_BIT       = (1 << 22);    // Bit 22 is for GPIO AMBA clock control
-
-// GPIO control registers
-const uint32_t GPIO_BASE_ADDR     = 0xE000A000;
-// Following size includes all GPIO registers (from 0x0000 to 0x02E4), which is
-// more than enough (we only use 0x0048 - 0x02c8).
-const uint32_t GPIO_SIZE          = 0x000002E8;
-
-// GPIO registers used for EMIO interface
-enum EMIO_Reg {
-    Reg_OutputLower = 0x00000048,   // Data output, emio[31:0]
-    Reg_OutputUpper = 0x0000004c,   // Data output, emio[63:32]
-    Reg_InputLower  = 0x00000068,   // Data input, emio[31:0]
-    Reg_InputUpper  = 0x0000006c,   // Data input, emio[63:32]
-    Reg_DirLower    = 0x00000284,   // Direction: 0 = input (default), 1 = output
-    Reg_OutEnLower  = 0x00000288,   // Output enable: 0 = disabled (default), 1 = enabled
-    Reg_DirUpper    = 0x000002c4,   // Direction: 0 = input (default), 1 = output
-    Reg_OutEnUpper  = 0x000002c8    // Output enable: 0 = disabled (default), 1 = enabled
-};
-
-// Bit masks for upper EMIO bits
-enum EMIO_Bits {
-    Bits_RegAddr        = 0x0000ffff,   // 16-bit address (output)
-    Bits_RequestBus     = 0x00010000,   // Request read or write bus (output)
-    Bits_OpDone         = 0x00020000,   // Read or write done (input)
-    Bits_RegWen         = 0x00040000,   // Register write enable (output)
-    Bits_BlkStart       = 0x00080000,   // Block start (output)
-    Bits_BlkEnd         = 0x00100000,   // Block end (output)
-    Bits_Write          = 0x00200000,   // Write operation detected (based on tristate)
-    Bits_GrantBus       = 0x00400000,   // Grant of read or write bus (input)
-    Bits_LSB            = 0x00800000,   // Address least significant bit (output)
-    Bits_Version        = 0xf0000000    // Bus interface version (input)
-};
-
-EMIO_Interface_Mmap::EMIO_Interface_Mmap() : EMIO_Interface()
+#include "fpgav3_emio_sim.h"
+#include "fpgav3_emio_regs.h"
+#include "fpgav3_mmio.h"
+#include "fpgav3_probes.h"
+
+// GPIO chip and line of op_done, for event mode (see EMIO_Interface_Gpiod)
+static const char * const EVENT_GPIO_CHIP = "/dev/gpiochip0";
+const unsigned int INDEX_EMIO_OP_DONE = 54+49;
+
+EMIO_Interface_Mmap::EMIO_Interface_Mmap() : EMIO_MmapCore(), fd(-1), mmap_region(0),
+                                             eventChip(0), eventLine(0), eventSpin_us(20.0),
+                                             waitAvg_us(0.0), numEventSleeps(0)
 {
     if (!Init()) {
         if (fd >= 0) close(fd);
@@ -74,6 +48,8 @@ bool EMIO_Interface_Mmap::Init()
         if (isVerbose)
             std::cout << "Setting clock bit" << std::endl;
         RegisterWrite(APER_CLK_CTRL, aper_clk_reg | GPIO_CLK_BIT);
+        // Ensure that the clock is enabled (SLCR) before accessing the GPIO registers
+        MMIO_Barrier();
     }
 
     // Release mmap_region
@@ -84,8 +60,15 @@ bool EMIO_Interface_Mmap::Init()
     if (!mmap_region)
         return false;
 
+    // If the lines were already configured (e.g., by another process that may be using
+    // the bus), only make changes that are needed (see RevalidateDirection), so that
+    // a transaction in progress is not disrupted.
+    bool isConfigured = (RegisterRead(Reg_DirUpper) == Bits_UpperOutputs) &&
+                        (RegisterRead(Reg_OutEnUpper) == Bits_UpperOutputs);
+
     // Set upper bits as input and read bus version number
-    RegisterWrite(Reg_DirUpper, 0x00000000);
+    if (!isConfigured)
+        RegisterWrite(Reg_DirUpper, 0x00000000);
     uint32_t upper;
     upper = RegisterRead(Reg_InputUpper);
     version = (upper & Bits_Version) >> 28;
@@ -95,9 +78,17 @@ bool EMIO_Interface_Mmap::Init()
         return false;
     }
 
+    if (isConfigured) {
+        RevalidateDirection();
+        return true;
+    }
+
     // emio[31:0] is reg_data (initialize as input)
     RegisterWrite(Reg_DirLower, 0x00000000);
     isInput = true;
+    // Enable all outputs; this has no effect while the direction is set to input,
+    // so we only need to write Reg_DirLower to change direction (see SetDataInput).
+    RegisterWrite(Reg_OutEnLower, 0xffffffff);
     // emio[63:60] is version number (input)
     // emio[55] is addr_lsb (output)
     // emio[54] is grant_bus (input)
@@ -108,13 +99,11 @@ bool EMIO_Interface_Mmap::Init()
     // emio[49] is op_done (input)
     // emio[48] is req_bus (output)
     // emio[47:32] is reg_addr (output)
-    RegisterWrite(Reg_DirUpper,
-                  Bits_RegAddr | Bits_RequestBus | Bits_RegWen | Bits_BlkStart | Bits_BlkEnd | Bits_LSB);
+    RegisterWrite(Reg_DirUpper, Bits_UpperOutputs);
     // Initialize all outputs to 0
     RegisterWrite(Reg_OutputUpper, 0x00000000);
     // Enable all outputs
-    RegisterWrite(Reg_OutEnUpper,
-                  Bits_RegAddr | Bits_RequestBus | Bits_RegWen | Bits_BlkStart | Bits_BlkEnd | Bits_LSB);
+    RegisterWrite(Reg_OutEnUpper, Bits_UpperOutputs);
 
     return true;
 }
@@ -142,6 +131,7 @@ void *EMIO_Interface_Mmap::mmap_init(uint32_t base_addr, uint16_t size)
 
 EMIO_Interface_Mmap::~EMIO_Interface_Mmap()
 {
+    CloseEventLine();
     if (mmap_region) {
         munmap(mmap_region, GPIO_SIZE);
         if (fd >= 0) close(fd);
@@ -150,68 +140,228 @@ EMIO_Interface_Mmap::~EMIO_Interface_Mmap()
 
 void EMIO_Interface_Mmap::SetEventMode(bool newState)
 {
-    if (newState)
-        std::cout << "EMIO_Interface_Mmap: events not implemented (using polling)" << std::endl;
-    useEvents = false;
+    if (newState && !eventLine && !OpenEventLine()) {
+        std::cout << "EMIO_Interface_Mmap: events not available (using polling)" << std::endl;
+        newState = false;
+    }
+    // Release the line in polling mode, so that op_done does not generate interrupts
+    if (!newState)
+        CloseEventLine();
+    waitAvg_us = 0.0;
+    useEvents = newState;
 }
 
-uint32_t EMIO_Interface_Mmap::RegisterRead(uint32_t reg_addr)
+// Local method to request the op_done line for rising-edge events. The line is only used
+// for events (the kernel GPIO driver handles the interrupt); its value is read via mmap.
+bool EMIO_Interface_Mmap::OpenEventLine()
 {
-    return *(reinterpret_cast<uint32_t *>(mmap_region)+(reg_addr/sizeof(uint32_t)));
+    eventChip = gpiod_chip_open(EVENT_GPIO_CHIP);
+    if (!eventChip) {
+        if (isVerbose)
+            std::cout << "EMIO_Interface_Mmap: failed to open " << EVENT_GPIO_CHIP << std::endl;
+        return false;
+    }
+    eventLine = gpiod_chip_get_line(eventChip, INDEX_EMIO_OP_DONE);
+    if (!eventLine || (gpiod_line_request_rising_edge_events(eventLine, "libfpgav3") != 0)) {
+        if (isVerbose)
+            std::cout << "EMIO_Interface_Mmap: failed to request op_done events" << std::endl;
+        eventLine = 0;
+        gpiod_chip_close(eventChip);
+        eventChip = 0;
+        return false;
+    }
+    return true;
 }
 
-void EMIO_Interface_Mmap::RegisterWrite(uint32_t reg_addr, uint32_t reg_data)
+void EMIO_Interface_Mmap::CloseEventLine()
 {
-    *(reinterpret_cast<uint32_t *>(mmap_region)+(reg_addr/sizeof(uint32_t))) = reg_data;
+    if (eventLine)
+        gpiod_line_release(eventLine);
+    if (eventChip)
+        gpiod_chip_close(eventChip);
+    eventLine = 0;
+    eventChip = 0;
+}
+
+// Local method to wait for op_done to be set in event mode. If the expected wait (moving
+// average, weight 1/8) is shorter than the spin limit, op_done is polled for up to the
+// spin limit; then (or right away), the thread sleeps until the rising-edge event.
+bool EMIO_Interface_Mmap::WaitOpDoneEvent(const char *opType, unsigned int num)
+{
+    bool sampleGrant = SampleGrant();
+
+    // op_done is often already set
+    if (ReadOpDone(sampleGrant)) {
+        waitAvg_us -= waitAvg_us/8;
+        return true;
+    }
+
+    fpgav3_time_t waitStart, curTime;
+    GetCurTime(&waitStart);
+    double waitLimit_us = DeadlineLimit_us(timeout_us);
+    bool opdone = false;
+    if (waitAvg_us < eventSpin_us) {
+        do {
+            opdone = ReadOpDone(sampleGrant);
+            GetCurTime(&curTime);
+        } while (!opdone && (TimeDiff_us(&waitStart, &curTime) < eventSpin_us));
+    }
+
+    bool slept = false;
+    bool error = false;
+    while (!opdone) {
+        // Discard any events from previous transactions (op_done is usually seen by polling,
+        // so its events are not read), then check op_done again. Any rising edge after this
+        // check generates a new event, so the wakeup cannot be missed.
+        struct timespec zero = { 0, 0 };
+        struct gpiod_line_event event;
+        while (gpiod_line_event_wait(eventLine, &zero) == 1) {
+            if (gpiod_line_event_read(eventLine, &event) != 0)
+                break;
+        }
+        if ((opdone = ReadOpDone(sampleGrant)))
+            break;
+        GetCurTime(&curTime);
+        double remaining_us = waitLimit_us - TimeDiff_us(&waitStart, &curTime);
+        if (remaining_us <= 0.0)
+            break;
+        struct timespec timeout;
+        timeout.tv_sec = remaining_us*1.0e-6;
+        timeout.tv_nsec = (remaining_us - 1.0e6*timeout.tv_sec)*1.0e3;
+        if (!slept) {
+            numEventSleeps++;
+            slept = true;
+        }
+        int rc = gpiod_line_event_wait(eventLine, &timeout);
+        if (rc < 0) {
+            error = true;
+            break;
+        }
+        if (rc == 0) {
+            opdone = ReadOpDone(sampleGrant);
+            break;
+        }
+    }
+
+    GetCurTime(&curTime);
+    double wait_us = TimeDiff_us(&waitStart, &curTime);
+    if (traceRec)
+        traceWait += curTime-waitStart;
+    if (!opdone && !error)
+        WaitTimeout();
+    // Timeouts are not included in the average (as in WaitEnd)
+    if (opdone)
+        waitAvg_us += (wait_us - waitAvg_us)/8;
+    if (isVerbose) {
+        if (opdone)
+            std::cout << "Waited " << wait_us << " us (" << (slept ? "event" : "polling") << ") for ";
+        else if (error)
+            std::cout << "EMIO event error waiting for ";
+        else
+            std::cout << "EMIO event timeout waiting for ";
+        std::cout << opType << " quadlet " << num << " set" << std::endl;
+    }
+    return opdone;
+}
+
+// Local method to restore the line configuration, called when the bus lock was last held
+// by another owner. Another process may have changed the data direction (so isInput could
+// be wrong) or, if it used gpiod, the output enables.
+void EMIO_Interface_Mmap::RevalidateDirection()
+{
+    uint32_t dir = RegisterRead(Reg_DirLower);
+    if (dir == 0xffffffff) {
+        isInput = false;
+    }
+    else {
+        if (dir != 0x00000000)
+            RegisterWrite(Reg_DirLower, 0x00000000);
+        isInput = true;
+    }
+    if (RegisterRead(Reg_OutEnLower) != 0xffffffff)
+        RegisterWrite(Reg_OutEnLower, 0xffffffff);
+    if (RegisterRead(Reg_DirUpper) != Bits_UpperOutputs)
+        RegisterWrite(Reg_DirUpper, Bits_UpperOutputs);
+    if (RegisterRead(Reg_OutEnUpper) != Bits_UpperOutputs)
+        RegisterWrite(Reg_OutEnUpper, Bits_UpperOutputs);
 }
 
 // Local method to wait for op_done to be set (if state is true) or cleared (if state is false),
-// using polling
-bool EMIO_Interface_Mmap::WaitOpDone(const char *opType, unsigned int num, bool state)
+// using polling. In event mode, the wait for op_done to be set uses WaitOpDoneEvent; op_done
+// is cleared quickly (after req_bus is cleared), so that wait always uses polling.
+template <class Derived>
+bool EMIO_MmapCore<Derived>::WaitOpDone(const char *opType, unsigned int num, bool state)
 {
+    FPGAV3_PROBE3(emio_wait_start, opType, num, state);
+    bool opdone;
+    bool sampleGrant = state && SampleGrant();
+    if (state && useEvents) {
+        opdone = static_cast<Derived *>(this)->WaitOpDoneEvent(opType, num);
+        FPGAV3_PROBE4(emio_wait_end, opType, num, state, opdone);
+        return opdone;
+    }
+
     // op_done should be set quickly by firmware, to indicate that read or write
     // has completed. If the FPGA bus is not busy (due to Firewire or Ethernet
     // access), it should be ready right away.
-    bool opdone = (RegisterRead(Reg_InputUpper) & Bits_OpDone)^(!state);
+    opdone = ReadOpDone(sampleGrant)^(!state);
     if (!opdone) {
-        fpgav3_time_t waitStart;
-        fpgav3_time_t curTime;
-        GetCurTime(&waitStart);
-        double dt = 0.0;   // elapsed time in us
-        while (dt < timeout_us) {
-            opdone = (RegisterRead(Reg_InputUpper) & Bits_OpDone)^(!state);
-            if (opdone)
-                break;
-            GetCurTime(&curTime);
-            dt = TimeDiff_us(&waitStart, &curTime);
-        }
+        // Poll using the wait policy (see EMIO_Interface::SetWaitPolicy)
+        WaitState ws;
+        WaitBegin(ws);
+        while (!(opdone = ReadOpDone(sampleGrant)^(!state)) && WaitContinue(ws));
+        WaitEnd(ws, opdone);
         if (isVerbose) {
             if (opdone)
-                std::cout << "Waited " << dt << " us for ";
+                std::cout << "Waited " << WaitElapsed_us(ws) << " us for ";
             else
                 std::cout << "EMIO polling timeout waiting for ";
             std::cout << opType << " quadlet " << num << (state ? " set" : " clear") << std::endl;
         }
     }
+    FPGAV3_PROBE4(emio_wait_end, opType, num, state, opdone);
+    return opdone;
+}
+
+// Local method to set data lines to input or output. The output enable register
+// (Reg_OutEnLower) is set during Init, so only the direction register needs to be written.
+template <class Derived>
+void EMIO_MmapCore<Derived>::SetDataInput(bool input)
+{
+    if (input != isInput) {
+        RegisterWrite(Reg_DirLower, input ? 0x00000000 : 0xffffffff);
+        isInput = input;
+        CountDirSwitch();
+    }
+}
+
+// Local method to abort a transaction after a timeout (see EMIO_Interface::TransactionFailed).
+// Clearing all outputs drops req_bus, blk_start and blk_end, so that the firmware ends the
+// transaction and clears op_done; the data lines are set to input so that they cannot
+// conflict with the firmware.
+template <class Derived>
+bool EMIO_MmapCore<Derived>::AbortTransaction()
+{
+    RegisterWrite(Reg_OutputUpper, 0x00000000);
+    SetDataInput(true);
+    MMIO_Barrier();
     return true;
 }
 
-// ReadQuadlet: read quadlet from specified address
-bool EMIO_Interface_Mmap::ReadQuadlet(uint16_t addr, uint32_t &data)
+template <class Derived>
+bool EMIO_MmapCore<Derived>::WaitBusIdle()
 {
-    // For timing measurements
-    fpgav3_time_t beforeWait;
-    fpgav3_time_t afterWait;
+    return WaitOpDone("recover", 0, false);
+}
 
-    // Get start time for measurement
-    if (doTiming > 0)
-        GetCurTime(&startTime);
+template <class Derived>
+bool EMIO_MmapCore<Derived>::DoReadQuadlet(uint16_t addr, uint32_t &data, fpgav3_time_t *midTimes)
+{
+    // Order previous memory accesses before the bus handshake
+    MMIO_Barrier();
 
     // Set all data lines to input
-    if (!isInput) {
-       RegisterWrite(Reg_DirLower, 0x00000000);
-       isInput = true;
-    }
+    SetDataInput(true);
 
     uint32_t outreg = addr;
     // Write reg_addr (read address)
@@ -220,8 +370,8 @@ bool EMIO_Interface_Mmap::ReadQuadlet(uint16_t addr, uint32_t &data)
     RegisterWrite(Reg_OutputUpper, outreg | Bits_RequestBus);
 
     // Get time before wait
-    if (doTiming > 1)
-        GetCurTime(&beforeWait);
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
 
     // Wait for op_done to be set
     if (!WaitOpDone("read", 0)) {
@@ -230,8 +380,8 @@ bool EMIO_Interface_Mmap::ReadQuadlet(uint16_t addr, uint32_t &data)
     }
 
     // Get time after wait
-    if (doTiming > 1)
-        GetCurTime(&afterWait);
+    if (midTimes)
+        GetCurTime(&midTimes[1]);
 
     // Read data
     data = RegisterRead(Reg_InputLower);
@@ -239,43 +389,22 @@ bool EMIO_Interface_Mmap::ReadQuadlet(uint16_t addr, uint32_t &data)
     RegisterWrite(Reg_OutputUpper, 0x00000000);
 
     // Wait for op_done to be cleared
-    WaitOpDone("read", 0, false);
+    bool ret = WaitOpDone("read", 0, false);
 
-    // Get end time
-    if (doTiming > 0) {
-        GetCurTime(&endTime);
-        double dt = TimeDiff_us(&startTime, &endTime)-timingOverhead;
-        if (doTiming > 1) dt -= 2*timingOverhead;
-        std::cout << "ReadQuadlet total time = " << dt << " us" << std::endl;
-        if (doTiming > 1) {
-            std::cout << "Start-wait-end times = " 
-                      << TimeDiff_us(&startTime, &beforeWait)-timingOverhead << ", "
-                      << TimeDiff_us(&beforeWait, &afterWait)-timingOverhead << ", "
-                      << TimeDiff_us(&afterWait, &endTime)-timingOverhead << " us" << std::endl;
-        }
-    }
+    // Order the bus handshake before subsequent memory accesses
+    MMIO_Barrier();
 
-    return true;
+    return ret;
 }
 
-// WriteQuadlet: write quadlet to specified address
-bool EMIO_Interface_Mmap::WriteQuadlet(uint16_t addr, uint32_t data)
+template <class Derived>
+bool EMIO_MmapCore<Derived>::DoWriteQuadlet(uint16_t addr, uint32_t data, fpgav3_time_t *midTimes)
 {
-    // For timing measurements
-    fpgav3_time_t beforeWait;
-    fpgav3_time_t afterWait;
+    // Order previous memory accesses before the bus handshake
+    MMIO_Barrier();
 
-    // Get start time for measurement
-    if (doTiming > 0)
-        GetCurTime(&startTime);
-
-    if (isInput) {
-        // Set all data lines to output
-        RegisterWrite(Reg_DirLower, 0xffffffff);
-        // Enable all outputs
-        RegisterWrite(Reg_OutEnLower, 0xffffffff);
-        isInput = false;
-    }
+    // Set all data lines to output
+    SetDataInput(false);
 
     // Write reg_wdata (write data)
     RegisterWrite(Reg_OutputLower, data);
@@ -287,60 +416,44 @@ bool EMIO_Interface_Mmap::WriteQuadlet(uint16_t addr, uint32_t data)
     RegisterWrite(Reg_OutputUpper, outreg | Bits_RegWen | Bits_RequestBus);
 
     // Get time before wait
-    if (doTiming > 1)
-        GetCurTime(&beforeWait);
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
 
     // Wait for op_done to be set
     bool ret = WaitOpDone("write", 0);
 
     // Get time after wait
-    if (ret && (doTiming > 1))
-        GetCurTime(&afterWait);
+    if (ret && midTimes)
+        GetCurTime(&midTimes[1]);
 
     // Set req_bus to 0 (also sets reg_addr and reg_wen to 0)
     RegisterWrite(Reg_OutputUpper, 0x00000000);
 
     // Wait for op_done to be cleared
-    WaitOpDone("write", 0, false);
+    if (!WaitOpDone("write", 0, false))
+        ret = false;
 
-    // Get end time
-    if (ret && (doTiming > 0)) {
-        GetCurTime(&endTime);
-        double dt = TimeDiff_us(&startTime, &endTime)-timingOverhead;
-        if (doTiming > 1) dt -= 2*timingOverhead;
-        std::cout << "WriteQuadlet total time = " << dt << " us" << std::endl;
-        if (doTiming > 1) {
-            std::cout << "Start-wait-end times = "
-                      << TimeDiff_us(&startTime,  &beforeWait)-timingOverhead << ", "
-                      << TimeDiff_us(&beforeWait, &afterWait)-timingOverhead << ", "
-                      << TimeDiff_us(&afterWait,  &endTime)-timingOverhead << " us" << std::endl;
-        }
-    }
+    // Order the bus handshake before subsequent memory accesses
+    MMIO_Barrier();
 
-    return true;
+    return ret;
 }
 
-// Read block of data
-bool EMIO_Interface_Mmap::ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+template <class Derived>
+bool EMIO_MmapCore<Derived>::DoReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes,
+                                         fpgav3_time_t *midTimes)
 {
-    // For timing measurements
-    fpgav3_time_t firstRead;
-    fpgav3_time_t lastRead;
-
     if (version < 1) {
         std::cout << "ReadBlock (mmap): not supported for version " << version << std::endl;
+        lastError = EMIO_ERR_UNSUPPORTED;
         return false;
     }
 
-    // Get start time for measurement
-    if (doTiming > 0)
-        GetCurTime(&startTime);
+    // Order previous memory accesses before the bus handshake
+    MMIO_Barrier();
 
     // Set all data lines to input
-    if (!isInput) {
-       RegisterWrite(Reg_DirLower, 0x00000000);
-       isInput = true;
-    }
+    SetDataInput(true);
 
     uint32_t val;
     unsigned int q;
@@ -351,8 +464,8 @@ bool EMIO_Interface_Mmap::ReadBlock(uint16_t addr, uint32_t *data, unsigned int
     // Because the firmware latches req_bus, there is enough delay that we can set it now
     uint32_t outreg = addr | Bits_BlkStart | Bits_RequestBus;
 
-    if (doTiming > 1)
-        GetCurTime(&firstRead);
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
 
     for (q = 0; q < nQuads; q++) {
 
@@ -379,66 +492,47 @@ bool EMIO_Interface_Mmap::ReadBlock(uint16_t addr, uint32_t *data, unsigned int
         data[q] = bswap_32(val);
     }
 
-    if (doTiming > 1)
-        GetCurTime(&lastRead);
+    if (midTimes)
+        GetCurTime(&midTimes[1]);
 
     // Set all lines to 0
     RegisterWrite(Reg_OutputUpper, 0);
 
     // Wait for op_done to be cleared
-    WaitOpDone("read", q, false);
+    bool ret = WaitOpDone("read", q, false);
 
-    // Get end time
-    if (doTiming > 0) {
-        GetCurTime(&endTime);
-        double dt = TimeDiff_us(&startTime, &endTime)-timingOverhead;
-        if (doTiming > 1) dt -= 2*timingOverhead;
-        std::cout << "ReadBlock total time = " << dt << " us" << std::endl;
-        if (doTiming > 1) {
-            std::cout << "Start-loop-end times = "
-                      << TimeDiff_us(&startTime, &firstRead)-timingOverhead << ", "
-                      << TimeDiff_us(&firstRead, &lastRead)-timingOverhead << ", "
-                      << TimeDiff_us(&lastRead,  &endTime)-timingOverhead << " us" << std::endl;
-        }
-    }
+    // Order the bus handshake before subsequent memory accesses
+    MMIO_Barrier();
 
-    return true;
+    return ret;
 }
 
-// Write block of data.
-bool EMIO_Interface_Mmap::WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes)
+template <class Derived>
+bool EMIO_MmapCore<Derived>::DoWriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes,
+                                          fpgav3_time_t *midTimes)
 {
-    // For timing measurements
-    fpgav3_time_t firstWrite;
-    fpgav3_time_t lastWrite;
-
     uint32_t val;
     unsigned int q;
     unsigned int nQuads = (nBytes+3)/4;
 
     if (version < 1) {
         std::cout << "WriteBlock (mmap): not supported for version " << version << std::endl;
+        lastError = EMIO_ERR_UNSUPPORTED;
         return false;
     }
 
-    // Get start time for measurement
-    if (doTiming > 0)
-        GetCurTime(&startTime);
+    // Order previous memory accesses before the bus handshake
+    MMIO_Barrier();
 
-    if (isInput) {
-        // Set all data lines to output
-        RegisterWrite(Reg_DirLower, 0xffffffff);
-        // Enable all outputs
-        RegisterWrite(Reg_OutEnLower, 0xffffffff);
-        isInput = false;
-    }
+    // Set all data lines to output
+    SetDataInput(false);
 
     // Set addr, blk_start and req_bus
     // Because the firmware latches req_bus, there is enough delay that we can set it now
     uint32_t outreg = addr | Bits_BlkStart | Bits_RequestBus;
 
-    if (doTiming > 1)
-        GetCurTime(&firstWrite);
+    if (midTimes)
+        GetCurTime(&midTimes[0]);
 
     for (q = 0; q < nQuads; q++) {
 
@@ -467,28 +561,207 @@ bool EMIO_Interface_Mmap::WriteBlock(uint16_t addr, const uint32_t *data, unsign
         }
     }
 
-    if (doTiming > 1)
-        GetCurTime(&lastWrite);
+    if (midTimes)
+        GetCurTime(&midTimes[1]);
 
     // Wait for op_done to be cleared
-    WaitOpDone("write", q, false);
+    bool ret = WaitOpDone("write", q, false);
 
     // Set all lines to 0
     RegisterWrite(Reg_OutputUpper, 0);
 
+    // Order the bus handshake before subsequent memory accesses
+    MMIO_Barrier();
+
+    return ret;
+}
+
+// ReadQuadlet: read quadlet from specified address
+template <class Derived>
+bool EMIO_MmapCore<Derived>::ReadQuadlet(uint16_t addr, uint32_t &data)
+{
+    // For timing measurements (before and after wait)
+    fpgav3_time_t midTimes[2];
+
+    FPGAV3_PROBE3(emio_entry, EMIO_READ_QUAD, addr, 4);
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus()) {
+        FPGAV3_PROBE4(emio_exit, EMIO_READ_QUAD, addr, 4, 0);
+        return false;
+    }
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoReadQuadlet(addr, data, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_READ_QUAD, addr, &data, 4, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    FPGAV3_PROBE4(emio_exit, EMIO_READ_QUAD, addr, 4, ret);
+    if (!ret)
+        return false;
+
     // Get end time
-    if (doTiming > 0) {
-        GetCurTime(&endTime);
-        double dt = TimeDiff_us(&startTime, &endTime)-timingOverhead;
-        if (doTiming > 1) dt -= 2*timingOverhead;
-        std::cout << "WriteBlock total time = " << dt << " us" << std::endl;
-        if (doTiming > 1) {
-            std::cout << "Start-loop-end times = "
-                      << TimeDiff_us(&startTime,  &firstWrite)-timingOverhead << ", "
-                      << TimeDiff_us(&firstWrite, &lastWrite)-timingOverhead << ", "
-                      << TimeDiff_us(&lastWrite,  &endTime)-timingOverhead << " us" << std::endl;
-        }
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_READ_QUAD, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// WriteQuadlet: write quadlet to specified address
+template <class Derived>
+bool EMIO_MmapCore<Derived>::WriteQuadlet(uint16_t addr, uint32_t data)
+{
+    // For timing measurements (before and after wait)
+    fpgav3_time_t midTimes[2];
+
+    FPGAV3_PROBE3(emio_entry, EMIO_WRITE_QUAD, addr, 4);
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus()) {
+        FPGAV3_PROBE4(emio_exit, EMIO_WRITE_QUAD, addr, 4, 0);
+        return false;
+    }
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoWriteQuadlet(addr, data, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_WRITE_QUAD, addr, &data, 4, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    FPGAV3_PROBE4(emio_exit, EMIO_WRITE_QUAD, addr, 4, ret);
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_WRITE_QUAD, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// Read block of data
+template <class Derived>
+bool EMIO_MmapCore<Derived>::ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+{
+    // For timing measurements (first and last read)
+    fpgav3_time_t midTimes[2];
+
+    FPGAV3_PROBE3(emio_entry, EMIO_READ_BLOCK, addr, nBytes);
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus()) {
+        FPGAV3_PROBE4(emio_exit, EMIO_READ_BLOCK, addr, nBytes, 0);
+        return false;
+    }
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoReadBlock(addr, data, nBytes, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_READ_BLOCK, addr, data, nBytes, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    FPGAV3_PROBE4(emio_exit, EMIO_READ_BLOCK, addr, nBytes, ret);
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_READ_BLOCK, (doTiming > 1) ? midTimes : 0);
+
+    return true;
+}
+
+// Write block of data.
+template <class Derived>
+bool EMIO_MmapCore<Derived>::WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes)
+{
+    // For timing measurements (first and last write)
+    fpgav3_time_t midTimes[2];
+
+    FPGAV3_PROBE3(emio_entry, EMIO_WRITE_BLOCK, addr, nBytes);
+
+    // Acquire cross-process bus lock (if enabled)
+    if (!LockBus()) {
+        FPGAV3_PROBE4(emio_exit, EMIO_WRITE_BLOCK, addr, nBytes, 0);
+        return false;
     }
 
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    bool ret;
+    do {
+        TraceBegin();
+        ret = DoWriteBlock(addr, data, nBytes, (doTiming > 1) ? midTimes : 0);
+        EndTransaction(EMIO_WRITE_BLOCK, addr, data, nBytes, ret);
+    } while (!ret && RetryTransaction());
+    UnlockBus();
+    FPGAV3_PROBE4(emio_exit, EMIO_WRITE_BLOCK, addr, nBytes, ret);
+    if (!ret)
+        return false;
+
+    // Get end time
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_WRITE_BLOCK, (doTiming > 1) ? midTimes : 0);
+
     return true;
 }
+
+// Execute batch of requests (see EMIO_Interface::ExecuteBatch)
+template <class Derived>
+bool EMIO_MmapCore<Derived>::RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags,
+                                      BatchPass pass)
+{
+    bool ret = true;
+    for (unsigned int i = 0; i < num; i++) {
+        EMIO_Request &req = reqs[i];
+        if (!BatchSelect(req, pass))
+            continue;
+        bool ok = false;
+        FPGAV3_PROBE3(emio_entry, req.opType, req.addr, req.nBytes);
+        TraceBegin();
+        // Recover the bus if the previous request was aborted
+        if (BeginRequest()) {
+            switch (req.opType) {
+                case EMIO_READ_QUAD:   ok = DoReadQuadlet(req.addr, *req.data);
+                                       break;
+                case EMIO_WRITE_QUAD:  ok = DoWriteQuadlet(req.addr, *req.data);
+                                       break;
+                case EMIO_READ_BLOCK:  ok = DoReadBlock(req.addr, req.data, req.nBytes);
+                                       break;
+                case EMIO_WRITE_BLOCK: ok = DoWriteBlock(req.addr, req.data, req.nBytes);
+                                       break;
+            }
+        }
+        EndTransaction(req.opType, req.addr, req.data, req.nBytes, ok);
+        FPGAV3_PROBE4(emio_exit, req.opType, req.addr, req.nBytes, ok);
+        req.status = ok ? EMIO_REQ_OK : EMIO_REQ_FAILED;
+        if (!ok) {
+            ret = false;
+            if (flags & EMIO_BATCH_STOP_ON_ERR)
+                break;
+        }
+    }
+    return ret;
+}
+
+// Instantiate the transaction code for the hardware and the simulated registers
+template class EMIO_MmapCore<EMIO_Interface_Mmap>;
+template class EMIO_MmapCore<EMIO_Interface_Sim>;
@@ -12,17 +12,110 @@
  * (PS input when reading, PS output when writing).
  *
  * This derived class uses Linux mmap for direct access to the GPIO registers.
+ *
+ * In event mode (SetEventMode), the registers are still accessed via mmap, but the
+ * wait for op_done can sleep until the rising edge of op_done, which is requested as
+ * an edge event (interrupt) via libgpiod. Based on the expected wait time (moving
+ * average of previous waits), WaitOpDone either polls op_done for up to a spin limit
+ * (SetEventSpinLimit_us) before sleeping, or sleeps right away, so that short waits
+ * do not incur the interrupt latency and long waits (e.g., when the FPGA bus is busy
+ * with FireWire or Ethernet access) do not occupy a core.
+ *
+ * The transaction code is in the class template EMIO_MmapCore, which accesses the GPIO
+ * registers via the RegisterRead and RegisterWrite methods of its derived class (given as
+ * template parameter). These are inline and non-virtual, so each register access remains
+ * a single volatile load or store, while EMIO_Interface_Sim can provide the registers
+ * instead and still use the same transaction code.
  */
 
 #ifndef FPGAV3_EMIO_MMAP_H
 #define FPGAV3_EMIO_MMAP_H
 
 #include "fpgav3_emio.h"
+#include "fpgav3_emio_regs.h"
+#include "fpgav3_mmio.h"
+
+// Forward declarations (libgpiod)
+struct gpiod_chip;
+struct gpiod_line;
+
+// Transaction code shared by EMIO_Interface_Mmap and EMIO_Interface_Sim. Derived must provide
+// (inline) RegisterRead and RegisterWrite methods, which are resolved at compile time. The
+// methods are instantiated in fpgav3_emio_mmap.cpp for both derived classes.
+template <class Derived>
+class EMIO_MmapCore : public EMIO_Interface
+{
+public:
+
+    bool ReadQuadlet(uint16_t addr, uint32_t &data);
+
+    bool WriteQuadlet(uint16_t addr, uint32_t data);
+
+    bool ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes);
+
+    bool WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes);
+
+protected:
+
+    EMIO_MmapCore() : EMIO_Interface() {}
+
+    // Register access of the derived class (see EMIO_Interface_Mmap::RegisterRead)
+    uint32_t RegisterRead(uint32_t reg_addr)
+    { return static_cast<Derived *>(this)->RegisterRead(reg_addr); }
+
+    void RegisterWrite(uint32_t reg_addr, uint32_t reg_data)
+    { static_cast<Derived *>(this)->RegisterWrite(reg_addr, reg_data); }
+
+    // Read op_done; if sampleGrant is true, also records the time that grant_bus was first
+    // seen set (see EMIO_Interface::GrantSeen), which is free because both are in the same
+    // register. The resolution of the grant time is therefore the polling interval.
+    bool ReadOpDone(bool sampleGrant)
+    {
+        uint32_t inreg = RegisterRead(Reg_InputUpper);
+        if (sampleGrant && (inreg & Bits_GrantBus))
+            GrantSeen();
+        return (inreg & Bits_OpDone);
+    }
 
-class EMIO_Interface_Mmap : public EMIO_Interface
+    bool WaitOpDone(const char *opType, unsigned int num, bool state = true);
+
+    // Wait for op_done to be set in event mode; only called if useEvents is set, so a derived
+    // class that supports event mode must provide it
+    bool WaitOpDoneEvent(const char *, unsigned int)
+    { return false; }
+
+    // Set data lines to input (true) or output (false), if not already set
+    void SetDataInput(bool input);
+
+    // Abort a transaction and wait for the bus to become idle (see EMIO_Interface)
+    bool AbortTransaction();
+    bool WaitBusIdle();
+
+    // Low-level transactions, without timing measurements (used by the public methods
+    // and RunBatch). If midTimes is not 0, it is used to store the times before and
+    // after the wait (quadlet) or the first and last quadlet (block).
+    bool DoReadQuadlet(uint16_t addr, uint32_t &data, fpgav3_time_t *midTimes = 0);
+    bool DoWriteQuadlet(uint16_t addr, uint32_t data, fpgav3_time_t *midTimes = 0);
+    bool DoReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes,
+                     fpgav3_time_t *midTimes = 0);
+    bool DoWriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes,
+                      fpgav3_time_t *midTimes = 0);
+
+    bool RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass);
+
+};
+
+class EMIO_Interface_Mmap : public EMIO_MmapCore<EMIO_Interface_Mmap>
 {
+    friend class EMIO_MmapCore<EMIO_Interface_Mmap>;
+
     int fd;
     void *mmap_region;
+    struct gpiod_chip *eventChip;    // GPIO chip for op_done events (0 if not in event mode)
+    struct gpiod_line *eventLine;    // op_done line, requested for rising-edge events
+    double eventSpin_us;             // maximum time to poll before sleeping (event mode)
+    double waitAvg_us;               // moving average of op_done wait time (event mode)
+    unsigned long numEventSleeps;    // number of times WaitOpDone slept on an event
 
 public:
 
@@ -33,15 +126,21 @@ public:
     bool IsOK() const
     { return (mmap_region != 0); }
 
+    // Enable or disable event mode; if the op_done line cannot be requested for events,
+    // polling is used (GetEventMode returns false)
     void SetEventMode(bool newState);
 
-    bool ReadQuadlet(uint16_t addr, uint32_t &data);
+    // Get/Set the maximum time (in microseconds) to poll op_done in event mode before
+    // sleeping (default 20 us). If the expected wait is longer, polling is skipped.
+    double GetEventSpinLimit_us() const
+    { return eventSpin_us; }
 
-    bool WriteQuadlet(uint16_t addr, uint32_t data);
+    void SetEventSpinLimit_us(double spin_us)
+    { eventSpin_us = spin_us; }
 
-    bool ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes);
-
-    bool WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes);
+    // Returns the number of times a wait for op_done slept on an event
+    unsigned long GetNumEventSleeps() const
+    { return numEventSleeps; }
 
 protected:
 
@@ -49,11 +148,26 @@ protected:
 
     bool Init();
 
-    uint32_t RegisterRead(uint32_t reg_addr);
+    // Register accesses are volatile (see fpgav3_mmio.h), so they are performed exactly
+    // as written and in program order. Because all GPIO registers are in the same
+    // (uncached) peripheral, no barrier is needed between them; the transactions use
+    // MMIO_Barrier only at the start and end, to order the bus handshake with respect
+    // to other memory accesses (e.g., the caller's data buffer or shared state).
+    uint32_t RegisterRead(uint32_t reg_addr)
+    { return MMIO_Read32(mmap_region, reg_addr); }
 
-    void RegisterWrite(uint32_t reg_addr, uint32_t reg_data);
+    void RegisterWrite(uint32_t reg_addr, uint32_t reg_data)
+    { MMIO_Write32(mmap_region, reg_addr, reg_data); }
 
-    bool WaitOpDone(const char *opType, unsigned int num, bool state = true);
+    // Request/release the op_done line for rising-edge events
+    bool OpenEventLine();
+    void CloseEventLine();
+
+    // Wait for op_done to be set in event mode (see EMIO_MmapCore::WaitOpDone)
+    bool WaitOpDoneEvent(const char *opType, unsigned int num);
+
+    // Restore line configuration (from Init), which may have been changed by another process
+    void RevalidateDirection();
 
 };
 
@@ -0,0 +1,68 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_regs (Linux library)
+ *
+ * Zynq GPIO registers and EMIO bit assignments used by the EMIO bus interface.
+ * These are used by EMIO_Interface_Mmap (hardware registers) and EMIO_Interface_Sim
+ * (simulated registers). Also includes the Cortex-A9 global timer registers, which
+ * can be used for timing measurements.
+ */
+
+#ifndef FPGAV3_EMIO_REGS_H
+#define FPGAV3_EMIO_REGS_H
+
+#include <stdint.h>
+
+// System level control registers
+const uint32_t SLCR_BASE_ADDR     = 0xF8000000;
+const uint32_t APER_CLK_CTRL      = 0x0000012C;   // APER clock control register
+const uint32_t GPIO_CLK_BIT       = (1 << 22);    // Bit 22 is for GPIO AMBA clock control
+
+// GPIO control registers
+const uint32_t GPIO_BASE_ADDR     = 0xE000A000;
+// Following size includes all GPIO registers (from 0x0000 to 0x02E4), which is
+// more than enough (we only use 0x0048 - 0x02c8).
+const uint32_t GPIO_SIZE          = 0x000002E8;
+
+// Cortex-A9 private memory region (SCU), which includes the global timer
+// (see also SCU_GLOBAL_TIMER_* in platform_standalone/mfg_test_src/testDefines.h)
+const uint32_t SCU_BASE_ADDR          = 0xF8F00000;
+const uint32_t SCU_SIZE               = 0x00001000;
+const uint32_t GLOBAL_TIMER_COUNT_L32 = 0x00000200;   // Global timer counter, lower 32 bits
+const uint32_t GLOBAL_TIMER_COUNT_U32 = 0x00000204;   // Global timer counter, upper 32 bits
+const uint32_t GLOBAL_TIMER_CONTROL   = 0x00000208;   // Global timer control
+const uint32_t GLOBAL_TIMER_ENABLE    = 0x00000001;   // Timer enable bit (control register)
+
+// GPIO registers used for EMIO interface
+enum EMIO_Reg {
+    Reg_OutputLower = 0x00000048,   // Data output, emio[31:0]
+    Reg_OutputUpper = 0x0000004c,   // Data output, emio[63:32]
+    Reg_InputLower  = 0x00000068,   // Data input, emio[31:0]
+    Reg_InputUpper  = 0x0000006c,   // Data input, emio[63:32]
+    Reg_DirLower    = 0x00000284,   // Direction: 0 = input (default), 1 = output
+    Reg_OutEnLower  = 0x00000288,   // Output enable: 0 = disabled (default), 1 = enabled
+    Reg_DirUpper    = 0x000002c4,   // Direction: 0 = input (default), 1 = output
+    Reg_OutEnUpper  = 0x000002c8    // Output enable: 0 = disabled (default), 1 = enabled
+};
+
+// Bit masks for upper EMIO bits
+enum EMIO_Bits {
+    Bits_RegAddr        = 0x0000ffff,   // 16-bit address (output)
+    Bits_RequestBus     = 0x00010000,   // Request read or write bus (output)
+    Bits_OpDone         = 0x00020000,   // Read or write done (input)
+    Bits_RegWen         = 0x00040000,   // Register write enable (output)
+    Bits_BlkStart       = 0x00080000,   // Block start (output)
+    Bits_BlkEnd         = 0x00100000,   // Block end (output)
+    Bits_Write          = 0x00200000,   // Write operation detected (based on tristate)
+    Bits_GrantBus       = 0x00400000,   // Grant of read or write bus (input)
+    Bits_LSB            = 0x00800000,   // Address least significant bit (output)
+    Bits_Version        = 0xf0000000    // Bus interface version (input)
+};
+
+// Upper EMIO bits that are outputs from the PS
+const uint32_t Bits_UpperOutputs = Bits_RegAddr | Bits_RequestBus | Bits_RegWen |
+                                   Bits_BlkStart | Bits_BlkEnd | Bits_LSB;
+
+#endif // FPGAV3_EMIO_REGS_H
@@ -0,0 +1,624 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fpgav3_emio_remote.h"
+#include "fpgav3_futex.h"
+
+// Identifies (and versions) the layout of the shared-memory segment
+const uint32_t REMOTE_MAGIC = 0x454d5231;    // 'EMR1'
+
+const unsigned int REMOTE_MAX_CLIENTS = 16;
+const unsigned int REMOTE_RING_SIZE = 64;    // requests per slot (power of 2)
+const unsigned int REMOTE_DATA_QUADS = 4096; // data area per slot (quadlets)
+
+// Number of polls of the tail (client) or doorbell (server) before sleeping on the futex
+const unsigned int REMOTE_CLIENT_SPIN = 2000;
+const unsigned int REMOTE_SERVER_SPIN = 20000;
+
+// Client: time to wait for the server before checking that it is still running, and
+// maximum time to wait for a submission to be completed
+const long REMOTE_CLIENT_POLL_NS = 10000000;      // 10 ms
+const double REMOTE_CLIENT_TIMEOUT_US = 1.0e6;    // 1 s
+
+// Server: maximum sleep time and interval for checking for terminated clients
+const long REMOTE_SERVER_SLEEP_NS = 100000000;    // 100 ms
+const double REMOTE_CHECK_CLIENTS_US = 1.0e6;     // 1 s
+
+// Request descriptor in shared memory (see EMIO_Request). The data is at
+// dataOffset (in quadlets) in the data area of the slot.
+struct RemoteReq {
+    uint32_t opType;
+    uint32_t addr;
+    uint32_t nBytes;
+    uint32_t dataOffset;
+    uint32_t status;
+    uint32_t reserved;
+};
+
+enum RemoteSlotState { SLOT_FREE, SLOT_IN_USE };
+
+// Per-client slot. The client writes the descriptors, write data and head; the server
+// writes the status, read data and tail. Each client has at most one submission in
+// progress, so the data area is reused by each submission. The head and tail are
+// on separate cache lines.
+struct EMIO_RemoteSlot {
+    uint32_t state;            // RemoteSlotState (claimed by client with compare-and-swap)
+    int32_t  pid;              // client process
+    uint32_t head;             // number of requests submitted
+    uint32_t flags;            // EMIO_BatchFlags of current submission
+    uint32_t pad1[12];
+    uint32_t tail;             // number of requests completed (futex)
+    uint32_t clientWaiting;    // 1 if client is (about to be) sleeping on tail
+    uint32_t pad2[14];
+    RemoteReq reqs[REMOTE_RING_SIZE];
+    uint32_t data[REMOTE_DATA_QUADS];
+};
+
+// Shared-memory segment, created (all zero) by the server
+struct EMIO_RemoteShared {
+    uint32_t magic;            // written last by server (0 when server exits)
+    int32_t  serverPid;
+    uint32_t emioVersion;      // bus interface version of server backend
+    uint32_t numConnects;      // number of times a client claimed a slot
+    uint32_t pad1[12];
+    uint32_t doorbell;         // incremented by each submission (futex)
+    uint32_t serverWaiting;    // 1 if server is (about to be) sleeping on doorbell
+    uint32_t pad2[14];
+    EMIO_RemoteSlot slots[REMOTE_MAX_CLIENTS];
+};
+
+static double ElapsedSince_us(const struct timespec &start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec-start.tv_sec)*1.0e6 + (now.tv_nsec-start.tv_nsec)*1.0e-3;
+}
+
+// Returns true if the specified process has terminated
+static bool ProcessTerminated(pid_t pid)
+{
+    return (pid <= 0) || ((kill(pid, 0) != 0) && (errno == ESRCH));
+}
+
+// Returns number of quadlets used by a request
+static inline unsigned int RequestQuads(uint32_t opType, uint32_t nBytes)
+{
+    // Computed without overflow, since nBytes is set by the client
+    return ((opType == EMIO_READ_BLOCK) || (opType == EMIO_WRITE_BLOCK)) ? nBytes/4 + ((nBytes%4) ? 1 : 0) : 1;
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_Interface_Remote
+
+EMIO_Interface_Remote::EMIO_Interface_Remote(const char *name) : shared(0), slot(0), head(0),
+                                                                 isBroken(false)
+{
+    std::string path = std::string("/dev/shm/") + name;
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0) {
+        std::cout << "EMIO_Interface_Remote: failed to open " << path
+                  << " (is fpgav3emiod running?)" << std::endl;
+        return;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size < static_cast<off_t>(sizeof(EMIO_RemoteShared)))) {
+        std::cout << "EMIO_Interface_Remote: " << path << " has unexpected size" << std::endl;
+        close(fd);
+        return;
+    }
+    void *region = mmap(NULL, sizeof(EMIO_RemoteShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        std::cout << "EMIO_Interface_Remote: failed to mmap " << path << std::endl;
+        return;
+    }
+    shared = reinterpret_cast<EMIO_RemoteShared *>(region);
+    if ((__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != REMOTE_MAGIC) ||
+        ProcessTerminated(shared->serverPid)) {
+        std::cout << "EMIO_Interface_Remote: server not running" << std::endl;
+        munmap(shared, sizeof(EMIO_RemoteShared));
+        shared = 0;
+        return;
+    }
+    version = shared->emioVersion;
+
+    // Claim a free slot
+    for (unsigned int id = 0; id < REMOTE_MAX_CLIENTS; id++) {
+        EMIO_RemoteSlot *s = &shared->slots[id];
+        uint32_t state = SLOT_FREE;
+        if (__atomic_compare_exchange_n(&s->state, &state, SLOT_IN_USE, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            // Server does not process the slot while head is equal to tail
+            head = __atomic_load_n(&s->tail, __ATOMIC_ACQUIRE);
+            __atomic_store_n(&s->head, head, __ATOMIC_RELEASE);
+            __atomic_store_n(&s->pid, getpid(), __ATOMIC_RELEASE);
+            __atomic_fetch_add(&shared->numConnects, 1, __ATOMIC_RELAXED);
+            slot = s;
+            break;
+        }
+    }
+    if (!slot) {
+        std::cout << "EMIO_Interface_Remote: no free slot (maximum " << REMOTE_MAX_CLIENTS
+                  << " clients)" << std::endl;
+        munmap(shared, sizeof(EMIO_RemoteShared));
+        shared = 0;
+    }
+}
+
+EMIO_Interface_Remote::~EMIO_Interface_Remote()
+{
+    if (slot) {
+        __atomic_store_n(&slot->pid, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&slot->state, SLOT_FREE, __ATOMIC_RELEASE);
+    }
+    if (shared)
+        munmap(shared, sizeof(EMIO_RemoteShared));
+}
+
+void EMIO_Interface_Remote::SetEventMode(bool newState)
+{
+    // Event mode (if any) is selected when starting the server
+    if (newState && isVerbose)
+        std::cout << "EMIO_Interface_Remote: event mode is set by server" << std::endl;
+    useEvents = false;
+}
+
+bool EMIO_Interface_Remote::SetBusLock(bool enable, const char *)
+{
+    if (enable) {
+        std::cout << "EMIO_Interface_Remote: bus lock not supported (use server bus lock)" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool EMIO_Interface_Remote::Submit(unsigned int num, unsigned int flags)
+{
+    if (!IsOK())
+        return false;
+
+    // Publish the requests and ring the doorbell. The sequentially consistent operations
+    // ensure that either the server sees the new doorbell value before sleeping, or this
+    // client sees that the server is waiting (and wakes it).
+    slot->flags = flags;
+    head += num;
+    __atomic_store_n(&slot->head, head, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&shared->doorbell, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shared->serverWaiting, __ATOMIC_SEQ_CST))
+        FutexWake(&shared->doorbell, 1);
+
+    // Spin briefly, since the server is normally polling
+    for (unsigned int i = 0; i < REMOTE_CLIENT_SPIN; i++) {
+        if (__atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE) == head)
+            return true;
+    }
+
+    // Sleep until tail is updated, checking that server is still running
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    const struct timespec pollTime = { 0, REMOTE_CLIENT_POLL_NS };
+    bool done = false;
+    while (!done) {
+        __atomic_store_n(&slot->clientWaiting, 1, __ATOMIC_SEQ_CST);
+        uint32_t t = __atomic_load_n(&slot->tail, __ATOMIC_SEQ_CST);
+        if (t == head) {
+            done = true;
+            break;
+        }
+        FutexWait(&slot->tail, t, &pollTime);
+        if (__atomic_load_n(&slot->tail, __ATOMIC_ACQUIRE) == head) {
+            done = true;
+            break;
+        }
+        if ((__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != REMOTE_MAGIC) ||
+            ProcessTerminated(shared->serverPid)) {
+            std::cout << "EMIO_Interface_Remote: server terminated" << std::endl;
+            break;
+        }
+        if (ElapsedSince_us(start) > REMOTE_CLIENT_TIMEOUT_US) {
+            std::cout << "EMIO_Interface_Remote: server did not respond" << std::endl;
+            break;
+        }
+    }
+    __atomic_store_n(&slot->clientWaiting, 0, __ATOMIC_RELAXED);
+    // If the server did not complete the requests, the slot can no longer be used
+    if (!done)
+        isBroken = true;
+    return done;
+}
+
+bool EMIO_Interface_Remote::DoTransfer(EMIO_OpType opType, uint16_t addr, uint32_t *data, unsigned int nBytes)
+{
+    if (!IsOK())
+        return false;
+    unsigned int nQuads = RequestQuads(opType, nBytes);
+    if (nQuads > REMOTE_DATA_QUADS) {
+        std::cout << "EMIO_Interface_Remote: transfer of " << nBytes << " bytes too large" << std::endl;
+        return false;
+    }
+    RemoteReq &req = slot->reqs[head & (REMOTE_RING_SIZE-1)];
+    req.opType = opType;
+    req.addr = addr;
+    req.nBytes = nBytes;
+    req.dataOffset = 0;
+    req.status = EMIO_REQ_PENDING;
+    bool isWrite = (opType == EMIO_WRITE_QUAD) || (opType == EMIO_WRITE_BLOCK);
+    if (isWrite)
+        memcpy(slot->data, data, nQuads*sizeof(uint32_t));
+    if (!Submit(1, EMIO_BATCH_DEFAULT))
+        return false;
+    if (req.status != EMIO_REQ_OK) {
+        if (isVerbose)
+            std::cout << "EMIO_Interface_Remote: request failed at address " << std::hex << addr
+                      << std::dec << std::endl;
+        return false;
+    }
+    if (!isWrite)
+        memcpy(data, slot->data, nQuads*sizeof(uint32_t));
+    return true;
+}
+
+bool EMIO_Interface_Remote::ReadQuadlet(uint16_t addr, uint32_t &data)
+{
+    // Check the deadline (which is not passed to the server) and clear the error code
+    if (!LockBus())
+        return false;
+
+    // Get start time for measurement
+    if (doTiming > 0)
+        StartTiming();
+
+    TraceBegin();
+    bool ret = DoTransfer(EMIO_READ_QUAD, addr, &data, 4);
+    EndTransaction(EMIO_READ_QUAD, addr, &data, 4, ret);
+    UnlockBus();
+    if (!ret)
+        return false;
+
+    // Get end time (includes round trip to server)
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_READ_QUAD);
+
+    return true;
+}
+
+bool EMIO_Interface_Remote::WriteQuadlet(uint16_t addr, uint32_t data)
+{
+    // Check the deadline (which is not passed to the server) and clear the error code
+    if (!LockBus())
+        return false;
+
+    if (doTiming > 0)
+        StartTiming();
+
+    TraceBegin();
+    bool ret = DoTransfer(EMIO_WRITE_QUAD, addr, &data, 4);
+    EndTransaction(EMIO_WRITE_QUAD, addr, &data, 4, ret);
+    UnlockBus();
+    if (!ret)
+        return false;
+
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_WRITE_QUAD);
+
+    return true;
+}
+
+bool EMIO_Interface_Remote::ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+{
+    // Check the deadline (which is not passed to the server) and clear the error code
+    if (!LockBus())
+        return false;
+
+    if (doTiming > 0)
+        StartTiming();
+
+    TraceBegin();
+    bool ret = DoTransfer(EMIO_READ_BLOCK, addr, data, nBytes);
+    EndTransaction(EMIO_READ_BLOCK, addr, data, nBytes, ret);
+    UnlockBus();
+    if (!ret)
+        return false;
+
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_READ_BLOCK);
+
+    return true;
+}
+
+bool EMIO_Interface_Remote::WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes)
+{
+    // Check the deadline (which is not passed to the server) and clear the error code
+    if (!LockBus())
+        return false;
+
+    if (doTiming > 0)
+        StartTiming();
+
+    // DoTransfer does not modify write data
+    TraceBegin();
+    bool ret = DoTransfer(EMIO_WRITE_BLOCK, addr, const_cast<uint32_t *>(data), nBytes);
+    EndTransaction(EMIO_WRITE_BLOCK, addr, data, nBytes, ret);
+    UnlockBus();
+    if (!ret)
+        return false;
+
+    if (doTiming > 0)
+        RecordTiming(EMIO_TIMING_WRITE_BLOCK);
+
+    return true;
+}
+
+// Sends the selected requests to the server, in chunks that fit in the slot (ring and
+// data area). Reordering (EMIO_BATCH_READS_FIRST) is done by ExecuteBatch, so only
+// EMIO_BATCH_STOP_ON_ERR is passed to the server.
+bool EMIO_Interface_Remote::RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass)
+{
+    if (!IsOK())
+        return false;
+    unsigned int remoteFlags = flags & EMIO_BATCH_STOP_ON_ERR;
+    EMIO_Request *chunk[REMOTE_RING_SIZE];
+    bool ret = true;
+    unsigned int i = 0;
+    while (i < num) {
+        // Fill the slot
+        unsigned int numChunk = 0;
+        unsigned int offset = 0;
+        uint32_t first = head;
+        for (; (i < num) && (numChunk < REMOTE_RING_SIZE); i++) {
+            EMIO_Request &req = reqs[i];
+            if (!BatchSelect(req, pass))
+                continue;
+            unsigned int nQuads = RequestQuads(req.opType, req.nBytes);
+            if (nQuads > REMOTE_DATA_QUADS) {
+                std::cout << "EMIO_Interface_Remote: transfer of " << req.nBytes << " bytes too large" << std::endl;
+                req.status = EMIO_REQ_FAILED;
+                ret = false;
+                if (remoteFlags)
+                    return false;
+                continue;
+            }
+            if (offset+nQuads > REMOTE_DATA_QUADS)
+                break;
+            RemoteReq &rreq = slot->reqs[(first+numChunk) & (REMOTE_RING_SIZE-1)];
+            rreq.opType = req.opType;
+            rreq.addr = req.addr;
+            rreq.nBytes = req.nBytes;
+            rreq.dataOffset = offset;
+            rreq.status = EMIO_REQ_PENDING;
+            if (req.IsWrite())
+                memcpy(slot->data+offset, req.data, nQuads*sizeof(uint32_t));
+            offset += nQuads;
+            chunk[numChunk++] = &req;
+        }
+        if (numChunk == 0)
+            continue;
+        TraceBegin();
+        if (!Submit(numChunk, remoteFlags)) {
+            for (unsigned int j = 0; j < numChunk; j++)
+                chunk[j]->status = EMIO_REQ_FAILED;
+            return false;
+        }
+        // Copy status and read data; if tracing, each request is recorded with the round
+        // trip time of the chunk
+        bool chunkOK = true;
+        for (unsigned int j = 0; j < numChunk; j++) {
+            const RemoteReq &rreq = slot->reqs[(first+j) & (REMOTE_RING_SIZE-1)];
+            EMIO_Request &req = *chunk[j];
+            req.status = static_cast<EMIO_ReqStatus>(rreq.status);
+            if ((req.status == EMIO_REQ_OK) && !req.IsWrite())
+                memcpy(req.data, slot->data+rreq.dataOffset, RequestQuads(req.opType, req.nBytes)*sizeof(uint32_t));
+            else if (req.status != EMIO_REQ_OK)
+                chunkOK = false;
+            if (req.status != EMIO_REQ_PENDING)
+                EndTransaction(req.opType, req.addr, req.data, req.nBytes, req.status == EMIO_REQ_OK);
+        }
+        if (!chunkOK) {
+            ret = false;
+            if (remoteFlags)
+                break;
+        }
+    }
+    return ret;
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_RemoteServer
+
+EMIO_RemoteServer::EMIO_RemoteServer(EMIO_Interface *backend, const char *name, gid_t group) :
+    emio(backend), shared(0), stopRequested(false)
+{
+    path = std::string("/dev/shm/") + name;
+    // Replace any existing segment (e.g., from a previous server), so that the new
+    // segment is all zero; clients of the previous server detect that it terminated.
+    unlink(path.c_str());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        std::cout << "EMIO_RemoteServer: failed to create " << path << std::endl;
+        return;
+    }
+    // Allow members of the group to connect (the mode of open is masked by umask)
+    if ((group != static_cast<gid_t>(-1)) && (fchown(fd, -1, group) != 0)) {
+        std::cout << "EMIO_RemoteServer: failed to set group of " << path << std::endl;
+        close(fd);
+        unlink(path.c_str());
+        return;
+    }
+    fchmod(fd, 0660);
+    if (ftruncate(fd, sizeof(EMIO_RemoteShared)) != 0) {
+        std::cout << "EMIO_RemoteServer: failed to set size of " << path << std::endl;
+        close(fd);
+        unlink(path.c_str());
+        return;
+    }
+    void *region = mmap(NULL, sizeof(EMIO_RemoteShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        std::cout << "EMIO_RemoteServer: failed to mmap " << path << std::endl;
+        unlink(path.c_str());
+        return;
+    }
+    shared = reinterpret_cast<EMIO_RemoteShared *>(region);
+    shared->serverPid = getpid();
+    shared->emioVersion = emio->GetVersion();
+    batch.reserve(REMOTE_MAX_CLIENTS*REMOTE_RING_SIZE);
+    slotIds.reserve(REMOTE_MAX_CLIENTS);
+    slotNums.reserve(REMOTE_MAX_CLIENTS);
+    // Clients only connect after the magic number is set
+    __atomic_store_n(&shared->magic, REMOTE_MAGIC, __ATOMIC_RELEASE);
+}
+
+EMIO_RemoteServer::~EMIO_RemoteServer()
+{
+    if (shared) {
+        __atomic_store_n(&shared->magic, 0, __ATOMIC_RELEASE);
+        shared->serverPid = 0;
+        munmap(shared, sizeof(EMIO_RemoteShared));
+        unlink(path.c_str());
+    }
+}
+
+void EMIO_RemoteServer::Complete(unsigned int id, const EMIO_Request *reqs, unsigned int num)
+{
+    EMIO_RemoteSlot &s = shared->slots[id];
+    uint32_t t = s.tail;
+    for (unsigned int i = 0; (i < num) && (i < REMOTE_RING_SIZE); i++)
+        s.reqs[(t+i) & (REMOTE_RING_SIZE-1)].status = reqs ? reqs[i].status : EMIO_REQ_FAILED;
+    // See EMIO_Interface_Remote::Submit
+    __atomic_store_n(&s.tail, t+num, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s.clientWaiting, __ATOMIC_SEQ_CST))
+        FutexWake(&s.tail, 1);
+}
+
+unsigned int EMIO_RemoteServer::ProcessRequests()
+{
+    batch.clear();
+    slotIds.clear();
+    slotNums.clear();
+    unsigned int numReqs = 0;
+    for (unsigned int id = 0; id < REMOTE_MAX_CLIENTS; id++) {
+        EMIO_RemoteSlot &s = shared->slots[id];
+        if (__atomic_load_n(&s.state, __ATOMIC_ACQUIRE) != SLOT_IN_USE)
+            continue;
+        uint32_t t = s.tail;
+        uint32_t n = __atomic_load_n(&s.head, __ATOMIC_ACQUIRE)-t;
+        if (n == 0)
+            continue;
+        stats.numSubmissions++;
+        // Check the descriptors, since the slot is writable by any client. Each descriptor
+        // is read once, and only the copy is checked and used, so that the client cannot
+        // change it after it has been checked.
+        bool valid = (n <= REMOTE_RING_SIZE);
+        size_t first = batch.size();
+        for (unsigned int i = 0; valid && (i < n); i++) {
+            const RemoteReq &sreq = s.reqs[(t+i) & (REMOTE_RING_SIZE-1)];
+            RemoteReq rreq;
+            rreq.opType = __atomic_load_n(&sreq.opType, __ATOMIC_RELAXED);
+            rreq.addr = __atomic_load_n(&sreq.addr, __ATOMIC_RELAXED);
+            rreq.nBytes = __atomic_load_n(&sreq.nBytes, __ATOMIC_RELAXED);
+            rreq.dataOffset = __atomic_load_n(&sreq.dataOffset, __ATOMIC_RELAXED);
+            if ((rreq.opType > EMIO_WRITE_BLOCK) || (rreq.addr > 0xffff) ||
+                (rreq.dataOffset >= REMOTE_DATA_QUADS) ||
+                (RequestQuads(rreq.opType, rreq.nBytes) > REMOTE_DATA_QUADS-rreq.dataOffset)) {
+                valid = false;
+                break;
+            }
+            EMIO_Request req = { static_cast<EMIO_OpType>(rreq.opType), static_cast<uint16_t>(rreq.addr),
+                                 s.data+rreq.dataOffset, rreq.nBytes, EMIO_REQ_PENDING };
+            batch.push_back(req);
+        }
+        if (!valid) {
+            std::cout << "EMIO_RemoteServer: invalid request from process " << s.pid << std::endl;
+            batch.resize(first);
+            Complete(id, 0, n);
+            continue;
+        }
+        numReqs += n;
+        unsigned int flags = __atomic_load_n(&s.flags, __ATOMIC_RELAXED);
+        if (flags != EMIO_BATCH_DEFAULT) {
+            // Execute separately, so that the flags only apply to this client
+            emio->ExecuteBatch(&batch[first], n, flags & EMIO_BATCH_STOP_ON_ERR);
+            stats.numBatches++;
+            Complete(id, &batch[first], n);
+            batch.resize(first);
+        }
+        else {
+            slotIds.push_back(id);
+            slotNums.push_back(n);
+        }
+    }
+    if (!slotIds.empty()) {
+        // Execute requests of all clients in one batch; the data is read and written
+        // directly in the data area of each slot
+        emio->ExecuteBatch(&batch[0], batch.size());
+        stats.numBatches++;
+        size_t first = 0;
+        for (size_t i = 0; i < slotIds.size(); i++) {
+            Complete(slotIds[i], &batch[first], slotNums[i]);
+            first += slotNums[i];
+        }
+    }
+    stats.numRequests += numReqs;
+    return numReqs;
+}
+
+void EMIO_RemoteServer::CheckClients()
+{
+    for (unsigned int id = 0; id < REMOTE_MAX_CLIENTS; id++) {
+        EMIO_RemoteSlot &s = shared->slots[id];
+        if (__atomic_load_n(&s.state, __ATOMIC_ACQUIRE) != SLOT_IN_USE)
+            continue;
+        pid_t pid = __atomic_load_n(&s.pid, __ATOMIC_ACQUIRE);
+        // A slot that was just claimed does not have a pid yet
+        if ((pid <= 0) || !ProcessTerminated(pid))
+            continue;
+        // Discard any requests that were not processed, then release slot
+        __atomic_store_n(&s.tail, __atomic_load_n(&s.head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+        __atomic_store_n(&s.pid, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s.state, SLOT_FREE, __ATOMIC_RELEASE);
+        stats.numDeadClients++;
+    }
+}
+
+void EMIO_RemoteServer::Run()
+{
+    if (!shared)
+        return;
+    const struct timespec sleepTime = { 0, REMOTE_SERVER_SLEEP_NS };
+    struct timespec lastCheck;
+    clock_gettime(CLOCK_MONOTONIC, &lastCheck);
+    unsigned int idlePolls = 0;
+    unsigned int loops = 0;
+    while (!stopRequested) {
+        // Check for terminated clients about once per second
+        if (((++loops % REMOTE_SERVER_SPIN) == 0) && (ElapsedSince_us(lastCheck) > REMOTE_CHECK_CLIENTS_US)) {
+            CheckClients();
+            stats.numClients = __atomic_load_n(&shared->numConnects, __ATOMIC_RELAXED);
+            clock_gettime(CLOCK_MONOTONIC, &lastCheck);
+        }
+        uint32_t bell = __atomic_load_n(&shared->doorbell, __ATOMIC_ACQUIRE);
+        if (ProcessRequests() > 0) {
+            idlePolls = 0;
+            continue;
+        }
+        if (++idlePolls < REMOTE_SERVER_SPIN)
+            continue;
+        idlePolls = 0;
+        loops = REMOTE_SERVER_SPIN-1;    // check clients after sleeping
+        // Sleep until a client rings the doorbell (see EMIO_Interface_Remote::Submit)
+        __atomic_store_n(&shared->serverWaiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&shared->doorbell, __ATOMIC_SEQ_CST) == bell)
+            FutexWait(&shared->doorbell, bell, &sleepTime);
+        __atomic_store_n(&shared->serverWaiting, 0, __ATOMIC_RELAXED);
+    }
+    stats.numClients = __atomic_load_n(&shared->numConnects, __ATOMIC_RELAXED);
+}
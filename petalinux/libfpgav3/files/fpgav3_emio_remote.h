@@ -0,0 +1,141 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_remote (Linux library)
+ *
+ * This library provides an interface from the Zynq PS to the read and write buses
+ * on the FPGA (PL), via the EMIO bits. The read and write buses each consist of
+ * a 16-bit address bus and a 32-bit data bus. The EMIO interface uses the same
+ * 16 bits for the read/write address and the same 32 bits for the read/write data.
+ * The address bus is always output from the PS, whereas the data bus is bidirectional
+ * (PS input when reading, PS output when writing).
+ *
+ * This file defines EMIO_Interface_Remote, a derived class that sends each transaction
+ * to a request server (the fpgav3emiod daemon), and EMIO_RemoteServer, which implements
+ * the server using one of the other derived classes (e.g., EMIO_Interface_Mmap).
+ *
+ * The server creates a shared-memory segment (a file in /dev/shm) with one slot per
+ * client. Each slot contains a single-producer/single-consumer ring of request
+ * descriptors and a data area. The client copies write data to the data area, publishes
+ * the descriptors (head index), and sleeps on a futex until the server has completed
+ * them (tail index). The server collects the pending requests of all clients into one
+ * batch (see EMIO_Interface::ExecuteBatch), which reads and writes the data area
+ * directly. Thus, only the server accesses the EMIO hardware, and clients start quickly
+ * because they do not need to map /dev/mem or initialize the GPIO.
+ *
+ * The segment is only accessible by the owner and group of the server (mode 0660), since
+ * any client can submit transactions to the FPGA; the group can be specified so that its
+ * members can connect without root privileges (see fpgav3emiod -g).
+ */
+
+#ifndef FPGAV3_EMIO_REMOTE_H
+#define FPGAV3_EMIO_REMOTE_H
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "fpgav3_emio.h"
+
+// Default name of shared-memory segment (/dev/shm/fpgav3emiod)
+#define EMIO_REMOTE_DEFAULT_NAME "fpgav3emiod"
+
+struct EMIO_RemoteShared;
+struct EMIO_RemoteSlot;
+
+class EMIO_Interface_Remote : public EMIO_Interface
+{
+    EMIO_RemoteShared *shared;  // shared-memory segment (0 if not connected)
+    EMIO_RemoteSlot *slot;      // slot assigned to this client
+    uint32_t head;              // number of requests submitted
+    bool isBroken;              // true if server did not respond (slot state unknown)
+
+public:
+
+    EMIO_Interface_Remote(const char *name = EMIO_REMOTE_DEFAULT_NAME);
+
+    ~EMIO_Interface_Remote();
+
+    bool IsOK() const
+    { return (slot != 0) && !isBroken; }
+
+    void SetEventMode(bool newState);
+
+    // The server serializes access to the EMIO bus (and may itself use the bus lock),
+    // so the bus lock cannot be used by a remote interface.
+    bool SetBusLock(bool enable, const char *name = EMIO_BUSLOCK_DEFAULT_NAME);
+
+    bool ReadQuadlet(uint16_t addr, uint32_t &data);
+
+    bool WriteQuadlet(uint16_t addr, uint32_t data);
+
+    bool ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes);
+
+    bool WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes);
+
+protected:
+
+    // Submit num requests (descriptors and write data already in slot) and wait for
+    // them to be completed by the server. Returns false if the server does not respond.
+    bool Submit(unsigned int num, unsigned int flags);
+
+    bool DoTransfer(EMIO_OpType opType, uint16_t addr, uint32_t *data, unsigned int nBytes);
+
+    bool RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass);
+};
+
+// Server statistics
+struct EMIO_RemoteServerStats {
+    unsigned long numBatches;       // number of batches executed
+    unsigned long numRequests;      // number of requests executed
+    unsigned long numSubmissions;   // number of client submissions (several per batch if busy)
+    unsigned long numClients;       // number of clients that connected
+    unsigned long numDeadClients;   // number of slots released because client terminated
+
+    EMIO_RemoteServerStats() : numBatches(0), numRequests(0), numSubmissions(0), numClients(0),
+                               numDeadClients(0) {}
+};
+
+class EMIO_RemoteServer
+{
+    EMIO_Interface *emio;             // backend (not owned)
+    EMIO_RemoteShared *shared;        // shared-memory segment
+    std::string path;                 // path of shared-memory segment
+    volatile bool stopRequested;
+    EMIO_RemoteServerStats stats;
+    std::vector<EMIO_Request> batch;  // requests of current batch
+    std::vector<unsigned int> slotIds;  // slots in current batch
+    std::vector<unsigned int> slotNums; // number of requests of each slot in current batch
+
+    // Execute pending requests of all clients; returns number of requests
+    unsigned int ProcessRequests();
+
+    // Complete submission of specified slot (copy status and wake client)
+    void Complete(unsigned int id, const EMIO_Request *reqs, unsigned int num);
+
+    // Release slots of terminated clients
+    void CheckClients();
+
+public:
+
+    // Creates the shared-memory segment (replacing any existing segment with the same name),
+    // with mode 0660; if group is not -1, the segment is assigned to that group
+    EMIO_RemoteServer(EMIO_Interface *backend, const char *name = EMIO_REMOTE_DEFAULT_NAME,
+                      gid_t group = static_cast<gid_t>(-1));
+
+    ~EMIO_RemoteServer();
+
+    bool IsOK() const
+    { return (shared != 0); }
+
+    // Process requests until Stop is called (Stop can be called from a signal handler)
+    void Run();
+
+    void Stop()
+    { stopRequested = true; }
+
+    const EMIO_RemoteServerStats &GetStats() const
+    { return stats; }
+};
+
+#endif // FPGAV3_EMIO_REMOTE_H
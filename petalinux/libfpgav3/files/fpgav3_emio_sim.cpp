@@ -0,0 +1,182 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <time.h>
+#include "fpgav3_emio_sim.h"
+#include "fpgav3_emio_regs.h"
+
+// Number of registers in the simulated FPGA (16-bit address)
+const unsigned int SIM_NUM_REGS = 0x10000;
+
+EMIO_Interface_Sim::EMIO_Interface_Sim(unsigned int simVersion) : EMIO_MmapCore(),
+    outLower(0), outUpper(0), inLower(0), dirLower(0), busAddr(0), opPending(false),
+    opDone(false), busGrant(false), blkWriteEnd(false), grantTime_ns(0), doneTime_ns(0), latency_ns(0),
+    contentionProb(0.0), contention_ns(0), randState(1), numBusCycles(0), numContention(0)
+{
+    version = simVersion;
+    regFile = new uint32_t[SIM_NUM_REGS];
+    for (unsigned int i = 0; i < SIM_NUM_REGS; i++)
+        regFile[i] = 0;
+    // Hardware version register (address 4) indicates BCFG firmware
+    regFile[4] = 0x42434647;
+    isInput = true;
+}
+
+EMIO_Interface_Sim::~EMIO_Interface_Sim()
+{
+    delete [] regFile;
+}
+
+void EMIO_Interface_Sim::SetEventMode(bool newState)
+{
+    if (newState && isVerbose)
+        std::cout << "EMIO_Interface_Sim: events not implemented (using polling)" << std::endl;
+    useEvents = false;
+}
+
+void EMIO_Interface_Sim::SetContention(double probability, uint32_t delay_ns, uint32_t seed)
+{
+    contentionProb = probability;
+    contention_ns = delay_ns;
+    randState = (seed != 0) ? seed : 1;
+}
+
+// Local method to get current time in nanoseconds
+uint64_t EMIO_Interface_Sim::GetTime_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+// Simulated firmware: a new bus operation starts on the rising edge of req_bus
+// (newRequest is true) or when addr_lsb changes during a block transfer. The
+// register is accessed immediately, but op_done is not visible until the bus has
+// been granted and the op_done latency has elapsed. At the end of a block write
+// (blk_end set), op_done is cleared after it has been read once, because the
+// host waits for op_done to be cleared before clearing req_bus.
+void EMIO_Interface_Sim::StartBusOp(bool newRequest)
+{
+    if (dirLower != 0) {
+        regFile[busAddr] = outLower;    // write (data lines are output)
+        blkWriteEnd = (outUpper & Bits_BlkEnd);
+    }
+    else {
+        inLower = regFile[busAddr];     // read
+        blkWriteEnd = false;
+    }
+    numBusCycles++;
+
+    opPending = true;
+    opDone = false;
+
+    uint32_t delay_ns = 0;
+    if (newRequest) {
+        busGrant = false;
+        if (contentionProb > 0.0) {
+            // xorshift32 random number generator
+            randState ^= randState << 13;
+            randState ^= randState >> 17;
+            randState ^= randState << 5;
+            if (randState < contentionProb*4294967295.0) {
+                delay_ns = contention_ns;
+                numContention++;
+            }
+        }
+    }
+    if ((delay_ns == 0) && (latency_ns == 0)) {
+        // No need to get the time
+        grantTime_ns = 0;
+        doneTime_ns = 0;
+    }
+    else {
+        uint64_t now_ns = GetTime_ns();
+        grantTime_ns = (newRequest ? now_ns + delay_ns : 0);
+        doneTime_ns = now_ns + delay_ns + latency_ns;
+    }
+}
+
+uint32_t EMIO_Interface_Sim::RegisterRead(uint32_t reg_addr)
+{
+    uint32_t val = 0;
+    switch (reg_addr) {
+        case Reg_InputLower:
+            val = (dirLower != 0) ? outLower : inLower;
+            break;
+        case Reg_InputUpper:
+            if (opPending) {
+                uint64_t now_ns = (doneTime_ns != 0) ? GetTime_ns() : 0;
+                if (!busGrant && (now_ns >= grantTime_ns))
+                    busGrant = true;
+                if (now_ns >= doneTime_ns) {
+                    opDone = true;
+                    opPending = false;
+                }
+            }
+            val = (version << 28) | (outUpper & Bits_UpperOutputs);
+            if (opDone)        val |= Bits_OpDone;
+            if (busGrant)      val |= Bits_GrantBus;
+            if (dirLower != 0) val |= Bits_Write;
+            if (opDone && blkWriteEnd) {
+                opDone = false;
+                blkWriteEnd = false;
+            }
+            break;
+        case Reg_OutputLower:
+            val = outLower;
+            break;
+        case Reg_OutputUpper:
+            val = outUpper;
+            break;
+        case Reg_DirLower:
+            val = dirLower;
+            break;
+    }
+    return val;
+}
+
+void EMIO_Interface_Sim::RegisterWrite(uint32_t reg_addr, uint32_t reg_data)
+{
+    if (reg_addr == Reg_OutputLower) {
+        outLower = reg_data;
+    }
+    else if (reg_addr == Reg_DirLower) {
+        dirLower = reg_data;
+    }
+    else if (reg_addr == Reg_OutputUpper) {
+        uint32_t prev = outUpper;
+        outUpper = reg_data;
+        if (!(reg_data & Bits_RequestBus)) {
+            // req_bus cleared: firmware releases the bus and clears op_done
+            opPending = false;
+            opDone = false;
+            busGrant = false;
+            blkWriteEnd = false;
+        }
+        else if (!(prev & Bits_RequestBus)) {
+            // Rising edge of req_bus: quadlet or first quadlet of block
+            busAddr = reg_data & Bits_RegAddr;
+            StartBusOp(true);
+        }
+        else if ((prev ^ reg_data) & Bits_LSB) {
+            // Change of addr_lsb during block transfer: next quadlet
+            busAddr++;
+            StartBusOp(false);
+        }
+    }
+}
+
+// Local method to re-validate isInput (see EMIO_Interface_Mmap::RevalidateDirection)
+void EMIO_Interface_Sim::RevalidateDirection()
+{
+    uint32_t dir = RegisterRead(Reg_DirLower);
+    if (dir == 0xffffffff) {
+        isInput = false;
+    }
+    else {
+        if (dir != 0x00000000)
+            RegisterWrite(Reg_DirLower, 0x00000000);
+        isInput = true;
+    }
+}
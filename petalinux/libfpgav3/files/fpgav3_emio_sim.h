@@ -0,0 +1,112 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_sim (Linux library)
+ *
+ * This library provides an interface from the Zynq PS to the read and write buses
+ * on the FPGA (PL), via the EMIO bits. The read and write buses each consist of
+ * a 16-bit address bus and a 32-bit data bus. The EMIO interface uses the same
+ * 16 bits for the read/write address and the same 32 bits for the read/write data.
+ * The address bus is always output from the PS, whereas the data bus is bidirectional
+ * (PS input when reading, PS output when writing).
+ *
+ * This derived class does not access any hardware. It simulates the GPIO registers
+ * used by EMIO_Interface_Mmap and the firmware side of the bus protocol (req_bus,
+ * op_done, grant_bus, blk_start, blk_end and addr_lsb), backed by a software register
+ * file. It shares the transaction code of EMIO_Interface_Mmap (EMIO_MmapCore) and only
+ * provides the register accessors, so that the transactions run the same code as on the
+ * hardware. It is intended for measuring and testing the library overhead on any Linux
+ * platform (e.g., x86). The simulated firmware can be configured to delay op_done by a
+ * fixed latency and to randomly delay the bus grant to mimic contention with Firewire
+ * or Ethernet access.
+ */
+
+#ifndef FPGAV3_EMIO_SIM_H
+#define FPGAV3_EMIO_SIM_H
+
+#include "fpgav3_emio_mmap.h"
+
+class EMIO_Interface_Sim : public EMIO_MmapCore<EMIO_Interface_Sim>
+{
+    friend class EMIO_MmapCore<EMIO_Interface_Sim>;
+
+    uint32_t *regFile;          // simulated FPGA registers (64K quadlets)
+
+    // Simulated GPIO registers
+    uint32_t outLower;          // emio[31:0] output (write data)
+    uint32_t outUpper;          // emio[63:32] output (address and control)
+    uint32_t inLower;           // emio[31:0] input (read data)
+    uint32_t dirLower;          // direction of emio[31:0]
+
+    // Simulated firmware state
+    uint16_t busAddr;           // current register address (incremented during block transfer)
+    bool     opPending;         // true if a bus operation is in progress
+    bool     opDone;            // op_done
+    bool     busGrant;          // grant_bus
+    bool     blkWriteEnd;       // true if last quadlet of block write
+    uint64_t grantTime_ns;      // time when bus will be granted
+    uint64_t doneTime_ns;       // time when op_done will be set
+
+    // Simulation parameters
+    uint32_t latency_ns;        // delay from bus grant to op_done
+    double   contentionProb;    // probability that bus grant is delayed
+    uint32_t contention_ns;     // delay of bus grant due to contention
+    uint32_t randState;         // random number generator state
+
+    // Statistics
+    unsigned long numBusCycles;
+    unsigned long numContention;
+
+public:
+
+    EMIO_Interface_Sim(unsigned int simVersion = 1);
+
+    ~EMIO_Interface_Sim();
+
+    bool IsOK() const
+    { return (regFile != 0); }
+
+    void SetEventMode(bool newState);
+
+    // Get/Set delay (in nanoseconds) from bus grant to op_done (default 0)
+    uint32_t GetOpDoneLatency_ns() const
+    { return latency_ns; }
+
+    void SetOpDoneLatency_ns(uint32_t new_latency_ns)
+    { latency_ns = new_latency_ns; }
+
+    // Set simulated bus contention: each bus request has the specified probability
+    // (0.0 to 1.0) of having its bus grant delayed by delay_ns nanoseconds.
+    // The seed initializes the (deterministic) random number generator.
+    void SetContention(double probability, uint32_t delay_ns, uint32_t seed = 1);
+
+    // Direct access to simulated FPGA registers (e.g., to initialize register values)
+    uint32_t *GetRegisterFile()
+    { return regFile; }
+
+    // Statistics: number of quadlets transferred and number of delayed bus grants
+    unsigned long GetNumBusCycles() const
+    { return numBusCycles; }
+
+    unsigned long GetNumContention() const
+    { return numContention; }
+
+protected:
+
+    // Simulated GPIO register access (same register offsets as EMIO_Interface_Mmap)
+    uint32_t RegisterRead(uint32_t reg_addr);
+
+    void RegisterWrite(uint32_t reg_addr, uint32_t reg_data);
+
+    // Simulated firmware: start of bus operation (quadlet or next quadlet of block)
+    void StartBusOp(bool newRequest);
+
+    static uint64_t GetTime_ns();
+
+    // Only the data direction is simulated (the other line configuration is fixed)
+    void RevalidateDirection();
+
+};
+
+#endif // FPGAV3_EMIO_SIM_H
@@ -0,0 +1,152 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fpgav3_emio_trace.h"
+
+uint32_t EMIO_TraceHash(const uint32_t *data, unsigned int nQuads)
+{
+    uint32_t hash = 2166136261u;
+    for (unsigned int q = 0; q < nQuads; q++) {
+        uint32_t val = data[q];
+        for (unsigned int b = 0; b < 4; b++) {
+            hash ^= (val & 0xff);
+            hash *= 16777619u;
+            val >>= 8;
+        }
+    }
+    return hash;
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_TraceRecorder
+
+EMIO_TraceRecorder::EMIO_TraceRecorder(const char *fileName, unsigned int maxEntries, unsigned int emioVersion) :
+    header(0), entries(0), mapSize(0)
+{
+    if (maxEntries == 0) {
+        std::cout << "EMIO_TraceRecorder: invalid number of entries" << std::endl;
+        return;
+    }
+    int fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cout << "EMIO_TraceRecorder: failed to create " << fileName << std::endl;
+        return;
+    }
+    size_t size = sizeof(EMIO_TraceHeader) + maxEntries*sizeof(EMIO_TraceEntry);
+    if (ftruncate(fd, size) != 0) {
+        std::cout << "EMIO_TraceRecorder: failed to set size of " << fileName << std::endl;
+        close(fd);
+        return;
+    }
+    void *region = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        std::cout << "EMIO_TraceRecorder: failed to mmap " << fileName << std::endl;
+        return;
+    }
+    // Write all pages now, so that Record does not cause page faults that allocate file blocks
+    memset(region, 0, size);
+    mapSize = size;
+    header = reinterpret_cast<EMIO_TraceHeader *>(region);
+    entries = reinterpret_cast<EMIO_TraceEntry *>(header+1);
+    header->entrySize = sizeof(EMIO_TraceEntry);
+    header->maxEntries = maxEntries;
+    header->emioVersion = emioVersion;
+    header->tickPeriod_us = EMIO_Interface::GetTickPeriod_us();
+    header->timeSource = EMIO_Interface::GetTimeSource();
+    // Readers check the magic number last
+    __atomic_store_n(&header->magic, EMIO_TRACE_MAGIC, __ATOMIC_RELEASE);
+}
+
+EMIO_TraceRecorder::~EMIO_TraceRecorder()
+{
+    if (header)
+        munmap(header, mapSize);
+}
+
+void EMIO_TraceRecorder::Record(EMIO_OpType opType, uint16_t addr, const uint32_t *data, unsigned int nBytes,
+                                bool ok, fpgav3_time_t start, fpgav3_time_t end, fpgav3_time_t wait)
+{
+    bool isBlock = (opType == EMIO_READ_BLOCK) || (opType == EMIO_WRITE_BLOCK);
+    unsigned int nQuads = isBlock ? (nBytes+3)/4 : 1;
+    uint64_t n = header->numRecorded;
+    if (n == 0)
+        header->startTime = start;
+    EMIO_TraceEntry &entry = entries[n%header->maxEntries];
+    entry.start = start;
+    entry.duration = ((end-start) < 0xffffffffULL) ? (end-start) : 0xffffffffU;
+    entry.wait = (wait < 0xffffffffULL) ? wait : 0xffffffffU;
+    bool isWrite = (opType == EMIO_WRITE_QUAD) || (opType == EMIO_WRITE_BLOCK);
+    if (!ok && !isWrite)
+        entry.data = 0;
+    else
+        entry.data = isBlock ? EMIO_TraceHash(data, nQuads) : *data;
+    entry.addr = addr;
+    entry.nQuads = (nQuads < 0xffff) ? nQuads : 0xffff;
+    entry.opType = opType;
+    entry.ok = ok ? 1 : 0;
+    // Only one thread records (EMIO_Interface is not thread-safe); the release store
+    // makes the entry visible to readers of a live trace
+    __atomic_store_n(&header->numRecorded, n+1, __ATOMIC_RELEASE);
+}
+
+unsigned long EMIO_TraceRecorder::GetNumRecorded() const
+{
+    return header ? header->numRecorded : 0;
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_TraceReader
+
+EMIO_TraceReader::EMIO_TraceReader(const char *fileName) : header(0), entries(0), mapSize(0),
+                                                           first(0), numEntries(0)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd < 0) {
+        std::cout << "EMIO_TraceReader: failed to open " << fileName << std::endl;
+        return;
+    }
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size < static_cast<off_t>(sizeof(EMIO_TraceHeader)))) {
+        std::cout << "EMIO_TraceReader: invalid size of " << fileName << std::endl;
+        close(fd);
+        return;
+    }
+    void *region = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        std::cout << "EMIO_TraceReader: failed to mmap " << fileName << std::endl;
+        return;
+    }
+    const EMIO_TraceHeader *hdr = reinterpret_cast<const EMIO_TraceHeader *>(region);
+    size_t size = sizeof(EMIO_TraceHeader) + static_cast<size_t>(hdr->maxEntries)*sizeof(EMIO_TraceEntry);
+    if ((__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != EMIO_TRACE_MAGIC) ||
+        (hdr->entrySize != sizeof(EMIO_TraceEntry)) || (size > static_cast<size_t>(st.st_size))) {
+        std::cout << "EMIO_TraceReader: " << fileName << " is not a valid trace file" << std::endl;
+        munmap(region, st.st_size);
+        return;
+    }
+    header = hdr;
+    entries = reinterpret_cast<const EMIO_TraceEntry *>(header+1);
+    mapSize = st.st_size;
+    uint64_t n = __atomic_load_n(&header->numRecorded, __ATOMIC_ACQUIRE);
+    numEntries = (n < header->maxEntries) ? n : header->maxEntries;
+    first = n-numEntries;
+}
+
+EMIO_TraceReader::~EMIO_TraceReader()
+{
+    if (header)
+        munmap(const_cast<EMIO_TraceHeader *>(header), mapSize);
+}
+
+const EMIO_TraceEntry &EMIO_TraceReader::GetEntry(unsigned int n) const
+{
+    return entries[(first+n)%header->maxEntries];
+}
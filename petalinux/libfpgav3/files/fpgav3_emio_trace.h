@@ -0,0 +1,120 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_trace (Linux library)
+ *
+ * Binary trace of EMIO transactions. When tracing is enabled (EMIO_Interface::StartTrace),
+ * each transaction (including each request of a batch) is recorded as a fixed-size entry
+ * in a file that is mapped into memory, so that recording only copies the entry (no
+ * allocation, formatting or system call). The file is a ring buffer: when it is full,
+ * the oldest entries are overwritten, so it always contains the most recent transactions
+ * (e.g., those that preceded a failure). The file remains valid if the process terminates,
+ * and can be read while it is being written.
+ *
+ * EMIO_TraceReader provides the entries in chronological order; see the fpgav3trace
+ * application, which summarizes a trace, converts it to Chrome trace (Perfetto) JSON,
+ * and replays it against any EMIO_Interface.
+ */
+
+#ifndef FPGAV3_EMIO_TRACE_H
+#define FPGAV3_EMIO_TRACE_H
+
+#include <stdint.h>
+#include "fpgav3_emio.h"
+
+const uint32_t EMIO_TRACE_MAGIC = 0x454d5431;    // 'EMT1'
+
+// Default number of entries (2 MB)
+const unsigned int EMIO_TRACE_DEFAULT_ENTRIES = 65536;
+
+// One transaction (32 bytes). Times are in ticks of the time source that was used when
+// the trace was started (see EMIO_TraceHeader::tickPeriod_us).
+struct EMIO_TraceEntry {
+    uint64_t start;            // start time of transaction (after acquiring bus lock)
+    uint32_t duration;         // duration of transaction
+    uint32_t wait;             // time spent waiting for op_done (polling or event)
+    uint32_t data;             // quadlet data, or FNV-1a hash of block data (see EMIO_TraceHash)
+    uint16_t addr;             // register address
+    uint16_t nQuads;           // number of quadlets
+    uint8_t  opType;           // EMIO_OpType
+    uint8_t  ok;               // 1 if successful
+    uint16_t reserved1;
+    uint32_t reserved2;
+};
+
+// File header (64 bytes), followed by maxEntries entries
+struct EMIO_TraceHeader {
+    uint32_t magic;            // EMIO_TRACE_MAGIC
+    uint32_t entrySize;        // sizeof(EMIO_TraceEntry)
+    uint32_t maxEntries;       // size of ring buffer
+    uint32_t emioVersion;      // EMIO bus interface version
+    uint64_t numRecorded;      // total number of entries recorded (may exceed maxEntries)
+    double   tickPeriod_us;    // duration of one tick
+    uint32_t timeSource;       // EMIO_TimeSource
+    uint32_t reserved1;
+    uint64_t startTime;        // time when trace was started (ticks)
+    uint32_t reserved2[4];
+};
+
+// Returns the FNV-1a hash of nQuads quadlets
+uint32_t EMIO_TraceHash(const uint32_t *data, unsigned int nQuads);
+
+class EMIO_TraceRecorder
+{
+    EMIO_TraceHeader *header;  // mapped file (0 if not open)
+    EMIO_TraceEntry *entries;
+    size_t mapSize;
+
+public:
+
+    // Creates (or truncates) the file and maps it; the whole file is written once, so
+    // that recording does not cause page faults that allocate file blocks
+    EMIO_TraceRecorder(const char *fileName, unsigned int maxEntries, unsigned int emioVersion);
+
+    ~EMIO_TraceRecorder();
+
+    bool IsOK() const
+    { return (header != 0); }
+
+    // Record one transaction (data is not used if ok is false for a read)
+    void Record(EMIO_OpType opType, uint16_t addr, const uint32_t *data, unsigned int nBytes, bool ok,
+                fpgav3_time_t start, fpgav3_time_t end, fpgav3_time_t wait);
+
+    unsigned long GetNumRecorded() const;
+};
+
+class EMIO_TraceReader
+{
+    const EMIO_TraceHeader *header;   // mapped file (0 if not open)
+    const EMIO_TraceEntry *entries;
+    size_t mapSize;
+    uint64_t first;            // index (in numRecorded) of oldest entry, when opened
+    unsigned int numEntries;
+
+public:
+
+    EMIO_TraceReader(const char *fileName);
+
+    ~EMIO_TraceReader();
+
+    bool IsOK() const
+    { return (header != 0); }
+
+    const EMIO_TraceHeader *GetHeader() const
+    { return header; }
+
+    // Number of entries available when the file was opened (at most maxEntries)
+    unsigned int GetNumEntries() const
+    { return numEntries; }
+
+    // Returns entry n in chronological order (0 is the oldest); if the trace is still
+    // being recorded, the oldest entries may already have been overwritten
+    const EMIO_TraceEntry &GetEntry(unsigned int n) const;
+
+    // Converts ticks to microseconds
+    double Ticks_us(uint64_t ticks) const
+    { return ticks*header->tickPeriod_us; }
+};
+
+#endif // FPGAV3_EMIO_TRACE_H
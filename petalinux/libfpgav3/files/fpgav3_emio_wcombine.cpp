@@ -0,0 +1,163 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <algorithm>
+#include <byteswap.h>
+#include "fpgav3_emio_wcombine.h"
+
+EMIO_Interface_WriteCombined::EMIO_Interface_WriteCombined(EMIO_Interface *emioIntf, unsigned int maxBufQuads) :
+    EMIO_Interface(), emio(emioIntf), bufAddr(0), bufQuads(0), bufLimit(0),
+    maxQuads(maxBufQuads ? maxBufQuads : 1)
+{
+    buf.resize(maxQuads, 0);
+    if (emio) {
+        isVerbose = emio->GetVerbose();
+        useEvents = emio->GetEventMode();
+        version = emio->GetVersion();
+    }
+}
+
+EMIO_Interface_WriteCombined::~EMIO_Interface_WriteCombined()
+{
+    if (emio && (bufQuads > 0) && !Flush())
+        std::cout << "EMIO_Interface_WriteCombined: failed to flush " << bufQuads << " quadlets" << std::endl;
+}
+
+void EMIO_Interface_WriteCombined::SetEventMode(bool newState)
+{
+    emio->SetEventMode(newState);
+    useEvents = emio->GetEventMode();
+}
+
+bool EMIO_Interface_WriteCombined::SetBusLock(bool enable, const char *name)
+{
+    return emio->SetBusLock(enable, name);
+}
+
+bool EMIO_Interface_WriteCombined::SetMaxQuads(unsigned int newMaxQuads)
+{
+    bool ret = Flush();
+    maxQuads = newMaxQuads ? newMaxQuads : 1;
+    buf.resize(maxQuads, 0);
+    return ret;
+}
+
+bool EMIO_Interface_WriteCombined::Flush()
+{
+    return FlushFor(stats.numFlushExplicit);
+}
+
+bool EMIO_Interface_WriteCombined::FlushFor(unsigned long &reason)
+{
+    if (bufQuads == 0)
+        return true;
+    bool ok;
+    if (bufQuads == 1) {
+        ok = emio->WriteQuadlet(bufAddr, bswap_32(buf[0]));
+        stats.numSingles++;
+    }
+    else {
+        ok = emio->WriteBlock(bufAddr, &buf[0], 4*bufQuads);
+        stats.numBlocks++;
+        stats.numCombined += bufQuads;
+    }
+    reason++;
+    if (!ok)
+        stats.numFlushErrors++;
+    lastError = emio->GetLastError();
+    // The buffer is discarded even if the write failed, since some quadlets may have been
+    // written and the caller has already been told that they were successful
+    bufQuads = 0;
+    return ok;
+}
+
+bool EMIO_Interface_WriteCombined::ReadQuadlet(uint16_t addr, uint32_t &data)
+{
+    if (IsBuffered(addr, 1) && !FlushFor(stats.numFlushRead))
+        return false;
+    bool ok = emio->ReadQuadlet(addr, data);
+    lastError = emio->GetLastError();
+    return ok;
+}
+
+bool EMIO_Interface_WriteCombined::WriteQuadlet(uint16_t addr, uint32_t data)
+{
+    stats.numWrites++;
+    unsigned int rangeQuads = (version >= 1) ? BlockRangeQuads(addr) : 0;
+    if (rangeQuads == 0) {
+        // Not in a block range (or version 0): written directly, after the buffered writes
+        stats.numDirect++;
+        if (!FlushFor(stats.numFlushOther))
+            return false;
+        bool ok = emio->WriteQuadlet(addr, data);
+        lastError = emio->GetLastError();
+        return ok;
+    }
+    if ((bufQuads > 0) && (addr != bufAddr+bufQuads) && !FlushFor(stats.numFlushGap))
+        return false;
+    if (bufQuads == 0) {
+        // The buffered run cannot extend beyond the block range that contains its first address
+        bufAddr = addr;
+        bufLimit = std::min(maxQuads, rangeQuads);
+    }
+    // Block data is byte-swapped, but quadlet data is not
+    buf[bufQuads++] = bswap_32(data);
+    lastError = EMIO_OK;
+    // The buffer is flushed when full (rather than before the next write), so that the
+    // time that writes are delayed is limited
+    if (bufQuads == bufLimit)
+        return FlushFor(stats.numFlushFull);
+    return true;
+}
+
+bool EMIO_Interface_WriteCombined::ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
+{
+    if (IsBuffered(addr, (nBytes+3)/4) && !FlushFor(stats.numFlushRead))
+        return false;
+    bool ok = emio->ReadBlock(addr, data, nBytes);
+    lastError = emio->GetLastError();
+    return ok;
+}
+
+bool EMIO_Interface_WriteCombined::WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes)
+{
+    if (!FlushFor(stats.numFlushOther))
+        return false;
+    bool ok = emio->WriteBlock(addr, data, nBytes);
+    lastError = emio->GetLastError();
+    return ok;
+}
+
+bool EMIO_Interface_WriteCombined::RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass)
+{
+    // The buffered writes precede all requests of the batch; the selected requests are
+    // then forwarded (in order) to the underlying interface as one batch
+    bool ok = FlushFor(stats.numFlushOther);
+    fwdReqs.clear();
+    fwdIndex.clear();
+    unsigned int i;
+    for (i = 0; i < num; i++) {
+        if (!BatchSelect(reqs[i], pass))
+            continue;
+        if (!ok) {
+            reqs[i].status = EMIO_REQ_FAILED;
+            if (flags & EMIO_BATCH_STOP_ON_ERR)
+                break;
+            continue;
+        }
+        fwdReqs.push_back(reqs[i]);
+        fwdIndex.push_back(i);
+    }
+    if (!ok)
+        return false;
+
+    bool ret = true;
+    if (!fwdReqs.empty()) {
+        ret = emio->ExecuteBatch(&fwdReqs[0], fwdReqs.size(), flags & EMIO_BATCH_STOP_ON_ERR);
+        lastError = emio->GetLastError();
+    }
+    for (size_t f = 0; f < fwdReqs.size(); f++)
+        reqs[fwdIndex[f]].status = fwdReqs[f].status;
+    return ret;
+}
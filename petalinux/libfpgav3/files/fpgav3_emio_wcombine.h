@@ -0,0 +1,147 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_emio_wcombine (Linux library)
+ *
+ * This file defines EMIO_Interface_WriteCombined, a derived class that adds a write-combining
+ * buffer to another EMIO_Interface (e.g., EMIO_Interface_Mmap). Quadlet writes to consecutive
+ * addresses are accumulated in the buffer and written to the FPGA as one block write, which
+ * requires one bus arbitration instead of one per quadlet.
+ *
+ * A block write is only equivalent to the quadlet writes at consecutive addresses for some
+ * registers (e.g., a block write to address 0 is the real-time block write), so writes are
+ * only buffered within the block ranges added to this object by the caller (see
+ * EMIO_Interface::AddBlockRange, e.g., EMIO_ADDR_PROM_DATA); by default, no ranges are
+ * added and all writes are passed through. A buffered run does not extend beyond the
+ * range that contains its first address. The buffer is flushed:
+ *
+ *    - by Flush (and when the object is destroyed)
+ *    - before a quadlet write that does not continue the buffered run (address gap)
+ *    - when the buffer holds the maximum number of quadlets (see SetMaxQuads) or
+ *      reaches the end of the block range
+ *    - before a read (quadlet or block) that overlaps the buffered addresses
+ *    - before a block write, a quadlet write outside the block ranges and a batch
+ *      (ExecuteBatch)
+ *
+ * A buffer that holds a single quadlet is flushed as a quadlet write. Block writes require
+ * version 1 or higher; for version 0, all writes are passed through.
+ *
+ * Ordering: writes are executed in the order in which they were made, and a read always
+ * returns the value of the last write to the same address. However, a buffered write may
+ * be executed after a later read of a different address, or not until the next flush. If a
+ * write has side effects on other registers (e.g., a command register whose status is then
+ * read), or must take effect by a certain time, call Flush after it. A buffered write returns
+ * true; if the flush fails, the operation that triggered it (e.g., the next write or read)
+ * fails without being executed, and the buffered writes are discarded (some of them may have
+ * been written). The error code (GetLastError) is that of the underlying interface.
+ */
+
+#ifndef FPGAV3_EMIO_WCOMBINE_H
+#define FPGAV3_EMIO_WCOMBINE_H
+
+#include <vector>
+#include "fpgav3_emio.h"
+
+// Default maximum number of quadlets in the buffer
+const unsigned int EMIO_WCOMBINE_DEFAULT_QUADS = EMIO_HOLD_MAX_QUADS;
+
+// Write-combining statistics
+struct EMIO_WriteCombineStats {
+    unsigned long numWrites;        // quadlet writes (buffered or passed through)
+    unsigned long numDirect;        // quadlet writes passed through (not in a block range)
+    unsigned long numBlocks;        // block writes issued by flushes
+    unsigned long numCombined;      // quadlets written by those block writes
+    unsigned long numSingles;       // flushes of a single quadlet (quadlet write)
+    unsigned long numFlushExplicit; // flushes by Flush (or the destructor)
+    unsigned long numFlushGap;      // flushes due to an address gap
+    unsigned long numFlushFull;     // flushes due to a full buffer (or end of block range)
+    unsigned long numFlushRead;     // flushes due to an overlapping read
+    unsigned long numFlushOther;    // flushes before a block write, direct write or batch
+    unsigned long numFlushErrors;   // flushes that failed
+
+    EMIO_WriteCombineStats() : numWrites(0), numDirect(0), numBlocks(0), numCombined(0), numSingles(0),
+                               numFlushExplicit(0), numFlushGap(0), numFlushFull(0),
+                               numFlushRead(0), numFlushOther(0), numFlushErrors(0) {}
+};
+
+class EMIO_Interface_WriteCombined : public EMIO_Interface
+{
+    EMIO_Interface *emio;           // underlying interface (not owned)
+    uint16_t bufAddr;               // address of first buffered quadlet
+    unsigned int bufQuads;          // number of buffered quadlets
+    unsigned int bufLimit;          // maximum quadlets of current run (buffer or block range)
+    unsigned int maxQuads;          // maximum number of buffered quadlets
+    std::vector<uint32_t> buf;      // buffered data (byte-swapped, as for WriteBlock)
+    EMIO_WriteCombineStats stats;
+    std::vector<EMIO_Request> fwdReqs;      // requests forwarded by RunBatch
+    std::vector<unsigned int> fwdIndex;     // index of each forwarded request
+
+public:
+
+    EMIO_Interface_WriteCombined(EMIO_Interface *emioIntf, unsigned int maxBufQuads = EMIO_WCOMBINE_DEFAULT_QUADS);
+
+    // Flushes the buffer
+    ~EMIO_Interface_WriteCombined();
+
+    bool IsOK() const
+    { return emio && emio->IsOK(); }
+
+    unsigned int GetVersion() const
+    { return emio->GetVersion(); }
+
+    // Returns the underlying interface
+    EMIO_Interface *GetInterface() const
+    { return emio; }
+
+    // The event mode and bus lock are set on the underlying interface. The deadline and retries
+    // (see EMIO_Interface::SetDeadline) are those of the underlying interface, and the error
+    // code is copied from it after each operation.
+    void SetEventMode(bool newState);
+
+    bool SetBusLock(bool enable, const char *name = EMIO_BUSLOCK_DEFAULT_NAME);
+
+    // Get/Set maximum number of buffered quadlets (at least 1); SetMaxQuads flushes the
+    // buffer and returns false if that failed
+    unsigned int GetMaxQuads() const
+    { return maxQuads; }
+
+    bool SetMaxQuads(unsigned int newMaxQuads);
+
+    // Returns the number of buffered quadlets
+    unsigned int GetNumBuffered() const
+    { return bufQuads; }
+
+    // Flush
+    //   Writes the buffered quadlets to the FPGA (see above).
+    // Returns: true if successful (or the buffer was empty)
+    bool Flush();
+
+    // Get/Reset statistics
+    const EMIO_WriteCombineStats &GetStats() const
+    { return stats; }
+
+    void ResetStats()
+    { stats = EMIO_WriteCombineStats(); }
+
+    bool ReadQuadlet(uint16_t addr, uint32_t &data);
+
+    bool WriteQuadlet(uint16_t addr, uint32_t data);
+
+    bool ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes);
+
+    bool WriteBlock(uint16_t addr, const uint32_t *data, unsigned int nBytes);
+
+protected:
+
+    // Returns true if any of the nQuads registers starting at addr is buffered
+    bool IsBuffered(uint16_t addr, unsigned int nQuads) const
+    { return (bufQuads > 0) && (addr < bufAddr+bufQuads) && (bufAddr < addr+nQuads); }
+
+    // Flush the buffer and count the reason (stats counter)
+    bool FlushFor(unsigned long &reason);
+
+    bool RunBatch(EMIO_Request *reqs, unsigned int num, unsigned int flags, BatchPass pass);
+};
+
+#endif // FPGAV3_EMIO_WCOMBINE_H
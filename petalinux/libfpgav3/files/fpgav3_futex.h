@@ -0,0 +1,33 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_futex (Linux library)
+ *
+ * Futex wait and wake, used for synchronization via shared memory (see EMIO_BusLock
+ * and EMIO_Interface_Remote). These are not the private futex operations, since the
+ * futex words are shared between processes.
+ */
+
+#ifndef FPGAV3_FUTEX_H
+#define FPGAV3_FUTEX_H
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Sleep while *addr is equal to val, up to the specified (relative) timeout
+static inline void FutexWait(uint32_t *addr, uint32_t val, const struct timespec *timeout)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+// Wake up to num processes waiting on addr
+static inline void FutexWake(uint32_t *addr, int num)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, num, NULL, NULL, 0);
+}
+
+#endif // FPGAV3_FUTEX_H
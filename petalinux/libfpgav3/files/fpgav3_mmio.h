@@ -0,0 +1,57 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_mmio (Linux library)
+ *
+ * Accessors for memory-mapped device registers (e.g., the GPIO registers used by
+ * EMIO_Interface_Mmap, mapped via /dev/mem).
+ *
+ * Each register access is a single 32-bit volatile load or store, so that the compiler
+ * cannot remove, merge or hoist it (e.g., out of a polling loop), or reorder it with
+ * respect to other register accesses, at any optimization level (including LTO).
+ *
+ * The /dev/mem mapping (O_SYNC) is uncached device memory, so the processor performs
+ * register accesses to the same peripheral in program order. A memory barrier (dmb) is
+ * therefore only needed where a handshake must be ordered with respect to accesses that
+ * are not to the same peripheral (e.g., normal memory), and it is placed explicitly
+ * with MMIO_Barrier, rather than being part of every access.
+ */
+
+#ifndef FPGAV3_MMIO_H
+#define FPGAV3_MMIO_H
+
+#include <stdint.h>
+
+// Read 32-bit register at byte offset from base
+static inline uint32_t MMIO_Read32(const volatile void *base, uint32_t offset)
+{
+    return *(reinterpret_cast<const volatile uint32_t *>(base)+(offset/sizeof(uint32_t)));
+}
+
+// Write 32-bit register at byte offset from base
+static inline void MMIO_Write32(volatile void *base, uint32_t offset, uint32_t value)
+{
+    *(reinterpret_cast<volatile uint32_t *>(base)+(offset/sizeof(uint32_t))) = value;
+}
+
+// Memory barrier: all memory accesses (device and normal) before the barrier are
+// observed before all memory accesses after the barrier. Also a compiler barrier.
+static inline void MMIO_Barrier()
+{
+#if defined(__arm__) || defined(__aarch64__)
+    __asm__ __volatile__("dmb osh" ::: "memory");
+#else
+    // Other platforms (e.g., x86 for EMIO_Interface_Sim) are not used for device access
+    __sync_synchronize();
+#endif
+}
+
+// Compiler barrier: prevents the compiler from moving memory accesses across it,
+// without any processor instruction
+static inline void MMIO_CompilerBarrier()
+{
+    __asm__ __volatile__("" ::: "memory");
+}
+
+#endif // FPGAV3_MMIO_H
@@ -0,0 +1,100 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "fpgav3_perf.h"
+
+// Open one counter for the calling thread, on any CPU. Kernel counting is tried first,
+// since the EMIO backends spend most of their time in system calls (gpiod) or may be
+// preempted; if that is not permitted (perf_event_paranoid), only user space is counted.
+static int OpenCounter(uint32_t type, uint64_t config, int groupFd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.disabled = (groupFd < 0) ? 1 : 0;   // group is enabled via leader
+    attr.exclude_hv = 1;
+    int fd = syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    if (fd < 0) {
+        attr.exclude_kernel = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+    return fd;
+}
+
+EMIO_PerfCounters::EMIO_PerfCounters() : leaderFd(-1), availMask(0), numOpen(0)
+{
+    static const struct { uint32_t type; uint64_t config; } events[EMIO_PERF_NUM_COUNTERS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES }
+    };
+    for (unsigned int i = 0; i < EMIO_PERF_NUM_COUNTERS; i++) {
+        startValues[i] = 0;
+        // First counter that can be opened becomes the group leader
+        fd[i] = OpenCounter(events[i].type, events[i].config, leaderFd);
+        if (fd[i] < 0)
+            continue;
+        if (leaderFd < 0)
+            leaderFd = fd[i];
+        availMask |= (1 << i);
+        numOpen++;
+    }
+    if (leaderFd < 0) {
+        std::cout << "EMIO_PerfCounters: could not open performance counters: " << strerror(errno)
+                  << std::endl;
+        return;
+    }
+    ioctl(leaderFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+EMIO_PerfCounters::~EMIO_PerfCounters()
+{
+    for (unsigned int i = 0; i < EMIO_PERF_NUM_COUNTERS; i++) {
+        if (fd[i] >= 0)
+            close(fd[i]);
+    }
+}
+
+bool EMIO_PerfCounters::ReadValues(uint64_t *values) const
+{
+    // PERF_FORMAT_GROUP: number of counters, followed by value of each counter (in the
+    // order they were added to the group)
+    uint64_t buf[1+EMIO_PERF_NUM_COUNTERS];
+    if (leaderFd < 0)
+        return false;
+    ssize_t n = read(leaderFd, buf, (1+numOpen)*sizeof(uint64_t));
+    if ((n < static_cast<ssize_t>(sizeof(uint64_t))) || (buf[0] != numOpen))
+        return false;
+    unsigned int j = 1;
+    for (unsigned int i = 0; i < EMIO_PERF_NUM_COUNTERS; i++)
+        values[i] = (availMask & (1 << i)) ? buf[j++] : 0;
+    return true;
+}
+
+void EMIO_PerfCounters::Start()
+{
+    ReadValues(startValues);
+}
+
+bool EMIO_PerfCounters::Stop(uint32_t *deltas) const
+{
+    uint64_t values[EMIO_PERF_NUM_COUNTERS];
+    if (!ReadValues(values))
+        return false;
+    for (unsigned int i = 0; i < EMIO_PERF_NUM_COUNTERS; i++)
+        deltas[i] = static_cast<uint32_t>(values[i]-startValues[i]);
+    return true;
+}
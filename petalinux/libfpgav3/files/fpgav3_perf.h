@@ -0,0 +1,61 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_perf (Linux library)
+ *
+ * Hardware/software performance counters (Linux perf_event_open) that are read at the
+ * start and end of each EMIO transaction, so that slow transactions can be attributed
+ * to the CPU (cache misses), the scheduler (context switches) or the device (many
+ * cycles spent polling op_done). The counters are opened as one group, so that all of
+ * them are read with a single read system call.
+ *
+ * The counters only count the thread that created them, so EMIO_PerfCounters should be
+ * used by the thread that performs the transactions. Counters that are not supported
+ * (e.g., hardware counters in a virtual machine, or when perf_event_paranoid does not
+ * permit kernel counting) are omitted; see GetAvailableMask.
+ *
+ * See EMIO_Interface::SetPerfCounters.
+ */
+
+#ifndef FPGAV3_PERF_H
+#define FPGAV3_PERF_H
+
+#include <stdint.h>
+#include "fpgav3_timing.h"
+
+class EMIO_PerfCounters
+{
+    int fd[EMIO_PERF_NUM_COUNTERS];           // file descriptor of each counter (-1 if not open)
+    int leaderFd;                             // group leader (-1 if no counters)
+    unsigned int availMask;                   // bit per EMIO_PerfCounter
+    unsigned int numOpen;                     // number of counters in group
+    uint64_t startValues[EMIO_PERF_NUM_COUNTERS];
+
+    // Read counter values (in EMIO_PerfCounter order; unavailable counters are 0)
+    bool ReadValues(uint64_t *values) const;
+
+public:
+
+    EMIO_PerfCounters();
+
+    ~EMIO_PerfCounters();
+
+    // Returns true if at least one counter is available
+    bool IsOK() const
+    { return (leaderFd >= 0); }
+
+    // Returns the available counters (bit per EMIO_PerfCounter)
+    unsigned int GetAvailableMask() const
+    { return availMask; }
+
+    // Read the counters at the start of a transaction
+    void Start();
+
+    // Read the counters at the end of a transaction and store the differences from Start
+    // in deltas (EMIO_PERF_NUM_COUNTERS values). Returns false if the counters could not
+    // be read.
+    bool Stop(uint32_t *deltas) const;
+};
+
+#endif // FPGAV3_PERF_H
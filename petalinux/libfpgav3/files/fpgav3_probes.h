@@ -0,0 +1,53 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_probes (Linux library)
+ *
+ * User-space statically defined tracepoints (USDT) for the "fpgav3" provider, which
+ * can be attached by bpftrace, perf or SystemTap on a running system, e.g.:
+ *
+ *    bpftrace -e 'usdt:/usr/lib/libfpgav3.so.1.1:fpgav3:emio_exit { @[arg0] = hist(arg2); }'
+ *    perf buildid-cache --add /usr/lib/libfpgav3.so.1.1; perf record -e sdt_fpgav3:emio_wait_end ...
+ *
+ * Each probe is a single nop instruction (plus an ELF note) and its arguments are only
+ * evaluated when a tracer is attached, so the probes can be left in production builds.
+ * The probes use <sys/sdt.h> (e.g., from systemtap); if it is not available, or if
+ * FPGAV3_NO_USDT is defined, the probes are compiled out.
+ *
+ * Probes in libfpgav3 (op is EMIO_OpType, ok is 1 for success):
+ *    emio_entry(op, addr, nBytes)          start of EMIO transaction (before bus lock)
+ *    emio_wait_start(opType, num, state)   start of wait for op_done to be set (state 1)
+ *                                          or cleared (state 0) for quadlet num
+ *    emio_wait_end(opType, num, state, ok) end of wait for op_done
+ *    emio_exit(op, addr, nBytes, ok)       end of EMIO transaction
+ *    flash_start(fileName, devName)        start of ProgramFlash
+ *    flash_sector(offset, nBytes, differ)  sector compared (and written if differ is 1)
+ *    flash_done(fileName, numDiff, numSectors, ok)
+ *
+ * Probes in fpgav3init:
+ *    init_step_start(step, name)           start of initialization step (1-7)
+ *    init_step_end(step, ok)               end of initialization step
+ */
+
+#ifndef FPGAV3_PROBES_H
+#define FPGAV3_PROBES_H
+
+#if !defined(FPGAV3_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define FPGAV3_USDT 1
+#endif
+#endif
+
+#ifdef FPGAV3_USDT
+#define FPGAV3_PROBE2(name, a1, a2)             DTRACE_PROBE2(fpgav3, name, a1, a2)
+#define FPGAV3_PROBE3(name, a1, a2, a3)         DTRACE_PROBE3(fpgav3, name, a1, a2, a3)
+#define FPGAV3_PROBE4(name, a1, a2, a3, a4)     DTRACE_PROBE4(fpgav3, name, a1, a2, a3, a4)
+#else
+#define FPGAV3_PROBE2(name, a1, a2)             do {} while (0)
+#define FPGAV3_PROBE3(name, a1, a2, a3)         do {} while (0)
+#define FPGAV3_PROBE4(name, a1, a2, a3, a4)     do {} while (0)
+#endif
+
+#endif // FPGAV3_PROBES_H
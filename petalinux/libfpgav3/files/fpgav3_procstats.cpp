@@ -0,0 +1,220 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iostream>
+#include <string>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fpgav3_procstats.h"
+
+// Identifies (and versions) the layout of the shared-memory segment
+const uint32_t PROCSTATS_MAGIC = 0x50535433;    // 'PST3'
+
+// Shared-memory segment (magic is set last, after the other fields are initialized)
+struct EMIO_ProcessStatsShared {
+    uint32_t magic;
+    int32_t  pid;
+    char     name[16];
+    EMIO_ProcessCounters counters;
+};
+
+// Counters of this process (shared by all EMIO_Interface objects)
+static EMIO_ProcessStats *instance = 0;
+static pthread_mutex_t instanceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static std::string SegmentPath(pid_t pid)
+{
+    return std::string("/dev/shm/" EMIO_PROCSTATS_PREFIX) + std::to_string(pid);
+}
+
+// Removes the segment of this process at exit, in case interfaces are not deleted
+// (e.g., the process calls exit with an interface still allocated)
+static void RemoveAtExit()
+{
+    pthread_mutex_lock(&instanceMutex);
+    if (instance && instance->GetPid() == getpid())
+        unlink(SegmentPath(getpid()).c_str());
+    pthread_mutex_unlock(&instanceMutex);
+}
+
+EMIO_ProcessStats::EMIO_ProcessStats() : shared(0), ctr(0), pid(getpid()), refCount(0)
+{
+    std::string path = SegmentPath(pid);
+    // Replace any existing file (e.g., the segment of a terminated process with the same pid)
+    // with a new segment; O_EXCL and O_NOFOLLOW ensure that the file is created here, rather
+    // than following a symbolic link placed at the path by another user
+    unlink(path.c_str());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cout << "EMIO_ProcessStats: failed to create " << path << std::endl;
+        return;
+    }
+    // Allow other users to read the counters (the mode of open is masked by umask)
+    fchmod(fd, 0644);
+    if (ftruncate(fd, sizeof(EMIO_ProcessStatsShared)) != 0) {
+        std::cout << "EMIO_ProcessStats: failed to set size of " << path << std::endl;
+        close(fd);
+        unlink(path.c_str());
+        return;
+    }
+    void *region = mmap(NULL, sizeof(EMIO_ProcessStatsShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED) {
+        std::cout << "EMIO_ProcessStats: failed to mmap " << path << std::endl;
+        unlink(path.c_str());
+        return;
+    }
+    shared = reinterpret_cast<EMIO_ProcessStatsShared *>(region);
+    shared->pid = pid;
+    int commFd = open("/proc/self/comm", O_RDONLY | O_CLOEXEC);
+    if (commFd >= 0) {
+        ssize_t n = read(commFd, shared->name, sizeof(shared->name)-1);
+        if ((n > 0) && (shared->name[n-1] == '\n'))
+            shared->name[n-1] = 0;
+        close(commFd);
+    }
+    __atomic_store_n(&shared->magic, PROCSTATS_MAGIC, __ATOMIC_RELEASE);
+    ctr = &shared->counters;
+}
+
+EMIO_ProcessStats::~EMIO_ProcessStats()
+{
+    if (shared) {
+        munmap(shared, sizeof(EMIO_ProcessStatsShared));
+        unlink(SegmentPath(pid).c_str());
+    }
+}
+
+EMIO_ProcessStats *EMIO_ProcessStats::Acquire()
+{
+    const char *env = getenv("FPGAV3_STATS");
+    if (env && (strcmp(env, "0") == 0))
+        return 0;
+    pthread_mutex_lock(&instanceMutex);
+    // A child process (fork) gets its own segment; the inherited object still refers
+    // to the segment of the parent, so it is not deleted.
+    if (instance && (instance->pid != getpid()))
+        instance = 0;
+    if (!instance) {
+        // Remove the segments of processes that terminated without removing them
+        // (e.g., killed by a signal)
+        std::vector<pid_t> pids;
+        EMIO_ProcessStatsReader::ListProcesses(pids);
+        for (size_t i = 0; i < pids.size(); i++)
+            EMIO_ProcessStatsReader::RemoveStale(pids[i]);
+        instance = new EMIO_ProcessStats;
+        if (!instance->shared) {
+            delete instance;
+            instance = 0;
+        }
+        // The handler is inherited by child processes (fork), so it is only registered once
+        static bool atExitRegistered = false;
+        if (instance && !atExitRegistered)
+            atExitRegistered = (atexit(RemoveAtExit) == 0);
+    }
+    EMIO_ProcessStats *ret = instance;
+    if (ret)
+        ret->refCount++;
+    pthread_mutex_unlock(&instanceMutex);
+    return ret;
+}
+
+void EMIO_ProcessStats::Release(EMIO_ProcessStats *stats)
+{
+    if (!stats)
+        return;
+    pthread_mutex_lock(&instanceMutex);
+    // Objects inherited from the parent process are left alone
+    if ((stats->pid == getpid()) && (--stats->refCount == 0)) {
+        if (stats == instance)
+            instance = 0;
+        delete stats;
+    }
+    pthread_mutex_unlock(&instanceMutex);
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_ProcessStatsReader
+
+EMIO_ProcessStatsReader::EMIO_ProcessStatsReader(pid_t procId) : shared(0), pid(procId)
+{
+    int fd = open(SegmentPath(pid).c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat st;
+    if ((fstat(fd, &st) != 0) || (st.st_size < static_cast<off_t>(sizeof(EMIO_ProcessStatsShared)))) {
+        close(fd);
+        return;
+    }
+    void *region = mmap(NULL, sizeof(EMIO_ProcessStatsShared), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (region == MAP_FAILED)
+        return;
+    const EMIO_ProcessStatsShared *seg = reinterpret_cast<const EMIO_ProcessStatsShared *>(region);
+    if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != PROCSTATS_MAGIC) {
+        munmap(region, sizeof(EMIO_ProcessStatsShared));
+        return;
+    }
+    shared = seg;
+}
+
+EMIO_ProcessStatsReader::~EMIO_ProcessStatsReader()
+{
+    if (shared)
+        munmap(const_cast<EMIO_ProcessStatsShared *>(shared), sizeof(EMIO_ProcessStatsShared));
+}
+
+const char *EMIO_ProcessStatsReader::GetName() const
+{
+    return shared ? shared->name : "";
+}
+
+bool EMIO_ProcessStatsReader::IsAlive() const
+{
+    return (kill(pid, 0) == 0) || (errno == EPERM);
+}
+
+bool EMIO_ProcessStatsReader::Read(EMIO_ProcessCounters &counters) const
+{
+    if (!shared)
+        return false;
+    const uint64_t *src = reinterpret_cast<const uint64_t *>(&shared->counters);
+    uint64_t *dest = reinterpret_cast<uint64_t *>(&counters);
+    for (size_t i = 0; i < sizeof(EMIO_ProcessCounters)/sizeof(uint64_t); i++)
+        dest[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    return true;
+}
+
+void EMIO_ProcessStatsReader::ListProcesses(std::vector<pid_t> &pids)
+{
+    pids.clear();
+    DIR *dir = opendir("/dev/shm");
+    if (!dir)
+        return;
+    const size_t prefixLen = strlen(EMIO_PROCSTATS_PREFIX);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != 0) {
+        if (strncmp(entry->d_name, EMIO_PROCSTATS_PREFIX, prefixLen) == 0) {
+            char *end;
+            long id = strtol(entry->d_name+prefixLen, &end, 10);
+            if ((id > 0) && (*end == 0))
+                pids.push_back(static_cast<pid_t>(id));
+        }
+    }
+    closedir(dir);
+}
+
+bool EMIO_ProcessStatsReader::RemoveStale(pid_t procId)
+{
+    if ((kill(procId, 0) == 0) || (errno == EPERM))
+        return false;
+    return (unlink(SegmentPath(procId).c_str()) == 0);
+}
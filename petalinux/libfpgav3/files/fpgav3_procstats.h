@@ -0,0 +1,171 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_procstats (Linux library)
+ *
+ * Per-process EMIO counters (transactions, bytes, waits, timeouts, direction switches,
+ * aborts, retries, maximum latency, bus arbitration) in a shared-memory segment,
+ * /dev/shm/fpgav3_stats.<pid>, so that a monitoring tool (fpgav3stat) can collect the
+ * counters of all processes that use libfpgav3 without any cooperation from them.
+ *
+ * All EMIO_Interface objects in a process share one segment, which is created when the
+ * first interface is created and removed when the last one is deleted. The counters are
+ * only written by the owning process, using relaxed atomic increments (no locks or
+ * system calls), so that counting does not add measurable latency to the transactions.
+ * Setting the environment variable FPGAV3_STATS=0 disables the counters.
+ *
+ * The segment is also removed when the process exits (atexit), in case interfaces were
+ * not deleted. The segment of a process that terminated abnormally (e.g., killed by a
+ * signal) remains in /dev/shm until another process creates its segment, which removes
+ * the segments of all terminated processes; EMIO_ProcessStatsReader::IsAlive can be used
+ * to detect this case.
+ */
+
+#ifndef FPGAV3_PROCSTATS_H
+#define FPGAV3_PROCSTATS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+#include "fpgav3_timing.h"
+
+// Prefix of shared-memory segment names (/dev/shm/fpgav3_stats.<pid>)
+#define EMIO_PROCSTATS_PREFIX "fpgav3_stats."
+
+// Counters of one process. Operations are indexed by EMIO_TimingOp (the individual
+// requests of a batch are also counted as quadlet or block operations).
+struct EMIO_ProcessCounters {
+    uint64_t numOps[EMIO_TIMING_NUM_OPS];
+    uint64_t numErrors;         // failed operations (including timeouts)
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t numWaits;          // waits for op_done that required polling
+    uint64_t waitPolls;         // total number of polls in those waits
+    uint64_t numTimeouts;       // waits for op_done that timed out
+    uint64_t numDirSwitches;    // data line direction changes
+    uint64_t maxWait_ns;        // maximum polling wait for op_done
+    uint64_t maxLatency_ns;     // maximum operation time (only if timing mode enabled)
+    uint64_t numAborts;         // transactions aborted after a timeout or deadline miss
+    uint64_t numRetries;        // retries after a timeout
+    uint64_t numGrants;         // transactions with a sampled grant_bus (timing mode 2)
+    uint64_t arbitration_ns;    // total time from request to grant_bus (arbitration)
+    uint64_t access_ns;         // total time from grant_bus to op_done (access)
+    uint64_t maxArbitration_ns; // maximum arbitration time
+};
+
+// Layout of shared-memory segment (see fpgav3_procstats.cpp)
+struct EMIO_ProcessStatsShared;
+
+class EMIO_ProcessStats
+{
+    EMIO_ProcessStatsShared *shared;
+    EMIO_ProcessCounters *ctr;   // counters in shared
+    pid_t pid;
+    unsigned int refCount;
+
+    EMIO_ProcessStats();
+    ~EMIO_ProcessStats();
+
+    static void UpdateMax(uint64_t *value, uint64_t newValue)
+    {
+        uint64_t cur = __atomic_load_n(value, __ATOMIC_RELAXED);
+        while ((newValue > cur) &&
+               !__atomic_compare_exchange_n(value, &cur, newValue, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+
+public:
+
+    // Returns the counters of this process (creating the segment if needed), or 0 if
+    // the counters are disabled or the segment could not be created. Each call must be
+    // matched by a call to Release.
+    static EMIO_ProcessStats *Acquire();
+
+    static void Release(EMIO_ProcessStats *stats);
+
+    // Returns the process that owns the segment
+    pid_t GetPid() const
+    { return pid; }
+
+    // Count an operation (op is EMIO_TimingOp); nBytes is only used if ok
+    void CountOp(unsigned int op, unsigned int nBytes, bool isWrite, bool ok)
+    {
+        __atomic_fetch_add(&ctr->numOps[op], 1, __ATOMIC_RELAXED);
+        if (!ok)
+            __atomic_fetch_add(&ctr->numErrors, 1, __ATOMIC_RELAXED);
+        else
+            __atomic_fetch_add(isWrite ? &ctr->bytesWritten : &ctr->bytesRead, nBytes, __ATOMIC_RELAXED);
+    }
+
+    // Count a polling wait for op_done
+    void CountWait(unsigned int polls, bool done, uint64_t wait_ns)
+    {
+        __atomic_fetch_add(&ctr->numWaits, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctr->waitPolls, polls, __ATOMIC_RELAXED);
+        if (!done)
+            __atomic_fetch_add(&ctr->numTimeouts, 1, __ATOMIC_RELAXED);
+        UpdateMax(&ctr->maxWait_ns, wait_ns);
+    }
+
+    // Count a timeout of a wait that does not use polling (e.g., events)
+    void CountTimeout()
+    { __atomic_fetch_add(&ctr->numTimeouts, 1, __ATOMIC_RELAXED); }
+
+    void CountDirSwitch()
+    { __atomic_fetch_add(&ctr->numDirSwitches, 1, __ATOMIC_RELAXED); }
+
+    void CountAbort()
+    { __atomic_fetch_add(&ctr->numAborts, 1, __ATOMIC_RELAXED); }
+
+    void CountRetry()
+    { __atomic_fetch_add(&ctr->numRetries, 1, __ATOMIC_RELAXED); }
+
+    void UpdateMaxLatency(uint64_t latency_ns)
+    { UpdateMax(&ctr->maxLatency_ns, latency_ns); }
+
+    // Count the arbitration and access times of a transaction (see EMIO_OpTimingStats)
+    void CountGrant(uint64_t arbitration_ns, uint64_t access_ns)
+    {
+        __atomic_fetch_add(&ctr->numGrants, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctr->arbitration_ns, arbitration_ns, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctr->access_ns, access_ns, __ATOMIC_RELAXED);
+        UpdateMax(&ctr->maxArbitration_ns, arbitration_ns);
+    }
+};
+
+class EMIO_ProcessStatsReader
+{
+    const EMIO_ProcessStatsShared *shared;
+    pid_t pid;
+
+public:
+
+    EMIO_ProcessStatsReader(pid_t procId);
+
+    ~EMIO_ProcessStatsReader();
+
+    // Returns true if the segment of the process was opened
+    bool IsOK() const
+    { return (shared != 0); }
+
+    pid_t GetPid() const
+    { return pid; }
+
+    // Returns the process name (from /proc/<pid>/comm when the segment was created)
+    const char *GetName() const;
+
+    // Returns true if the process is still running
+    bool IsAlive() const;
+
+    // Read the current counters (each counter is read atomically, but the counters are
+    // not a consistent snapshot). Returns false if the segment is not open.
+    bool Read(EMIO_ProcessCounters &counters) const;
+
+    // Get the process ids of all segments in /dev/shm (including terminated processes)
+    static void ListProcesses(std::vector<pid_t> &pids);
+
+    // Remove the segment of a terminated process; returns false if it is still running
+    static bool RemoveStale(pid_t procId);
+};
+
+#endif // FPGAV3_PROCSTATS_H
@@ -10,6 +10,7 @@
 #include <sys/ioctl.h>
 #include <mtd/mtd-user.h>
 #include "fpgav3_qspi.h"
+#include "fpgav3_probes.h"
 
 // Format: FPGA 1234-56 (12 bytes) or FPGA 1234-567 (13 bytes).
 // Note that on PROM, the string is terminated by 0xff because the sector
@@ -86,9 +87,12 @@ bool ProgramFpgaSerialNumber(const char *sn)
 
 bool ProgramFlash(const char *fileName, const char *devName)
 {
+    FPGAV3_PROBE2(flash_start, fileName, devName);
+
     int fdFile = open(fileName, O_RDONLY);
     if (fdFile < 0) {
         printf("ProgramFlash: cannot open file %s\n", fileName);
+        FPGAV3_PROBE4(flash_done, fileName, 0, 0, 0);
         return false;
     }
 
@@ -96,6 +100,7 @@ bool ProgramFlash(const char *fileName, const char *devName)
     if (fdFlash < 0) {
         printf("ProgramFlash: cannot open QSPI flash device %s\n", devName);
         close(fdFile);
+        FPGAV3_PROBE4(flash_done, fileName, 0, 0, 0);
         return false;
     }
 
@@ -112,6 +117,7 @@ bool ProgramFlash(const char *fileName, const char *devName)
         free(devBuf);
         close(fdFile);
         close(fdFlash);
+        FPGAV3_PROBE4(flash_done, fileName, 0, 0, 0);
         return false;
     }
 
@@ -130,7 +136,8 @@ bool ProgramFlash(const char *fileName, const char *devName)
         size_t nb = (bytesLeft < mtd_info.erasesize) ? bytesLeft : mtd_info.erasesize;
         read(fdFile, fileBuf, nb);
         read(fdFlash, devBuf, nb);
-        if (memcmp(fileBuf, devBuf, nb) == 0) {
+        bool differ = (memcmp(fileBuf, devBuf, nb) != 0);
+        if (!differ) {
             numSame++;
         }
         else {
@@ -144,6 +151,7 @@ bool ProgramFlash(const char *fileName, const char *devName)
             // write new contents
             write(fdFlash, fileBuf, nb);
         }
+        FPGAV3_PROBE3(flash_sector, nBytes, nb, differ);
     }
     if (numDiff == 0) {
         printf("ProgramFlash:  %s already present in %s\n", fileName, devName);
@@ -156,5 +164,6 @@ bool ProgramFlash(const char *fileName, const char *devName)
     free(devBuf);
     close(fdFile);
     close(fdFlash);
+    FPGAV3_PROBE4(flash_done, fileName, numDiff, numSame+numDiff, 1);
     return true;
 }
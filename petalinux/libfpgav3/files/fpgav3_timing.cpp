@@ -0,0 +1,393 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+#include <iomanip>
+#include <time.h>
+#include "fpgav3_timing.h"
+
+const char *EMIO_TimingOpName(EMIO_TimingOp op)
+{
+    static const char *opNames[EMIO_TIMING_NUM_OPS] =
+        { "ReadQuadlet", "WriteQuadlet", "ReadBlock", "WriteBlock", "ExecuteBatch" };
+    return (op < EMIO_TIMING_NUM_OPS) ? opNames[op] : "Unknown";
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_Histogram
+
+void EMIO_Histogram::Clear()
+{
+    for (unsigned int i = 0; i < NUM_BUCKETS; i++)
+        buckets[i] = 0;
+    count = 0;
+    sum_ns = 0;
+    min_ns = 0;
+    max_ns = 0;
+}
+
+// Values below SUB_BUCKETS use the first SUB_BUCKETS (exact) buckets. Larger values
+// with most significant bit e use SUB_BUCKETS buckets, indexed by the SUB_BITS bits
+// following the most significant bit.
+unsigned int EMIO_Histogram::BucketIndex(uint64_t val_ns)
+{
+    if (val_ns < SUB_BUCKETS)
+        return static_cast<unsigned int>(val_ns);
+    unsigned int e = 63-__builtin_clzll(val_ns);
+    if (e > MAX_EXP)
+        return NUM_BUCKETS-1;
+    unsigned int sub = static_cast<unsigned int>(val_ns >> (e-SUB_BITS)) & (SUB_BUCKETS-1);
+    return (e-SUB_BITS+1)*SUB_BUCKETS + sub;
+}
+
+uint64_t EMIO_Histogram::BucketLowerBound(unsigned int idx)
+{
+    if (idx < SUB_BUCKETS)
+        return idx;
+    unsigned int e = idx/SUB_BUCKETS+SUB_BITS-1;
+    uint64_t sub = idx%SUB_BUCKETS;
+    return (SUB_BUCKETS+sub) << (e-SUB_BITS);
+}
+
+void EMIO_Histogram::Add(uint64_t val_ns)
+{
+    buckets[BucketIndex(val_ns)]++;
+    if ((count == 0) || (val_ns < min_ns))
+        min_ns = val_ns;
+    if (val_ns > max_ns)
+        max_ns = val_ns;
+    sum_ns += val_ns;
+    count++;
+}
+
+double EMIO_Histogram::GetPercentile_us(double pct) const
+{
+    if (count == 0)
+        return 0.0;
+    // Rank of the requested sample (1..count)
+    unsigned long rank = static_cast<unsigned long>(pct*count/100.0+0.5);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+    unsigned long cum = 0;
+    unsigned int i;
+    for (i = 0; i < NUM_BUCKETS-1; i++) {
+        cum += buckets[i];
+        if (cum >= rank)
+            break;
+    }
+    double val_ns = 0.5*(BucketLowerBound(i)+BucketLowerBound(i+1));
+    if (val_ns < min_ns) val_ns = min_ns;
+    if (val_ns > max_ns) val_ns = max_ns;
+    return val_ns*1.0e-3;
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_PerfStats
+
+const char *EMIO_PerfCounterName(EMIO_PerfCounter counter)
+{
+    static const char *names[EMIO_PERF_NUM_COUNTERS] = { "cycles", "instructions", "cache-misses",
+                                                         "context-switches" };
+    return (counter < EMIO_PERF_NUM_COUNTERS) ? names[counter] : "unknown";
+}
+
+void EMIO_PerfStats::Clear()
+{
+    count = 0;
+    for (unsigned int i = 0; i < EMIO_PERF_NUM_COUNTERS; i++) {
+        sum[i] = 0;
+        max[i] = 0;
+        slowest[i] = 0;
+    }
+    slowest_ns = 0;
+}
+
+void EMIO_PerfStats::Add(const uint32_t *counters, uint64_t total_ns)
+{
+    bool isSlowest = (count == 0) || (total_ns > slowest_ns);
+    count++;
+    for (unsigned int i = 0; i < EMIO_PERF_NUM_COUNTERS; i++) {
+        sum[i] += counters[i];
+        if (counters[i] > max[i])
+            max[i] = counters[i];
+        if (isSlowest)
+            slowest[i] = counters[i];
+    }
+    if (isSlowest)
+        slowest_ns = total_ns;
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_TimingStats
+
+void EMIO_TimingStats::Clear()
+{
+    for (unsigned int i = 0; i < EMIO_TIMING_NUM_OPS; i++) {
+        op[i].total.Clear();
+        for (unsigned int j = 0; j < EMIO_NUM_PHASES; j++)
+            op[i].phase[j].Clear();
+        op[i].arbitration.Clear();
+        op[i].access.Clear();
+        op[i].perf.Clear();
+    }
+    numDropped = 0;
+}
+
+void EMIO_TimingStats::Print(std::ostream &outStr) const
+{
+    std::ios_base::fmtflags oldFlags = outStr.flags();
+    std::streamsize oldPrec = outStr.precision();
+    outStr << std::fixed << std::setprecision(3);
+    outStr << "Operation         count      mean       p50       p99     p99.9       max (us)" << std::endl;
+    for (unsigned int i = 0; i < EMIO_TIMING_NUM_OPS; i++) {
+        const EMIO_Histogram &h = op[i].total;
+        if (h.GetCount() == 0)
+            continue;
+        outStr << std::left << std::setw(12) << EMIO_TimingOpName(static_cast<EMIO_TimingOp>(i))
+               << std::right << std::setw(11) << h.GetCount()
+               << std::setw(10) << h.GetMean_us() << std::setw(10) << h.GetPercentile_us(50.0)
+               << std::setw(10) << h.GetPercentile_us(99.0) << std::setw(10) << h.GetPercentile_us(99.9)
+               << std::setw(10) << h.GetMax_us() << std::endl;
+        if (op[i].phase[EMIO_PHASE_WAIT].GetCount() > 0) {
+            outStr << "    phases (mean)       " << std::setw(10) << op[i].phase[EMIO_PHASE_START].GetMean_us()
+                   << std::setw(10) << op[i].phase[EMIO_PHASE_WAIT].GetMean_us()
+                   << std::setw(10) << op[i].phase[EMIO_PHASE_END].GetMean_us() << std::endl;
+        }
+        const EMIO_Histogram &arb = op[i].arbitration;
+        if (arb.GetCount() > 0) {
+            outStr << "    arbitration " << std::setw(11) << arb.GetCount()
+                   << std::setw(10) << arb.GetMean_us() << std::setw(10) << arb.GetPercentile_us(50.0)
+                   << std::setw(10) << arb.GetPercentile_us(99.0) << std::setw(10) << arb.GetPercentile_us(99.9)
+                   << std::setw(10) << arb.GetMax_us() << std::endl;
+            const EMIO_Histogram &acc = op[i].access;
+            outStr << "    access      " << std::setw(11) << acc.GetCount()
+                   << std::setw(10) << acc.GetMean_us() << std::setw(10) << acc.GetPercentile_us(50.0)
+                   << std::setw(10) << acc.GetPercentile_us(99.0) << std::setw(10) << acc.GetPercentile_us(99.9)
+                   << std::setw(10) << acc.GetMax_us() << std::endl;
+        }
+    }
+    // Performance counters (mean, max and slowest transaction of each operation)
+    bool hasCounters = false;
+    for (unsigned int i = 0; i < EMIO_TIMING_NUM_OPS; i++) {
+        if (op[i].perf.count > 0)
+            hasCounters = true;
+    }
+    if (hasCounters) {
+        outStr << std::setprecision(1);
+        outStr << "Counter (mean / max / slowest)";
+        for (unsigned int c = 0; c < EMIO_PERF_NUM_COUNTERS; c++) {
+            if (perfMask & (1 << c))
+                outStr << "  " << EMIO_PerfCounterName(static_cast<EMIO_PerfCounter>(c));
+        }
+        outStr << std::endl;
+        for (unsigned int i = 0; i < EMIO_TIMING_NUM_OPS; i++) {
+            const EMIO_PerfStats &p = op[i].perf;
+            if (p.count == 0)
+                continue;
+            outStr << std::left << std::setw(12) << EMIO_TimingOpName(static_cast<EMIO_TimingOp>(i))
+                   << std::right;
+            for (unsigned int c = 0; c < EMIO_PERF_NUM_COUNTERS; c++) {
+                if (perfMask & (1 << c))
+                    outStr << "  " << p.GetMean(static_cast<EMIO_PerfCounter>(c)) << " / " << p.max[c]
+                           << " / " << p.slowest[c];
+            }
+            outStr << std::endl;
+        }
+    }
+    if (numDropped > 0)
+        outStr << "Dropped samples: " << numDropped << std::endl;
+    outStr.flags(oldFlags);
+    outStr.precision(oldPrec);
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_TimingRecorder
+
+EMIO_TimingRecorder::EMIO_TimingRecorder(unsigned int ringSize) : head(0), tail(0), numDropped(0),
+                                                                  tickPeriod_us(1.0e-3), overhead_us(0.0)
+{
+    unsigned int size = 1;
+    while (size < ringSize)
+        size <<= 1;
+    ring = new Sample[size];
+    ringMask = size-1;
+}
+
+EMIO_TimingRecorder::~EMIO_TimingRecorder()
+{
+    delete [] ring;
+}
+
+void EMIO_TimingRecorder::SetConversion(double newTickPeriod_us, double newOverhead_us)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    // Samples already recorded were measured with the previous settings
+    Drain();
+    tickPeriod_us = newTickPeriod_us;
+    overhead_us = newOverhead_us;
+}
+
+void EMIO_TimingRecorder::Record(EMIO_TimingOp op, fpgav3_time_t startTime, const fpgav3_time_t *midTimes,
+                                 fpgav3_time_t endTime, const uint32_t *counters, fpgav3_time_t grantTime)
+{
+    unsigned int h = head.load(std::memory_order_relaxed);
+    if (h-tail.load(std::memory_order_acquire) > ringMask) {
+        // Ring buffer full: aggregate pending samples, unless another thread is already doing so
+        if (!statsMutex.try_lock()) {
+            numDropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Drain();
+        statsMutex.unlock();
+    }
+    Sample &s = ring[h & ringMask];
+    s.op = op;
+    s.hasPhases = (midTimes != 0);
+    s.t[0] = startTime;
+    if (midTimes) {
+        s.t[1] = midTimes[0];
+        s.t[2] = midTimes[1];
+    }
+    s.t[3] = endTime;
+    s.grant = midTimes ? grantTime : 0;
+    s.hasCounters = (counters != 0);
+    if (counters) {
+        for (unsigned int i = 0; i < EMIO_PERF_NUM_COUNTERS; i++)
+            s.counters[i] = counters[i];
+    }
+    head.store(h+1, std::memory_order_release);
+}
+
+// Local function to convert time difference (ticks) to ns, after subtracting the
+// overhead (us); negative values are set to 0.
+static inline uint64_t TicksToNs(fpgav3_time_t t0, fpgav3_time_t t1, double tickPeriod_us,
+                                 double overhead_us)
+{
+    double dt_us = static_cast<int64_t>(t1-t0)*tickPeriod_us - overhead_us;
+    return (dt_us > 0.0) ? static_cast<uint64_t>(dt_us*1.0e3+0.5) : 0;
+}
+
+void EMIO_TimingRecorder::Drain()
+{
+    unsigned int t = tail.load(std::memory_order_relaxed);
+    unsigned int h = head.load(std::memory_order_acquire);
+    for (; t != h; t++) {
+        const Sample &s = ring[t & ringMask];
+        if (s.op >= EMIO_TIMING_NUM_OPS)
+            continue;
+        EMIO_OpTimingStats &opStats = stats.op[s.op];
+        uint64_t total_ns;
+        if (s.hasPhases) {
+            // Each intermediate time measurement adds to the total time
+            total_ns = TicksToNs(s.t[0], s.t[3], tickPeriod_us, 3*overhead_us);
+            for (unsigned int i = 0; i < EMIO_NUM_PHASES; i++)
+                opStats.phase[i].Add(TicksToNs(s.t[i], s.t[i+1], tickPeriod_us, overhead_us));
+            if (s.grant) {
+                // Wait phase split at grant_bus (the grant is sampled during the wait)
+                opStats.arbitration.Add(TicksToNs(s.t[1], s.grant, tickPeriod_us, 0.0));
+                opStats.access.Add(TicksToNs(s.grant, s.t[2], tickPeriod_us, 0.0));
+            }
+        }
+        else {
+            total_ns = TicksToNs(s.t[0], s.t[3], tickPeriod_us, overhead_us);
+        }
+        opStats.total.Add(total_ns);
+        if (s.hasCounters)
+            opStats.perf.Add(s.counters, total_ns);
+    }
+    tail.store(t, std::memory_order_release);
+}
+
+void EMIO_TimingRecorder::GetStats(EMIO_TimingStats &outStats)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    Drain();
+    outStats = stats;
+    outStats.numDropped = numDropped.load(std::memory_order_relaxed);
+}
+
+void EMIO_TimingRecorder::Reset()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    Drain();
+    stats.Clear();
+    numDropped.store(0, std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_EdgeStats
+
+void EMIO_EdgeStats::Clear()
+{
+    for (unsigned int i = 0; i < 2; i++) {
+        op[i].request.Clear();
+        op[i].response.Clear();
+        op[i].wakeup.Clear();
+    }
+    numStale = 0;
+}
+
+void EMIO_EdgeStats::Print(std::ostream &outStr) const
+{
+    const char *dirName[2] = { "read", "write" };
+    std::ios_base::fmtflags oldFlags = outStr.flags();
+    std::streamsize oldPrec = outStr.precision();
+    outStr << std::fixed << std::setprecision(3);
+    outStr << "Edge timing       count      mean       p50       p99     p99.9       max (us)" << std::endl;
+    for (unsigned int i = 0; i < 2; i++) {
+        const EMIO_Histogram *h[3] = { &op[i].request, &op[i].response, &op[i].wakeup };
+        const char *name[3] = { "request", "response", "wakeup" };
+        if (h[0]->GetCount() == 0)
+            continue;
+        for (unsigned int j = 0; j < 3; j++) {
+            outStr << std::left << std::setw(5) << dirName[i] << " " << std::setw(8) << name[j]
+                   << std::right << std::setw(9) << h[j]->GetCount()
+                   << std::setw(10) << h[j]->GetMean_us() << std::setw(10) << h[j]->GetPercentile_us(50.0)
+                   << std::setw(10) << h[j]->GetPercentile_us(99.0) << std::setw(10) << h[j]->GetPercentile_us(99.9)
+                   << std::setw(10) << h[j]->GetMax_us() << std::endl;
+        }
+    }
+    if (numStale > 0)
+        outStr << "Stale events: " << numStale << std::endl;
+    outStr.flags(oldFlags);
+    outStr.precision(oldPrec);
+}
+
+// ---------------------------------------------------------------------------------
+// EMIO_EdgeRecorder
+
+uint64_t EMIO_EdgeRecorder::GetMonotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+}
+
+void EMIO_EdgeRecorder::Record(bool isWrite, uint64_t edge_ns, uint64_t wake_ns)
+{
+    if (reqStart_ns == 0)
+        return;
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (edge_ns < reqStart_ns) {
+        // Edge of an earlier request (e.g., after a timeout)
+        stats.numStale++;
+    }
+    else {
+        EMIO_EdgeOpStats &s = stats.op[isWrite ? 1 : 0];
+        s.request.Add(reqEnd_ns-reqStart_ns);
+        s.response.Add((edge_ns > reqEnd_ns) ? edge_ns-reqEnd_ns : 0);
+        s.wakeup.Add((wake_ns > edge_ns) ? wake_ns-edge_ns : 0);
+    }
+    reqStart_ns = 0;
+}
+
+void EMIO_EdgeRecorder::GetStats(EMIO_EdgeStats &outStats)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    outStats = stats;
+}
+
+void EMIO_EdgeRecorder::Reset()
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats.Clear();
+}
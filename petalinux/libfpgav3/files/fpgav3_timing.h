@@ -0,0 +1,265 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*-    */
+/* ex: set filetype=cpp softtabstop=4 shiftwidth=4 tabstop=4 cindent expandtab: */
+
+/*
+ * fpgav3_timing (Linux library)
+ *
+ * Timing statistics for the EMIO bus interface. When timing mode is enabled
+ * (EMIO_Interface::SetTimingMode), each transaction records its timestamps (raw ticks)
+ * in a preallocated ring buffer, without locking or printing. The samples are later
+ * aggregated into per-operation log-linear histograms, which are returned by
+ * EMIO_Interface::GetTimingStats.
+ *
+ * If hardware performance counters are enabled (EMIO_Interface::SetPerfCounters), each
+ * sample also contains the counter deltas (e.g., cycles, cache misses, context switches)
+ * for the transaction, which are aggregated per operation (see EMIO_PerfStats).
+ *
+ * If edge timing is enabled (EMIO_Interface::SetEdgeTiming), the backends that wait for
+ * op_done via kernel edge events use the kernel timestamp of each op_done rising edge to
+ * separate the firmware response time from the user-space and kernel overhead (see
+ * EMIO_EdgeStats).
+ */
+
+#ifndef FPGAV3_TIMING_H
+#define FPGAV3_TIMING_H
+
+#include <stdint.h>
+#include <iostream>
+#include <atomic>
+#include <mutex>
+
+// Timestamp used for timing measurements, in ticks of the current time source
+// (see EMIO_Interface::SetTimeSource). Timestamps are only converted to microseconds
+// when computing time differences.
+typedef uint64_t fpgav3_time_t;
+
+// Operations for which timing statistics are kept
+enum EMIO_TimingOp {
+    EMIO_TIMING_READ_QUAD,
+    EMIO_TIMING_WRITE_QUAD,
+    EMIO_TIMING_READ_BLOCK,
+    EMIO_TIMING_WRITE_BLOCK,
+    EMIO_TIMING_BATCH,
+    EMIO_TIMING_NUM_OPS
+};
+
+// Returns the name of the operation (e.g., "ReadQuadlet")
+const char *EMIO_TimingOpName(EMIO_TimingOp op);
+
+// Phases of a transaction (timing mode 2). For quadlet operations, these are the times
+// before, during and after waiting for op_done. For block operations, these are the times
+// before the first quadlet, from the first to the last quadlet, and after the last quadlet.
+enum EMIO_TimingPhase { EMIO_PHASE_START, EMIO_PHASE_WAIT, EMIO_PHASE_END, EMIO_NUM_PHASES };
+
+// Performance counters that can be captured per transaction (see fpgav3_perf.h)
+enum EMIO_PerfCounter {
+    EMIO_PERF_CYCLES,
+    EMIO_PERF_INSTRUCTIONS,
+    EMIO_PERF_CACHE_MISSES,
+    EMIO_PERF_CONTEXT_SWITCHES,
+    EMIO_PERF_NUM_COUNTERS
+};
+
+// Returns the name of the counter (e.g., "cycles")
+const char *EMIO_PerfCounterName(EMIO_PerfCounter counter);
+
+// Log-linear histogram of durations. Durations are stored in nanoseconds, with exact
+// values below 16 ns and 16 linear sub-buckets per power of 2 above that (i.e., the
+// relative resolution is better than 6.25%), up to about 68 seconds.
+class EMIO_Histogram
+{
+public:
+    enum { SUB_BITS = 4, SUB_BUCKETS = (1 << SUB_BITS), MAX_EXP = 35,
+           NUM_BUCKETS = (MAX_EXP-SUB_BITS+2)*SUB_BUCKETS };
+
+protected:
+    uint32_t buckets[NUM_BUCKETS];
+    unsigned long count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+
+    static unsigned int BucketIndex(uint64_t val_ns);
+    static uint64_t BucketLowerBound(unsigned int idx);
+
+public:
+
+    EMIO_Histogram()
+    { Clear(); }
+
+    void Clear();
+
+    void Add(uint64_t val_ns);
+
+    unsigned long GetCount() const
+    { return count; }
+
+    double GetMin_us() const
+    { return (count > 0) ? min_ns*1.0e-3 : 0.0; }
+
+    double GetMax_us() const
+    { return max_ns*1.0e-3; }
+
+    double GetMean_us() const
+    { return (count > 0) ? (sum_ns*1.0e-3)/count : 0.0; }
+
+    // Returns the specified percentile (0-100), in microseconds. The result is the
+    // midpoint of the corresponding bucket, limited to the measured min and max.
+    double GetPercentile_us(double pct) const;
+};
+
+// Performance counter statistics for one operation. Besides the mean and maximum of each
+// counter, the counters of the slowest transaction are kept, to show whether it was
+// delayed by cache misses, context switches or the device (many cycles, few instructions).
+struct EMIO_PerfStats {
+    unsigned long count;                          // number of transactions with counters
+    uint64_t sum[EMIO_PERF_NUM_COUNTERS];
+    uint32_t max[EMIO_PERF_NUM_COUNTERS];
+    uint32_t slowest[EMIO_PERF_NUM_COUNTERS];     // counters of slowest transaction
+    uint64_t slowest_ns;                          // duration of slowest transaction
+
+    EMIO_PerfStats()
+    { Clear(); }
+
+    void Clear();
+
+    void Add(const uint32_t *counters, uint64_t total_ns);
+
+    double GetMean(EMIO_PerfCounter counter) const
+    { return (count > 0) ? static_cast<double>(sum[counter])/count : 0.0; }
+};
+
+// Timing statistics for one operation: total time, (timing mode 2) time of each phase
+// and (if enabled) performance counters. In timing mode 2, the backends that can sample
+// grant_bus (mmap, gpiod) also split the wait phase at the time that the bus was granted:
+// arbitration is the time from the request to the grant (i.e., while the FPGA bus was busy,
+// e.g., with FireWire or Ethernet traffic) and access is the time from the grant to op_done.
+// For block operations, the bus is only arbitrated for the first quadlet.
+struct EMIO_OpTimingStats {
+    EMIO_Histogram total;
+    EMIO_Histogram phase[EMIO_NUM_PHASES];
+    EMIO_Histogram arbitration;
+    EMIO_Histogram access;
+    EMIO_PerfStats perf;
+};
+
+// Timing statistics for all operations
+struct EMIO_TimingStats {
+    EMIO_OpTimingStats op[EMIO_TIMING_NUM_OPS];
+    unsigned long numDropped;      // samples dropped because the ring buffer was full
+    unsigned int perfMask;         // counters that are available (bit per EMIO_PerfCounter)
+
+    EMIO_TimingStats() : numDropped(0), perfMask(0) {}
+
+    void Clear();
+
+    // Print summary (count, mean and percentiles) of each operation with samples
+    void Print(std::ostream &outStr) const;
+};
+
+// Ring buffer of timing samples (one producer) and aggregated statistics.
+// Record is lock-free; if the ring buffer is full, Record aggregates the pending
+// samples if no other thread is doing so, and otherwise drops the sample.
+class EMIO_TimingRecorder
+{
+    struct Sample {
+        uint32_t op;
+        uint16_t hasPhases;
+        uint16_t hasCounters;
+        fpgav3_time_t t[4];        // start, 2 intermediate times, end
+        fpgav3_time_t grant;       // time that grant_bus was seen (0 if not sampled)
+        uint32_t counters[EMIO_PERF_NUM_COUNTERS];
+    };
+
+    Sample *ring;
+    unsigned int ringMask;
+    std::atomic<unsigned int> head;     // next sample to write (producer)
+    std::atomic<unsigned int> tail;     // next sample to aggregate (consumer)
+    std::atomic<unsigned long> numDropped;
+    std::mutex statsMutex;             // protects stats and consumer side of ring
+    EMIO_TimingStats stats;
+    double tickPeriod_us;
+    double overhead_us;
+
+    // Aggregate pending samples (statsMutex must be locked)
+    void Drain();
+
+public:
+
+    // ringSize is rounded up to a power of 2
+    EMIO_TimingRecorder(unsigned int ringSize = 1024);
+
+    ~EMIO_TimingRecorder();
+
+    // Set parameters used to convert samples (applies to subsequent aggregation)
+    void SetConversion(double newTickPeriod_us, double newOverhead_us);
+
+    // Record a sample; midTimes (2 values) is 0 if phases were not measured, counters
+    // (EMIO_PERF_NUM_COUNTERS deltas) is 0 if counters were not captured, and grantTime
+    // (only used with midTimes) is 0 if grant_bus was not sampled
+    void Record(EMIO_TimingOp op, fpgav3_time_t startTime, const fpgav3_time_t *midTimes,
+                fpgav3_time_t endTime, const uint32_t *counters = 0, fpgav3_time_t grantTime = 0);
+
+    void GetStats(EMIO_TimingStats &outStats);
+
+    void Reset();
+};
+
+// Edge timing statistics for one direction (read or write). Times are measured on
+// CLOCK_MONOTONIC, which is also the clock of the kernel event timestamps. The request is
+// the write of req_bus (first quadlet) or addr_lsb (subsequent quadlets of a block), which
+// is a system call; the firmware response is measured from the return of that write to
+// the op_done edge, so it is a lower bound (by at most the request time). Edges before
+// the end of the write are counted as 0.
+struct EMIO_EdgeOpStats {
+    EMIO_Histogram request;    // duration of the request write (system call)
+    EMIO_Histogram response;   // end of request write to op_done edge (firmware)
+    EMIO_Histogram wakeup;     // op_done edge to return of the wait (interrupt and scheduling)
+};
+
+// Edge timing statistics for reads (op[0]) and writes (op[1])
+struct EMIO_EdgeStats {
+    EMIO_EdgeOpStats op[2];
+    unsigned long numStale;    // events with a timestamp before the request (not recorded)
+
+    EMIO_EdgeStats() : numStale(0) {}
+
+    void Clear();
+
+    // Print summary (count, mean and percentiles) of each direction with samples
+    void Print(std::ostream &outStr) const;
+};
+
+// Edge timing samples of one interface. RequestBegin/RequestEnd are called before and after
+// the write that requests a quadlet, and Record when the op_done event is received. The
+// statistics are protected by a mutex, so GetStats can be called from another thread.
+class EMIO_EdgeRecorder
+{
+    std::mutex statsMutex;
+    EMIO_EdgeStats stats;
+    uint64_t reqStart_ns;      // start of request write (0 if no pending request)
+    uint64_t reqEnd_ns;        // end of request write
+
+public:
+
+    EMIO_EdgeRecorder() : reqStart_ns(0), reqEnd_ns(0) {}
+
+    // Returns the current CLOCK_MONOTONIC time, in nanoseconds
+    static uint64_t GetMonotonic_ns();
+
+    void RequestBegin()
+    { reqStart_ns = GetMonotonic_ns(); }
+
+    void RequestEnd()
+    { reqEnd_ns = GetMonotonic_ns(); }
+
+    // Record the kernel timestamp of the op_done edge (edge_ns) and the time that the wait
+    // returned (wake_ns) for the pending request, which is then cleared
+    void Record(bool isWrite, uint64_t edge_ns, uint64_t wake_ns);
+
+    void GetStats(EMIO_EdgeStats &outStats);
+
+    void Reset();
+};
+
+#endif // FPGAV3_TIMING_H
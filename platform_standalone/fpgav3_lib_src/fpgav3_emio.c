@@ -5,6 +5,7 @@
 #include "xparameters.h"
 #include "xil_printf.h"
 #include "xil_io.h"
+#include "xtime_l.h"
 #include "fpgav3_emio.h"
 
 enum EMIO_Reg {
@@ -32,6 +33,16 @@ enum EMIO_Bits {
     Bits_Version        = 0xf0000000    // Bus interface version (input)
 };
 
+// Number of polls of op_done before the elapsed time is checked
+#define WAIT_FAST_POLLS 5
+
+static unsigned int timeout_us = 250;          // timeout for op_done
+static bool hasDeadline = false;               // true if transactions have a deadline
+static XTime deadlineTime = 0;                 // transaction deadline (global timer)
+static EMIO_Error lastError = EMIO_OK;         // error code of most recent transaction
+static bool abortPending = false;              // true if bus must be recovered after abort
+static EMIO_RecoveryStats recoveryStats;
+
 void EMIO_Init()
 {
     // emio[31:0] is reg_data (initialize as input)
@@ -62,30 +73,115 @@ unsigned int EMIO_GetVersion()
     return (upper & Bits_Version) >> 28;
 }
 
-static bool WaitOpDone(const char *opType, uint16_t addr, unsigned int num)
+unsigned int EMIO_GetTimeout_us()
+{
+    return timeout_us;
+}
+
+void EMIO_SetTimeout_us(unsigned int new_timeout_us)
+{
+    timeout_us = new_timeout_us;
+}
+
+void EMIO_SetDeadline(uint64_t deadline)
+{
+    deadlineTime = deadline;
+    hasDeadline = true;
+}
+
+void EMIO_ClearDeadline()
 {
-    // op_done should be set quickly by firmware, to indicate that read or write
-    // has completed. If the FPGA bus is not busy (due to Firewire or Ethernet
-    // access), it should only take about 1 iteration of the following loop.
-    int i;
-    uint32_t upper = 0;
-    for (i = 0; (i < num) && !(upper & Bits_OpDone); i++) {
-        upper = Xil_In32(XPS_GPIO_BASEADDR + Reg_InputUpper);
+    hasDeadline = false;
+}
+
+EMIO_Error EMIO_GetLastError()
+{
+    return lastError;
+}
+
+void EMIO_GetRecoveryStats(EMIO_RecoveryStats *stats)
+{
+    *stats = recoveryStats;
+}
+
+// Local method to wait for op_done to be set (if state is true) or cleared (if state is false).
+// op_done should be set quickly by firmware, to indicate that read or write has completed.
+// If the FPGA bus is not busy (due to Firewire or Ethernet access), it should only take
+// about 1 iteration of the first loop; otherwise, op_done is polled until the timeout
+// (or the transaction deadline, if earlier) expires, and the error code is set.
+static bool WaitOpDone(const char *opType, uint16_t addr, bool state)
+{
+    unsigned int i;
+    for (i = 0; i < WAIT_FAST_POLLS; i++) {
+        if (((Xil_In32(XPS_GPIO_BASEADDR + Reg_InputUpper) & Bits_OpDone) != 0) == state)
+            return true;
+    }
+    XTime now, limit;
+    XTime_GetTime(&now);
+    limit = now + ((XTime)timeout_us*COUNTS_PER_SECOND)/1000000;
+    bool byDeadline = hasDeadline && (deadlineTime < limit);
+    if (byDeadline)
+        limit = deadlineTime;
+    while (now < limit) {
+        if (((Xil_In32(XPS_GPIO_BASEADDR + Reg_InputUpper) & Bits_OpDone) != 0) == state)
+            return true;
+        XTime_GetTime(&now);
+        i++;
     }
-    if (i == num) {
-        // If the above loop timed out, we print a message and keep checking.
-        // It would be better to set a timeout to avoid an infinite loop.
-        xil_printf("Waiting to %s addr %x", opType, addr);
-        while (!(upper & Bits_OpDone)) {
-            upper = Xil_In32(XPS_GPIO_BASEADDR + Reg_InputUpper);
-            xil_printf(".");
-            i++;
+    lastError = byDeadline ? EMIO_ERR_DEADLINE : EMIO_ERR_TIMEOUT;
+    xil_printf("EMIO %s waiting to %s addr %x (op_done %s, %d iterations)\r\n",
+               byDeadline ? "deadline" : "timeout", opType, addr, state ? "set" : "clear", i);
+    return false;
+}
+
+// Local method called at the start of each transaction: clears the error code, checks the
+// deadline and, after an aborted transaction, waits for op_done to be cleared
+static bool BeginTransaction()
+{
+    lastError = EMIO_OK;
+    if (hasDeadline) {
+        XTime now;
+        XTime_GetTime(&now);
+        if (now >= deadlineTime) {
+            lastError = EMIO_ERR_DEADLINE;
+            recoveryStats.numDeadlineMisses++;
+            return false;
+        }
+    }
+    if (abortPending) {
+        if (!WaitOpDone("recover", 0, false)) {
+            if (lastError == EMIO_ERR_TIMEOUT) {
+                lastError = EMIO_ERR_BUS_STUCK;
+                recoveryStats.numRecoveryFailures++;
+            }
+            else {
+                recoveryStats.numDeadlineMisses++;
+            }
+            return false;
         }
-        xil_printf("\r\nWaited %d iterations\r\n", i);
+        abortPending = false;
+        recoveryStats.numRecoveries++;
     }
     return true;
 }
 
+// Local method to abort a transaction after a timeout or deadline miss. Clearing all outputs
+// drops req_bus, blk_start and blk_end, so that the firmware ends the transaction and clears
+// op_done; the data lines are set to input so that they cannot conflict with the firmware.
+// Always returns false (the result of the transaction).
+static bool AbortTransaction()
+{
+    if (lastError == EMIO_ERR_TIMEOUT)
+        recoveryStats.numTimeouts++;
+    else
+        recoveryStats.numDeadlineMisses++;
+    Xil_Out32(XPS_GPIO_BASEADDR + Reg_OutputUpper, 0x00000000);
+    Xil_Out32(XPS_GPIO_BASEADDR + Reg_DirLower, 0x00000000);
+    abortPending = true;
+    recoveryStats.numAborts++;
+    return false;
+}
+
 // Local method to check whether data lines are set for input.
 // This verifies the assumption that reg_data is set for input, since that
 // is their initial value and the Write methods set them to input before
@@ -101,6 +197,7 @@ static bool setDataInput(const char *name)
     // Do not want RequestBus or Write to be set
     if (upper & upper_mask) {
         xil_printf("%s: invalid state %x\r\n", name, upper);
+        lastError = EMIO_ERR_IO;
         return false;
     }
     return true;
@@ -120,6 +217,7 @@ static bool setDataOutput(const char *name)
     // Do not want RequestBus to be set, but Write must be set
     if ((upper & upper_mask) != Bits_Write) {
         xil_printf("%s: invalid state %x\r\n", name, upper);
+        lastError = EMIO_ERR_IO;
         return false;
     }
     return true;
@@ -127,6 +225,9 @@ static bool setDataOutput(const char *name)
 
 bool EMIO_ReadQuadlet(uint16_t addr, uint32_t *data)
 {
+    if (!BeginTransaction())
+        return false;
+
     // Set data lines set for input and check state
     if (!setDataInput("EMIO_ReadQuadlet"))
         return false;
@@ -137,8 +238,8 @@ bool EMIO_ReadQuadlet(uint16_t addr, uint32_t *data)
     // Because the firmware latches req_bus, there is enough delay that we can set it now
     Xil_Out32(XPS_GPIO_BASEADDR + Reg_OutputUpper, outreg | Bits_RequestBus);
     // Wait for op_done to be set
-    WaitOpDone("read", addr, 5);
-    // Local method to wait for op_done to be set, using either events or polling (default)
+    if (!WaitOpDone("read", addr, true))
+        return AbortTransaction();
     // Read data from reg_data
     *data = Xil_In32(XPS_GPIO_BASEADDR + Reg_InputLower);
     // Set req_bus to 0 (also sets reg_addr to 0)
@@ -148,6 +249,9 @@ bool EMIO_ReadQuadlet(uint16_t addr, uint32_t *data)
 
 bool EMIO_WriteQuadlet(uint16_t addr, uint32_t data)
 {
+    if (!BeginTransaction())
+        return false;
+
     // Set data lines for output and check state
     if (!setDataOutput("EMIO_WriteQuadlet"))
         return false;
@@ -160,7 +264,8 @@ bool EMIO_WriteQuadlet(uint16_t addr, uint32_t data)
     uint32_t outreg = addr;
     Xil_Out32(XPS_GPIO_BASEADDR + Reg_OutputUpper, outreg | Bits_RegWen | Bits_RequestBus);
     // Wait for op_done to be set
-    WaitOpDone("write", addr, 5);
+    if (!WaitOpDone("write", addr, true))
+        return AbortTransaction();
     // Set req_bus to 0 (also sets reg_addr and reg_wen to 0)
     Xil_Out32(XPS_GPIO_BASEADDR + Reg_OutputUpper, 0x00000000);
     return true;
@@ -168,9 +273,13 @@ bool EMIO_WriteQuadlet(uint16_t addr, uint32_t data)
 
 bool EMIO_ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
 {
+    if (!BeginTransaction())
+        return false;
+
     unsigned int ver = EMIO_GetVersion();
     if (ver != 1) {
         xil_printf("EMIO_ReadBlock: unsupported interface version %d\r\n", ver);
+        lastError = EMIO_ERR_UNSUPPORTED;
         return false;
     }
 
@@ -202,7 +311,8 @@ bool EMIO_ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
         // Increment address (it would be enough to toggle LSB)
         addr++;
 
-        WaitOpDone("read", addr, 5);
+        if (!WaitOpDone("read", addr, true))
+            return AbortTransaction();
 
         // Read data from reg_data
         val = Xil_In32(XPS_GPIO_BASEADDR + Reg_InputLower);
@@ -218,9 +328,13 @@ bool EMIO_ReadBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
 
 bool EMIO_WriteBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
 {
+    if (!BeginTransaction())
+        return false;
+
     unsigned int ver = EMIO_GetVersion();
     if (ver != 1) {
         xil_printf("EMIO_WriteBlock: unsupported interface version %d\r\n", ver);
+        lastError = EMIO_ERR_UNSUPPORTED;
         return false;
     }
 
@@ -258,7 +372,8 @@ bool EMIO_WriteBlock(uint16_t addr, uint32_t *data, unsigned int nBytes)
         addr++;
 
         // Wait for op_done to be set
-        WaitOpDone("write", addr, 5);
+        if (!WaitOpDone("write", addr, true))
+            return AbortTransaction();
     }
 
     // Set all lines to 0
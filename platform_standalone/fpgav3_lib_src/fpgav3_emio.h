@@ -20,6 +20,26 @@
 extern "C" {
 #endif
 
+// Error codes (see EMIO_GetLastError); same values as in the Linux library
+typedef enum {
+    EMIO_OK,
+    EMIO_ERR_TIMEOUT,         // op_done not set within the timeout
+    EMIO_ERR_DEADLINE,        // transaction deadline expired (before or during the transaction)
+    EMIO_ERR_BUS_LOCK,        // (not used)
+    EMIO_ERR_BUS_STUCK,       // op_done did not clear after an aborted transaction
+    EMIO_ERR_UNSUPPORTED,     // not supported (block transfer with interface version 0)
+    EMIO_ERR_IO               // invalid line state (e.g., req_bus already set)
+} EMIO_Error;
+
+// Recovery statistics (see EMIO_GetRecoveryStats)
+typedef struct {
+    unsigned long numTimeouts;          // transactions that failed with EMIO_ERR_TIMEOUT
+    unsigned long numDeadlineMisses;    // transactions that failed with EMIO_ERR_DEADLINE
+    unsigned long numAborts;            // transactions aborted (bus lines reset to idle)
+    unsigned long numRecoveries;        // successful recoveries (op_done cleared after abort)
+    unsigned long numRecoveryFailures;  // recoveries that failed with EMIO_ERR_BUS_STUCK
+} EMIO_RecoveryStats;
+
 // EMIO_Init
 //
 //   Initializes EMIO to provide an interface to the internal read and write buses
@@ -29,6 +49,29 @@ void EMIO_Init();
 // Get bus interface version number
 unsigned int EMIO_GetVersion();
 
+// Get/Set timeout for op_done, in microseconds (default 250)
+unsigned int EMIO_GetTimeout_us();
+
+void EMIO_SetTimeout_us(unsigned int timeout_us);
+
+// Set/Clear transaction deadline, as an absolute time of the global timer (XTime_GetTime,
+// COUNTS_PER_SECOND). The deadline applies to all subsequent transactions until it is
+// changed or cleared. A transaction started after the deadline fails immediately and the
+// wait for op_done is limited to the deadline (error code EMIO_ERR_DEADLINE).
+void EMIO_SetDeadline(uint64_t deadline);
+
+void EMIO_ClearDeadline();
+
+// Returns the error code of the most recent transaction (EMIO_OK if successful).
+// A transaction that fails with EMIO_ERR_TIMEOUT or EMIO_ERR_DEADLINE is aborted:
+// req_bus, blk_start and blk_end are cleared and the data lines are set to input.
+// The next transaction first waits (up to the timeout) for op_done to clear and
+// fails with EMIO_ERR_BUS_STUCK if it does not.
+EMIO_Error EMIO_GetLastError();
+
+// Get timeout, abort and recovery counters
+void EMIO_GetRecoveryStats(EMIO_RecoveryStats *stats);
+
 // EMIO_ReadQuadlet
 //   Reads a quadlet (32-bit register) from the FPGA.
 // Parameters: